@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <getopt.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "transport.hpp"
+#include "util.hpp"
+
+// Compares transports on one pair of connected sockets. The client end runs
+// on the main thread and an echo end on a second one; both use the same
+// I/O model. Results are printed as JSON.
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_STREAM_BYTES (16 << 20)
+#define WARMUP_ITERATIONS 100
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    int iterations = DEFAULT_ITERATIONS;
+    size_t stream_bytes = DEFAULT_STREAM_BYTES;
+    std::vector<size_t> sizes = {64, 1024, 16384, 65536};
+    std::vector<Family> families = {FAMILY_TCP, FAMILY_UNIX};
+    std::vector<Mode> modes = {MODE_BLOCKING, MODE_EPOLL_LT, MODE_EPOLL_ET,
+                               MODE_IO_URING};
+    std::string output;
+};
+
+struct PingPong
+{
+    int iterations;
+    double mean_us;
+    double min_us;
+    double p50_us;
+    double p99_us;
+    double max_us;
+};
+
+struct Stream
+{
+    size_t bytes;
+    double seconds;
+    double mb_per_s;
+};
+
+// Runs client on this thread against echo on a new one, with channels made
+// from the two ends of one pair. An exception on either side is rethrown
+// here once both are done.
+template <typename Client, typename Echo>
+void runPair(Family family, Mode mode, Client client, Echo echo)
+{
+    auto [client_fd, echo_fd] = connectedPair(family);
+    std::unique_ptr<Channel> client_channel;
+    std::unique_ptr<Channel> echo_channel;
+    try
+    {
+        client_channel = makeChannel(mode, client_fd);
+    }
+    catch (...)
+    {
+        close(echo_fd);
+        throw;
+    }
+    echo_channel = makeChannel(mode, echo_fd);
+
+    std::exception_ptr echo_error;
+    std::thread echo_thread(
+        [&]()
+        {
+            try
+            {
+                echo(*echo_channel);
+            }
+            catch (...)
+            {
+                echo_error = std::current_exception();
+                // Unblocks the client.
+                shutdown(echo_fd, SHUT_RDWR);
+            }
+        });
+
+    std::exception_ptr client_error;
+    try
+    {
+        client(*client_channel);
+    }
+    catch (...)
+    {
+        client_error = std::current_exception();
+        shutdown(client_fd, SHUT_RDWR);
+    }
+    echo_thread.join();
+
+    if (echo_error)
+    {
+        std::rethrow_exception(echo_error);
+    }
+    if (client_error)
+    {
+        std::rethrow_exception(client_error);
+    }
+}
+
+double percentile(const std::vector<double> &sorted, double fraction)
+{
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Round trips of size bytes each way.
+PingPong measurePingPong(Family family, Mode mode, size_t size,
+                         int iterations)
+{
+    std::vector<double> samples;
+    samples.reserve(iterations);
+    int rounds = WARMUP_ITERATIONS + iterations;
+
+    runPair(
+        family, mode,
+        [&](Channel &channel)
+        {
+            std::vector<char> out(size, 'x');
+            std::vector<char> in(size);
+            for (int i = 0; i < rounds; i++)
+            {
+                auto start = Clock::now();
+                channel.sendAll(out.data(), size);
+                channel.recvAll(in.data(), size);
+                auto took = std::chrono::duration<double, std::micro>(
+                    Clock::now() - start);
+                if (i >= WARMUP_ITERATIONS)
+                {
+                    samples.push_back(took.count());
+                }
+            }
+        },
+        [&](Channel &channel)
+        {
+            std::vector<char> buf(size);
+            for (int i = 0; i < rounds; i++)
+            {
+                channel.recvAll(buf.data(), size);
+                channel.sendAll(buf.data(), size);
+            }
+        });
+
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double sample : samples)
+    {
+        total += sample;
+    }
+    return PingPong{iterations,
+                    total / samples.size(),
+                    samples.front(),
+                    percentile(samples, 0.50),
+                    percentile(samples, 0.99),
+                    samples.back()};
+}
+
+// bytes one way in writes of size, timed until the receiver acknowledges
+// the last of them.
+Stream measureStream(Family family, Mode mode, size_t size, size_t bytes)
+{
+    size_t writes = std::max<size_t>(1, bytes / size);
+    double seconds = 0;
+
+    runPair(
+        family, mode,
+        [&](Channel &channel)
+        {
+            std::vector<char> out(size, 'x');
+            char ack;
+            auto start = Clock::now();
+            for (size_t i = 0; i < writes; i++)
+            {
+                channel.sendAll(out.data(), size);
+            }
+            channel.recvAll(&ack, 1);
+            seconds =
+                std::chrono::duration<double>(Clock::now() - start).count();
+        },
+        [&](Channel &channel)
+        {
+            std::vector<char> buf(size);
+            for (size_t i = 0; i < writes; i++)
+            {
+                channel.recvAll(buf.data(), size);
+            }
+            char ack = 1;
+            channel.sendAll(&ack, 1);
+        });
+
+    size_t total = writes * size;
+    return Stream{total, seconds, total / seconds / 1e6};
+}
+
+// Checks that the mode works here at all, e.g. io_uring may be missing from
+// the kernel or blocked in a container. Returns the reason when it does not.
+std::string unsupported(Mode mode)
+{
+    if (mode != MODE_IO_URING)
+    {
+        return "";
+    }
+    try
+    {
+        Uring ring;
+    }
+    catch (std::exception &error)
+    {
+        return error.what();
+    }
+    return "";
+}
+
+/// ARGUMENTS
+
+template <typename T, typename Parse>
+std::vector<T> parseList(const char *arg, Parse parse)
+{
+    std::vector<T> items;
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        items.push_back(parse(item));
+    }
+    return items;
+}
+
+Family parseFamily(const std::string &name)
+{
+    if (name == "tcp")
+    {
+        return FAMILY_TCP;
+    }
+    if (name == "unix")
+    {
+        return FAMILY_UNIX;
+    }
+    throw std::invalid_argument("unknown transport " + name);
+}
+
+Mode parseMode(const std::string &name)
+{
+    for (Mode mode : {MODE_BLOCKING, MODE_EPOLL_LT, MODE_EPOLL_ET,
+                      MODE_IO_URING})
+    {
+        if (name == modeName(mode))
+        {
+            return mode;
+        }
+    }
+    throw std::invalid_argument("unknown mode " + name);
+}
+
+size_t parseSize(const std::string &text)
+{
+    size_t size = std::stoul(text);
+    if (size == 0)
+    {
+        throw std::invalid_argument("payload size must be positive");
+    }
+    return size;
+}
+
+void usage()
+{
+    LOG_ERROR(
+        "Invalid arguments. \n"
+        "Use like sample below\n\n"
+        "bench [-n ITERATIONS] [-b STREAM_BYTES] [-s SIZE,...]\n"
+        "      [-t tcp,unix] [-m blocking,epoll-lt,epoll-et,io_uring]\n"
+        "      [-o OUTPUT]")
+}
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    int opt;
+    try
+    {
+        while ((opt = getopt(argc, argv, "n:b:s:t:m:o:")) != -1)
+        {
+            switch (opt)
+            {
+            case 'n':
+                options.iterations = std::stoi(optarg);
+                break;
+            case 'b':
+                options.stream_bytes = parseSize(optarg);
+                break;
+            case 's':
+                options.sizes = parseList<size_t>(optarg, parseSize);
+                break;
+            case 't':
+                options.families = parseList<Family>(optarg, parseFamily);
+                break;
+            case 'm':
+                options.modes = parseList<Mode>(optarg, parseMode);
+                break;
+            case 'o':
+                options.output = optarg;
+                break;
+            default:
+                return false;
+            }
+        }
+    }
+    catch (std::exception &error)
+    {
+        LOG_ERROR(error.what())
+        return false;
+    }
+    return optind == argc && options.iterations > 0;
+}
+
+/// OUTPUT
+
+std::string jsonString(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+int main(int argc, char *argv[])
+{
+    LOG_LEVEL = WARN;
+
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = stdout;
+    if (!options.output.empty())
+    {
+        out = fopen(options.output.c_str(), "w");
+        if (out == nullptr)
+        {
+            LOG_ERROR(strerror(errno))
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(out,
+            "{\n  \"iterations\": %d,\n  \"stream_bytes\": %zu,\n"
+            "  \"results\": [",
+            options.iterations, options.stream_bytes);
+    std::string skipped;
+    bool first = true;
+    for (Family family : options.families)
+    {
+        for (Mode mode : options.modes)
+        {
+            std::string reason = unsupported(mode);
+            if (!reason.empty())
+            {
+                skipped += std::string(skipped.empty() ? "" : ",") +
+                           "\n    {\"transport\": " +
+                           jsonString(familyName(family)) +
+                           ", \"mode\": " + jsonString(modeName(mode)) +
+                           ", \"reason\": " + jsonString(reason) + "}";
+                continue;
+            }
+
+            for (size_t size : options.sizes)
+            {
+                PingPong ping;
+                Stream stream;
+                try
+                {
+                    ping = measurePingPong(family, mode, size,
+                                           options.iterations);
+                    stream = measureStream(family, mode, size,
+                                           options.stream_bytes);
+                }
+                catch (std::exception &error)
+                {
+                    std::string message = std::string(familyName(family)) +
+                                          " " + modeName(mode) + ": " +
+                                          error.what();
+                    LOG_CRITICAL(message.c_str())
+                    return EXIT_FAILURE;
+                }
+
+                fprintf(out,
+                        "%s\n    {\"transport\": \"%s\", \"mode\": \"%s\", "
+                        "\"payload\": %zu,\n"
+                        "     \"pingpong\": {\"iterations\": %d, "
+                        "\"mean_us\": %.2f, \"min_us\": %.2f, "
+                        "\"p50_us\": %.2f, \"p99_us\": %.2f, "
+                        "\"max_us\": %.2f},\n"
+                        "     \"stream\": {\"bytes\": %zu, "
+                        "\"seconds\": %.6f, \"mb_per_s\": %.1f}}",
+                        first ? "" : ",", familyName(family), modeName(mode),
+                        size, ping.iterations, ping.mean_us, ping.min_us,
+                        ping.p50_us, ping.p99_us, ping.max_us, stream.bytes,
+                        stream.seconds, stream.mb_per_s);
+                fflush(out);
+                first = false;
+            }
+        }
+    }
+    fprintf(out, "\n  ],\n  \"skipped\": [%s\n  ]\n}\n", skipped.c_str());
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,396 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include "uring.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+
+inline std::runtime_error systemError(const char *what)
+{
+    return std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+/// CONNECTED PAIRS
+
+enum Family
+{
+    FAMILY_TCP,  // loopback, TCP_NODELAY on both ends
+    FAMILY_UNIX, // AF_UNIX stream socketpair
+};
+
+inline const char *familyName(Family family)
+{
+    return family == FAMILY_TCP ? "tcp" : "unix";
+}
+
+inline std::pair<int, int> connectedPair(Family family)
+{
+    int fds[2];
+    if (family == FAMILY_UNIX)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            throw systemError("socketpair");
+        }
+        return std::make_pair(fds[0], fds[1]);
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        throw systemError("socket");
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listener, 1) < 0 ||
+        getsockname(listener, (sockaddr *)&addr, &addr_len) < 0)
+    {
+        close(listener);
+        throw systemError("listen");
+    }
+
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[0] < 0 || connect(fds[0], (sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(listener);
+        throw systemError("connect");
+    }
+    fds[1] = accept(listener, nullptr, nullptr);
+    close(listener);
+    if (fds[1] < 0)
+    {
+        close(fds[0]);
+        throw systemError("accept");
+    }
+
+    int one = 1;
+    setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return std::make_pair(fds[0], fds[1]);
+}
+
+/// CHANNELS
+//
+// One end of a connected pair, moving whole buffers with a given I/O model.
+// Channels own their socket.
+
+enum Mode
+{
+    MODE_BLOCKING,
+    MODE_EPOLL_LT,
+    MODE_EPOLL_ET,
+    MODE_IO_URING,
+};
+
+inline const char *modeName(Mode mode)
+{
+    switch (mode)
+    {
+    case MODE_BLOCKING:
+        return "blocking";
+    case MODE_EPOLL_LT:
+        return "epoll-lt";
+    case MODE_EPOLL_ET:
+        return "epoll-et";
+    default:
+        return "io_uring";
+    }
+}
+
+class Channel
+{
+protected:
+    int fd;
+
+public:
+    Channel(int fd) : fd(fd){};
+    Channel(const Channel &) = delete;
+    Channel &operator=(const Channel &) = delete;
+    virtual ~Channel() { close(this->fd); }
+
+    virtual void sendAll(const char *buf, size_t len) = 0;
+    virtual void recvAll(char *buf, size_t len) = 0;
+};
+
+// Plain blocking send and recv.
+class BlockingChannel : public Channel
+{
+public:
+    BlockingChannel(int fd) : Channel(fd){};
+
+    void sendAll(const char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            ssize_t sent = send(this->fd, buf, len, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw systemError("send");
+            }
+            buf += sent;
+            len -= sent;
+        }
+    }
+
+    void recvAll(char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            ssize_t got = recv(this->fd, buf, len, 0);
+            if (got == 0)
+            {
+                throw std::runtime_error("recv: peer closed");
+            }
+            if (got < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw systemError("recv");
+            }
+            buf += got;
+            len -= got;
+        }
+    }
+};
+
+// Non-blocking socket behind its own epoll instance.
+class EpollChannel : public Channel
+{
+protected:
+    int epoll_fd;
+
+    void control(int op, uint32_t events)
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.fd = this->fd;
+        if (epoll_ctl(this->epoll_fd, op, this->fd, &event) < 0)
+        {
+            throw systemError("epoll_ctl");
+        }
+    }
+
+    void wait()
+    {
+        epoll_event event;
+        while (epoll_wait(this->epoll_fd, &event, 1, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                throw systemError("epoll_wait");
+            }
+        }
+    }
+
+    // One non-blocking call. Returns 0 when it would block.
+    ssize_t trySend(const char *buf, size_t len)
+    {
+        ssize_t sent = send(this->fd, buf, len, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return 0;
+            }
+            throw systemError("send");
+        }
+        return sent;
+    }
+
+    ssize_t tryRecv(char *buf, size_t len)
+    {
+        ssize_t got = recv(this->fd, buf, len, 0);
+        if (got == 0)
+        {
+            throw std::runtime_error("recv: peer closed");
+        }
+        if (got < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return 0;
+            }
+            throw systemError("recv");
+        }
+        return got;
+    }
+
+public:
+    EpollChannel(int fd) : Channel(fd)
+    {
+        this->epoll_fd = epoll_create1(0);
+        if (this->epoll_fd < 0)
+        {
+            throw systemError("epoll_create1");
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    ~EpollChannel() { close(this->epoll_fd); }
+};
+
+// Level-triggered: wait for readiness, then one call per wakeup, the way a
+// loop serving many sockets reads.
+class EpollLevelChannel : public EpollChannel
+{
+public:
+    EpollLevelChannel(int fd) : EpollChannel(fd)
+    {
+        this->control(EPOLL_CTL_ADD, EPOLLIN);
+    }
+
+    void sendAll(const char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            ssize_t sent = this->trySend(buf, len);
+            if (sent == 0)
+            {
+                this->control(EPOLL_CTL_MOD, EPOLLOUT);
+                this->wait();
+                this->control(EPOLL_CTL_MOD, EPOLLIN);
+                continue;
+            }
+            buf += sent;
+            len -= sent;
+        }
+    }
+
+    void recvAll(char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            this->wait();
+            ssize_t got = this->tryRecv(buf, len);
+            buf += got;
+            len -= got;
+        }
+    }
+};
+
+// Edge-triggered: registered once for both directions, calls until EAGAIN
+// and only then waits for the next edge.
+class EpollEdgeChannel : public EpollChannel
+{
+public:
+    EpollEdgeChannel(int fd) : EpollChannel(fd)
+    {
+        this->control(EPOLL_CTL_ADD, EPOLLIN | EPOLLOUT | EPOLLET);
+    }
+
+    void sendAll(const char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            ssize_t sent = this->trySend(buf, len);
+            if (sent == 0)
+            {
+                this->wait();
+                continue;
+            }
+            buf += sent;
+            len -= sent;
+        }
+    }
+
+    void recvAll(char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            ssize_t got = this->tryRecv(buf, len);
+            if (got == 0)
+            {
+                this->wait();
+                continue;
+            }
+            buf += got;
+            len -= got;
+        }
+    }
+};
+
+// IORING_OP_SEND / IORING_OP_RECV on a blocking socket, one in flight.
+class UringChannel : public Channel
+{
+    Uring ring;
+
+    size_t run(uint8_t opcode, char *buf, size_t len)
+    {
+        int result = this->ring.run(opcode, this->fd, buf, len);
+        if (result == 0 && opcode == IORING_OP_RECV)
+        {
+            throw std::runtime_error("recv: peer closed");
+        }
+        if (result < 0)
+        {
+            errno = -result;
+            throw systemError(opcode == IORING_OP_SEND ? "io_uring send"
+                                                       : "io_uring recv");
+        }
+        return result;
+    }
+
+public:
+    UringChannel(int fd) : Channel(fd){};
+
+    void sendAll(const char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            size_t sent = this->run(IORING_OP_SEND, (char *)buf, len);
+            buf += sent;
+            len -= sent;
+        }
+    }
+
+    void recvAll(char *buf, size_t len) override
+    {
+        while (len > 0)
+        {
+            size_t got = this->run(IORING_OP_RECV, buf, len);
+            buf += got;
+            len -= got;
+        }
+    }
+};
+
+// Takes ownership of fd; the Channel base closes it also when a derived
+// constructor throws.
+inline std::unique_ptr<Channel> makeChannel(Mode mode, int fd)
+{
+    switch (mode)
+    {
+    case MODE_BLOCKING:
+        return std::make_unique<BlockingChannel>(fd);
+    case MODE_EPOLL_LT:
+        return std::make_unique<EpollLevelChannel>(fd);
+    case MODE_EPOLL_ET:
+        return std::make_unique<EpollEdgeChannel>(fd);
+    default:
+        return std::make_unique<UringChannel>(fd);
+    }
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Just enough io_uring to run one request at a time, straight on the
+// syscalls so the project does not need liburing.
+class Uring
+{
+    int ring_fd = -1;
+    void *sq_ring = MAP_FAILED;
+    void *cq_ring = MAP_FAILED;
+    size_t sq_ring_len = 0;
+    size_t cq_ring_len = 0;
+    io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+    size_t sqes_len = 0;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    io_uring_cqe *cqes;
+
+    void *map(size_t len, off_t offset)
+    {
+        void *ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, this->ring_fd, offset);
+        if (ptr == MAP_FAILED)
+        {
+            throw std::runtime_error(std::string("io_uring mmap: ") +
+                                     strerror(errno));
+        }
+        return ptr;
+    }
+
+    void release()
+    {
+        if (this->sqes != MAP_FAILED)
+        {
+            munmap(this->sqes, this->sqes_len);
+        }
+        if (this->cq_ring != MAP_FAILED && this->cq_ring != this->sq_ring)
+        {
+            munmap(this->cq_ring, this->cq_ring_len);
+        }
+        if (this->sq_ring != MAP_FAILED)
+        {
+            munmap(this->sq_ring, this->sq_ring_len);
+        }
+        if (this->ring_fd >= 0)
+        {
+            close(this->ring_fd);
+        }
+    }
+
+public:
+    // Throws std::runtime_error when the kernel has no io_uring or it is
+    // blocked, e.g. by a container seccomp profile.
+    Uring(unsigned entries = 8)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        this->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (this->ring_fd < 0)
+        {
+            throw std::runtime_error(std::string("io_uring_setup: ") +
+                                     strerror(errno));
+        }
+
+        try
+        {
+            this->sq_ring_len =
+                params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            this->cq_ring_len =
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                this->sq_ring_len = this->cq_ring_len =
+                    std::max(this->sq_ring_len, this->cq_ring_len);
+                this->sq_ring = this->cq_ring =
+                    this->map(this->sq_ring_len, IORING_OFF_SQ_RING);
+            }
+            else
+            {
+                this->sq_ring = this->map(this->sq_ring_len,
+                                          IORING_OFF_SQ_RING);
+                this->cq_ring = this->map(this->cq_ring_len,
+                                          IORING_OFF_CQ_RING);
+            }
+            this->sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+            this->sqes =
+                (io_uring_sqe *)this->map(this->sqes_len, IORING_OFF_SQES);
+        }
+        catch (...)
+        {
+            this->release();
+            throw;
+        }
+
+        char *sq = (char *)this->sq_ring;
+        char *cq = (char *)this->cq_ring;
+        this->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        this->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+        this->sq_array = (unsigned *)(sq + params.sq_off.array);
+        this->cq_head = (unsigned *)(cq + params.cq_off.head);
+        this->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        this->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+        this->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    }
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    ~Uring() { this->release(); }
+
+    // Submit one request and wait for its completion. Returns the result of
+    // the operation, -errno on failure like the kernel reports it.
+    int run(uint8_t opcode, int fd, void *buf, size_t len)
+    {
+        unsigned tail = *this->sq_tail;
+        unsigned index = tail & *this->sq_mask;
+        io_uring_sqe *sqe = &this->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)buf;
+        sqe->len = len;
+        sqe->msg_flags = opcode == IORING_OP_SEND ? MSG_NOSIGNAL : 0;
+        this->sq_array[index] = index;
+        __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        unsigned to_submit = 1;
+        while (true)
+        {
+            int entered = syscall(__NR_io_uring_enter, this->ring_fd,
+                                  to_submit, 1, IORING_ENTER_GETEVENTS,
+                                  nullptr, 0);
+            if (entered < 0 && errno != EINTR)
+            {
+                return -errno;
+            }
+            if (entered > 0)
+            {
+                to_submit = 0;
+            }
+
+            unsigned head = *this->cq_head;
+            if (head != __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE))
+            {
+                int result = this->cqes[head & *this->cq_mask].res;
+                __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+                return result;
+            }
+        }
+    }
+};
+
+#endif
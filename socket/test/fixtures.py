@@ -42,3 +42,8 @@ async def server(server_binary_path, host, port) -> Process:
         server_binary_path, "--host", host, "--port", str(port),
         stdout=PIPE
     )
+
+
+@pytest.fixture(scope='session')
+def bench_binary_path(pytestconfig: pytest.Config) -> str:
+    return str(Path(pytestconfig.invocation_params.dir) / 'bin' / 'bench')
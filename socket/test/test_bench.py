@@ -0,0 +1,68 @@
+import json
+from subprocess import run
+
+import pytest
+
+TRANSPORTS = ('tcp', 'unix')
+MODES = ('blocking', 'epoll-lt', 'epoll-et', 'io_uring')
+PAYLOADS = (64, 1024, 16384, 65536)
+
+# Loose enough for a loaded CI box; a miss means something regressed by
+# an order of magnitude, not noise.
+MAX_P50_US = 500.0
+MAX_P99_US = 5000.0
+MIN_STREAM_MB_PER_S = {64: 5.0, 1024: 50.0, 16384: 200.0, 65536: 200.0}
+
+
+@pytest.fixture(scope='module')
+def report(bench_binary_path) -> dict:
+    result = run(
+        [bench_binary_path, '-n', '300', '-b', str(4 << 20),
+         '-s', ','.join(str(size) for size in PAYLOADS)],
+        capture_output=True, timeout=120
+    )
+    assert result.returncode == 0, result.stdout
+    return json.loads(result.stdout)
+
+
+def test_covers_every_case(report):
+    measured = {
+        (r['transport'], r['mode'], r['payload']) for r in report['results']
+    }
+    skipped = {(s['transport'], s['mode']) for s in report['skipped']}
+
+    for transport in TRANSPORTS:
+        for mode in MODES:
+            if (transport, mode) in skipped:
+                continue
+            for payload in PAYLOADS:
+                assert (transport, mode, payload) in measured
+
+    # Only io_uring depends on the kernel and sandbox.
+    assert all(mode == 'io_uring' for _, mode in skipped)
+
+
+@pytest.mark.parametrize('transport', TRANSPORTS)
+def test_pingpong_latency(report, transport):
+    for result in report['results']:
+        if result['transport'] != transport:
+            continue
+        case = f"{transport} {result['mode']} {result['payload']}"
+        pingpong = result['pingpong']
+        assert pingpong['iterations'] == report['iterations']
+        assert 0 < pingpong['min_us'] <= pingpong['p50_us']
+        assert pingpong['p50_us'] <= pingpong['p99_us'] <= pingpong['max_us']
+        assert pingpong['p50_us'] < MAX_P50_US, case
+        assert pingpong['p99_us'] < MAX_P99_US, case
+
+
+@pytest.mark.parametrize('transport', TRANSPORTS)
+def test_stream_throughput(report, transport):
+    for result in report['results']:
+        if result['transport'] != transport:
+            continue
+        case = f"{transport} {result['mode']} {result['payload']}"
+        stream = result['stream']
+        assert stream['bytes'] > 0
+        assert stream['mb_per_s'] > MIN_STREAM_MB_PER_S[result['payload']], \
+            case
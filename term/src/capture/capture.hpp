@@ -0,0 +1,167 @@
+#ifndef __CAPTURE_CAPTURE_H__
+#define __CAPTURE_CAPTURE_H__
+
+#include "src/protocol/packet.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Capture file layout (host byte order):
+//
+//   file header : "MCAP" | uint32 version
+//   record      : uint64 nanoseconds since capture start
+//                 uint32 connection id
+//                 uint8  kind (CaptureKind)
+//                 uint32 payload length
+//                 payload
+//
+// Connection ids are assigned in accept order, so they stay stable when the
+// server reuses file descriptors.
+#define CAPTURE_MAGIC "MCAP"
+#define CAPTURE_VERSION 1
+
+enum CaptureKind : uint8_t {
+  CAPTURE_OPEN = 0,
+  CAPTURE_FRAME = 1,
+  CAPTURE_CLOSE = 2,
+};
+
+struct CaptureRecord {
+  uint64_t timestamp;
+  uint32_t conn_id;
+  CaptureKind kind;
+  Data payload;
+};
+
+class CaptureError : public std::exception {
+public:
+  const char *what() const throw() { return "Invalid capture file"; }
+};
+
+// Records inbound traffic of a server into a capture file.
+class CaptureWriter {
+  FILE *file;
+  uint32_t next_id;
+  std::unordered_map<int, uint32_t> ids;
+  std::chrono::steady_clock::time_point start;
+
+  void writeRecord(uint32_t conn_id, CaptureKind kind, const uint8_t *data,
+                   uint32_t size) {
+    uint64_t timestamp =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - this->start)
+            .count();
+    std::fwrite(&timestamp, sizeof(timestamp), 1, this->file);
+    std::fwrite(&conn_id, sizeof(conn_id), 1, this->file);
+    std::fwrite(&kind, sizeof(kind), 1, this->file);
+    std::fwrite(&size, sizeof(size), 1, this->file);
+    // Open and close records have no bytes, and no buffer either.
+    if (data != nullptr && size > 0) {
+      std::fwrite(data, 1, size, this->file);
+    }
+  }
+
+public:
+  CaptureWriter(const std::string &path)
+      : next_id(0), start(std::chrono::steady_clock::now()) {
+    this->file = std::fopen(path.c_str(), "wb");
+    if (this->file == nullptr) {
+      throw CaptureError();
+    }
+    uint32_t version = CAPTURE_VERSION;
+    std::fwrite(CAPTURE_MAGIC, 1, 4, this->file);
+    std::fwrite(&version, sizeof(version), 1, this->file);
+  };
+
+  CaptureWriter(const CaptureWriter &) = delete;
+  CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+  ~CaptureWriter() {
+    if (this->file != nullptr) {
+      std::fclose(this->file);
+    }
+  }
+
+  void open(int fd) {
+    uint32_t id = this->next_id++;
+    this->ids[fd] = id;
+    writeRecord(id, CAPTURE_OPEN, nullptr, 0);
+  }
+
+  void frame(int fd, const Data &data) {
+    auto iter = this->ids.find(fd);
+    if (iter == this->ids.end()) {
+      return;
+    }
+    writeRecord(iter->second, CAPTURE_FRAME, data.data(), data.size());
+  }
+
+  void close(int fd) {
+    auto iter = this->ids.find(fd);
+    if (iter == this->ids.end()) {
+      return;
+    }
+    writeRecord(iter->second, CAPTURE_CLOSE, nullptr, 0);
+    this->ids.erase(iter);
+  }
+
+  void flush() { std::fflush(this->file); }
+};
+
+// Reads records back in the order they were written.
+class CaptureReader {
+  FILE *file;
+
+public:
+  CaptureReader(const std::string &path) {
+    this->file = std::fopen(path.c_str(), "rb");
+    if (this->file == nullptr) {
+      throw CaptureError();
+    }
+    char magic[4];
+    uint32_t version;
+    if (std::fread(magic, 1, 4, this->file) != 4 ||
+        std::memcmp(magic, CAPTURE_MAGIC, 4) != 0 ||
+        std::fread(&version, sizeof(version), 1, this->file) != 1 ||
+        version != CAPTURE_VERSION) {
+      std::fclose(this->file);
+      throw CaptureError();
+    }
+  };
+
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader &operator=(const CaptureReader &) = delete;
+
+  ~CaptureReader() { std::fclose(this->file); }
+
+  // Next record, or nullopt at the end of the file. A truncated trailing
+  // record (e.g. server killed mid-write) is treated as the end.
+  std::optional<CaptureRecord> next() {
+    CaptureRecord record;
+    uint32_t size;
+    if (std::fread(&record.timestamp, sizeof(record.timestamp), 1,
+                   this->file) != 1 ||
+        std::fread(&record.conn_id, sizeof(record.conn_id), 1, this->file) !=
+            1 ||
+        std::fread(&record.kind, sizeof(record.kind), 1, this->file) != 1 ||
+        std::fread(&size, sizeof(size), 1, this->file) != 1) {
+      return std::nullopt;
+    }
+    if (record.kind > CAPTURE_CLOSE || size > (1u << 30)) {
+      throw CaptureError();
+    }
+    record.payload.resize(size);
+    if (size > 0 &&
+        std::fread(record.payload.data(), 1, size, this->file) != size) {
+      return std::nullopt;
+    }
+    return record;
+  }
+};
+
+#endif
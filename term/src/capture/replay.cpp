@@ -0,0 +1,183 @@
+#include "src/capture/capture.hpp"
+#include "src/cli/parser.h"
+#include "src/logging/logging.hpp"
+#include "src/mychat/mychat.hpp"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+using Clock = std::chrono::steady_clock;
+
+// Replays a capture file against a running server over real sockets.
+//
+// Records are applied strictly in file order; only the pacing depends on the
+// speed factor, so two replays of the same capture produce the same inbound
+// byte streams on the server.
+class Replayer {
+  MychatAddress server_addr;
+  double speed;
+  int epoll_fd;
+  std::unordered_map<uint32_t, int> sockets;
+
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t received;
+
+  // Read everything the server sent back so its send buffers never fill up.
+  void drain(int timeout) {
+    epoll_event events[64];
+    int event_count = epoll_wait(this->epoll_fd, events, 64, timeout);
+    uint8_t buffer[4096];
+    for (int i = 0; i < event_count; i++) {
+      int n;
+      while ((n = recv(events[i].data.fd, buffer, sizeof(buffer),
+                       MSG_DONTWAIT)) > 0) {
+        this->received += n;
+      }
+      if (n == 0) {
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, events[i].data.fd, nullptr);
+      }
+    }
+  }
+
+  void waitUntil(Clock::time_point target) {
+    while (true) {
+      auto now = Clock::now();
+      if (now >= target) {
+        return;
+      }
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          target - now);
+      drain(left.count());
+    }
+  }
+
+  void open(uint32_t conn_id) {
+    int sock = mychat_connect(this->server_addr);
+    if (sock < 0) {
+      LOG_ERROR("Connection " + std::to_string(conn_id) + " failed.");
+      return;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, sock, &event);
+    this->sockets[conn_id] = sock;
+  }
+
+  void frame(uint32_t conn_id, Data &payload) {
+    auto iter = this->sockets.find(conn_id);
+    if (iter == this->sockets.end()) {
+      return;
+    }
+    size_t pos = 0;
+    while (pos < payload.size()) {
+      int sent = mychat_send(iter->second, payload.data() + pos,
+                             payload.size() - pos);
+      if (sent < 0) {
+        LOG_ERROR("Send failed on connection " + std::to_string(conn_id));
+        return;
+      }
+      pos += sent;
+    }
+    this->frames++;
+    this->bytes += payload.size();
+  }
+
+  void close(uint32_t conn_id) {
+    auto iter = this->sockets.find(conn_id);
+    if (iter == this->sockets.end()) {
+      return;
+    }
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, iter->second, nullptr);
+    mychat_close(iter->second);
+    this->sockets.erase(iter);
+  }
+
+public:
+  // speed of 0 replays as fast as possible.
+  Replayer(MychatAddress server_addr, double speed)
+      : server_addr(server_addr), speed(speed), frames(0), bytes(0),
+        received(0) {
+    this->epoll_fd = epoll_create1(0);
+  };
+
+  ~Replayer() {
+    for (auto iter = this->sockets.begin(); iter != this->sockets.end();
+         ++iter) {
+      mychat_close(iter->second);
+    }
+    ::close(this->epoll_fd);
+  }
+
+  void run(CaptureReader &reader) {
+    auto start = Clock::now();
+    while (auto record = reader.next()) {
+      if (this->speed > 0) {
+        waitUntil(start + std::chrono::nanoseconds((uint64_t)(
+                              record->timestamp / this->speed)));
+      } else {
+        drain(0);
+      }
+
+      switch (record->kind) {
+      case CAPTURE_OPEN: {
+        open(record->conn_id);
+        break;
+      }
+      case CAPTURE_FRAME: {
+        frame(record->conn_id, record->payload);
+        break;
+      }
+      case CAPTURE_CLOSE: {
+        close(record->conn_id);
+        break;
+      }
+      }
+    }
+    drain(100);
+
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    LOG_INFO("Replayed " + std::to_string(this->frames) + " frames (" +
+             std::to_string(this->bytes) + " bytes) in " +
+             std::to_string(elapsed) + " s, received " +
+             std::to_string(this->received) + " bytes");
+  }
+};
+
+int main(int argc, char **argv) {
+  auto p = Parser("replay");
+  auto speedopt =
+      StringOption("replay speed factor. 0 for maximum speed. defaults to 1",
+                   "speed", 's', "GROUP", std::string("1"));
+  p.addOption(&speedopt);
+
+  auto capturearg = Argument("capture", "capture file recorded by server");
+  p.addArgument(&capturearg);
+  auto hostarg =
+      Argument("host", "server ip, or unix:<path> for a local socket");
+  p.addArgument(&hostarg);
+  auto portarg = Argument("port", "server port to replay to");
+  p.addArgument(&portarg);
+
+  p.run(argc, argv);
+  _LOG_LEVEL = INFO;
+
+  auto server_addr = mychat_address(p.getArgumentValue("host"),
+                                    std::stoi(p.getArgumentValue("port")));
+
+  try {
+    CaptureReader reader(p.getArgumentValue("capture"));
+    Replayer(server_addr, std::stod(std::any_cast<std::string>(
+                              p.getValue("speed"))))
+        .run(reader);
+  } catch (CaptureError &e) {
+    LOG_CRITICAL(e.what());
+    return -1;
+  }
+}
@@ -3,6 +3,7 @@
 #include <exception>
 
 class CliError : public std::exception {
+public:
   virtual const char *what() const throw() {
     return "Parser Exception happend";
   }
@@ -29,4 +30,18 @@ class OptionDuplicateError : public ParserDeclationError {};
 class InvalidOptionError : public ParserError {};
 
 class OptionNotExistsError : public ParserError {};
+
+class InvalidOptionValueError : public ParserError {
+  const char *what() const throw() { return "Invalid option value"; }
+};
+
+class ConfigError : public CliError {};
+
+class ConfigFileError : public ConfigError {
+  const char *what() const throw() { return "Config file can not be read"; }
+};
+
+class ConfigSyntaxError : public ConfigError {
+  const char *what() const throw() { return "Config line is not key = value"; }
+};
 #endif
@@ -1,11 +1,15 @@
+#ifndef __CLI_PARSER__H__
+#define __CLI_PARSER__H__
 #include "src/cli/error.h"
 #include "src/cli/token.h"
 #include <algorithm>
 #include <any>
+#include <fstream>
 #include <iostream>
 #include <iterator>
 #include <queue>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
@@ -30,6 +34,7 @@ private:
   std::unordered_map<ShortOptName, IOption *> _short_name_map;
   std::unordered_map<OptName, IOption *> _long_name_map;
   std::unordered_map<OptName, OptValue> _value_map;
+  std::unordered_set<OptName> _argv_names; // set on the command line
   std::vector<std::string> arg_values;
   std::vector<Argument> arguments;
   std::string command;
@@ -150,7 +155,11 @@ public:
           continue;
         }
         case ENTER_VALUE_OPT: {
-          this->_value_map.find(current_option->name)->second = token;
+          this->_value_map.find(current_option->name)->second =
+              ((IValueOption *)current_option)
+                  ->cast(current_option->name, token);
+          this->_argv_names.insert(current_option->name);
+          state = ParsingState::READY;
           continue;
         }
         // NOT READY TO USE
@@ -172,6 +181,61 @@ public:
     }
   };
 
+  // Reads "name = value" lines into value options. '#' starts a comment.
+  // Options given on the command line keep their value; every other value
+  // option is reset to its default first, so a key deleted from the file
+  // reverts on reload. Nothing is applied unless the whole file is valid.
+  void loadConfig(std::string path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+      throw ConfigFileError();
+    }
+
+    std::unordered_map<OptName, OptValue> loaded;
+    std::string line;
+    while (std::getline(file, line)) {
+      auto comment = line.find('#');
+      if (comment != std::string::npos) {
+        line = line.substr(0, comment);
+      }
+      line = trimSpace(line);
+      if (line.empty()) {
+        continue;
+      }
+
+      auto eq = line.find('=');
+      if (eq == std::string::npos) {
+        throw ConfigSyntaxError();
+      }
+      auto key = trimSpace(line.substr(0, eq));
+      auto value = trimSpace(line.substr(eq + 1));
+
+      IOption *option = getOptionWithLong(key);
+      if (!option->isValueRequired()) {
+        throw InvalidOptionValueError();
+      }
+      loaded[key] = ((IValueOption *)option)->cast(key, value);
+    }
+
+    // Keys removed from the file since the last load go back to default.
+    for (auto iter = this->_long_name_map.begin();
+         iter != this->_long_name_map.end(); iter++) {
+      if (iter->second->isValueRequired() &&
+          this->_argv_names.count(iter->first) == 0) {
+        this->_value_map[iter->first] = iter->second->getDefault();
+      }
+    }
+    for (auto iter = loaded.begin(); iter != loaded.end(); iter++) {
+      if (this->_argv_names.count(iter->first) == 0) {
+        this->_value_map[iter->first] = iter->second;
+      }
+    }
+  }
+
+  template <typename T> T get(OptName name) {
+    return std::any_cast<T>(getValue(name));
+  }
+
   OptValue getValue(OptName name) {
     auto viter = this->_value_map.find(name);
     if (viter != this->_value_map.end()) {
@@ -205,12 +269,22 @@ public:
     }
   }
 
+  static std::string trimSpace(std::string token) {
+    auto begin = token.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+      return "";
+    }
+    auto end = token.find_last_not_of(" \t\r");
+    return token.substr(begin, end - begin + 1);
+  }
+
   ParsingState handleOption(IOption *current_option) {
     if (current_option->isValueRequired()) {
       return ParsingState::ENTER_VALUE_OPT;
     } else {
       auto viter = this->_value_map.find(current_option->name);
       viter->second = ((INonValueOption *)current_option)->feed(viter->second);
+      this->_argv_names.insert(current_option->name);
       return ParsingState::READY;
     }
   };
@@ -243,3 +317,4 @@ public:
     throw OptionNotExistsError();
   }
 };
+#endif
@@ -1,5 +1,10 @@
+#ifndef __CLI_TOKEN__H__
+#define __CLI_TOKEN__H__
 #include "src/cli/error.h"
 #include <any>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <optional>
 #include <string>
@@ -142,9 +147,126 @@ public:
   }
 };
 
+// Parses a whole string as a non negative integer followed by a unit suffix.
+// Returns the number and leaves the suffix in unit.
+inline unsigned long long parseNumberWithUnit(const std::string &input,
+                                              std::string &unit) {
+  size_t pos = 0;
+  while (pos < input.size() && input[pos] >= '0' && input[pos] <= '9') {
+    pos++;
+  }
+  if (pos == 0) {
+    throw InvalidOptionValueError();
+  }
+  unit = input.substr(pos);
+  try {
+    return std::stoull(input.substr(0, pos));
+  } catch (std::exception &e) {
+    throw InvalidOptionValueError();
+  }
+}
+
+class IntOption : public IValueOption {
+public:
+  typedef int ValueType;
+
+  ValueType default_value;
+
+  IntOption(std::string help, OptName name,
+            std::optional<ShortOptName> short_name, std::string group,
+            ValueType default_value)
+      : IValueOption(help, name, short_name, group),
+        default_value(default_value){};
+
+  inline std::any getDefault() { return this->default_value; }
+  std::any cast(std::string origin, std::string input) {
+    size_t pos = 0;
+    ValueType value;
+    try {
+      value = std::stoi(input, &pos);
+    } catch (std::exception &e) {
+      throw InvalidOptionValueError();
+    }
+    if (pos != input.size()) {
+      throw InvalidOptionValueError();
+    }
+    return value;
+  }
+};
+
+// Accepts "250ms", "2s", "5m", "1h". A bare number is milliseconds.
+class DurationOption : public IValueOption {
+public:
+  typedef std::chrono::milliseconds ValueType;
+
+  ValueType default_value;
+
+  DurationOption(std::string help, OptName name,
+                 std::optional<ShortOptName> short_name, std::string group,
+                 ValueType default_value)
+      : IValueOption(help, name, short_name, group),
+        default_value(default_value){};
+
+  inline std::any getDefault() { return this->default_value; }
+  std::any cast(std::string origin, std::string input) {
+    std::string unit;
+    auto value = parseNumberWithUnit(input, unit);
+    if (unit == "" || unit == "ms") {
+      return ValueType(value);
+    } else if (unit == "s") {
+      return ValueType(value * 1000);
+    } else if (unit == "m") {
+      return ValueType(value * 60 * 1000);
+    } else if (unit == "h") {
+      return ValueType(value * 60 * 60 * 1000);
+    }
+    throw InvalidOptionValueError();
+  }
+};
+
+// Accepts a byte count with an optional K, M or G (binary) suffix.
+class SizeOption : public IValueOption {
+public:
+  typedef size_t ValueType;
+
+  ValueType default_value;
+
+  SizeOption(std::string help, OptName name,
+             std::optional<ShortOptName> short_name, std::string group,
+             ValueType default_value)
+      : IValueOption(help, name, short_name, group),
+        default_value(default_value){};
+
+  inline std::any getDefault() { return this->default_value; }
+  std::any cast(std::string origin, std::string input) {
+    std::string unit;
+    ValueType value = parseNumberWithUnit(input, unit);
+    if (unit.size() == 3 && unit.substr(1) == "iB") {
+      unit = unit.substr(0, 1);
+    }
+    int shift;
+    if (unit == "" || unit == "B") {
+      shift = 0;
+    } else if (unit == "K" || unit == "k") {
+      shift = 10;
+    } else if (unit == "M") {
+      shift = 20;
+    } else if (unit == "G") {
+      shift = 30;
+    } else {
+      throw InvalidOptionValueError();
+    }
+    if (value > (SIZE_MAX >> shift)) {
+      throw InvalidOptionValueError();
+    }
+    return ValueType(value << shift);
+  }
+};
+
 // ----------------Argument-----------------
 class Argument : public IToken {
 public:
   Argument(){};
   Argument(std::string name, std::string help) : IToken(name, help){};
-};
\ No newline at end of file
+};
+#endif
@@ -1,126 +1,233 @@
 #include "src/cli/parser.h"
+#include "src/client/core.hpp"
+#include "src/client/render.hpp"
 #include "src/logging/logging.hpp"
 #include "src/mychat/mychat.hpp"
 #include "src/protocol/packet.hpp"
 #include "src/protocol/protocol.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
 #include <error.h>
 #include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <thread>
 #include <variant>
 #include <vector>
 
-Handle handle = Handle();
-
-void enterServer(int socket, std::string name) {
-  Header header;
-  header.version = 1;
-  header.type = MessageType::ENTER;
-  header.size = name.length();
+void handleMessage(Renderer &renderer, RecvMessage &msg) {
+  renderer.push("\033[33m" + msg.sender_name + "\033[0m : " +
+                std::string(msg.content) + "\n");
+}
 
-  std::vector<uint8_t> packet;
-  packet.resize(sizeof(Header) + name.length());
-  std::memcpy(packet.data(), &header, sizeof(Header));
-  std::memcpy(packet.data() + sizeof(Header), name.c_str(), name.length());
+void handleNotice(Renderer &renderer, RecvNotice &ntc) {
+  renderer.push("\033[36mNOTICE\033[0m : " + ntc.content + "\n");
+}
 
-  if (mychat_send(socket, packet.data(), packet.size()) < 0) {
-    EXIT_WITH_LOG_CRITICAL("Error in sending data to server");
+void handleSearch(Renderer &renderer, SearchResult &result) {
+  RecvNotice ntc(std::to_string(result.hits.size()) + " messages found.");
+  handleNotice(renderer, ntc);
+  for (auto iter = result.hits.rbegin(); iter != result.hits.rend(); ++iter) {
+    renderer.push("\033[35m#" + std::to_string(iter->seq) + "\033[0m " +
+                  "\033[33m" + iter->sender + "\033[0m : " + iter->content +
+                  "\n");
   }
 }
 
-void sendMessage(int socket, std::string message) {
-  Header header(MESSAGE, message.size());
+void handleRoster(Renderer &renderer, RosterSnapshot &snapshot) {
+  RecvNotice ntc(std::to_string(snapshot.members.size()) + " users online.");
+  handleNotice(renderer, ntc);
+}
 
-  std::vector<uint8_t> packet;
-  packet.resize(sizeof(Header) + message.length());
-  std::memcpy(packet.data(), &header, sizeof(Header));
-  std::memcpy(packet.data() + sizeof(Header), message.c_str(),
-              message.length());
+void handleJoin(Renderer &renderer, RosterMember &member) {
+  RecvNotice ntc("User " + member.name + " entered. Please say hello.");
+  handleNotice(renderer, ntc);
+}
 
-  if (mychat_send(socket, packet.data(), packet.size()) < 0) {
-    EXIT_WITH_LOG_CRITICAL("Error in sending data to server");
-  }
+void handleLeave(Renderer &renderer, RosterMember &member) {
+  RecvNotice ntc("User " + member.name + " get out.");
+  handleNotice(renderer, ntc);
 }
 
-void handleMessage(Data buffer) {
-  if (buffer.size() < sizeof(Header)) {
-    throw HandleReturn::SHORTER_THAN_HEADER;
-  }
-  auto recv = handle.parseRecv(buffer);
-  if (std::holds_alternative<RecvMessage>(recv)) {
-    auto msg = std::get<RecvMessage>(recv);
+void handleAttachment(Renderer &renderer, RecvAttachment &attachment) {
+  RecvNotice ntc(attachment.sender + " shared " + attachment.name + " (" +
+                 std::to_string(attachment.length) + " bytes). /fetch " +
+                 std::to_string(attachment.id) + " to save it.");
+  handleNotice(renderer, ntc);
+}
 
-    std::cout << "\033[33m" << msg.sender_name << "\033[0m : " << msg.content
-              << std::endl;
-  } else if (std::holds_alternative<RecvNotice>(recv)) {
-    auto msg = std::get<RecvNotice>(recv);
+// Attachments seen so far and the files downloads go to.
+struct Attachments {
+  std::map<uint64_t, RecvAttachment> announced;
+  std::map<uint64_t, int> saving;
+};
 
-    std::cout << "\033[36mNOTICE"
-              << "\033[0m : " << msg.content << std::endl;
-  }
+std::string baseName(const std::string &path) {
+  auto slash = path.find_last_of('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
 }
 
-int connectServer(sockaddr_in *server_addr) {
+int connectServer(const MychatAddress &server_addr) {
   int socket_fd;
 
-  socket_fd = mychat_enter((sockaddr *)server_addr, sizeof(*server_addr));
+  socket_fd = mychat_connect(server_addr);
 
   if (socket_fd <= 0) {
     EXIT_WITH_LOG_CRITICAL("Error in connecting server");
     exit(-1);
   }
-  fcntl(socket_fd, F_SETFL, O_NONBLOCK);
   LOG_INFO("Creating connection succeed.");
 
   return socket_fd;
 }
 
-void infinite(int socket) {
-  int bytes_received;
-  char buffer[1024] = {0};
-  std::string line;
-  RecvMessage msg;
+// Try to get a new connection after the server went away, waiting longer
+// after every failure. Returns -1 once attempts are used up.
+int reconnectServer(const MychatAddress &server_addr, int attempts) {
+  int delay_ms = 250;
+  for (int i = 0; i < attempts; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    int socket_fd = mychat_connect(server_addr);
+    if (socket_fd >= 0) {
+      LOG_DEBUG("Reconnected.");
+      return socket_fd;
+    }
+    delay_ms = std::min(delay_ms * 2, 5000);
+  }
+  return -1;
+}
 
-  fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
-  fcntl(STDOUT_FILENO, F_SETFL, O_NONBLOCK);
+#define SEARCH_COMMAND "/search "
+#define ATTACH_COMMAND "/attach "
+#define FETCH_COMMAND "/fetch "
 
-  while (true) {
-    bytes_received = read(STDIN_FILENO, buffer, 1024);
-    if (bytes_received > 0) {
-      sendMessage(socket, std::string(buffer));
+void attachFile(ClientCore &core, Renderer &renderer,
+                const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    RecvNotice ntc("Can not read " + path + ".");
+    handleNotice(renderer, ntc);
+    return;
+  }
+  std::stringstream bytes;
+  bytes << file.rdbuf();
+  core.attach(baseName(path), bytes.str());
+}
+
+// Save attachment id under its name in the working directory.
+void fetchFile(ClientCore &core, Renderer &renderer, Attachments &files,
+               uint64_t id) {
+  auto iter = files.announced.find(id);
+  if (iter == files.announced.end() || files.saving.count(id) > 0) {
+    RecvNotice ntc("No attachment " + std::to_string(id) + " to fetch.");
+    handleNotice(renderer, ntc);
+    return;
+  }
+  std::string name = baseName(iter->second.name);
+  int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (name.empty() || fd < 0) {
+    RecvNotice ntc("Can not write " + name + ".");
+    handleNotice(renderer, ntc);
+    return;
+  }
+  files.saving[id] = fd;
+  core.fetch(id, iter->second.length, fd);
+}
+
+// Input is sent as a message, except "/search words" which searches the
+// server's history, "/attach path" which shares a file and "/fetch id"
+// which saves one.
+void readInput(ClientCore &core, Renderer &renderer, Attachments &files,
+               int fd) {
+  char buffer[1024];
+  int bytes_read = read(fd, buffer, sizeof(buffer));
+  if (bytes_read > 0) {
+    std::string input(buffer, bytes_read);
+    std::string argument =
+        input.substr(0, input.find_last_not_of("\r\n") + 1);
+    if (input.rfind(SEARCH_COMMAND, 0) == 0) {
+      core.search(input.substr(sizeof(SEARCH_COMMAND) - 1));
+    } else if (input.rfind(ATTACH_COMMAND, 0) == 0) {
+      attachFile(core, renderer, argument.substr(sizeof(ATTACH_COMMAND) - 1));
+    } else if (input.rfind(FETCH_COMMAND, 0) == 0) {
+      fetchFile(core, renderer, files,
+                strtoull(argument.c_str() + sizeof(FETCH_COMMAND) - 1,
+                         nullptr, 10));
+    } else {
+      core.sendMessage(input);
     }
+  } else if (bytes_read == 0) {
+    core.unwatch(fd);
+  }
+}
 
-    memset(buffer, 0, 1024);
-    bytes_received = mychat_recv(socket, buffer, 1024);
-    if (bytes_received > 0) {
-      handleMessage(Data(buffer, buffer + 1024));
-    } else if (bytes_received == 0) {
-      LOG_ERROR("Server closed.");
+void infinite(const MychatAddress &server_addr, int socket, std::string name,
+              int flush_interval, int scrollback, int reconnects) {
+  ClientCore core(socket);
+  Renderer renderer(STDOUT_FILENO, flush_interval, RENDER_DEFAULT_MAX_BYTES,
+                    scrollback);
+  core.on_message = [&](RecvMessage &msg) { handleMessage(renderer, msg); };
+  core.on_notice = [&](RecvNotice &ntc) { handleNotice(renderer, ntc); };
+  core.on_roster = [&](RosterSnapshot &snapshot) {
+    handleRoster(renderer, snapshot);
+  };
+  core.on_join = [&](RosterMember &member) { handleJoin(renderer, member); };
+  core.on_leave = [&](RosterMember &member) { handleLeave(renderer, member); };
+  core.on_search = [&](SearchResult &result) {
+    handleSearch(renderer, result);
+  };
+  Attachments files;
+  core.on_attachment = [&](RecvAttachment &attachment) {
+    files.announced[attachment.id] = attachment;
+    handleAttachment(renderer, attachment);
+  };
+  core.on_uploaded = [&](uint32_t upload, uint64_t id) {
+    RecvNotice ntc(id != 0 ? "Sending attachment " + std::to_string(id) + "."
+                           : std::string("Attachment refused."));
+    handleNotice(renderer, ntc);
+  };
+  core.on_fetched = [&](uint64_t id, bool ok) {
+    close(files.saving[id]);
+    files.saving.erase(id);
+    RecvNotice ntc(std::string(ok ? "Saved " : "Could not fetch ") +
+                   files.announced[id].name + ".");
+    handleNotice(renderer, ntc);
+  };
+
+  if (renderer.timerFd() >= 0) {
+    core.watch(renderer.timerFd(), [&](int fd) { renderer.onTimer(); });
+  }
+  if (!core.watch(STDIN_FILENO, [&](int fd) {
+        readInput(core, renderer, files, fd);
+      })) {
+    LOG_WARN("Standard input can not be polled. Running receive only.");
+  }
+  core.enter(name);
+  while (true) {
+    core.run();
+    int socket_fd = reconnectServer(server_addr, reconnects);
+    if (socket_fd < 0) {
       break;
     }
+    core.reconnect(socket_fd);
   }
 }
 
-void runClient(std::string address, int port, std::string name) {
+void runClient(std::string address, int port, std::string name,
+               int flush_interval, int scrollback, int reconnects) {
   int socket_fd;
-  struct sockaddr_in server_addr;
-
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr.s_addr = inet_addr(address.c_str());
-  server_addr.sin_port = htons(port);
-
-  if (inet_pton(AF_INET, address.c_str(), &server_addr.sin_addr) <= 0) {
-    LOG_ERROR("Error in converting server address")
-    EXIT
-  }
 
-  socket_fd = connectServer(&server_addr);
-  enterServer(socket_fd, name);
-  infinite(socket_fd);
+  auto server_addr = mychat_address(address, port);
+  socket_fd = connectServer(server_addr);
+  infinite(server_addr, socket_fd, name, flush_interval, scrollback,
+           reconnects);
 }
 
 int main(int argc, char *argv[]) {
@@ -129,11 +236,24 @@ int main(int argc, char *argv[]) {
   auto opt =
       CounterOption("set log level", "verbose", std::optional('v'), "GROUP", 3);
   p.addOption(&opt);
+  auto intervalopt =
+      DurationOption("time to batch output. 0 to disable. defaults to 16ms",
+                     "flush-interval", 'i', "GROUP",
+                     std::chrono::milliseconds(RENDER_DEFAULT_INTERVAL_MS));
+  p.addOption(&intervalopt);
+  auto scrollopt = IntOption(
+      "maximum lines rendered per batch. 0 to render all. defaults to 0",
+      "scrollback", 's', "GROUP", 0);
+  p.addOption(&scrollopt);
+  auto reconnectopt =
+      IntOption("reconnect attempts after the server went away. defaults to 5",
+                "reconnect", 'r', "GROUP", 5);
+  p.addOption(&reconnectopt);
 
-  arg = Argument("host", "server ip to connect");
+  arg = Argument("host", "server ip, or unix:<path> for a local socket");
   p.addArgument(&arg);
 
-  arg = Argument("port", "server port to connect");
+  arg = Argument("port", "server port to connect. ignored for unix:");
   p.addArgument(&arg);
 
   arg = Argument("name", "name to use in chatting");
@@ -150,6 +270,13 @@ int main(int argc, char *argv[]) {
     _LOG_LEVEL = INFO;
   }
 
-  runClient(p.getArgumentValue("host"), std::stoi(p.getArgumentValue("port")),
-            p.getArgumentValue("name"));
+  // clang-format off
+  runClient(
+    p.getArgumentValue("host"),
+    std::stoi(p.getArgumentValue("port")),
+    p.getArgumentValue("name"),
+    p.get<std::chrono::milliseconds>("flush-interval").count(),
+    p.get<int>("scrollback"),
+    p.get<int>("reconnect"));
+  // clang-format on
 }
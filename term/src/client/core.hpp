@@ -0,0 +1,627 @@
+#ifndef __CLIENT_CORE_H__
+#define __CLIENT_CORE_H__
+
+#include "src/logging/logging.hpp"
+#include "src/mychat/mychat.hpp"
+#include "src/protocol/frame.hpp"
+#include "src/protocol/names.hpp"
+#include "src/protocol/packet.hpp"
+#include "src/protocol/protocol.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <variant>
+
+#define CLIENT_CORE_MAX_EVENTS 16
+#define CLIENT_CORE_READ_SIZE 4096
+// Attachment bytes per ATTACH_CHUNK and per ATTACH_FETCH, and how many of
+// either are in flight at once.
+#define CLIENT_CORE_CHUNK (64 << 10)
+#define CLIENT_CORE_CHUNKS_IN_FLIGHT 4
+
+// Event-driven chat client on top of epoll.
+//
+// Incoming bytes are framed by Header.size and every complete frame is parsed
+// and handed to the message/notice callbacks. Outgoing frames are written
+// immediately when possible; whatever the kernel does not take is queued and
+// flushed when the socket becomes writable again. The loop sleeps in
+// epoll_wait while there is nothing to do.
+class ClientCore {
+  int sock;
+  int epoll_fd;
+  bool stopflag;
+  bool want_write;
+  Handle handle;
+
+  FrameReader reader;
+  std::deque<Data> send_queue;
+  size_t send_offset;
+
+  std::unordered_map<int, std::function<void(int)>> watchers;
+
+  // Roster as of roster_version.
+  std::map<uint32_t, std::string> roster;
+  uint64_t roster_version;
+  bool roster_syncing;
+  // Everyone the roster ever named, for the sender ids of messages. Also
+  // fed by deltas dropped while syncing.
+  SenderNames names;
+
+  // Send credits left, -1 while the server has not granted any. Messages
+  // written without credits wait in held.
+  int64_t credits;
+  std::deque<Data> held;
+
+  // Session to resume after a reconnect, and the newest message seen.
+  std::string name;
+  uint64_t session_token;
+  uint64_t last_seq;
+  bool resuming;
+
+  uint32_t search_id;
+
+  // Uploads by their number, queued a chunk at a time once accepted, so
+  // messages typed meanwhile do not wait for the whole file.
+  struct Upload {
+    std::string bytes;
+    size_t sent;
+    bool accepted;
+  };
+  std::map<uint32_t, Upload> uploads;
+  uint32_t upload_id;
+
+  // Downloads by file id, written to fd as chunks arrive.
+  struct Download {
+    int fd;
+    uint64_t length;
+    uint64_t received;
+    uint64_t requested;
+  };
+  std::map<uint64_t, Download> downloads;
+
+  void updateSocketEvents() {
+    epoll_event event;
+    event.events =
+        (uint32_t)EPOLLIN | (this->want_write ? (uint32_t)EPOLLOUT : 0u);
+    event.data.fd = this->sock;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, this->sock, &event);
+  }
+
+  // Top the send queue up with chunks of accepted uploads.
+  void queueChunks() {
+    auto iter = this->uploads.begin();
+    while (this->send_queue.size() < CLIENT_CORE_CHUNKS_IN_FLIGHT &&
+           iter != this->uploads.end()) {
+      Upload &upload = iter->second;
+      if (!upload.accepted) {
+        ++iter;
+        continue;
+      }
+      size_t length = std::min<size_t>(CLIENT_CORE_CHUNK,
+                                       upload.bytes.size() - upload.sent);
+      AttachChunk chunk{iter->first,
+                        (const uint8_t *)upload.bytes.data() + upload.sent,
+                        length};
+      this->send_queue.push_back(this->handle.build(chunk));
+      upload.sent += length;
+      if (upload.sent == upload.bytes.size()) {
+        iter = this->uploads.erase(iter);
+      }
+    }
+  }
+
+  void flushSendQueue() {
+    queueChunks();
+    while (!this->send_queue.empty()) {
+      Data &front = this->send_queue.front();
+      int sent = mychat_send(this->sock, front.data() + this->send_offset,
+                             front.size() - this->send_offset);
+      if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+          break;
+        }
+        LOG_ERROR("Error in sending data to server");
+        this->close();
+        return;
+      }
+      this->send_offset += sent;
+      if (this->send_offset == front.size()) {
+        this->send_queue.pop_front();
+        this->send_offset = 0;
+        queueChunks();
+      }
+    }
+
+    bool pending = !this->send_queue.empty();
+    if (pending != this->want_write) {
+      this->want_write = pending;
+      updateSocketEvents();
+    }
+  }
+
+  void readSocket() {
+    uint8_t buffer[CLIENT_CORE_READ_SIZE];
+    while (true) {
+      int bytes_received = mychat_recv(this->sock, buffer, sizeof(buffer));
+      if (bytes_received > 0) {
+        this->reader.append(buffer, bytes_received);
+        continue;
+      }
+      if (bytes_received == 0) {
+        LOG_ERROR("Server closed.");
+        this->close();
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_ERROR("Error in receiving data from server");
+        this->close();
+        return;
+      }
+      break;
+    }
+    dispatchFrames();
+  }
+
+  // Parse every complete frame received so far.
+  void dispatchFrames() {
+    try {
+      while (auto frame = this->reader.next()) {
+        dispatchFrame(frame.value());
+      }
+    } catch (HandleReturn e) {
+      LOG_ERROR("Invalid frame size from server");
+      this->close();
+    }
+  }
+
+  void dispatchFrame(Data &frame) {
+    try {
+      auto recv = this->handle.parseRecv(frame);
+      if (std::holds_alternative<RecvMessage>(recv)) {
+        auto &msg = std::get<RecvMessage>(recv);
+        if (msg.seq != 0 && msg.seq <= this->last_seq) {
+          return;
+        }
+        this->last_seq = std::max(this->last_seq, msg.seq);
+        if (!this->names.resolve(msg)) {
+          LOG_DEBUG("Message from unknown sender " +
+                    std::to_string(msg.sender_id));
+          msg.sender_name = "#" + std::to_string(msg.sender_id);
+          requestSync();
+        }
+        if (this->on_message) {
+          this->on_message(msg);
+        }
+      } else if (std::holds_alternative<RecvNotice>(recv)) {
+        if (this->on_notice) {
+          this->on_notice(std::get<RecvNotice>(recv));
+        }
+      } else if (std::holds_alternative<RosterSnapshot>(recv)) {
+        applySnapshot(std::get<RosterSnapshot>(recv));
+      } else if (std::holds_alternative<RosterDelta>(recv)) {
+        applyDelta(std::get<RosterDelta>(recv));
+      } else if (std::holds_alternative<FlowCredit>(recv)) {
+        applyCredit(std::get<FlowCredit>(recv));
+      } else if (std::holds_alternative<SessionInfo>(recv)) {
+        applySession(std::get<SessionInfo>(recv));
+      } else if (std::holds_alternative<SearchResult>(recv)) {
+        if (this->on_search) {
+          this->on_search(std::get<SearchResult>(recv));
+        }
+      } else if (std::holds_alternative<AttachAck>(recv)) {
+        applyAttachAck(std::get<AttachAck>(recv));
+      } else if (std::holds_alternative<RecvAttachment>(recv)) {
+        if (this->on_attachment) {
+          this->on_attachment(std::get<RecvAttachment>(recv));
+        }
+      } else if (std::holds_alternative<AttachData>(recv)) {
+        applyAttachData(std::get<AttachData>(recv));
+      }
+    } catch (HandleReturn e) {
+      LOG_WARN("Dropping invalid frame from server");
+    }
+  }
+
+  // Ask for the roster changes missed, once until they arrive.
+  void requestSync() {
+    if (this->roster_syncing) {
+      return;
+    }
+    this->roster_syncing = true;
+    SendRosterSync sync{this->roster_version};
+    send(this->handle.build(sync));
+  }
+
+  void applySnapshot(RosterSnapshot &snapshot) {
+    this->names.learn(snapshot);
+    this->roster.clear();
+    for (auto &member : snapshot.members) {
+      this->roster[member.id] = member.name;
+    }
+    this->roster_version = snapshot.version;
+    this->roster_syncing = false;
+    if (this->on_roster) {
+      this->on_roster(snapshot);
+    }
+  }
+
+  void applyDelta(RosterDelta &delta) {
+    this->names.learn(delta);
+    if (delta.version <= this->roster_version) {
+      return;
+    }
+    if (delta.version != this->roster_version + 1) {
+      // Missed an update. Ask once and drop deltas until caught up.
+      requestSync();
+      return;
+    }
+
+    this->roster_version = delta.version;
+    this->roster_syncing = false;
+    RosterMember member{delta.id, delta.name};
+    if (delta.op == ROSTER_JOIN) {
+      this->roster[delta.id] = delta.name;
+      if (this->on_join) {
+        this->on_join(member);
+      }
+    } else {
+      auto iter = this->roster.find(delta.id);
+      if (iter != this->roster.end()) {
+        member.name = iter->second;
+        this->roster.erase(iter);
+      }
+      if (this->on_leave) {
+        this->on_leave(member);
+      }
+    }
+  }
+
+  void applySession(SessionInfo &info) {
+    bool resumed = this->resuming;
+    this->resuming = false;
+    if (info.token == 0) {
+      LOG_DEBUG("Session expired. Entering again.");
+      this->session_token = 0;
+      enter(this->name);
+      return;
+    }
+    this->session_token = info.token;
+    if (this->credits == 0) {
+      // Messages held back over a reconnect.
+      this->credits = -1;
+      releaseHeld();
+    }
+    if (!resumed) {
+      // After a resume, replayed messages and a roster snapshot follow.
+      this->last_seq = info.seq;
+    }
+  }
+
+  void applyAttachAck(AttachAck &ack) {
+    auto iter = this->uploads.find(ack.upload);
+    if (iter == this->uploads.end()) {
+      return;
+    }
+    if (ack.id == 0) {
+      this->uploads.erase(iter);
+    } else {
+      iter->second.accepted = true;
+      flushSendQueue();
+    }
+    if (this->on_uploaded) {
+      this->on_uploaded(ack.upload, ack.id);
+    }
+  }
+
+  // The server forgets transfers with the connection.
+  void dropTransfers() {
+    this->uploads.clear();
+    auto downloads = std::move(this->downloads);
+    this->downloads.clear();
+    for (auto &download : downloads) {
+      if (this->on_fetched) {
+        this->on_fetched(download.first, false);
+      }
+    }
+  }
+
+  void requestChunk(uint64_t id, Download &download) {
+    AttachFetch fetch{id, download.requested,
+                      (uint32_t)std::min<uint64_t>(
+                          CLIENT_CORE_CHUNK,
+                          download.length - download.requested)};
+    download.requested += fetch.length;
+    send(this->handle.build(fetch));
+  }
+
+  void applyAttachData(AttachData &chunk) {
+    auto iter = this->downloads.find(chunk.id);
+    if (iter == this->downloads.end()) {
+      return;
+    }
+    Download &download = iter->second;
+    bool failed = chunk.bytes.empty() ||
+                  pwrite(download.fd, chunk.bytes.data(), chunk.bytes.size(),
+                         chunk.offset) != (ssize_t)chunk.bytes.size();
+    if (!failed) {
+      download.received += chunk.bytes.size();
+      if (download.requested < download.length) {
+        requestChunk(chunk.id, download);
+      }
+      if (download.received < download.length) {
+        return;
+      }
+    }
+    this->downloads.erase(iter);
+    if (this->on_fetched) {
+      this->on_fetched(chunk.id, !failed);
+    }
+  }
+
+  void applyCredit(FlowCredit &credit) {
+    this->credits = std::max<int64_t>(this->credits, 0) + credit.credits;
+    releaseHeld();
+  }
+
+  void releaseHeld() {
+    while (this->credits != 0 && !this->held.empty()) {
+      if (this->credits > 0) {
+        this->credits--;
+      }
+      send(std::move(this->held.front()));
+      this->held.pop_front();
+    }
+  }
+
+public:
+  std::function<void(RecvMessage &)> on_message;
+  std::function<void(RecvNotice &)> on_notice;
+  std::function<void()> on_close;
+  std::function<void(RosterSnapshot &)> on_roster;
+  std::function<void(RosterMember &)> on_join;
+  std::function<void(RosterMember &)> on_leave;
+  std::function<void(SearchResult &)> on_search;
+  std::function<void(RecvAttachment &)> on_attachment;
+  // Upload number and the file's id, 0 when the server refused it.
+  std::function<void(uint32_t, uint64_t)> on_uploaded;
+  // File id and whether all of it was written.
+  std::function<void(uint64_t, bool)> on_fetched;
+
+  ClientCore(int sock)
+      : sock(sock), epoll_fd(-1), stopflag(false), want_write(false),
+        send_offset(0), roster_version(0), roster_syncing(false),
+        credits(-1), session_token(0), last_seq(0), resuming(false),
+        search_id(0), upload_id(0) {
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    this->epoll_fd = epoll_create1(0);
+    if (this->epoll_fd < 0) {
+      LOG_CRITICAL("Error in attaching io events.");
+      return;
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+      LOG_CRITICAL("Error in handling io events.");
+    }
+  };
+
+  ClientCore(const ClientCore &) = delete;
+  ClientCore &operator=(const ClientCore &) = delete;
+
+  ~ClientCore() {
+    if (this->epoll_fd >= 0) {
+      ::close(this->epoll_fd);
+    }
+    if (this->sock >= 0) {
+      mychat_close(this->sock);
+    }
+  }
+
+  // Call callback with the fd whenever it becomes readable. Returns false if
+  // the fd can not be polled (e.g. a regular file).
+  bool watch(int fd, std::function<void(int)> callback) {
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      return false;
+    }
+    this->watchers[fd] = callback;
+    return true;
+  }
+
+  void unwatch(int fd) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    this->watchers.erase(fd);
+  }
+
+  // Queue a raw frame. Written right away if nothing is pending.
+  void send(Data packet) {
+    if (this->sock < 0) {
+      return;
+    }
+    this->send_queue.push_back(std::move(packet));
+    flushSendQueue();
+  }
+
+  void enter(const std::string &name) {
+    this->name = name;
+    send(this->handle.buildRaw(ENTER, name));
+  }
+
+  // Continue on a new connection after the old one dropped. Resumes the
+  // session when there is one, so the server neither announces a leave nor
+  // a join and replays the messages missed in between. Unsent messages are
+  // held until the server confirmed the session; other unsent frames are
+  // dropped.
+  void reconnect(int sock) {
+    if (this->sock >= 0) {
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, this->sock, nullptr);
+      mychat_close(this->sock);
+    }
+    this->sock = sock;
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+      LOG_CRITICAL("Error in handling io events.");
+    }
+    this->reader = FrameReader();
+    dropTransfers();
+    this->want_write = false;
+    this->stopflag = false;
+    this->credits = 0;
+
+    std::deque<Data> pending;
+    pending.swap(this->send_queue);
+    this->send_offset = 0;
+    for (auto iter = pending.rbegin(); iter != pending.rend(); ++iter) {
+      Header header;
+      std::memcpy(&header, iter->data(), sizeof(Header));
+      if (header.type == MESSAGE) {
+        this->held.push_front(std::move(*iter));
+      }
+    }
+
+    if (this->session_token != 0) {
+      this->resuming = true;
+      SendResume resume{this->session_token, this->last_seq};
+      send(this->handle.build(resume));
+    } else if (!this->name.empty()) {
+      enter(this->name);
+    }
+  }
+
+  uint64_t lastSeq() { return this->last_seq; }
+
+  // Ask for the newest limit messages containing every word of query, 0 for
+  // the server's default. Returns the id the answer will carry.
+  uint32_t search(const std::string &query, uint32_t limit = 0) {
+    SendSearch search(++this->search_id, limit, query);
+    send(this->handle.build(search));
+    return search.id;
+  }
+
+  // Offer bytes as the file name. They are sent once the server accepted
+  // them, see on_uploaded. Returns the upload's number.
+  uint32_t attach(const std::string &name, std::string bytes) {
+    AttachOffer offer(++this->upload_id, bytes.size(), name);
+    this->uploads[offer.upload] = Upload{std::move(bytes), 0, false};
+    send(this->handle.build(offer));
+    return offer.upload;
+  }
+
+  // Download the length bytes of file id into fd, see on_fetched.
+  void fetch(uint64_t id, uint64_t length, int fd) {
+    auto &download = this->downloads[id];
+    download = Download{fd, length, 0, 0};
+    for (int i = 0; i < CLIENT_CORE_CHUNKS_IN_FLIGHT &&
+                    download.requested < download.length;
+         i++) {
+      requestChunk(id, download);
+    }
+  }
+
+  // Held back while the server's credits are used up.
+  void sendMessage(const std::string &message) {
+    auto packet = this->handle.buildRaw(MESSAGE, message);
+    if (this->credits == 0 || !this->held.empty()) {
+      this->held.push_back(std::move(packet));
+      return;
+    }
+    if (this->credits > 0) {
+      this->credits--;
+    }
+    send(std::move(packet));
+  }
+
+  size_t heldMessages() { return this->held.size(); }
+
+  size_t pendingBytes() {
+    size_t total = 0;
+    for (auto &packet : this->send_queue) {
+      total += packet.size();
+    }
+    return total - this->send_offset;
+  }
+
+  bool isConnected() { return this->sock >= 0; }
+
+  const std::map<uint32_t, std::string> &members() { return this->roster; }
+
+  uint64_t rosterVersion() { return this->roster_version; }
+
+  void stop() { this->stopflag = true; }
+
+  void close() {
+    if (this->sock < 0) {
+      return;
+    }
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, this->sock, nullptr);
+    mychat_close(this->sock);
+    this->sock = -1;
+    this->send_queue.clear();
+    this->stopflag = true;
+    dropTransfers();
+    if (this->on_close) {
+      this->on_close();
+    }
+  }
+
+  // Process ready events once. timeout follows epoll_wait semantics.
+  void poll(int timeout) {
+    epoll_event events[CLIENT_CORE_MAX_EVENTS];
+    int event_count =
+        epoll_wait(this->epoll_fd, events, CLIENT_CORE_MAX_EVENTS, timeout);
+    if (event_count < 0) {
+      if (errno != EINTR) {
+        LOG_ERROR("Error in waiting for io events");
+        this->stopflag = true;
+      }
+      return;
+    }
+
+    for (int i = 0; i < event_count; i++) {
+      int fd = events[i].data.fd;
+      if (fd == this->sock) {
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+          readSocket();
+        }
+        if (this->sock >= 0 && (events[i].events & EPOLLOUT)) {
+          flushSendQueue();
+        }
+      } else {
+        auto iter = this->watchers.find(fd);
+        if (iter != this->watchers.end()) {
+          auto callback = iter->second;
+          callback(fd);
+        }
+      }
+    }
+  }
+
+  // Block until stop() is called or the server goes away.
+  void run() {
+    while (!this->stopflag) {
+      poll(-1);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef __CLIENT_RENDER_H__
+#define __CLIENT_RENDER_H__
+
+#include <cerrno>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define RENDER_DEFAULT_INTERVAL_MS 16
+#define RENDER_DEFAULT_MAX_BYTES (64 * 1024)
+
+// Collects output lines and writes them to the terminal in batches.
+//
+// A batch is written when the flush interval elapses after its first line or
+// when it grows past max_bytes, whichever comes first. With a scrollback cap,
+// only the newest lines of a batch are rendered and the rest are summarized,
+// so a flood of messages can not make the terminal fall behind.
+class Renderer {
+  int out_fd;
+  int timer_fd;
+  int interval_ms;
+  size_t max_bytes;
+  size_t scrollback;
+
+  std::deque<std::string> lines;
+  size_t pending_bytes;
+  size_t dropped;
+  bool armed;
+
+  void arm() {
+    if (this->armed || this->timer_fd < 0) {
+      return;
+    }
+    itimerspec spec = {};
+    spec.it_value.tv_sec = this->interval_ms / 1000;
+    spec.it_value.tv_nsec = (this->interval_ms % 1000) * 1000000L;
+    timerfd_settime(this->timer_fd, 0, &spec, nullptr);
+    this->armed = true;
+  }
+
+  void disarm() {
+    if (!this->armed) {
+      return;
+    }
+    itimerspec spec = {};
+    timerfd_settime(this->timer_fd, 0, &spec, nullptr);
+    this->armed = false;
+  }
+
+  void writeAll(const std::string &out) {
+    size_t pos = 0;
+    while (pos < out.size()) {
+      int written = write(this->out_fd, out.data() + pos, out.size() - pos);
+      if (written < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+          continue;
+        }
+        return;
+      }
+      pos += written;
+    }
+  }
+
+public:
+  // interval_ms of 0 writes every line immediately. scrollback of 0 renders
+  // every line.
+  Renderer(int out_fd = STDOUT_FILENO,
+           int interval_ms = RENDER_DEFAULT_INTERVAL_MS,
+           size_t max_bytes = RENDER_DEFAULT_MAX_BYTES, size_t scrollback = 0)
+      : out_fd(out_fd), timer_fd(-1), interval_ms(interval_ms),
+        max_bytes(max_bytes), scrollback(scrollback), pending_bytes(0),
+        dropped(0), armed(false) {
+    if (interval_ms > 0) {
+      this->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    }
+  };
+
+  Renderer(const Renderer &) = delete;
+  Renderer &operator=(const Renderer &) = delete;
+
+  ~Renderer() {
+    flush();
+    if (this->timer_fd >= 0) {
+      close(this->timer_fd);
+    }
+  }
+
+  // Readable when a pending batch is due. -1 when batching is disabled.
+  int timerFd() { return this->timer_fd; }
+
+  void onTimer() {
+    uint64_t expirations;
+    while (read(this->timer_fd, &expirations, sizeof(expirations)) > 0) {
+    }
+    this->armed = false;
+    flush();
+  }
+
+  // line must include its trailing newline.
+  void push(std::string line) {
+    this->pending_bytes += line.size();
+    this->lines.push_back(std::move(line));
+
+    if (this->scrollback > 0 && this->lines.size() > this->scrollback) {
+      this->pending_bytes -= this->lines.front().size();
+      this->lines.pop_front();
+      this->dropped++;
+    }
+
+    if (this->timer_fd < 0 || this->pending_bytes >= this->max_bytes) {
+      flush();
+    } else {
+      arm();
+    }
+  }
+
+  void flush() {
+    if (this->lines.empty() && this->dropped == 0) {
+      return;
+    }
+
+    std::string out;
+    out.reserve(this->pending_bytes + 64);
+    if (this->dropped > 0) {
+      out += "\033[2m... " + std::to_string(this->dropped) +
+             " lines skipped ...\033[0m\n";
+    }
+    for (auto &line : this->lines) {
+      out += line;
+    }
+    writeAll(out);
+
+    this->lines.clear();
+    this->pending_bytes = 0;
+    this->dropped = 0;
+    disarm();
+  }
+
+  size_t droppedLines() { return this->dropped; }
+};
+
+#endif
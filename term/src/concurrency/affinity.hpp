@@ -0,0 +1,53 @@
+#ifndef __CONCURRENCY_AFFINITY_H__
+#define __CONCURRENCY_AFFINITY_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Keep thread on cpu only. False when cpu does not exist or is not allowed.
+inline bool pinThread(pthread_t thread, int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+// "2,3,6-7" to {2, 3, 6, 7}. Throws std::invalid_argument when malformed.
+inline std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  size_t start = 0;
+  while (start < list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string item = list.substr(start, end - start);
+    size_t dash = item.find('-');
+    size_t used;
+    int first = std::stoi(item.substr(0, dash), &used);
+    if (used != item.substr(0, dash).size() || first < 0) {
+      throw std::invalid_argument(item);
+    }
+    int last = first;
+    if (dash != std::string::npos) {
+      std::string tail = item.substr(dash + 1);
+      last = std::stoi(tail, &used);
+      if (used != tail.size() || last < first) {
+        throw std::invalid_argument(item);
+      }
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    start = end + 1;
+  }
+  return cpus;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __CONCURRENCY_CACHE_LINE_H__
+#define __CONCURRENCY_CACHE_LINE_H__
+
+#include <cstddef>
+
+// Alignment keeping fields written by different threads on separate cache
+// lines. 128 covers the adjacent-line prefetcher on x86 and the 128 byte
+// lines of some arm64 cores.
+#define CACHE_LINE_SIZE 128
+
+// Smallest power of two not below value, at least 2.
+inline size_t roundUpPowerOfTwo(size_t value) {
+  size_t size = 2;
+  while (size < value) {
+    size <<= 1;
+  }
+  return size;
+}
+
+#endif
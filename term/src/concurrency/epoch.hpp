@@ -0,0 +1,206 @@
+#ifndef __CONCURRENCY_EPOCH_H__
+#define __CONCURRENCY_EPOCH_H__
+
+#include "src/concurrency/cache_line.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Threads that can take part in one EpochReclaimer at the same time.
+#define EPOCH_MAX_PARTICIPANTS 64
+// Retired objects a participant keeps before it tries to free some.
+#define EPOCH_COLLECT_THRESHOLD 64
+
+// Epoch-based reclamation for objects shared between threads, e.g. message
+// buffers fanned out to several writer threads.
+//
+// A thread reads shared objects only while pinned. A writer that unlinks an
+// object retires it instead of deleting it; the object is tagged with the
+// global epoch of that moment. The global epoch advances only once every
+// pinned thread has seen the current one, so after two advances no thread
+// can still be pinned from before the unlink and the object is freed.
+//
+// Each thread joins once and keeps its Participant. Pinning is a store to the
+// participant's own cache line plus a fence; nothing is shared on the read
+// path.
+class EpochReclaimer {
+  static constexpr uint64_t IDLE = UINT64_MAX;
+
+  struct Retired {
+    uint64_t epoch;
+    void *ptr;
+    void (*deleter)(void *);
+  };
+
+  struct alignas(CACHE_LINE_SIZE) Record {
+    std::atomic<uint64_t> epoch{IDLE}; // epoch pinned at, IDLE when not
+    std::atomic<bool> used{false};
+  };
+
+  std::unique_ptr<Record[]> records;
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> global{0};
+
+  // Left behind by participants that quit before they could free them.
+  std::mutex orphans_lock;
+  std::vector<Retired> orphans;
+
+  // Moves the global epoch on if every pinned participant has seen it.
+  void tryAdvance() {
+    uint64_t epoch = this->global.load(std::memory_order_seq_cst);
+    for (size_t i = 0; i < EPOCH_MAX_PARTICIPANTS; i++) {
+      if (!this->records[i].used.load(std::memory_order_acquire)) {
+        continue;
+      }
+      uint64_t pinned = this->records[i].epoch.load(std::memory_order_seq_cst);
+      if (pinned != IDLE && pinned != epoch) {
+        return;
+      }
+    }
+    this->global.compare_exchange_strong(epoch, epoch + 1,
+                                         std::memory_order_seq_cst);
+  }
+
+  // Frees the entries of retired that are two epochs old, keeps the rest.
+  size_t freeExpired(std::vector<Retired> &retired) {
+    uint64_t epoch = this->global.load(std::memory_order_acquire);
+    size_t freed = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+      if (retired[i].epoch + 2 <= epoch) {
+        retired[i].deleter(retired[i].ptr);
+        freed++;
+      } else {
+        retired[kept++] = retired[i];
+      }
+    }
+    retired.resize(kept);
+    return freed;
+  }
+
+public:
+  class Participant {
+    EpochReclaimer &reclaimer;
+    Record &record;
+    std::vector<Retired> retired;
+    int depth; // nested pins
+
+  public:
+    Participant(EpochReclaimer &reclaimer, Record &record)
+        : reclaimer(reclaimer), record(record), depth(0){};
+
+    ~Participant() {
+      this->record.epoch.store(IDLE, std::memory_order_release);
+      if (!this->retired.empty()) {
+        std::lock_guard<std::mutex> lock(this->reclaimer.orphans_lock);
+        this->reclaimer.orphans.insert(this->reclaimer.orphans.end(),
+                                       this->retired.begin(),
+                                       this->retired.end());
+      }
+      this->record.used.store(false, std::memory_order_release);
+    }
+
+    Participant(const Participant &) = delete;
+    Participant &operator=(const Participant &) = delete;
+
+    // Shared objects read between pin and unpin stay valid. Pins nest.
+    void pin() {
+      if (this->depth++ > 0) {
+        return;
+      }
+      // Re-check so the epoch published is one the reclaimer can still
+      // see as current; otherwise two advances could slip past the pin.
+      uint64_t epoch = this->reclaimer.global.load(std::memory_order_seq_cst);
+      while (true) {
+        this->record.epoch.store(epoch, std::memory_order_seq_cst);
+        uint64_t now = this->reclaimer.global.load(std::memory_order_seq_cst);
+        if (now == epoch) {
+          break;
+        }
+        epoch = now;
+      }
+    }
+
+    void unpin() {
+      if (--this->depth == 0) {
+        this->record.epoch.store(IDLE, std::memory_order_release);
+      }
+    }
+
+    // Frees ptr once no thread pinned now can still reach it. Call after
+    // unlinking it from every shared structure.
+    template <typename T> void retire(T *ptr) {
+      retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    void retire(void *ptr, void (*deleter)(void *)) {
+      this->retired.push_back(Retired{
+          this->reclaimer.global.load(std::memory_order_acquire), ptr,
+          deleter});
+      if (this->retired.size() >= EPOCH_COLLECT_THRESHOLD) {
+        collect();
+      }
+    }
+
+    // Tries to advance the epoch and frees what has become safe. Returns
+    // how many objects were freed.
+    size_t collect() {
+      this->reclaimer.tryAdvance();
+      return this->reclaimer.freeExpired(this->retired) +
+             this->reclaimer.collectOrphans();
+    }
+
+    // Retired objects of this participant not freed yet.
+    size_t pending() { return this->retired.size(); }
+  };
+
+  // Keeps a participant pinned for a scope.
+  class Guard {
+    Participant &participant;
+
+  public:
+    Guard(Participant &participant) : participant(participant) {
+      this->participant.pin();
+    };
+    ~Guard() { this->participant.unpin(); }
+  };
+
+  EpochReclaimer() : records(new Record[EPOCH_MAX_PARTICIPANTS]){};
+
+  // Every participant must be gone by now, so everything left can go.
+  ~EpochReclaimer() {
+    for (auto &entry : this->orphans) {
+      entry.deleter(entry.ptr);
+    }
+  }
+
+  // Registers the calling thread. Throws std::length_error when
+  // EPOCH_MAX_PARTICIPANTS threads take part already.
+  Participant join() {
+    for (size_t i = 0; i < EPOCH_MAX_PARTICIPANTS; i++) {
+      bool expected = false;
+      if (this->records[i].used.compare_exchange_strong(
+              expected, true, std::memory_order_acq_rel)) {
+        return Participant(*this, this->records[i]);
+      }
+    }
+    throw std::length_error("too many epoch participants");
+  }
+
+  uint64_t epoch() { return this->global.load(std::memory_order_acquire); }
+
+  // Frees what quit participants left behind once it is safe. Skips the
+  // work when another thread is at it.
+  size_t collectOrphans() {
+    std::unique_lock<std::mutex> lock(this->orphans_lock, std::try_to_lock);
+    if (!lock.owns_lock() || this->orphans.empty()) {
+      return 0;
+    }
+    return freeExpired(this->orphans);
+  }
+};
+
+#endif
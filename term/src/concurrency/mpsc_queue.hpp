@@ -0,0 +1,109 @@
+#ifndef __CONCURRENCY_MPSC_QUEUE_H__
+#define __CONCURRENCY_MPSC_QUEUE_H__
+
+#include "src/concurrency/cache_line.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Bounded queue that any number of threads push to and one thread drains.
+//
+// Each slot carries a sequence number telling whose turn it is: a producer
+// claims a slot by advancing tail with a CAS, fills it and publishes it by
+// bumping the slot's sequence; the consumer takes slots in order as soon as
+// they are published and hands them back by bumping the sequence once more.
+// Producers only contend on tail, and the consumer never writes a shared
+// index, so draining a batch costs one acquire load per item.
+template <typename T> class MpscQueue {
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0}; // producers
+  alignas(CACHE_LINE_SIZE) size_t head = 0;             // consumer only
+
+public:
+  // capacity is rounded up to a power of two.
+  MpscQueue(size_t capacity) {
+    size_t size = roundUpPowerOfTwo(capacity);
+    this->slots.reset(new Slot[size]);
+    this->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+      this->slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  };
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  size_t capacity() { return this->mask + 1; }
+
+  // Any thread. Returns false when the queue is full.
+  bool push(T value) {
+    size_t pos = this->tail.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &this->slots[pos & this->mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (this->tail.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = this->tail.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::move(value);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only.
+  std::optional<T> pop() {
+    Slot &slot = this->slots[this->head & this->mask];
+    if (slot.seq.load(std::memory_order_acquire) != this->head + 1) {
+      return std::nullopt;
+    }
+    std::optional<T> value(std::move(slot.value));
+    slot.seq.store(this->head + this->mask + 1, std::memory_order_release);
+    this->head++;
+    return value;
+  }
+
+  // Consumer only. Moves up to max published items to out, stopping at the
+  // first slot a producer has claimed but not filled yet. Returns how many
+  // were moved.
+  size_t popBatch(std::vector<T> &out, size_t max) {
+    size_t count = 0;
+    while (count < max) {
+      Slot &slot = this->slots[this->head & this->mask];
+      if (slot.seq.load(std::memory_order_acquire) != this->head + 1) {
+        break;
+      }
+      out.push_back(std::move(slot.value));
+      slot.seq.store(this->head + this->mask + 1, std::memory_order_release);
+      this->head++;
+      count++;
+    }
+    return count;
+  }
+
+  // Consumer only.
+  bool empty() {
+    return this->slots[this->head & this->mask].seq.load(
+               std::memory_order_acquire) != this->head + 1;
+  }
+};
+
+#endif
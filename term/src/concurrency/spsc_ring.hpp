@@ -0,0 +1,93 @@
+#ifndef __CONCURRENCY_SPSC_RING_H__
+#define __CONCURRENCY_SPSC_RING_H__
+
+#include "src/concurrency/cache_line.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Bounded ring between exactly one producer thread and one consumer thread.
+//
+// The producer only writes tail and the consumer only writes head, each on
+// its own cache line. Both sides keep a private copy of the other side's
+// index and reload it only when the ring looks full or empty, so in steady
+// state a push or pop touches no cache line owned by the other thread.
+template <typename T> class SpscRing {
+  std::vector<T> slots;
+  size_t mask;
+
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0}; // next to pop
+  size_t tail_cache = 0;                                 // consumer's view
+
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0}; // next to push
+  size_t head_cache = 0;                                 // producer's view
+
+public:
+  // capacity is rounded up to a power of two.
+  SpscRing(size_t capacity)
+      : slots(roundUpPowerOfTwo(capacity)), mask(slots.size() - 1){};
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t capacity() { return this->slots.size(); }
+
+  // Producer side. Returns false when the ring is full.
+  bool push(T value) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - this->head_cache == this->slots.size()) {
+      this->head_cache = this->head.load(std::memory_order_acquire);
+      if (tail - this->head_cache == this->slots.size()) {
+        return false;
+      }
+    }
+    this->slots[tail & this->mask] = std::move(value);
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  std::optional<T> pop() {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    if (head == this->tail_cache) {
+      this->tail_cache = this->tail.load(std::memory_order_acquire);
+      if (head == this->tail_cache) {
+        return std::nullopt;
+      }
+    }
+    std::optional<T> value(std::move(this->slots[head & this->mask]));
+    this->head.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+  // Consumer side. Moves up to max items to out and frees their slots with a
+  // single store. Returns how many were moved.
+  size_t popBatch(std::vector<T> &out, size_t max) {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    if (this->tail_cache - head < max) {
+      this->tail_cache = this->tail.load(std::memory_order_acquire);
+    }
+    size_t count = std::min(max, this->tail_cache - head);
+    for (size_t i = 0; i < count; i++) {
+      out.push_back(std::move(this->slots[(head + i) & this->mask]));
+    }
+    if (count > 0) {
+      this->head.store(head + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // Exact only when called from one of the two sides while the other is
+  // idle.
+  size_t size() {
+    return this->tail.load(std::memory_order_acquire) -
+           this->head.load(std::memory_order_acquire);
+  }
+
+  bool empty() { return size() == 0; }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __CONCURRENCY_WAKEUP_H__
+#define __CONCURRENCY_WAKEUP_H__
+
+#include <atomic>
+#include <cstdint>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Wakes a thread blocked in epoll or poll from any other thread.
+//
+// fd() becomes readable after notify() and stays readable until the owner
+// calls drain(). Notifies between two drains coalesce: only the first one
+// writes to the eventfd, so a producer signalling every item it queues pays
+// for one syscall per wakeup rather than per item.
+class Wakeup {
+  int event_fd;
+  std::atomic<bool> pending{false};
+
+public:
+  Wakeup() { this->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); };
+
+  ~Wakeup() {
+    if (this->event_fd >= 0) {
+      ::close(this->event_fd);
+    }
+  }
+
+  Wakeup(const Wakeup &) = delete;
+  Wakeup &operator=(const Wakeup &) = delete;
+
+  // -1 when the eventfd could not be created.
+  int fd() { return this->event_fd; }
+
+  // Any thread.
+  void notify() {
+    if (this->pending.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+    uint64_t one = 1;
+    // Only fails when the counter would overflow, i.e. it is readable anyway.
+    (void)!::write(this->event_fd, &one, sizeof(one));
+  }
+
+  // Owner. Resets the eventfd so the next notify wakes it again. Returns
+  // whether there was a notify to consume. Check the queues after draining,
+  // not before, or a notify landing in between is lost.
+  bool drain() {
+    // Read before clearing pending: a notify in between sees pending still
+    // set and skips its write, which is fine because the caller checks the
+    // queues next. Clearing first would let that write be read here and
+    // leave pending set with nothing to wake the next wait.
+    uint64_t count;
+    (void)!::read(this->event_fd, &count, sizeof(count));
+    return this->pending.exchange(false, std::memory_order_acq_rel);
+  }
+
+  // Owner. Blocks until notified or timeout_ms passes, -1 waits forever.
+  // Returns whether it was notified.
+  bool wait(int timeout_ms) {
+    pollfd pfd{this->event_fd, POLLIN, 0};
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+      return false;
+    }
+    return drain();
+  }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef __CONCURRENCY_WORK_POOL_H__
+#define __CONCURRENCY_WORK_POOL_H__
+
+#include "src/concurrency/affinity.hpp"
+#include "src/concurrency/cache_line.hpp"
+#include "src/concurrency/mpsc_queue.hpp"
+#include "src/concurrency/wakeup.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Threads for CPU-heavy work that must not run on an event loop.
+//
+// Every worker owns a deque. A job submitted from outside the pool goes to
+// the workers in turn, one submitted by a running job to the back of its own
+// worker's deque. Workers take their newest job first, and once their deque
+// is empty steal the oldest job of another worker, so a burst landing on one
+// worker spreads over all of them.
+//
+// A job may come with a completion. Completions are handed back to the
+// owning loop through an MPSC queue and a Wakeup: the loop watches fd() and
+// calls runCompletions() when it turns readable, so completions run on the
+// loop thread and may touch its state without locks.
+class WorkPool {
+public:
+  using Job = std::function<void()>;
+
+private:
+  struct Task {
+    Job work;
+    Job done;
+  };
+
+  struct alignas(CACHE_LINE_SIZE) Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next{0};      // round robin for outside submits
+  std::atomic<size_t> queued{0};    // tasks in any deque
+  std::atomic<size_t> unfinished{0}; // submitted, completion not run yet
+  std::atomic<uint64_t> stolen{0};
+  std::atomic<bool> stopping{false};
+
+  std::mutex idle_lock;
+  std::condition_variable idle;
+
+  MpscQueue<Job> completions;
+  Wakeup wakeup;
+
+  // Index of the worker running on this thread in the pool it belongs to.
+  static inline thread_local WorkPool *current_pool = nullptr;
+  static inline thread_local size_t current_index = 0;
+
+  std::optional<Task> take(size_t index) {
+    Worker &own = *this->workers[index];
+    {
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.tasks.empty()) {
+        Task task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        this->queued.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+      }
+    }
+    for (size_t i = 1; i < this->workers.size(); i++) {
+      Worker &victim = *this->workers[(index + i) % this->workers.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tasks.empty()) {
+        Task task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        this->queued.fetch_sub(1, std::memory_order_relaxed);
+        this->stolen.fetch_add(1, std::memory_order_relaxed);
+        return task;
+      }
+    }
+    return std::nullopt;
+  }
+
+  void finish(Job done) {
+    if (!done) {
+      this->unfinished.fetch_sub(1, std::memory_order_acq_rel);
+      return;
+    }
+    // The loop never waits for the pool, so a full queue only means it is
+    // busy. Hold this worker back until it catches up.
+    while (!this->completions.push(done)) {
+      if (this->stopping.load(std::memory_order_relaxed)) {
+        return;
+      }
+      this->wakeup.notify();
+      std::this_thread::yield();
+    }
+    this->wakeup.notify();
+  }
+
+  void run(size_t index) {
+    current_pool = this;
+    current_index = index;
+    while (!this->stopping.load(std::memory_order_relaxed)) {
+      auto task = this->take(index);
+      if (task.has_value()) {
+        task->work();
+        this->finish(std::move(task->done));
+        continue;
+      }
+      std::unique_lock<std::mutex> guard(this->idle_lock);
+      this->idle.wait(guard, [this] {
+        return this->stopping.load(std::memory_order_relaxed) ||
+               this->queued.load(std::memory_order_relaxed) > 0;
+      });
+    }
+  }
+
+public:
+  // At least one worker. completion_capacity bounds the completions waiting
+  // for the loop and is rounded up to a power of two.
+  WorkPool(size_t workers, size_t completion_capacity = 4096)
+      : completions(completion_capacity) {
+    workers = workers == 0 ? 1 : workers;
+    for (size_t i = 0; i < workers; i++) {
+      this->workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < workers; i++) {
+      this->threads.emplace_back([this, i] { run(i); });
+    }
+  };
+
+  // Jobs not started yet are dropped, completions not run yet too.
+  ~WorkPool() {
+    {
+      std::lock_guard<std::mutex> guard(this->idle_lock);
+      this->stopping = true;
+    }
+    this->idle.notify_all();
+    for (auto &thread : this->threads) {
+      thread.join();
+    }
+  }
+
+  WorkPool(const WorkPool &) = delete;
+  WorkPool &operator=(const WorkPool &) = delete;
+
+  // Any thread, including a job of this pool. work runs on a worker and
+  // must not throw; done runs afterwards on the thread calling
+  // runCompletions().
+  void submit(Job work, Job done = nullptr) {
+    size_t index;
+    if (current_pool == this) {
+      index = current_index;
+    } else {
+      index = this->next.fetch_add(1, std::memory_order_relaxed) %
+              this->workers.size();
+    }
+    this->unfinished.fetch_add(1, std::memory_order_relaxed);
+    {
+      Worker &worker = *this->workers[index];
+      std::lock_guard<std::mutex> guard(worker.lock);
+      worker.tasks.push_back(Task{std::move(work), std::move(done)});
+      this->queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    // A worker about to sleep checks queued under idle_lock. Passing through
+    // it here means that worker either saw the task or is already waiting
+    // and gets the notify.
+    { std::lock_guard<std::mutex> guard(this->idle_lock); }
+    this->idle.notify_one();
+  }
+
+  // Keep worker i on cpus[i % cpus.size()]. Returns how many were pinned.
+  size_t pin(const std::vector<int> &cpus) {
+    size_t pinned = 0;
+    for (size_t i = 0; i < this->threads.size() && !cpus.empty(); i++) {
+      if (pinThread(this->threads[i].native_handle(),
+                    cpus[i % cpus.size()])) {
+        pinned++;
+      }
+    }
+    return pinned;
+  }
+
+  // Readable while completions are waiting. -1 when no eventfd.
+  int fd() { return this->wakeup.fd(); }
+
+  // Loop thread only. Runs up to max waiting completions and returns how
+  // many ran. Leaves fd() readable when more are left, so one busy pool
+  // cannot hold the loop for long.
+  size_t runCompletions(size_t max = 64) {
+    this->wakeup.drain();
+    std::vector<Job> batch;
+    this->completions.popBatch(batch, max);
+    for (auto &done : batch) {
+      done();
+      this->unfinished.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    if (!this->completions.empty()) {
+      this->wakeup.notify();
+    }
+    return batch.size();
+  }
+
+  // Jobs submitted whose completion has not run yet.
+  size_t pending() {
+    return this->unfinished.load(std::memory_order_acquire);
+  }
+
+  size_t size() { return this->threads.size(); }
+
+  // Jobs a worker took from another worker's deque.
+  uint64_t steals() { return this->stolen.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef __CORO_TASK_H__
+#define __CORO_TASK_H__
+
+#include "src/protocol/pool.hpp"
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// Coroutine frames come from BufferPool like message buffers do, so a
+// coroutine per connection or per awaited call stays off the global
+// allocator once the pool is warm.
+struct PooledFrame {
+  static void *operator new(size_t size) { return BufferPool::allocate(size); }
+  static void operator delete(void *ptr, size_t size) {
+    BufferPool::deallocate(ptr, size);
+  }
+};
+
+struct TaskPromiseBase : PooledFrame {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+  bool detached = false;
+
+  // Back to whoever awaited the task. A detached task frees itself.
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<P> finished) noexcept {
+      auto &promise = finished.promise();
+      if (promise.continuation) {
+        return promise.continuation;
+      }
+      if (promise.detached) {
+        finished.destroy();
+      }
+      return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { this->error = std::current_exception(); }
+
+  void rethrow() {
+    if (this->error) {
+      std::rethrow_exception(this->error);
+    }
+  }
+};
+
+template <typename T> struct TaskPromise : TaskPromiseBase {
+  std::optional<T> value;
+
+  void return_value(T value) { this->value.emplace(std::move(value)); }
+  T take() {
+    rethrow();
+    return std::move(*this->value);
+  }
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase {
+  void return_void() {}
+  void take() { rethrow(); }
+};
+
+// Lazily started coroutine producing a T.
+//
+// Awaiting a task runs it and resumes the awaiter, by symmetric transfer,
+// with its result or what it threw. A task at the top, e.g. one per
+// connection, is run with start() and resumed by whatever it awaits. The
+// Task owns the frame and destroys it, wherever it is suspended, unless
+// detach() handed it over to the coroutine itself.
+template <typename T = void> class Task {
+public:
+  struct promise_type : TaskPromise<T> {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  struct Awaiter {
+    std::coroutine_handle<promise_type> callee;
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+      this->callee.promise().continuation = caller;
+      return this->callee;
+    }
+    T await_resume() { return this->callee.promise().take(); }
+  };
+
+  Task() : handle(nullptr){};
+  Task(const Task &) = delete;
+  Task(Task &&other) : handle(std::exchange(other.handle, nullptr)){};
+  Task &operator=(Task &&other) {
+    if (this != &other) {
+      reset();
+      this->handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+  ~Task() { reset(); }
+
+  explicit operator bool() const { return this->handle != nullptr; }
+  bool done() const { return this->handle == nullptr || this->handle.done(); }
+
+  // Run until the first suspension point, or the end.
+  void start() { this->handle.resume(); }
+
+  // Result of a task that ran to the end. Rethrows what it threw.
+  T result() { return this->handle.promise().take(); }
+
+  // Let the coroutine free its own frame when it finishes, for a task still
+  // running whose owner goes away. Nothing can await it afterwards.
+  void detach() {
+    if (this->handle == nullptr) {
+      return;
+    }
+    if (this->handle.done()) {
+      this->handle.destroy();
+    } else {
+      this->handle.promise().detached = true;
+    }
+    this->handle = nullptr;
+  }
+
+  Awaiter operator co_await() && { return Awaiter{this->handle}; }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle){};
+
+  void reset() {
+    if (this->handle != nullptr) {
+      this->handle.destroy();
+      this->handle = nullptr;
+    }
+  }
+};
+
+#endif
@@ -1,5 +1,6 @@
 #ifndef __LOGGING_LOGGING_H__
 #define __LOGGING_LOGGING_H__
+#include <cctype>
 #include <iostream>
 #include <ostream>
 #include <string>
@@ -14,7 +15,7 @@
 
 #define EXIT ;
 
-int _LOG_LEVEL = TRACE;
+inline int _LOG_LEVEL = TRACE;
 
 inline const char *log_header_msg(int level) {
   switch (level) {
@@ -57,11 +58,35 @@ inline void log(int level, std::string msg) {
 
 inline void setLevel(int level) { _LOG_LEVEL = level; }
 
-#define LOG_TRACE(msg) log(TRACE, msg)
-#define LOG_DEBUG(msg) log(DEBUG, msg)
-#define LOG_INFO(msg) log(INFO, msg)
-#define LOG_WARN(msg) log(WARN, msg)
-#define LOG_ERROR(msg) log(ERROR, msg)
-#define LOG_CRITICAL(msg) log(CRITICAL, msg)
+// Level for names like "debug" or "WARN". -1 for unknown names.
+inline int levelFromName(std::string name) {
+  for (auto &c : name) {
+    c = std::tolower(c);
+  }
+  if (name == "trace") {
+    return TRACE;
+  } else if (name == "debug") {
+    return DEBUG;
+  } else if (name == "info") {
+    return INFO;
+  } else if (name == "warn") {
+    return WARN;
+  } else if (name == "error") {
+    return ERROR;
+  } else if (name == "critical") {
+    return CRITICAL;
+  }
+  return -1;
+}
+
+// The level is checked before msg is evaluated, so disabled calls do not
+// build their message.
+#define LOG_AT(level, msg) ((level) >= _LOG_LEVEL ? log(level, msg) : (void)0)
+#define LOG_TRACE(msg) LOG_AT(TRACE, msg)
+#define LOG_DEBUG(msg) LOG_AT(DEBUG, msg)
+#define LOG_INFO(msg) LOG_AT(INFO, msg)
+#define LOG_WARN(msg) LOG_AT(WARN, msg)
+#define LOG_ERROR(msg) LOG_AT(ERROR, msg)
+#define LOG_CRITICAL(msg) LOG_AT(CRITICAL, msg)
 #define EXIT_WITH_LOG_CRITICAL(msg) log(CRITICAL, msg)
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#ifndef __MYCHAT_IO_H__
+#define __MYCHAT_IO_H__
+
+#include "src/mychat/mychat.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using MychatClock = std::chrono::steady_clock;
+
+// Everything the server asks of the operating system about sockets, time
+// and readiness. Calls return what the syscalls they stand for return, with
+// errno set the same way, so code written against the syscalls keeps its
+// error handling. MychatSystemIo is the real thing; a simulated network can
+// stand in for it to run a server without sockets.
+class MychatIo {
+public:
+  virtual ~MychatIo() = default;
+
+  // Listening socket for addr, or a MYCHAT_* error below 0.
+  virtual int listen(const MychatAddress &addr, int max_conn) = 0;
+  // Nonblocking socket to addr, or a MYCHAT_* error below 0. The connect
+  // may still be in progress: it is done once the socket reports EPOLLOUT,
+  // and SO_ERROR tells whether it failed.
+  virtual int connect(const MychatAddress &addr) = 0;
+  // Next pending connection of a listening socket, already nonblocking.
+  virtual int accept(int fd) = 0;
+  virtual ssize_t recv(int fd, void *buffer, size_t size) = 0;
+  virtual ssize_t send(int fd, const void *buffer, size_t size) = 0;
+  // Up to size bytes of file from *offset on, which is moved past them.
+  virtual ssize_t sendfile(int fd, int file, off_t *offset, size_t size) = 0;
+  virtual int close(int fd) = 0;
+  virtual int setsockopt(int fd, int level, int name, const void *value,
+                         socklen_t size) = 0;
+  virtual int getsockopt(int fd, int level, int name, void *value,
+                         socklen_t *size) = 0;
+
+  // Report events (EPOLLIN, EPOLLOUT, EPOLLET, ...) of fd to wait(). Closing
+  // fd stops them.
+  virtual int watch(int fd, uint32_t events) = 0;
+  // Like epoll_wait: up to max ready fds, after at most timeout ms.
+  virtual int wait(epoll_event *events, int max, int timeout) = 0;
+
+  virtual MychatClock::time_point now() = 0;
+};
+
+class MychatSystemIo : public MychatIo {
+  int epoll_fd;
+
+public:
+  MychatSystemIo() : epoll_fd(-1){};
+  MychatSystemIo(const MychatSystemIo &) = delete;
+  ~MychatSystemIo() {
+    if (this->epoll_fd >= 0) {
+      ::close(this->epoll_fd);
+    }
+  }
+
+  int listen(const MychatAddress &addr, int max_conn) override {
+    return mychat_listen(addr, max_conn);
+  }
+
+  int connect(const MychatAddress &addr) override {
+    return mychat_connect(addr, true);
+  }
+
+  int accept(int fd) override {
+    struct sockaddr_storage addr;
+    socklen_t size = sizeof(addr);
+    int sock = mychat_accept(fd, (struct sockaddr *)&addr, &size);
+    if (sock >= 0) {
+      fcntl(sock, F_SETFL, O_NONBLOCK);
+    }
+    return sock;
+  }
+
+  ssize_t recv(int fd, void *buffer, size_t size) override {
+    return mychat_recv(fd, buffer, size);
+  }
+
+  ssize_t send(int fd, const void *buffer, size_t size) override {
+    return mychat_send(fd, buffer, size);
+  }
+
+  ssize_t sendfile(int fd, int file, off_t *offset, size_t size) override {
+    return ::sendfile(fd, file, offset, size);
+  }
+
+  int close(int fd) override { return mychat_close(fd); }
+
+  int setsockopt(int fd, int level, int name, const void *value,
+                 socklen_t size) override {
+    return ::setsockopt(fd, level, name, value, size);
+  }
+
+  int getsockopt(int fd, int level, int name, void *value,
+                 socklen_t *size) override {
+    return ::getsockopt(fd, level, name, value, size);
+  }
+
+  int watch(int fd, uint32_t events) override {
+    if (this->epoll_fd < 0) {
+      this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (this->epoll_fd < 0) {
+        return -1;
+      }
+    }
+    epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+
+  int wait(epoll_event *events, int max, int timeout) override {
+    if (this->epoll_fd < 0) {
+      errno = EBADF;
+      return -1;
+    }
+    return epoll_wait(this->epoll_fd, events, max, timeout);
+  }
+
+  MychatClock::time_point now() override { return MychatClock::now(); }
+};
+
+// For code that is not handed an io of its own.
+inline MychatIo &mychat_system_io() {
+  static MychatSystemIo io;
+  return io;
+}
+
+#endif
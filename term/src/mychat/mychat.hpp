@@ -1,7 +1,14 @@
+#ifndef __MYCHAT_MYCHAT_H__
+#define __MYCHAT_MYCHAT_H__
+
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
+#include <cerrno>
+#include <cstring>
 #include <stdio.h>
+#include <string>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #define MYCHAT_SERVE_NUM
@@ -11,8 +18,8 @@
 #define MYCHAT_SEND_NUM
 #define MYCHAT_CLOSE_NUM
 
-#define MYCHAT_SERVE_ERR_SOCKET_BINDING_FAILED -1;
-#define MYCHAT_SERVE_ERR_SOCKET_LISTENING_FAILED -2;
+#define MYCHAT_SERVE_ERR_SOCKET_BINDING_FAILED -1
+#define MYCHAT_SERVE_ERR_SOCKET_LISTENING_FAILED -2
 
 inline int mychat_serve(int port, int max_conn) {
 #ifndef MYCHAT_USE_SYSCALL
@@ -51,19 +58,25 @@ inline int mychat_accept(int fd, __SOCKADDR_ARG addr,
   return accept(fd, addr, size);
 };
 
-#define MYCHAT_ENTER_SOCKET_CREATING_FAILED -1;
-#define MYCHAT_ENTER_SOCKET_CONNECTING_FAILED -2;
+#define MYCHAT_ENTER_SOCKET_CREATING_FAILED -1
+#define MYCHAT_ENTER_SOCKET_CONNECTING_FAILED -2
 
-inline int mychat_enter(__CONST_SOCKADDR_ARG addr, socklen_t socksize) {
+// A nonblocking socket is returned while its connect is still in progress
+// (EINPROGRESS). It is done once the socket becomes writable, and SO_ERROR
+// tells whether it failed.
+inline int mychat_enter(__CONST_SOCKADDR_ARG addr, socklen_t socksize,
+                        bool nonblocking = false) {
 #ifndef MYCHAT_USE_SYSCALL
   int res;
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int sock = socket(AF_INET, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0),
+                    0);
   if (sock < 0) {
     return MYCHAT_ENTER_SOCKET_CREATING_FAILED;
   }
 
   res = connect(sock, addr, socksize);
-  if (res < 0) {
+  if (res < 0 && !(nonblocking && errno == EINPROGRESS)) {
+    close(sock);
     return MYCHAT_ENTER_SOCKET_CONNECTING_FAILED;
   }
 
@@ -89,4 +102,121 @@ inline int mychat_send(int fd, const void *buffer, socklen_t size) {
 #endif
 };
 
-inline int mychat_close(int fd) { return close(fd); };
\ No newline at end of file
+inline int mychat_close(int fd) { return close(fd); };
+
+// Transports
+//
+// An address is either "unix:<path>" for an AF_UNIX stream socket or a TCP
+// host. mychat_listen and mychat_connect pick the backend from it, so callers
+// do not care which one they talk over.
+enum MychatTransport { MYCHAT_TCP, MYCHAT_UNIX };
+
+struct MychatAddress {
+  MychatTransport transport;
+  std::string host; // ip for MYCHAT_TCP, socket path for MYCHAT_UNIX
+  int port;
+};
+
+#define MYCHAT_UNIX_PREFIX "unix:"
+#define MYCHAT_ERR_INVALID_ADDRESS -3
+
+inline MychatAddress mychat_address(const std::string &host, int port) {
+  std::string prefix = MYCHAT_UNIX_PREFIX;
+  if (host.compare(0, prefix.size(), prefix) == 0) {
+    return MychatAddress{MYCHAT_UNIX, host.substr(prefix.size()), 0};
+  }
+  return MychatAddress{MYCHAT_TCP, host, port};
+}
+
+inline bool mychat_unix_addr(const std::string &path, sockaddr_un *addr) {
+  if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  std::memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  std::memcpy(addr->sun_path, path.c_str(), path.size());
+  return true;
+}
+
+inline int mychat_serve_unix(const std::string &path, int max_conn) {
+  struct sockaddr_un server_addr;
+  if (!mychat_unix_addr(path, &server_addr)) {
+    return MYCHAT_ERR_INVALID_ADDRESS;
+  }
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    return sock;
+  }
+
+  // A stale socket file from a previous run would make bind fail.
+  unlink(path.c_str());
+  if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    close(sock);
+    return MYCHAT_SERVE_ERR_SOCKET_BINDING_FAILED;
+  }
+
+  if (listen(sock, max_conn) < 0) {
+    close(sock);
+    return MYCHAT_SERVE_ERR_SOCKET_LISTENING_FAILED;
+  }
+
+  return sock;
+}
+
+// Unix sockets connect at once or not at all, even nonblocking ones.
+inline int mychat_enter_unix(const std::string &path,
+                             bool nonblocking = false) {
+  struct sockaddr_un server_addr;
+  if (!mychat_unix_addr(path, &server_addr)) {
+    return MYCHAT_ERR_INVALID_ADDRESS;
+  }
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0),
+                    0);
+  if (sock < 0) {
+    return MYCHAT_ENTER_SOCKET_CREATING_FAILED;
+  }
+
+  if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) <
+      0) {
+    close(sock);
+    return MYCHAT_ENTER_SOCKET_CONNECTING_FAILED;
+  }
+
+  return sock;
+}
+
+inline int mychat_listen(const MychatAddress &addr, int max_conn) {
+  switch (addr.transport) {
+  case MYCHAT_UNIX: {
+    return mychat_serve_unix(addr.host, max_conn);
+  }
+  case MYCHAT_TCP: {
+    return mychat_serve(addr.port, max_conn);
+  }
+  }
+  return MYCHAT_ERR_INVALID_ADDRESS;
+}
+
+// See mychat_enter for nonblocking.
+inline int mychat_connect(const MychatAddress &addr, bool nonblocking = false) {
+  switch (addr.transport) {
+  case MYCHAT_UNIX: {
+    return mychat_enter_unix(addr.host, nonblocking);
+  }
+  case MYCHAT_TCP: {
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(addr.port);
+    if (inet_pton(AF_INET, addr.host.c_str(), &server_addr.sin_addr) <= 0) {
+      return MYCHAT_ERR_INVALID_ADDRESS;
+    }
+    return mychat_enter((struct sockaddr *)&server_addr, sizeof(server_addr),
+                        nonblocking);
+  }
+  }
+  return MYCHAT_ERR_INVALID_ADDRESS;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __PROTOCOL_FRAME_H__
+#define __PROTOCOL_FRAME_H__
+
+#include "src/protocol/packet.hpp"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+// Frames announcing a bigger payload are treated as a broken stream.
+#define FRAME_MAX_SIZE (1 << 24)
+
+// Splits a byte stream into frames of sizeof(Header) + Header.size bytes.
+class FrameReader {
+  Data buffer;
+  size_t pos;
+
+  void compact() {
+    if (this->pos > 0) {
+      this->buffer.erase(this->buffer.begin(),
+                         this->buffer.begin() + this->pos);
+      this->pos = 0;
+    }
+  }
+
+public:
+  FrameReader() : pos(0){};
+
+  void append(const uint8_t *data, size_t size) {
+    if (this->pos > 0 && this->pos == this->buffer.size()) {
+      this->buffer.clear();
+      this->pos = 0;
+    }
+    this->buffer.insert(this->buffer.end(), data, data + size);
+  }
+
+  // Next complete frame, header included. Throws INVALID_SIZE when the
+  // stream can not be framed any more.
+  std::optional<Data> next() {
+    if (this->buffer.size() - this->pos < sizeof(Header)) {
+      compact();
+      return std::nullopt;
+    }
+
+    Header header;
+    std::memcpy(&header, this->buffer.data() + this->pos, sizeof(Header));
+    if (header.size < 0 || header.size > FRAME_MAX_SIZE) {
+      throw HandleReturn::INVALID_SIZE;
+    }
+
+    size_t frame_size = sizeof(Header) + header.size;
+    if (this->buffer.size() - this->pos < frame_size) {
+      compact();
+      return std::nullopt;
+    }
+
+    Data frame(this->buffer.begin() + this->pos,
+               this->buffer.begin() + this->pos + frame_size);
+    this->pos += frame_size;
+    return frame;
+  }
+
+  size_t buffered() { return this->buffer.size() - this->pos; }
+
+  size_t capacity() { return this->buffer.capacity(); }
+
+  // Give back memory not needed for what is buffered.
+  void shrink() {
+    compact();
+    this->buffer.shrink_to_fit();
+  }
+
+  // Whether next() would return a frame, or throw, without more input.
+  bool ready() {
+    if (buffered() < sizeof(Header)) {
+      return false;
+    }
+    Header header;
+    std::memcpy(&header, this->buffer.data() + this->pos, sizeof(Header));
+    if (header.size < 0 || header.size > FRAME_MAX_SIZE) {
+      return true;
+    }
+    return buffered() >= sizeof(Header) + header.size;
+  }
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __PROTOCOL_NAMES_H__
+#define __PROTOCOL_NAMES_H__
+
+#include "src/protocol/packet.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Names behind the sender ids of RECV_MESSAGE, learned from the roster
+// frames of one connection. A server never reuses an id, so names stay
+// after their user leaves and are only ever overwritten by a newer join.
+class SenderNames {
+  std::unordered_map<uint32_t, std::string> names;
+
+public:
+  void learn(const RosterSnapshot &snapshot) {
+    for (auto &member : snapshot.members) {
+      this->names[member.id] = member.name;
+    }
+  }
+
+  void learn(const RosterDelta &delta) {
+    if (delta.op == ROSTER_JOIN) {
+      this->names[delta.id] = delta.name;
+    }
+  }
+
+  // Fill in the sender name of msg. False when its id was never announced.
+  bool resolve(RecvMessage &msg) {
+    if (msg.sender_id == 0) {
+      return true;
+    }
+    auto iter = this->names.find(msg.sender_id);
+    if (iter == this->names.end()) {
+      return false;
+    }
+    msg.sender_name = iter->second;
+    return true;
+  }
+
+  size_t size() { return this->names.size(); }
+};
+
+#endif
@@ -1,14 +1,44 @@
 #ifndef __PROTOCOL_PACKET_H__
 #define __PROTOCOL_PACKET_H__
 
+#include "src/protocol/pool.hpp"
+#include "src/protocol/schema.hpp"
+#include <cstdint>
 #include <string>
 #include <sys/types.h>
+#include <utility>
 #include <variant>
 #include <vector>
 
-enum MessageType { ENTER, MESSAGE, RECV_MESSAGE, RECV_NOTICE };
+enum MessageType {
+  ENTER,
+  MESSAGE,
+  RECV_MESSAGE,
+  RECV_NOTICE,
+  ROSTER_SNAPSHOT,
+  ROSTER_DELTA,
+  ROSTER_SYNC,
+  PEER_HELLO,
+  PEER_EVENT,
+  FLOW_CREDIT,
+  RESUME,
+  SESSION,
+  SEARCH,
+  SEARCH_RESULT,
+  ATTACH_OFFER,
+  ATTACH_ACK,
+  ATTACH_CHUNK,
+  RECV_ATTACHMENT,
+  ATTACH_FETCH,
+  ATTACH_DATA,
+};
+
+// Frame bytes. Pooled since one or more are made for every message.
+using Data = std::vector<uint8_t, PoolAllocator<uint8_t>>;
 
-using Data = std::vector<uint8_t>;
+// Message text, pooled for the same reason. Short texts stay inline.
+using Text =
+    std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
 
 class Header {
 public:
@@ -20,37 +50,238 @@ public:
   Header(MessageType type, int size) : version(1), type(type), size(size){};
 };
 
+// Every packet names its MessageType and lays out its payload with a schema,
+// see schema.hpp.
+
 // send by client
 struct SendEnter {
   std::string name;
+
+  static constexpr MessageType type = ENTER;
+  using schema = Fields<Rest<&SendEnter::name>>;
 };
 
 struct SendMessage {
+  Text content;
+
+  static constexpr MessageType type = MESSAGE;
+  using schema = Fields<Rest<&SendMessage::content>>;
+};
+
+// Ask for roster changes after version. Answered with deltas when the
+// server still has them, otherwise with a snapshot.
+struct SendRosterSync {
+  uint64_t version;
+
+  static constexpr MessageType type = ROSTER_SYNC;
+  using schema = Fields<Fixed<&SendRosterSync::version>>;
+};
+
+// Sessions
+//
+// ENTER is answered with a SESSION carrying a token. After a reconnect the
+// client sends RESUME with that token and the seq of the last message it
+// got instead of ENTER, and the server replays what it missed without
+// announcing a leave and a join. A SESSION with token 0 rejects the resume;
+// the client has to ENTER again.
+struct SendResume {
+  uint64_t token;
+  uint64_t last_seq;
+
+  static constexpr MessageType type = RESUME;
+  using schema =
+      Fields<Fixed<&SendResume::token>, Fixed<&SendResume::last_seq>>;
+};
+
+// Server to server link
+//
+// Nodes link on the peer port, never on the one clients use. The dialing
+// node introduces itself with PEER_HELLO, the other answers with its own,
+// and everything after that is PEER_EVENT. A hello carries the secret the
+// nodes share and the other nodes whose events its sender relays. A link
+// only carries events of nodes it introduced, and says hello again when
+// more nodes become reachable through it.
+struct PeerNode {
+  uint32_t id;
+};
+
+struct PeerHello {
+  uint32_t node_id;
+  std::string secret;
+  std::vector<PeerNode> relays;
+  uint64_t epoch = 0; // of the node's current run, see PeerEvent
+
+  static constexpr MessageType type = PEER_HELLO;
+  using schema = Fields<Fixed<&PeerHello::node_id>, Str<&PeerHello::secret>,
+                        List<&PeerHello::relays, Fixed<&PeerNode::id>>,
+                        Fixed<&PeerHello::epoch>>;
+};
+
+enum PeerEventKind : uint8_t { PEER_MESSAGE, PEER_JOIN, PEER_LEAVE };
+
+// (origin, epoch, seq) identifies an event across the cluster, so a node can
+// drop events that reach it twice over different links. seq starts over
+// when a node restarts, under a newer epoch.
+class PeerEvent {
+public:
+  uint32_t origin;
+  uint64_t epoch;
+  uint64_t seq;
+  PeerEventKind kind;
+  std::string name;
   std::string content;
+
+  PeerEvent() : origin(0), epoch(0), seq(0), kind(PEER_MESSAGE){};
+  PeerEvent(uint32_t origin, uint64_t epoch, uint64_t seq, PeerEventKind kind,
+            std::string name, std::string content)
+      : origin(origin), epoch(epoch), seq(seq), kind(kind), name(name),
+        content(content){};
+
+  static constexpr MessageType type = PEER_EVENT;
+  using schema =
+      Fields<Fixed<&PeerEvent::origin>, Fixed<&PeerEvent::epoch>,
+             Fixed<&PeerEvent::seq>, Enum<&PeerEvent::kind, PEER_LEAVE>,
+             Str<&PeerEvent::name>, Rest<&PeerEvent::content>>;
+};
+
+// Search
+//
+// SEARCH asks for the newest messages containing every word of query, at most
+// limit of them. The SEARCH_RESULT answering it carries the same id.
+class SendSearch {
+public:
+  uint32_t id;
+  uint32_t limit;
+  std::string query;
+
+  SendSearch() : id(0), limit(0){};
+  SendSearch(uint32_t id, uint32_t limit, std::string query)
+      : id(id), limit(limit), query(std::move(query)){};
+
+  static constexpr MessageType type = SEARCH;
+  using schema = Fields<Fixed<&SendSearch::id>, Fixed<&SendSearch::limit>,
+                        Rest<&SendSearch::query>>;
+};
+
+// Attachments
+//
+// A client uploads a file with ATTACH_OFFER, answered by an ATTACH_ACK with
+// the id the file gets, 0 when it is refused. The file's bytes follow in
+// order in ATTACH_CHUNK frames. Once they are all in, everyone else gets a
+// RECV_ATTACHMENT and pulls the file with ATTACH_FETCH, each answered by one
+// ATTACH_DATA frame. An ATTACH_DATA without bytes means there is nothing at
+// that offset: the file ended or is gone.
+
+// upload is the client's own number for the transfer, length the size of
+// the file.
+class AttachOffer {
+public:
+  uint32_t upload;
+  uint64_t length;
+  std::string name;
+
+  AttachOffer() : upload(0), length(0){};
+  AttachOffer(uint32_t upload, uint64_t length, std::string name)
+      : upload(upload), length(length), name(std::move(name)){};
+
+  static constexpr MessageType type = ATTACH_OFFER;
+  using schema =
+      Fields<Fixed<&AttachOffer::upload>, Fixed<&AttachOffer::length>,
+             Rest<&AttachOffer::name>>;
+};
+
+struct AttachAck {
+  uint32_t upload;
+  uint64_t id;
+
+  static constexpr MessageType type = ATTACH_ACK;
+  using schema = Fields<Fixed<&AttachAck::upload>, Fixed<&AttachAck::id>>;
 };
 
-enum HandleReturn {
-  SHORTER_THAN_HEADER,
-  INVALID_VERSION,
-  INVALID_TYPE,
-  INVALID_SIZE,
+// Parsed without copying: bytes points into the frame it came from.
+struct AttachChunk {
+  uint32_t upload;
+  const uint8_t *bytes;
+  size_t length;
+
+  static constexpr MessageType type = ATTACH_CHUNK;
+  using schema =
+      Fields<Fixed<&AttachChunk::upload>,
+             View<&AttachChunk::bytes, &AttachChunk::length>>;
 };
 
-using SendPacket = std::variant<SendEnter, SendMessage>;
+struct AttachFetch {
+  uint64_t id;
+  uint64_t offset;
+  uint32_t length;
+
+  static constexpr MessageType type = ATTACH_FETCH;
+  using schema = Fields<Fixed<&AttachFetch::id>, Fixed<&AttachFetch::offset>,
+                        Fixed<&AttachFetch::length>>;
+};
+
+class RecvAttachment {
+public:
+  uint64_t id;
+  uint64_t length;
+  std::string sender;
+  std::string name;
+
+  RecvAttachment() : id(0), length(0){};
+  RecvAttachment(uint64_t id, uint64_t length, std::string sender,
+                 std::string name)
+      : id(id), length(length), sender(std::move(sender)),
+        name(std::move(name)){};
+
+  static constexpr MessageType type = RECV_ATTACHMENT;
+  using schema =
+      Fields<Fixed<&RecvAttachment::id>, Fixed<&RecvAttachment::length>,
+             Str<&RecvAttachment::sender>, Rest<&RecvAttachment::name>>;
+};
+
+struct AttachData {
+  uint64_t id;
+  uint64_t offset;
+  std::string bytes;
+
+  static constexpr MessageType type = ATTACH_DATA;
+  using schema = Fields<Fixed<&AttachData::id>, Fixed<&AttachData::offset>,
+                        Rest<&AttachData::bytes>>;
+};
+
+using SendPacket =
+    std::variant<SendEnter, SendMessage, SendRosterSync, SendResume,
+                 PeerHello, PeerEvent, SendSearch, AttachOffer, AttachChunk,
+                 AttachFetch>;
 
 // received by client
+//
+// seq numbers every message the server delivers, in delivery order.
+//
+// The sender goes by its roster id, so the name is not repeated in every
+// frame to every recipient. The receiver looks the id up in the roster
+// frames it got (see SenderNames). Senders without an id, 0, carry their
+// name instead, as do messages replayed to a resumed session, whose senders
+// may have left meanwhile.
 class RecvMessage {
 public:
-  int name_size;
+  uint64_t seq;
+  uint32_t sender_id;
   std::string sender_name;
-  std::string content;
+  Text content;
 
-  RecvMessage(){};
-  RecvMessage(std::string sender_name, std::string content)
-      : name_size(sender_name.size()), sender_name(sender_name),
-        content(content) {}
+  RecvMessage() : seq(0), sender_id(0){};
+  RecvMessage(std::string sender_name, Text content, uint64_t seq = 0,
+              uint32_t sender_id = 0)
+      : seq(seq), sender_id(sender_id), sender_name(std::move(sender_name)),
+        content(std::move(content)) {}
 
-  int size() { return sizeof(name_size) + sender_name.size() + content.size(); }
+  static constexpr MessageType type = RECV_MESSAGE;
+  using schema =
+      Fields<Fixed<&RecvMessage::seq>, Fixed<&RecvMessage::sender_id>,
+             When<&RecvMessage::sender_id, 0,
+                  Str<&RecvMessage::sender_name, uint32_t, 1>>,
+             Rest<&RecvMessage::content>>;
 };
 
 class RecvNotice {
@@ -60,6 +291,97 @@ public:
   RecvNotice(){};
   RecvNotice(std::string content) : content(content){};
 
-  int size() { return content.size(); };
+  static constexpr MessageType type = RECV_NOTICE;
+  using schema = Fields<Rest<&RecvNotice::content>>;
+};
+
+// Roster
+//
+// Every roster change bumps the version by one. A client applies deltas in
+// version order and asks for a sync when it sees a gap.
+struct RosterMember {
+  uint32_t id;
+  std::string name;
+};
+
+class RosterSnapshot {
+public:
+  uint64_t version;
+  std::vector<RosterMember> members;
+
+  RosterSnapshot() : version(0){};
+  RosterSnapshot(uint64_t version, std::vector<RosterMember> members)
+      : version(version), members(members){};
+
+  static constexpr MessageType type = ROSTER_SNAPSHOT;
+  using schema =
+      Fields<Fixed<&RosterSnapshot::version>,
+             List<&RosterSnapshot::members, Fixed<&RosterMember::id>,
+                  Str<&RosterMember::name>>>;
+};
+
+enum RosterOp : uint8_t { ROSTER_JOIN, ROSTER_LEAVE };
+
+// Only joins carry the name.
+class RosterDelta {
+public:
+  uint64_t version;
+  RosterOp op;
+  uint32_t id;
+  std::string name;
+
+  RosterDelta() : version(0), op(ROSTER_JOIN), id(0){};
+  RosterDelta(uint64_t version, RosterOp op, uint32_t id, std::string name)
+      : version(version), op(op), id(id), name(name){};
+
+  static constexpr MessageType type = ROSTER_DELTA;
+  using schema =
+      Fields<Fixed<&RosterDelta::version>, Enum<&RosterDelta::op, ROSTER_LEAVE>,
+             Fixed<&RosterDelta::id>,
+             When<&RosterDelta::op, ROSTER_JOIN, Rest<&RosterDelta::name>>>;
+};
+
+// Flow control
+//
+// Lets the client send credits more MESSAGE frames. A client that has seen a
+// grant holds messages back once its credits are used up instead of running
+// into the server rate limit.
+struct FlowCredit {
+  uint32_t credits;
+
+  static constexpr MessageType type = FLOW_CREDIT;
+  using schema = Fields<Fixed<&FlowCredit::credits>>;
+};
+
+// seq is the newest message at the time of the grant.
+struct SessionInfo {
+  uint64_t token;
+  uint64_t seq;
+
+  static constexpr MessageType type = SESSION;
+  using schema = Fields<Fixed<&SessionInfo::token>, Fixed<&SessionInfo::seq>>;
+};
+
+struct SearchHit {
+  uint64_t seq;
+  std::string sender;
+  std::string content;
+};
+
+// Hits are newest first.
+class SearchResult {
+public:
+  uint32_t id;
+  std::vector<SearchHit> hits;
+
+  SearchResult() : id(0){};
+  SearchResult(uint32_t id, std::vector<SearchHit> hits)
+      : id(id), hits(std::move(hits)){};
+
+  static constexpr MessageType type = SEARCH_RESULT;
+  using schema =
+      Fields<Fixed<&SearchResult::id>,
+             List<&SearchResult::hits, Fixed<&SearchHit::seq>,
+                  Str<&SearchHit::sender>, Str<&SearchHit::content>>>;
 };
 #endif
\ No newline at end of file
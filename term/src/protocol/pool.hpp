@@ -0,0 +1,176 @@
+#ifndef __PROTOCOL_POOL_H__
+#define __PROTOCOL_POOL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+// Smallest pooled block. Requests are rounded up to a power of two from here.
+#define POOL_MIN_BLOCK 64
+// Size classes, 64 B to 128 KiB, so a 64 KiB message still fits with its
+// headers. Bigger requests go to operator new.
+#define POOL_CLASSES 12
+// Free blocks a thread keeps per size class, in bytes. Blocks freed beyond
+// that go back to operator delete.
+#define POOL_CLASS_BYTES (1 << 20)
+
+struct PoolStats {
+  uint64_t hits;   // served from a free list
+  uint64_t misses; // had to ask operator new
+  uint64_t cached; // bytes sitting in free lists
+};
+
+// Per-thread free lists of buffer blocks by size class.
+//
+// A block freed on a thread goes to that thread's list, whichever thread
+// allocated it, so allocating and freeing never takes a lock. The lists are
+// intrusive: a free block stores the pointer to the next one in its first
+// bytes.
+//
+// The state is trivially destructible so buffers freed during thread or
+// process teardown, after the lists were emptied, still find it and go
+// straight to operator delete.
+class BufferPool {
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  struct State {
+    FreeBlock *heads[POOL_CLASSES];
+    size_t counts[POOL_CLASSES];
+    PoolStats stats;
+    bool closed;
+  };
+
+  // Empties the calling thread's lists when it exits.
+  struct Reaper {
+    ~Reaper() {
+      State &cache = state();
+      cache.closed = true;
+      for (int cls = 0; cls < POOL_CLASSES; cls++) {
+        while (cache.heads[cls] != nullptr) {
+          FreeBlock *block = cache.heads[cls];
+          cache.heads[cls] = block->next;
+          ::operator delete(block);
+        }
+        cache.counts[cls] = 0;
+      }
+      cache.stats.cached = 0;
+    }
+  };
+
+  static State &state() {
+    static thread_local State cache{};
+    return cache;
+  }
+
+  static State &active() {
+    static thread_local Reaper reaper;
+    (void)reaper;
+    return state();
+  }
+
+public:
+  // Size class for size bytes, -1 when too big to pool.
+  static int classOf(size_t size) {
+    int cls = 0;
+    size_t block = POOL_MIN_BLOCK;
+    while (block < size) {
+      block <<= 1;
+      cls++;
+    }
+    return cls < POOL_CLASSES ? cls : -1;
+  }
+
+  static size_t blockSize(int cls) { return (size_t)POOL_MIN_BLOCK << cls; }
+
+  static void *allocate(size_t size) {
+    int cls = classOf(size);
+    if (cls < 0) {
+      return ::operator new(size);
+    }
+    State &cache = active();
+    FreeBlock *block = cache.heads[cls];
+    if (block != nullptr) {
+      cache.heads[cls] = block->next;
+      cache.counts[cls]--;
+      cache.stats.hits++;
+      cache.stats.cached -= blockSize(cls);
+      return block;
+    }
+    cache.stats.misses++;
+    return ::operator new(blockSize(cls));
+  }
+
+  // size must be what ptr was allocated with.
+  static void deallocate(void *ptr, size_t size) {
+    int cls = classOf(size);
+    if (cls < 0) {
+      ::operator delete(ptr);
+      return;
+    }
+    if (state().closed) {
+      ::operator delete(ptr);
+      return;
+    }
+    State &cache = active();
+    if ((cache.counts[cls] + 1) * blockSize(cls) > POOL_CLASS_BYTES) {
+      ::operator delete(ptr);
+      return;
+    }
+    FreeBlock *block = static_cast<FreeBlock *>(ptr);
+    block->next = cache.heads[cls];
+    cache.heads[cls] = block;
+    cache.counts[cls]++;
+    cache.stats.cached += blockSize(cls);
+  }
+
+  // Fill the calling thread's lists up to bytes per size class, at most
+  // POOL_CLASS_BYTES, with blocks written to once so their pages are
+  // faulted in before the first message needs them. Returns the bytes added.
+  static size_t reserve(size_t bytes) {
+    State &cache = active();
+    size_t added = 0;
+    for (int cls = 0; cls < POOL_CLASSES; cls++) {
+      size_t limit = std::min<size_t>(bytes, POOL_CLASS_BYTES);
+      while ((cache.counts[cls] + 1) * blockSize(cls) <= limit) {
+        void *block = ::operator new(blockSize(cls));
+        std::memset(block, 0, blockSize(cls));
+        deallocate(block, blockSize(cls));
+        added += blockSize(cls);
+      }
+    }
+    return added;
+  }
+
+  // Counters of the calling thread.
+  static PoolStats stats() { return state().stats; }
+};
+
+// Standard allocator drawing from BufferPool, for containers on the message
+// path.
+template <typename T> struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(BufferPool::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    BufferPool::deallocate(ptr, n * sizeof(T));
+  }
+
+  template <typename U> bool operator==(const PoolAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U> &) const {
+    return false;
+  }
+};
+
+#endif
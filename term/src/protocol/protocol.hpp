@@ -4,157 +4,131 @@
 #include "src/logging/logging.hpp"
 #include "src/protocol/packet.hpp"
 #include <arpa/inet.h>
-#include <climits>
 #include <cstdint>
 #include <cstring>
 #include <string>
-#include <tuple>
+#include <string_view>
 #include <type_traits>
 #include <variant>
 #include <vector>
 
-using Packet = std::variant<SendEnter, SendMessage>;
-using RecvPacket = std::variant<RecvMessage, RecvNotice>;
+using Packet =
+    std::variant<SendEnter, SendMessage, SendRosterSync, SendResume,
+                 PeerHello, PeerEvent, SendSearch, AttachOffer, AttachChunk,
+                 AttachFetch>;
+using RecvPacket =
+    std::variant<RecvMessage, RecvNotice, RosterSnapshot, RosterDelta,
+                 FlowCredit, SessionInfo, SearchResult, AttachAck,
+                 RecvAttachment, AttachData>;
+
+// Fails to compile when two alternatives of a variant share a MessageType,
+// which would leave one of them unreachable.
+template <typename... P> constexpr bool distinctTypes(std::variant<P...> *) {
+  MessageType types[] = {P::type...};
+  for (size_t i = 0; i < sizeof...(P); i++) {
+    for (size_t j = i + 1; j < sizeof...(P); j++) {
+      if (types[i] == types[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+static_assert(distinctTypes((Packet *)nullptr));
+static_assert(distinctTypes((RecvPacket *)nullptr));
 
+// Builds and parses frames of the packets in packet.hpp from their schemas.
 class Handle {
-  Header parseHeader(Data &data, int &pos) {
+  Header parseHeader(Data &data) {
     Header header;
 
     LOG_DEBUG("Parsing header ...");
 
-    std::memcpy(&header, data.data() + pos, sizeof(header));
-    pos += sizeof(header);
+    std::memcpy(&header, data.data(), sizeof(header));
 
-    if (data.size() < sizeof(Header) + header.size) {
+    if (header.size < 0 || data.size() < sizeof(Header) + header.size) {
       throw HandleReturn::INVALID_SIZE;
     }
     LOG_DEBUG("Parsing header finished");
     return header;
   };
 
-  SendEnter parseSendEnter(Data &data, const Header &header, int &pos) {
-    SendEnter enter;
-    enter.name =
-        std::string(data.data() + pos, data.data() + pos + header.size);
-    pos += sizeof(header.size);
-    return enter;
-  }
-
-  SendMessage parseSendMessage(Data &data, const Header &header, int &pos) {
-    SendMessage msg;
-    msg.content =
-        std::string(data.data() + pos, data.data() + pos + header.size);
-    pos += sizeof(header.size);
-    return msg;
+  // The payload of data as a P. INVALID_SIZE unless it is used up exactly.
+  template <typename P> P parse(Data &data, const Header &header) {
+    P packet;
+    const uint8_t *payload = data.data() + sizeof(Header);
+    WireReader in{payload, payload + header.size};
+    P::schema::read(packet, in);
+    if (in.left() > 0) {
+      throw HandleReturn::INVALID_SIZE;
+    }
+    return packet;
   }
 
-  RecvMessage parseRecvMessage(Data &data, const Header &header, int &pos) {
-    RecvMessage msg;
-
-    std::memcpy(&msg.name_size, data.data() + pos, sizeof(msg.name_size));
-    pos += sizeof(msg.name_size);
-
-    if (msg.name_size <= 0) {
-      throw INVALID_SIZE;
+  // The alternative of Variant with the type of header.
+  template <typename Variant, size_t I = 0>
+  Variant parseAny(Data &data, const Header &header) {
+    if constexpr (I == std::variant_size_v<Variant>) {
+      throw HandleReturn::INVALID_TYPE;
+    } else {
+      using P = std::variant_alternative_t<I, Variant>;
+      if (header.type == P::type) {
+        return parse<P>(data, header);
+      }
+      return parseAny<Variant, I + 1>(data, header);
     }
-
-    msg.sender_name =
-        std::string(data.data() + pos, data.data() + pos + msg.name_size);
-    pos += msg.name_size;
-
-    msg.content = std::string(data.data() + pos,
-                              data.data() + sizeof(Header) + header.size);
-    pos = sizeof(Header) + header.size;
-    return msg;
-  };
-
-  RecvNotice parseRecvNotice(Data &data, const Header &header, int &pos) {
-    RecvNotice ntc;
-
-    ntc.content =
-        std::string(data.data() + pos, data.data() + pos + header.size);
-    pos += sizeof(header.size);
-    return ntc;
-  };
+  }
 
 public:
-  Packet feed(std::vector<uint8_t> &buffer) {
+  Packet feed(Data &buffer) {
     if (buffer.size() < sizeof(Header)) {
       throw HandleReturn::SHORTER_THAN_HEADER;
     }
-    int pos = 0;
 
     LOG_DEBUG("Start parsing");
-    Header header = parseHeader(buffer, pos);
-
-    switch (header.type) {
-    case ENTER: {
-      return parseSendEnter(buffer, header, pos);
-    };
-    case MESSAGE: {
-      return parseSendMessage(buffer, header, pos);
-    };
-    default: {
-      throw HandleReturn::INVALID_TYPE;
-    }
-    }
+    Header header = parseHeader(buffer);
+    return parseAny<Packet>(buffer, header);
   }
 
   RecvPacket parseRecv(Data &buffer) {
     if (buffer.size() < sizeof(Header)) {
       throw HandleReturn::SHORTER_THAN_HEADER;
     }
-    int pos = 0;
-
-    Header header = parseHeader(buffer, pos);
 
-    switch (header.type) {
-    case RECV_MESSAGE: {
-      return parseRecvMessage(buffer, header, pos);
-    }
-    case RECV_NOTICE: {
-      return parseRecvNotice(buffer, header, pos);
-    }
-    default: {
-      throw HandleReturn::INVALID_TYPE;
-    }
-    }
+    Header header = parseHeader(buffer);
+    return parseAny<RecvPacket>(buffer, header);
   }
 
-  Data buildRecvMessage(RecvMessage &msg) {
-    Data data;
-    int pos = 0;
-    Header header(RECV_MESSAGE, msg.size());
-    data.resize(sizeof(Header) + header.size);
-
-    std::memcpy(data.data() + pos, &header, sizeof(Header));
-    pos += sizeof(Header);
-
-    std::memcpy(data.data() + pos, &(msg.name_size), sizeof(msg.name_size));
-    pos += sizeof(msg.name_size);
-
-    std::memcpy(data.data() + pos, msg.sender_name.c_str(),
-                msg.sender_name.size());
-    pos += msg.sender_name.size();
-
-    std::memcpy(data.data() + pos, msg.content.c_str(), msg.content.size());
-    pos += msg.content.size();
+  // Frame of any packet: header, then its fields as its schema lays them
+  // out.
+  template <typename P> Data build(const P &packet) {
+    size_t size = payloadSize(packet);
+    Data data(sizeof(Header) + size);
+    Header header(P::type, size);
+    std::memcpy(data.data(), &header, sizeof(Header));
 
+    uint8_t *out = data.data() + sizeof(Header);
+    P::schema::write(packet, out);
     return data;
-  };
-
-  Data buildRecvNotice(RecvNotice &ntc) {
-    Data data;
-    int pos = 0;
-    Header header(RECV_NOTICE, ntc.size());
-    data.resize(sizeof(Header) + header.size);
-
-    std::memcpy(data.data() + pos, &header, sizeof(Header));
-    pos += sizeof(Header);
+  }
 
-    std::memcpy(data.data() + pos, ntc.content.c_str(), ntc.content.size());
-    pos += sizeof(ntc.content.size());
+  // Frame of type around payload as it is, like ENTER and MESSAGE, which
+  // are their text and nothing else. Builds frames no packet would, too.
+  static Data buildRaw(MessageType type, std::string_view payload) {
+    Data data(sizeof(Header) + payload.size());
+    Header header(type, payload.size());
+    std::memcpy(data.data(), &header, sizeof(Header));
+    std::memcpy(data.data() + sizeof(Header), payload.data(), payload.size());
+    return data;
+  }
 
+  // ATTACH_DATA up to its bytes, which the server sends straight from the
+  // file after it.
+  Data buildAttachDataHead(uint64_t id, uint64_t offset, uint32_t length) {
+    AttachData head{id, offset, ""};
+    Data data = build(head);
+    Header header(ATTACH_DATA, payloadSize(head) + length);
+    std::memcpy(data.data(), &header, sizeof(Header));
     return data;
   }
 };
@@ -0,0 +1,297 @@
+#ifndef __PROTOCOL_SCHEMA_H__
+#define __PROTOCOL_SCHEMA_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+enum HandleReturn {
+  SHORTER_THAN_HEADER,
+  INVALID_VERSION,
+  INVALID_TYPE,
+  INVALID_SIZE,
+};
+
+// Packet schemas
+//
+// A packet lays out its payload once, as the list of its fields in wire
+// order:
+//
+//   struct SendResume {
+//     uint64_t token;
+//     uint64_t last_seq;
+//
+//     static constexpr MessageType type = RESUME;
+//     using schema = Fields<Fixed<&SendResume::token>,
+//                           Fixed<&SendResume::last_seq>>;
+//   };
+//
+// Handle builds and parses every packet from that, and payloadSize gives
+// the exact payload size, a constant for packets of fixed fields only.
+// Fields are packed without padding in host byte order, as the header is.
+
+// Payload bytes a parser has not used yet.
+struct WireReader {
+  const uint8_t *pos;
+  const uint8_t *end;
+
+  size_t left() const { return this->end - this->pos; }
+
+  // The next size bytes. INVALID_SIZE when the payload is shorter.
+  const uint8_t *take(size_t size) {
+    if (size > left()) {
+      throw INVALID_SIZE;
+    }
+    const uint8_t *start = this->pos;
+    this->pos += size;
+    return start;
+  }
+};
+
+template <typename M> struct MemberPointer;
+
+template <typename C, typename V> struct MemberPointer<V C::*> {
+  using owner = C;
+  using type = V;
+};
+
+template <auto Member>
+using MemberOwner = typename MemberPointer<decltype(Member)>::owner;
+
+template <auto Member>
+using MemberType = typename MemberPointer<decltype(Member)>::type;
+
+// Every field has
+//
+//   min_size  bytes it takes at least
+//   fixed     whether it always takes min_size
+//   tail      whether it takes the rest of the payload, so has to come last
+//
+// and size, write and read for the packet holding it.
+
+// A trivially copyable member, copied as is.
+template <auto Member> struct Fixed {
+  using Owner = MemberOwner<Member>;
+  using Type = MemberType<Member>;
+  static_assert(std::is_trivially_copyable_v<Type>);
+
+  static constexpr size_t min_size = sizeof(Type);
+  static constexpr bool fixed = true;
+  static constexpr bool tail = false;
+
+  static size_t size(const Owner &) { return sizeof(Type); }
+
+  static void write(const Owner &packet, uint8_t *&out) {
+    std::memcpy(out, &(packet.*Member), sizeof(Type));
+    out += sizeof(Type);
+  }
+
+  static void read(Owner &packet, WireReader &in) {
+    std::memcpy(&(packet.*Member), in.take(sizeof(Type)), sizeof(Type));
+  }
+};
+
+// An enum member. INVALID_TYPE when it is past Last.
+template <auto Member, auto Last> struct Enum : Fixed<Member> {
+  using Owner = MemberOwner<Member>;
+
+  static void read(Owner &packet, WireReader &in) {
+    Fixed<Member>::read(packet, in);
+    if (packet.*Member > Last) {
+      throw INVALID_TYPE;
+    }
+  }
+};
+
+// A string after its length as a Prefix. INVALID_SIZE when the length is
+// below Min or past the payload.
+template <auto Member, typename Prefix = uint32_t, size_t Min = 0>
+struct Str {
+  using Owner = MemberOwner<Member>;
+
+  static constexpr size_t min_size = sizeof(Prefix) + Min;
+  static constexpr bool fixed = false;
+  static constexpr bool tail = false;
+
+  static size_t size(const Owner &packet) {
+    return sizeof(Prefix) + (packet.*Member).size();
+  }
+
+  static void write(const Owner &packet, uint8_t *&out) {
+    const auto &value = packet.*Member;
+    Prefix length = value.size();
+    std::memcpy(out, &length, sizeof(Prefix));
+    std::memcpy(out + sizeof(Prefix), value.data(), value.size());
+    out += sizeof(Prefix) + value.size();
+  }
+
+  static void read(Owner &packet, WireReader &in) {
+    Prefix length;
+    std::memcpy(&length, in.take(sizeof(Prefix)), sizeof(Prefix));
+    if constexpr (std::is_signed_v<Prefix>) {
+      if (length < 0) {
+        throw INVALID_SIZE;
+      }
+    }
+    if ((size_t)length < Min) {
+      throw INVALID_SIZE;
+    }
+    const uint8_t *bytes = in.take(length);
+    (packet.*Member).assign((const char *)bytes, length);
+  }
+};
+
+// A string taking the rest of the payload.
+template <auto Member> struct Rest {
+  using Owner = MemberOwner<Member>;
+
+  static constexpr size_t min_size = 0;
+  static constexpr bool fixed = false;
+  static constexpr bool tail = true;
+
+  static size_t size(const Owner &packet) { return (packet.*Member).size(); }
+
+  static void write(const Owner &packet, uint8_t *&out) {
+    const auto &value = packet.*Member;
+    std::memcpy(out, value.data(), value.size());
+    out += value.size();
+  }
+
+  static void read(Owner &packet, WireReader &in) {
+    (packet.*Member).assign((const char *)in.pos, in.left());
+    in.pos = in.end;
+  }
+};
+
+// The rest of the payload as Bytes and Length, pointing into the frame it
+// was parsed from instead of copying it.
+template <auto Bytes, auto Length> struct View {
+  using Owner = MemberOwner<Bytes>;
+
+  static constexpr size_t min_size = 0;
+  static constexpr bool fixed = false;
+  static constexpr bool tail = true;
+
+  static size_t size(const Owner &packet) { return packet.*Length; }
+
+  static void write(const Owner &packet, uint8_t *&out) {
+    std::memcpy(out, packet.*Bytes, packet.*Length);
+    out += packet.*Length;
+  }
+
+  static void read(Owner &packet, WireReader &in) {
+    packet.*Bytes = in.pos;
+    packet.*Length = in.left();
+    in.pos = in.end;
+  }
+};
+
+// Field, there only when the member read before it equals Value.
+template <auto Member, auto Value, typename Field> struct When {
+  using Owner = MemberOwner<Member>;
+
+  static constexpr size_t min_size = 0;
+  static constexpr bool fixed = false;
+  static constexpr bool tail = Field::tail;
+
+  static size_t size(const Owner &packet) {
+    return packet.*Member == Value ? Field::size(packet) : 0;
+  }
+
+  static void write(const Owner &packet, uint8_t *&out) {
+    if (packet.*Member == Value) {
+      Field::write(packet, out);
+    }
+  }
+
+  static void read(Owner &packet, WireReader &in) {
+    if (packet.*Member == Value) {
+      Field::read(packet, in);
+    }
+  }
+};
+
+// A sequence of fields, the whole payload of a packet or one element of a
+// List.
+template <typename... Field> struct Fields {
+  static_assert(sizeof...(Field) > 0);
+
+  using Last =
+      std::tuple_element_t<sizeof...(Field) - 1, std::tuple<Field...>>;
+  static_assert((Field::tail + ... + 0) == (Last::tail ? 1 : 0),
+                "only the last field can take the rest of the payload");
+
+  static constexpr size_t min_size = (Field::min_size + ... + 0);
+  static constexpr bool fixed = (Field::fixed && ...);
+  static constexpr bool tail = Last::tail;
+
+  template <typename P> static size_t size(const P &packet) {
+    return (Field::size(packet) + ... + 0);
+  }
+
+  template <typename P> static void write(const P &packet, uint8_t *&out) {
+    (Field::write(packet, out), ...);
+  }
+
+  template <typename P> static void read(P &packet, WireReader &in) {
+    (Field::read(packet, in), ...);
+  }
+};
+
+// A vector after its element count as a uint32_t, each element laid out as
+// Element.
+template <auto Member, typename... Element> struct List {
+  using Owner = MemberOwner<Member>;
+  using Layout = Fields<Element...>;
+  static_assert(!Layout::tail, "list elements need a length");
+
+  static constexpr size_t min_size = sizeof(uint32_t);
+  static constexpr bool fixed = false;
+  static constexpr bool tail = false;
+
+  static size_t size(const Owner &packet) {
+    size_t total = sizeof(uint32_t);
+    for (auto &element : packet.*Member) {
+      total += Layout::size(element);
+    }
+    return total;
+  }
+
+  static void write(const Owner &packet, uint8_t *&out) {
+    uint32_t count = (packet.*Member).size();
+    std::memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+    for (auto &element : packet.*Member) {
+      Layout::write(element, out);
+    }
+  }
+
+  static void read(Owner &packet, WireReader &in) {
+    uint32_t count;
+    std::memcpy(&count, in.take(sizeof(count)), sizeof(count));
+    // Checked before reserving, so a bogus count can not allocate much.
+    if (Layout::min_size > 0 && count > in.left() / Layout::min_size) {
+      throw INVALID_SIZE;
+    }
+    auto &elements = packet.*Member;
+    elements.clear();
+    elements.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+      Layout::read(elements.emplace_back(), in);
+    }
+  }
+};
+
+// Exact payload size of packet.
+template <typename P> size_t payloadSize(const P &packet) {
+  if constexpr (P::schema::fixed) {
+    return P::schema::min_size;
+  } else {
+    return P::schema::size(packet);
+  }
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef __SERVER_ATTACHMENT_H__
+#define __SERVER_ATTACHMENT_H__
+
+#include "src/protocol/packet.hpp"
+#include "src/server/send_queue.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+// Most bytes one ATTACH_DATA carries, however many were asked for. Chat
+// frames for the same client queue behind at most this much file.
+#define ATTACHMENT_CHUNK (256 << 10)
+
+struct Attachment {
+  uint64_t id;
+  uint64_t length;
+  uint64_t received;
+  std::string sender;
+  std::string name;
+  std::shared_ptr<OpenFile> file;
+  int owner; // uploading connection, -1 once complete
+  uint32_t upload;
+
+  bool complete() { return this->received == this->length; }
+};
+
+enum AppendResult { APPEND_MORE, APPEND_DONE, APPEND_INVALID };
+
+// Uploaded files, each in an unnamed temporary file that disappears when it
+// is closed. Uploads reserve their full length up front. When a new one does
+// not fit, the oldest complete files are dropped; a download still running
+// keeps its file open through the send queue until it is done.
+class AttachmentStore {
+  std::map<uint64_t, Attachment> files; // by id, so oldest first
+  std::map<std::pair<int, uint32_t>, uint64_t> uploads; // (fd, upload) -> id
+  uint64_t next_id;
+  uint64_t stored;
+  std::string dir;
+  uint64_t file_limit;
+  uint64_t store_limit;
+
+  int openTemporary() {
+    int fd = open(this->dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR)) {
+      return fd;
+    }
+    // File systems without O_TMPFILE.
+    std::string path = this->dir + "/mychat-attachment-XXXXXX";
+    fd = mkstemp(path.data());
+    if (fd >= 0) {
+      unlink(path.c_str());
+    }
+    return fd;
+  }
+
+  void erase(std::map<uint64_t, Attachment>::iterator iter) {
+    if (iter->second.owner >= 0) {
+      this->uploads.erase({iter->second.owner, iter->second.upload});
+    }
+    this->stored -= iter->second.length;
+    this->files.erase(iter);
+  }
+
+  // Drop complete files, oldest first, until length more bytes fit.
+  bool makeRoom(uint64_t length) {
+    auto iter = this->files.begin();
+    while (this->stored + length > this->store_limit &&
+           iter != this->files.end()) {
+      if (iter->second.complete()) {
+        erase(iter++);
+      } else {
+        ++iter;
+      }
+    }
+    return this->stored + length <= this->store_limit;
+  }
+
+public:
+  AttachmentStore()
+      : next_id(1), stored(0), dir("/tmp"), file_limit(0), store_limit(0){};
+
+  // Files over file_limit bytes are refused, 0 refuses all. Lowering the
+  // limits drops complete files until the rest fit.
+  void configure(const std::string &dir, uint64_t file_limit,
+                 uint64_t store_limit) {
+    this->dir = dir;
+    this->file_limit = file_limit;
+    this->store_limit = store_limit;
+    makeRoom(0);
+  }
+
+  // Open an upload from fd. Returns the id the file will have, 0 when it is
+  // refused.
+  uint64_t begin(int fd, const AttachOffer &offer, const std::string &sender) {
+    if (offer.length == 0 || offer.length > this->file_limit ||
+        this->uploads.count({fd, offer.upload}) > 0 ||
+        !makeRoom(offer.length)) {
+      return 0;
+    }
+    int file = openTemporary();
+    if (file < 0) {
+      return 0;
+    }
+    uint64_t id = this->next_id++;
+    this->files[id] = Attachment{id,
+                                 offer.length,
+                                 0,
+                                 sender,
+                                 offer.name,
+                                 std::make_shared<OpenFile>(file),
+                                 fd,
+                                 offer.upload};
+    this->uploads[{fd, offer.upload}] = id;
+    this->stored += offer.length;
+    return id;
+  }
+
+  // Write the next bytes of an upload from fd. The id of the file is set
+  // whatever the result. An unknown upload, a chunk past the announced
+  // length or a failed write is APPEND_INVALID and drops the upload.
+  AppendResult append(int fd, const AttachChunk &chunk, uint64_t &id) {
+    auto upload = this->uploads.find({fd, chunk.upload});
+    if (upload == this->uploads.end()) {
+      id = 0;
+      return APPEND_INVALID;
+    }
+    id = upload->second;
+    auto iter = this->files.find(id);
+    Attachment &file = iter->second;
+    if (chunk.length > file.length - file.received) {
+      erase(iter);
+      return APPEND_INVALID;
+    }
+    size_t written = 0;
+    while (written < chunk.length) {
+      ssize_t result = pwrite(file.file->fd(), chunk.bytes + written,
+                              chunk.length - written, file.received);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      if (result <= 0) {
+        erase(iter);
+        return APPEND_INVALID;
+      }
+      written += result;
+      file.received += result;
+    }
+    if (!file.complete()) {
+      return APPEND_MORE;
+    }
+    this->uploads.erase(upload);
+    file.owner = -1;
+    return APPEND_DONE;
+  }
+
+  // A complete file, nullptr when there is none with id.
+  Attachment *find(uint64_t id) {
+    auto iter = this->files.find(id);
+    if (iter == this->files.end() || !iter->second.complete()) {
+      return nullptr;
+    }
+    return &iter->second;
+  }
+
+  // Drop what fd was still uploading.
+  void abort(int fd) {
+    auto upload = this->uploads.lower_bound({fd, 0});
+    while (upload != this->uploads.end() && upload->first.first == fd) {
+      uint64_t id = upload->second;
+      ++upload;
+      erase(this->files.find(id));
+    }
+  }
+
+  size_t size() { return this->files.size(); }
+  uint64_t bytes() { return this->stored; }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __SERVER_CONFIG_H__
+#define __SERVER_CONFIG_H__
+
+#include "src/logging/logging.hpp"
+#include "src/server/rate_limit.hpp"
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Tuning knobs that can change while the server runs. Everything here is
+// re-read from the config file on SIGHUP and applied without touching open
+// connections.
+struct ServerConfig {
+  int log_level = INFO;
+
+  // Bytes queued for one client before it is dropped as a slow consumer.
+  size_t send_queue_limit = 1 << 20;
+
+  // Work done for one client per event loop turn before moving on to the
+  // next one. Whichever runs out first ends the turn.
+  size_t frame_budget = 32;
+  size_t byte_budget = 64 << 10;
+
+  // Messages kept for replay, and how long a dropped user stays entered
+  // waiting for a RESUME. A linger of 0 makes every drop a leave.
+  size_t history_size = 1024;
+  std::chrono::milliseconds session_linger = std::chrono::seconds(30);
+
+  // Bytes accounted in memoryAccount() before the server sheds load, 0 for
+  // no limit, and how often usage is logged, 0 for only on SIGUSR1.
+  size_t memory_limit = 0;
+  std::chrono::milliseconds metrics_interval = std::chrono::milliseconds(0);
+
+  // Trace one inbound frame in every trace_sample, 0 for no tracing. The
+  // trace is written to trace_file on SIGUSR2.
+  uint32_t trace_sample = 0;
+  std::string trace_file = "mychat-trace.json";
+
+  // Newest messages kept searchable. 0 stops indexing and forgets the index.
+  size_t search_limit = 1000000;
+
+  // Block list of "mask PATTERN" and "reject PATTERN" lines applied to
+  // every message, empty for none. Reloading re-reads the file.
+  std::string filter_file = "";
+
+  // Attachments are kept in attachment_dir, at most attachment_limit bytes
+  // each, 0 for no attachments, and attachment_store bytes in all.
+  std::string attachment_dir = "/tmp";
+  size_t attachment_limit = 16 << 20;
+  size_t attachment_store = 256 << 20;
+
+  // Threads that take CPU-heavy work such as trace export off the event
+  // loop. Only read at start.
+  size_t workers = 2;
+
+  // Trade CPU for latency: the event loop spins instead of sleeping, client
+  // sockets get TCP_NODELAY and SO_BUSY_POLL for busy_poll microseconds (0
+  // for none), and buffer pools are faulted in and locked in memory.
+  // cpus pins the event loop to the first one and the workers to the rest,
+  // in either mode. Only read at start.
+  bool low_latency = false;
+  int busy_poll = 0;
+  std::vector<int> cpus;
+
+  // Applies to every client, including the ones already connected.
+  RateLimit rate_limit;
+
+  // With a node id, other nodes link on peer_port, 0 for none, and have to
+  // know peer_secret. Only read at start.
+  int peer_port = 0;
+  std::string peer_secret = "";
+};
+
+#endif
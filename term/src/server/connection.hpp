@@ -0,0 +1,305 @@
+#ifndef __SERVER_CONNECTION_H__
+#define __SERVER_CONNECTION_H__
+
+#include "src/coro/task.hpp"
+#include "src/protocol/frame.hpp"
+#include "src/protocol/protocol.hpp"
+#include "src/server/memory.hpp"
+#include "src/server/rate_limit.hpp"
+#include "src/server/send_queue.hpp"
+#include "src/server/trace.hpp"
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+// What a connection asks of the server. Every handler gets the socket of the
+// connection that triggered it. entered, resume, search, the attachment and
+// the peer handlers are optional, and so is clock, which defaults to
+// RateClock::now. A connection takes no ENTER without entered.
+struct ConnectionHandlers {
+  // Numbers and delivers a message sent by the connection.
+  std::function<void(int, RecvMessage &)> message;
+  std::function<bool(std::string)> checkExists;
+  std::function<void(int)> disconnect;
+  std::function<void(int, std::string)> entered;
+  std::function<void(int, uint64_t)> sync;
+  std::function<void(int, SendResume &)> resume;
+  std::function<void(int, SendSearch &)> search;
+  std::function<void(int, AttachOffer &)> offer;
+  std::function<void(int, AttachChunk &)> chunk;
+  std::function<void(int, AttachFetch &)> fetch;
+  std::function<void(int, PeerHello &)> peerHello;
+  std::function<void(int, PeerEvent &)> peerEvent;
+  std::function<RateClock::time_point()> clock;
+};
+
+class Connection {
+  bool is_entered;
+  int sock;
+  ConnectionHandlers on;
+  Handle handle;
+
+  RateLimit limit;
+  TokenBucket message_bucket;
+  TokenBucket byte_bucket;
+  uint32_t credits;   // granted and not used yet
+  uint32_t throttled; // MESSAGE frames dropped in a row
+
+  MemoryGauge object_gauge;
+  MemoryGauge recv_gauge;
+
+  RateClock::time_point now() {
+    return this->on.clock ? this->on.clock() : RateClock::now();
+  }
+
+  // Whether a MESSAGE frame of bytes fits the rate limit. Cuts the
+  // connection off when it keeps sending over the limit.
+  bool admit(size_t bytes) {
+    if (this->credits > 0) {
+      this->credits--;
+    }
+    auto now = this->now();
+    if (this->message_bucket.available(now) >= 1 &&
+        this->byte_bucket.available(now) >= bytes) {
+      this->message_bucket.take(1, now);
+      this->byte_bucket.take(bytes, now);
+      this->throttled = 0;
+      return true;
+    }
+
+    this->throttled++;
+    LOG_DEBUG("Dropping message from " + this->name + " over rate limit");
+    if (this->throttled > RATE_LIMIT_MAX_THROTTLED) {
+      LOG_WARN("Client " + this->name + " keeps exceeding its rate limit.");
+      this->on.disconnect(sock);
+    }
+    return false;
+  }
+
+  // What serve() awaits for the next frame: suspends until feed() hands
+  // one over.
+  struct NextFrame {
+    Connection *conn;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      this->conn->waiting = handle;
+      this->conn->running = false;
+    }
+    Data &await_resume() { return *this->conn->incoming; }
+  };
+
+  Task<> serving;
+  std::coroutine_handle<> waiting; // serving, suspended for a frame
+  Data *incoming;
+  bool running; // serving is on the stack
+  bool *gone;   // in serving's frame, set when the connection goes away
+
+  NextFrame nextFrame() { return NextFrame{this}; }
+
+  Packet parse(Data &packet) {
+    uint64_t trace_id = tracer().current();
+    uint64_t parse_start = trace_id != 0 ? Tracer::now() : 0;
+    auto res = this->handle.feed(packet);
+    if (trace_id != 0) {
+      tracer().record(trace_id, TRACE_PARSE, this->sock, parse_start,
+                      Tracer::now() - parse_start);
+    }
+    return res;
+  }
+
+  // The whole life of the connection, one frame per resume. Any handler may
+  // disconnect, which destroys the Connection under the running coroutine,
+  // so after each one only the frame's own gone flag is looked at.
+  Task<> serve() {
+    bool gone = false;
+    this->gone = &gone;
+    try {
+      // A client enters or resumes its session, another node says hello.
+      // Frames before that are not allowed.
+      while (!this->is_entered && !this->is_peer) {
+        Data &packet = co_await nextFrame();
+        auto res = parse(packet);
+        if (std::holds_alternative<SendEnter>(res) && this->on.entered) {
+          auto new_name = std::get<SendEnter>(res).name;
+          if (this->on.checkExists(new_name)) {
+            this->on.disconnect(this->sock);
+            co_return;
+          }
+          this->is_entered = true;
+          this->name = new_name;
+          this->on.entered(this->sock, new_name);
+        } else if (std::holds_alternative<SendResume>(res) && this->on.resume) {
+          // Leaves the connection as it was when the session is unknown.
+          this->on.resume(this->sock, std::get<SendResume>(res));
+        } else if (std::holds_alternative<PeerHello>(res) &&
+                   this->on.peerHello) {
+          this->is_peer = true;
+          this->on.peerHello(this->sock, std::get<PeerHello>(res));
+        } else {
+          this->on.disconnect(this->sock);
+          co_return;
+        }
+        if (gone) {
+          co_return;
+        }
+      }
+
+      while (this->is_peer) {
+        Data &packet = co_await nextFrame();
+        auto res = parse(packet);
+        if (std::holds_alternative<PeerEvent>(res) && this->on.peerEvent) {
+          this->on.peerEvent(this->sock, std::get<PeerEvent>(res));
+        } else if (std::holds_alternative<PeerHello>(res) &&
+                   this->on.peerHello) {
+          this->on.peerHello(this->sock, std::get<PeerHello>(res));
+        } else {
+          this->on.disconnect(this->sock);
+          co_return;
+        }
+        if (gone) {
+          co_return;
+        }
+      }
+
+      while (true) {
+        Data &packet = co_await nextFrame();
+        auto res = parse(packet);
+        if (std::holds_alternative<SendMessage>(res)) {
+          if (admit(packet.size())) {
+            auto recv = RecvMessage(
+                this->name, std::move(std::get<SendMessage>(res).content), 0,
+                this->user_id);
+            this->on.message(this->sock, recv);
+          }
+        } else if (std::holds_alternative<SendRosterSync>(res)) {
+          this->on.sync(this->sock, std::get<SendRosterSync>(res).version);
+        } else if (std::holds_alternative<SendSearch>(res) &&
+                   this->on.search) {
+          this->on.search(this->sock, std::get<SendSearch>(res));
+        } else if (std::holds_alternative<AttachOffer>(res) &&
+                   this->on.offer) {
+          this->on.offer(this->sock, std::get<AttachOffer>(res));
+        } else if (std::holds_alternative<AttachChunk>(res) &&
+                   this->on.chunk) {
+          this->on.chunk(this->sock, std::get<AttachChunk>(res));
+        } else if (std::holds_alternative<AttachFetch>(res) &&
+                   this->on.fetch) {
+          this->on.fetch(this->sock, std::get<AttachFetch>(res));
+        } else {
+          // Entering twice, a peer hello from a client and the like.
+          this->on.disconnect(this->sock);
+          co_return;
+        }
+        if (gone) {
+          co_return;
+        }
+      }
+    } catch (HandleReturn e) {
+      if (!gone) {
+        this->on.disconnect(this->sock);
+      }
+    }
+  }
+
+public:
+  std::string name;
+  uint32_t user_id;
+  bool is_peer;
+  uint64_t session; // token, 0 without a session
+  bool readable;    // socket not drained since the last edge
+  bool eof;
+  uint64_t last_read_ns; // only kept up to date while tracing
+  FrameReader reader;
+  SendQueue send_queue;
+
+  Connection(int sock, ConnectionHandlers handlers, Handle &handle)
+      : is_entered(false), sock(sock), on(handlers), handle(handle),
+        credits(0), throttled(0),
+        object_gauge(MEMORY_CONNECTIONS, sizeof(Connection)),
+        recv_gauge(MEMORY_RECV_BUFFERS), waiting(nullptr), incoming(nullptr),
+        running(false), gone(nullptr), name(""), user_id(0), is_peer(false),
+        session(0), readable(false), eof(false), last_read_ns(0){};
+  Connection(const Connection &) = delete;
+  // Only before the first feed(); the coroutine holds on to this.
+  Connection(Connection &&) = default;
+
+  ~Connection() {
+    if (this->running && !this->serving.done()) {
+      // Dropped from inside a handler: the coroutine finishes on its own.
+      *this->gone = true;
+      this->serving.detach();
+    }
+  }
+
+  bool isEntered() { return this->is_entered; }
+
+  // Charge the receive buffer as it is now.
+  void accountMemory() { this->recv_gauge.set(this->reader.capacity()); }
+
+  // Take over a resumed session.
+  void resumeAs(const std::string &name, uint32_t user_id, uint64_t session) {
+    this->is_entered = true;
+    this->name = name;
+    this->user_id = user_id;
+    this->session = session;
+  }
+
+  // Forget the user so closing the connection does not count as leaving,
+  // e.g. when another connection resumed its session.
+  void release() {
+    this->is_entered = false;
+    this->session = 0;
+  }
+
+  void setRateLimit(const RateLimit &limit) {
+    this->limit = limit;
+    this->message_bucket.configure(limit.message_rate, limit.message_burst,
+                                   now());
+    this->byte_bucket.configure(limit.byte_rate, limit.byte_burst, now());
+  }
+
+  // FLOW_CREDIT frame topping the client's credits up to what the message
+  // bucket allows, once half of them are used. Nothing unless flow credits
+  // are enabled.
+  std::optional<Data> grantCredits() {
+    if (this->limit.flow_credits == 0 || !this->is_entered ||
+        this->credits > this->limit.flow_credits / 2) {
+      return std::nullopt;
+    }
+    uint32_t target = this->limit.flow_credits;
+    if (this->message_bucket.enabled()) {
+      target = std::min(target,
+                        (uint32_t)this->message_bucket.available(now()));
+    }
+    if (target <= this->credits) {
+      return std::nullopt;
+    }
+    FlowCredit grant{target - this->credits};
+    this->credits = target;
+    return this->handle.build(grant);
+  }
+
+  // Hand packet to the connection's coroutine, which runs until it wants
+  // the next frame. The connection may be gone when this returns.
+  void feed(Data &packet) {
+    if (!this->serving) {
+      this->serving = serve();
+      this->running = true;
+      this->serving.start();
+    }
+    if (this->waiting == nullptr) {
+      return; // finished after a disconnect the handler did not carry out
+    }
+    this->incoming = &packet;
+    this->running = true;
+    std::exchange(this->waiting, nullptr).resume();
+  }
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "src/cli/parser.h"
+#include "src/logging/logging.hpp"
+#include "src/mychat/mychat.hpp"
+#include "src/protocol/frame.hpp"
+#include "src/protocol/names.hpp"
+#include "src/protocol/protocol.hpp"
+#include "src/server/federation.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <sys/epoll.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+#define FANOUT_SENDER "fanout-sender"
+
+// Measures fan-out across a cluster.
+//
+// One sender on the first node publishes timestamped messages while receivers
+// are spread round-robin over all nodes. Every receiver records the delay
+// between send and delivery, so the first node shows the local path and the
+// others show the cost of crossing a peer link. Aggregate throughput counts
+// deliveries over all receivers.
+class Fanout {
+  struct Receiver {
+    size_t node;
+    FrameReader reader;
+    SenderNames names;
+  };
+
+  std::vector<MychatAddress> nodes;
+  int epoll_fd;
+  int sender;
+  std::unordered_map<int, Receiver> receivers;
+  std::vector<std::vector<uint64_t>> latencies; // ns, per node
+  uint64_t delivered;
+  Handle handle;
+
+  static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
+  bool sendAll(int sock, const Data &packet) {
+    size_t pos = 0;
+    while (pos < packet.size()) {
+      int sent =
+          mychat_send(sock, packet.data() + pos, packet.size() - pos);
+      if (sent < 0) {
+        return false;
+      }
+      pos += sent;
+    }
+    return true;
+  }
+
+  int connectTo(size_t node, const std::string &name) {
+    int sock = mychat_connect(this->nodes[node]);
+    if (sock < 0) {
+      return -1;
+    }
+    if (!sendAll(sock, this->handle.buildRaw(ENTER, name))) {
+      mychat_close(sock);
+      return -1;
+    }
+    return sock;
+  }
+
+  void receive(int fd, Receiver &receiver) {
+    uint8_t buffer[4096];
+    int n;
+    while ((n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+      receiver.reader.append(buffer, n);
+    }
+    while (auto frame = receiver.reader.next()) {
+      auto recv = this->handle.parseRecv(frame.value());
+      if (auto *snapshot = std::get_if<RosterSnapshot>(&recv)) {
+        receiver.names.learn(*snapshot);
+      } else if (auto *delta = std::get_if<RosterDelta>(&recv)) {
+        receiver.names.learn(*delta);
+      }
+      if (!std::holds_alternative<RecvMessage>(recv)) {
+        continue;
+      }
+      auto &msg = std::get<RecvMessage>(recv);
+      if (!receiver.names.resolve(msg) || msg.sender_name != FANOUT_SENDER) {
+        continue;
+      }
+      uint64_t sent_at = std::stoull(std::string(msg.content));
+      this->latencies[receiver.node].push_back(nowNs() - sent_at);
+      this->delivered++;
+    }
+  }
+
+  void drain(int timeout) {
+    epoll_event events[64];
+    int event_count = epoll_wait(this->epoll_fd, events, 64, timeout);
+    for (int i = 0; i < event_count; i++) {
+      int fd = events[i].data.fd;
+      auto iter = this->receivers.find(fd);
+      if (iter != this->receivers.end()) {
+        receive(fd, iter->second);
+      }
+    }
+  }
+
+  static uint64_t percentile(std::vector<uint64_t> &values, double p) {
+    if (values.empty()) {
+      return 0;
+    }
+    size_t index = std::min(values.size() - 1, (size_t)(values.size() * p));
+    return values[index];
+  }
+
+public:
+  Fanout(std::vector<MychatAddress> nodes)
+      : nodes(nodes), sender(-1), latencies(nodes.size()), delivered(0) {
+    this->epoll_fd = epoll_create1(0);
+  };
+
+  ~Fanout() {
+    for (auto iter = this->receivers.begin(); iter != this->receivers.end();
+         ++iter) {
+      mychat_close(iter->first);
+    }
+    if (this->sender >= 0) {
+      mychat_close(this->sender);
+    }
+    ::close(this->epoll_fd);
+  }
+
+  bool setup(int receiver_count) {
+    for (int i = 0; i < receiver_count; i++) {
+      size_t node = i % this->nodes.size();
+      int sock = connectTo(node, "fanout-" + std::to_string(i));
+      if (sock < 0) {
+        LOG_ERROR("Receiver " + std::to_string(i) + " failed to connect.");
+        return false;
+      }
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.fd = sock;
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, sock, &event);
+      this->receivers[sock] = Receiver{node, FrameReader(), SenderNames()};
+    }
+    this->sender = connectTo(0, FANOUT_SENDER);
+    if (this->sender < 0) {
+      LOG_ERROR("Sender failed to connect.");
+      return false;
+    }
+
+    // Let joins settle across the cluster before measuring.
+    auto until = Clock::now() + std::chrono::milliseconds(500);
+    while (Clock::now() < until) {
+      drain(10);
+    }
+    return true;
+  }
+
+  void run(int count, int size, int rate) {
+    auto start = Clock::now();
+    auto interval = rate > 0 ? std::chrono::nanoseconds(1000000000 / rate)
+                             : std::chrono::nanoseconds(0);
+    uint64_t expected = (uint64_t)count * this->receivers.size();
+
+    for (int i = 0; i < count; i++) {
+      std::string content = std::to_string(nowNs());
+      content.resize(std::max((size_t)size, content.size() + 1), ' ');
+      if (!sendAll(this->sender, this->handle.buildRaw(MESSAGE, content))) {
+        LOG_ERROR("Sender disconnected.");
+        break;
+      }
+      if (rate > 0) {
+        auto target = start + interval * (i + 1);
+        while (Clock::now() < target) {
+          drain(0);
+        }
+      } else {
+        drain(0);
+      }
+    }
+
+    auto until = Clock::now() + std::chrono::seconds(5);
+    while (this->delivered < expected && Clock::now() < until) {
+      drain(10);
+    }
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (size_t node = 0; node < this->nodes.size(); node++) {
+      auto &values = this->latencies[node];
+      std::sort(values.begin(), values.end());
+      std::printf("node %zu (%s): %zu deliveries, p50 %.1f us, p99 %.1f us, "
+                  "max %.1f us\n",
+                  node, node == 0 ? "local" : "remote", values.size(),
+                  percentile(values, 0.5) / 1000.0,
+                  percentile(values, 0.99) / 1000.0,
+                  percentile(values, 1.0) / 1000.0);
+    }
+    std::printf("delivered %lu/%lu in %.3f s, %.0f deliveries/s\n",
+                (unsigned long)this->delivered, (unsigned long)expected,
+                elapsed, this->delivered / elapsed);
+  }
+};
+
+int main(int argc, char **argv) {
+  auto p = Parser("fanout");
+  auto receiversopt = IntOption("receivers spread over the nodes",
+                                "receivers", 'r', "GROUP", 30);
+  p.addOption(&receiversopt);
+  auto countopt =
+      IntOption("messages to send", "count", 'c', "GROUP", 10000);
+  p.addOption(&countopt);
+  auto sizeopt = IntOption("message size in bytes", "size", 's', "GROUP", 64);
+  p.addOption(&sizeopt);
+  auto rateopt = IntOption("messages per second. 0 sends as fast as possible",
+                           "rate", std::nullopt, "GROUP", 0);
+  p.addOption(&rateopt);
+
+  auto nodesarg = Argument(
+      "nodes", "comma separated host:port of the cluster, sender on the first");
+  p.addArgument(&nodesarg);
+
+  p.run(argc, argv);
+  _LOG_LEVEL = INFO;
+
+  std::vector<MychatAddress> nodes;
+  try {
+    nodes = parsePeers(p.getArgumentValue("nodes"));
+  } catch (std::exception &e) {
+    LOG_CRITICAL(std::string("Invalid node address: ") + e.what());
+    return -1;
+  }
+  if (nodes.empty()) {
+    LOG_CRITICAL("No nodes given.");
+    return -1;
+  }
+
+  Fanout fanout(nodes);
+  if (!fanout.setup(p.get<int>("receivers"))) {
+    return -1;
+  }
+  fanout.run(p.get<int>("count"), p.get<int>("size"), p.get<int>("rate"));
+}
@@ -0,0 +1,247 @@
+#ifndef __SERVER_FEDERATION_H__
+#define __SERVER_FEDERATION_H__
+
+#include "src/mychat/mychat.hpp"
+#include "src/protocol/packet.hpp"
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+// Sequence numbers older than this behind the newest one seen from an origin
+// are treated as already delivered.
+#define FEDERATION_SEEN_WINDOW 4096
+
+// Cluster state of one node.
+//
+// Links are only made with nodes that know the shared secret. Each link
+// carries events of the nodes its hello introduced and no others, and a node
+// never takes its own events back from a link.
+//
+// Every event a node originates gets the next seq of that node. Events are
+// flooded to every peer link except the one they came in on, and each node
+// applies an event only the first time it sees it, so any connected topology
+// works without loops. A restarted node numbers its events from 1 again
+// under a newer epoch, which makes the others forget what they saw of it.
+//
+// Names are claimed with PEER_JOIN. When two nodes accept the same name at
+// the same time, both see the conflict and the user on the node with the
+// lower id keeps it.
+class Federation {
+  uint32_t node_id;
+  uint64_t epoch;
+  uint64_t next_seq;
+  std::string secret;
+
+  // Nodes each link introduced: the one at its other end and those it
+  // relays for.
+  std::unordered_map<int, std::set<uint32_t>> introduced;
+
+  struct Seen {
+    uint64_t epoch = 0;
+    uint64_t newest = 0;
+    std::set<uint64_t> recent;
+  };
+  std::unordered_map<uint32_t, Seen> seen;
+
+  // Start over on node's events when its epoch changed.
+  void restart(uint32_t node, uint64_t epoch) {
+    Seen &seen = this->seen[node];
+    if (seen.epoch != epoch) {
+      seen = Seen{epoch, 0, {}};
+    }
+  }
+
+  // Names held by users on other nodes, with the node holding them.
+  std::unordered_map<std::string, uint32_t> remote_names;
+
+public:
+  // Without a secret no link is ever admitted. epoch has to grow from one
+  // run of the node to the next; the wall clock does unless it is set back.
+  Federation(uint32_t node_id, std::string secret = "",
+             uint64_t epoch = federationEpoch())
+      : node_id(node_id), epoch(epoch), next_seq(1),
+        secret(std::move(secret)){};
+
+  // Nanoseconds since the Unix epoch.
+  static uint64_t federationEpoch() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  uint32_t nodeId() { return this->node_id; }
+
+  // Whether hello comes from another node that knows the secret. The
+  // secret is compared in constant time.
+  bool admits(const PeerHello &hello) {
+    if (this->secret.empty() || hello.node_id == this->node_id ||
+        hello.secret.size() != this->secret.size()) {
+      return false;
+    }
+    uint8_t diff = 0;
+    for (size_t i = 0; i < this->secret.size(); i++) {
+      diff |= hello.secret[i] ^ this->secret[i];
+    }
+    return diff == 0;
+  }
+
+  // Record the nodes an admitted hello introduced on link, replacing what
+  // it introduced before. True when some of them were not reachable over
+  // any link yet, so the other links need a new hello. The hello's epoch is
+  // taken as is, even an older one after the node's clock was set back.
+  bool introduce(int link, const PeerHello &hello) {
+    restart(hello.node_id, hello.epoch);
+    std::set<uint32_t> nodes{hello.node_id};
+    for (auto &relay : hello.relays) {
+      if (relay.id != this->node_id) {
+        nodes.insert(relay.id);
+      }
+    }
+    bool grew = false;
+    for (uint32_t node : nodes) {
+      grew = grew || !reaches(node);
+    }
+    this->introduced[link] = std::move(nodes);
+    return grew;
+  }
+
+  bool reaches(uint32_t node) {
+    for (auto iter = this->introduced.begin();
+         iter != this->introduced.end(); ++iter) {
+      if (iter->second.count(node) > 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether link introduced origin, so may carry its events.
+  bool carries(int link, uint32_t origin) {
+    auto iter = this->introduced.find(link);
+    return iter != this->introduced.end() && iter->second.count(origin) > 0;
+  }
+
+  void unlink(int link) { this->introduced.erase(link); }
+
+  // Hello to send on link, relaying for the nodes of every other link.
+  PeerHello hello(int link) {
+    std::set<uint32_t> nodes;
+    for (auto iter = this->introduced.begin();
+         iter != this->introduced.end(); ++iter) {
+      if (iter->first != link) {
+        nodes.insert(iter->second.begin(), iter->second.end());
+      }
+    }
+    PeerHello hello{this->node_id, this->secret, {}, this->epoch};
+    for (uint32_t node : nodes) {
+      hello.relays.push_back(PeerNode{node});
+    }
+    return hello;
+  }
+
+  PeerEvent originate(PeerEventKind kind, const std::string &name,
+                      std::string_view content = "") {
+    return PeerEvent(this->node_id, this->epoch, this->next_seq++, kind, name,
+                     std::string(content));
+  }
+
+  // True the first time an event arrives. Own events and events of an
+  // earlier run of their origin always return false.
+  bool accept(const PeerEvent &event) {
+    if (event.origin == this->node_id) {
+      return false;
+    }
+    Seen &seen = this->seen[event.origin];
+    if (event.epoch < seen.epoch) {
+      return false;
+    }
+    if (event.epoch > seen.epoch) {
+      seen = Seen{event.epoch, 0, {}};
+    }
+    if (seen.newest > FEDERATION_SEEN_WINDOW &&
+        event.seq <= seen.newest - FEDERATION_SEEN_WINDOW) {
+      return false;
+    }
+    if (!seen.recent.insert(event.seq).second) {
+      return false;
+    }
+    if (event.seq > seen.newest) {
+      seen.newest = event.seq;
+      while (!seen.recent.empty() && seen.newest > FEDERATION_SEEN_WINDOW &&
+             *seen.recent.begin() <= seen.newest - FEDERATION_SEEN_WINDOW) {
+        seen.recent.erase(seen.recent.begin());
+      }
+    }
+    return true;
+  }
+
+  bool hasRemoteName(const std::string &name) {
+    return this->remote_names.count(name) > 0;
+  }
+
+  void addRemoteName(const std::string &name, uint32_t node) {
+    this->remote_names[name] = node;
+  }
+
+  // Returns false when the name was not held by node.
+  bool removeRemoteName(const std::string &name, uint32_t node) {
+    auto iter = this->remote_names.find(name);
+    if (iter == this->remote_names.end() || iter->second != node) {
+      return false;
+    }
+    this->remote_names.erase(iter);
+    return true;
+  }
+
+  // Names held on node, e.g. to forget them when its link goes down.
+  std::vector<std::string> namesOf(uint32_t node) {
+    std::vector<std::string> names;
+    for (auto iter = this->remote_names.begin();
+         iter != this->remote_names.end(); ++iter) {
+      if (iter->second == node) {
+        names.push_back(iter->first);
+      }
+    }
+    return names;
+  }
+
+  // Whether a local user keeps name against a claim from node.
+  bool winsAgainst(uint32_t node) { return this->node_id < node; }
+};
+
+// Parses "host:port,unix:/path,..." into peer addresses.
+inline std::vector<MychatAddress> parsePeers(const std::string &peers) {
+  std::vector<MychatAddress> addrs;
+  size_t start = 0;
+  while (start < peers.size()) {
+    size_t end = peers.find(',', start);
+    if (end == std::string::npos) {
+      end = peers.size();
+    }
+    std::string peer = peers.substr(start, end - start);
+    start = end + 1;
+    if (peer.empty()) {
+      continue;
+    }
+
+    if (peer.compare(0, 5, MYCHAT_UNIX_PREFIX) == 0) {
+      addrs.push_back(mychat_address(peer, 0));
+      continue;
+    }
+    size_t colon = peer.rfind(':');
+    if (colon == std::string::npos) {
+      throw std::invalid_argument(peer);
+    }
+    addrs.push_back(mychat_address(peer.substr(0, colon),
+                                   std::stoi(peer.substr(colon + 1))));
+  }
+  return addrs;
+}
+
+#endif
@@ -0,0 +1,547 @@
+#ifndef __SERVER_FILTER_H__
+#define __SERVER_FILTER_H__
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Content filter
+//
+// Block lists of words and links checked against every MESSAGE. Patterns
+// match anywhere in the content, ignoring ASCII case. A match of a mask
+// pattern overwrites it with '*', a match of a reject pattern drops the
+// whole message.
+
+enum FilterAction : uint8_t { FILTER_PASS, FILTER_MASK, FILTER_REJECT };
+
+struct FilterRule {
+  std::string pattern;
+  FilterAction action;
+};
+
+class FilterError : public std::runtime_error {
+public:
+  FilterError(const std::string &what) : std::runtime_error(what){};
+};
+
+inline uint8_t foldCase(uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+// Pattern file: one "mask PATTERN" or "reject PATTERN" per line. The pattern
+// is the rest of the line with surrounding blanks removed. Blank lines and
+// lines starting with '#' are skipped. Throws FilterError naming the first
+// bad line.
+inline std::vector<FilterRule> parseFilterRules(std::istream &in) {
+  std::vector<FilterRule> rules;
+  std::string line;
+  int number = 0;
+  while (std::getline(in, line)) {
+    number++;
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos || line[begin] == '#') {
+      continue;
+    }
+    size_t end = line.find_last_not_of(" \t\r") + 1;
+    size_t space = line.find_first_of(" \t", begin);
+    std::string action = line.substr(begin, space - begin);
+    size_t start = space == std::string::npos
+                       ? end
+                       : line.find_first_not_of(" \t", space);
+    if (start >= end || (action != "mask" && action != "reject")) {
+      throw FilterError("line " + std::to_string(number) +
+                        ": expected \"mask PATTERN\" or \"reject PATTERN\"");
+    }
+    rules.push_back(FilterRule{line.substr(start, end - start),
+                               action == "mask" ? FILTER_MASK
+                                                : FILTER_REJECT});
+  }
+  return rules;
+}
+
+// Aho-Corasick automaton over all patterns, run as a DFA near the root.
+//
+// Bytes are folded to lower case and mapped to classes first: every byte
+// used by some pattern gets a class of its own and all others share class
+// 0, so a state needs one transition per class rather than 256. Each
+// transition packs the target with its depth, whether it ends a pattern and
+// whether it left the trie path, i.e. came from a failure link.
+//
+// States are numbered breadth first. The first ones, as many as fit in
+// DENSE_BYTES, get a full row of transitions, so the scan is one load per
+// byte there. Deeper states, nearly all of them with thousands of patterns
+// and each reached only by a few texts, keep just their trie edges and a
+// failure link to follow when none fits. That keeps the automaton small
+// enough to stay in cache.
+//
+// Most text never comes near a pattern. A match can only start where the
+// first window bytes, up to 8, hash into the set of pattern prefixes, so
+// the scan skips ahead to the next such position whenever the automaton
+// holds no partial match that started at one: at the root, and after a
+// failure link whose new partial match starts at a position that is not a
+// candidate. The set is a bitmap in which every prefix sets two bits of one
+// word, so a position that starts no pattern rarely gets through even with
+// thousands of them, at the cost of a single load. With AVX2 the candidate
+// test runs on 8 positions at once, hashing their windows side by side and
+// gathering the bitmap words; without it a table of the first two bytes of
+// every pattern screens positions before hashing.
+class ContentFilter {
+  // Transition layout, from the low bit up.
+  static constexpr uint32_t OUTPUT_BIT = 1;  // target ends a pattern
+  static constexpr uint32_t RESTART_BIT = 2; // partial match moved on
+  static constexpr int DEPTH_SHIFT = 2;
+  static constexpr uint32_t DEPTH_MAX = 127; // and deeper
+  static constexpr int TARGET_SHIFT = 9;
+  static constexpr uint32_t REJECT_BIT = 1u << 31;
+  static constexpr size_t DENSE_BYTES = 128 << 10;
+
+  struct SparseState {
+    uint32_t first; // of its edges, which end at the next state's first
+    uint32_t fail;
+  };
+
+  std::array<uint8_t, 256> classes;
+  uint32_t width; // classes, i.e. transitions per dense state
+  uint32_t dense; // states with a row
+  std::vector<uint32_t> rows;
+  std::vector<SparseState> sparse; // from state dense on, and one past
+  std::vector<uint8_t> edge_classes;
+  std::vector<uint32_t> edges;
+  // Per state: longest mask pattern ending there, REJECT_BIT when a reject
+  // pattern does.
+  std::vector<uint32_t> outputs;
+
+  // Prefilter over the first window bytes of every pattern, folded into two
+  // words of up to 4. Off when some pattern is shorter than 2 bytes, since
+  // then nearly every position is a candidate anyway.
+  static constexpr int PREFIX_BITS = 18;
+  static constexpr size_t WINDOW_MAX = 8;
+  size_t window;
+  uint32_t low_mask;
+  uint32_t high_mask;
+  std::vector<uint32_t> prefixes; // bitmap, 1 << PREFIX_BITS bits
+  std::vector<uint8_t> pairs;     // 1 for the first two bytes of a pattern
+
+  size_t pattern_count;
+
+  static uint32_t prefixHash(uint32_t low, uint32_t high) {
+    return low * 0x9E3779B1u + high * 0x85EBCA77u;
+  }
+
+  // The bitmap word of a hash: its top bits.
+  static uint32_t prefixWord(uint32_t hash) {
+    return hash >> (32 - PREFIX_BITS + 5);
+  }
+
+  // Two bits of that word, picked by the next ten bits of the hash.
+  static uint32_t prefixBits(uint32_t hash) {
+    return 1u << (hash >> 9 & 31) | 1u << (hash >> 14 & 31);
+  }
+
+  // The window at text folded, its first 4 bytes into low and the rest
+  // into high.
+  void foldWindow(const uint8_t *text, uint32_t &low, uint32_t &high) {
+    low = 0;
+    high = 0;
+    for (size_t i = 0; i < this->window; i++) {
+      uint32_t &word = i < 4 ? low : high;
+      word |= (uint32_t)foldCase(text[i]) << (8 * (i % 4));
+    }
+  }
+
+  bool candidateAt(const uint8_t *text, size_t pos, size_t size) {
+    if (this->prefixes.empty()) {
+      return true;
+    }
+    if (pos + this->window > size) {
+      return false;
+    }
+    uint32_t low, high;
+    this->foldWindow(text + pos, low, high);
+    uint32_t hash = prefixHash(low, high);
+    uint32_t bits = prefixBits(hash);
+    return (this->prefixes[prefixWord(hash)] & bits) == bits;
+  }
+
+#if defined(__x86_64__)
+  static bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+  }
+
+  // Bit i set when the window at text + i may start a pattern, for i below
+  // 8. Loads 16 bytes.
+  __attribute__((target("avx2"), always_inline)) inline int
+  candidatesAvx2(const uint8_t *text) {
+    // Both lanes get the same 16 bytes. Lane 0 picks the windows at 0..3,
+    // lane 1 those at 4..7; high their bytes 4 further on.
+    const __m256i spread_low = _mm256_setr_epi8(
+        0, 1, 2, 3, 1, 2, 3, 4, 2, 3, 4, 5, 3, 4, 5, 6, //
+        4, 5, 6, 7, 5, 6, 7, 8, 6, 7, 8, 9, 7, 8, 9, 10);
+    const __m256i spread_high = _mm256_add_epi8(spread_low,
+                                                _mm256_set1_epi8(4));
+    const __m256i low_five = _mm256_set1_epi32(31);
+    const __m256i one = _mm256_set1_epi32(1);
+
+    __m128i bytes = _mm_loadu_si128((const __m128i *)text);
+    // Signed compares, so bytes from 0x80 up are never upper case.
+    __m128i upper =
+        _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), bytes));
+    __m256i folded = _mm256_broadcastsi128_si256(
+        _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    __m256i low = _mm256_and_si256(_mm256_shuffle_epi8(folded, spread_low),
+                                   _mm256_set1_epi32(this->low_mask));
+    __m256i high = _mm256_and_si256(_mm256_shuffle_epi8(folded, spread_high),
+                                    _mm256_set1_epi32(this->high_mask));
+    // prefixHash, prefixWord and prefixBits side by side.
+    __m256i hash = _mm256_add_epi32(
+        _mm256_mullo_epi32(low, _mm256_set1_epi32(0x9E3779B1u)),
+        _mm256_mullo_epi32(high, _mm256_set1_epi32(0x85EBCA77u)));
+    __m256i words = _mm256_i32gather_epi32(
+        (const int *)this->prefixes.data(),
+        _mm256_srli_epi32(hash, 32 - PREFIX_BITS + 5), sizeof(int));
+    __m256i bits = _mm256_or_si256(
+        _mm256_sllv_epi32(
+            one, _mm256_and_si256(_mm256_srli_epi32(hash, 9), low_five)),
+        _mm256_sllv_epi32(
+            one, _mm256_and_si256(_mm256_srli_epi32(hash, 14), low_five)));
+    __m256i found = _mm256_cmpeq_epi32(_mm256_and_si256(words, bits), bits);
+    return _mm256_movemask_ps(_mm256_castsi256_ps(found));
+  }
+
+  // nextCandidate, all of it.
+  __attribute__((target("avx2"))) size_t
+  nextCandidateAvx2(const uint8_t *text, size_t pos, size_t size) {
+    for (; pos + 16 <= size; pos += 8) {
+      int hits = this->candidatesAvx2(text + pos);
+      if (hits != 0) {
+        return pos + __builtin_ctz(hits);
+      }
+    }
+    if (pos + this->window > size) {
+      return size;
+    }
+    // The last windows from a copy padded so that 16 bytes load from each
+    // of them. Those running into the padding start no pattern.
+    uint8_t rest[24] = {};
+    std::memcpy(rest, text + pos, size - pos);
+    int hits =
+        this->candidatesAvx2(rest) | this->candidatesAvx2(rest + 8) << 8;
+    hits &= (1 << (size - pos - this->window + 1)) - 1;
+    return hits != 0 ? pos + __builtin_ctz(hits) : size;
+  }
+#endif
+
+  // First position from pos on where a pattern may start, size when none.
+  size_t nextCandidate(const uint8_t *text, size_t pos, size_t size) {
+    if (this->prefixes.empty()) {
+      return pos;
+    }
+#if defined(__x86_64__)
+    if (hasAvx2()) {
+      return this->nextCandidateAvx2(text, pos, size);
+    }
+#endif
+    // Without AVX2 positions go through the pair table eight at a time,
+    // straight on the raw bytes since the table has every case of a pair.
+    // Only positions passing it get the full window hashed.
+    const uint8_t *pairs = this->pairs.data();
+    while (pos + 9 <= size) {
+      uint32_t hits = 0;
+#pragma GCC unroll 8
+      for (int i = 0; i < 8; i++) {
+        uint16_t pair;
+        std::memcpy(&pair, text + pos + i, sizeof(pair));
+        hits |= (uint32_t)pairs[pair] << i;
+      }
+      while (hits != 0) {
+        size_t candidate = pos + __builtin_ctz(hits);
+        if (this->candidateAt(text, candidate, size)) {
+          return candidate;
+        }
+        hits &= hits - 1;
+      }
+      pos += 8;
+    }
+    for (; pos < size; pos++) {
+      if (this->candidateAt(text, pos, size)) {
+        return pos;
+      }
+    }
+    return size;
+  }
+
+  // Transition out of a state without a row: one of its edges, or else the
+  // failure links' transition, which leaves the trie path.
+  uint32_t sparseNext(uint32_t state, uint8_t c) {
+    while (state >= this->dense) {
+      const SparseState *node = &this->sparse[state - this->dense];
+      for (uint32_t i = node->first; i < node[1].first; i++) {
+        if (this->edge_classes[i] == c) {
+          return restarted(this->edges[i]);
+        }
+      }
+      state = node->fail;
+    }
+    return restarted(this->rows[state * this->width + c]);
+  }
+
+  static uint32_t restarted(uint32_t entry) {
+    return ((entry >> DEPTH_SHIFT) & DEPTH_MAX) < DEPTH_MAX
+               ? entry | RESTART_BIT
+               : entry;
+  }
+
+  // Past DEPTH_MAX the scan just keeps stepping.
+  uint32_t transition(uint32_t target, uint32_t depth, bool borrowed) {
+    uint32_t entry = target << TARGET_SHIFT |
+                     std::min(depth, DEPTH_MAX) << DEPTH_SHIFT;
+    if (this->outputs[target] != 0) {
+      entry |= OUTPUT_BIT;
+    }
+    return borrowed ? restarted(entry) : entry;
+  }
+
+  void build(const std::vector<FilterRule> &rules) {
+    this->classes.fill(0);
+    this->width = 1;
+    for (auto &rule : rules) {
+      for (unsigned char c : rule.pattern) {
+        uint8_t folded = foldCase(c);
+        if (this->classes[folded] == 0) {
+          this->classes[folded] = this->width++;
+        }
+      }
+    }
+    for (int c = 'A'; c <= 'Z'; c++) {
+      this->classes[c] = this->classes[c | 0x20];
+    }
+
+    // Trie in insertion order, with -1 for missing edges.
+    std::vector<int32_t> trie(this->width, -1);
+    std::vector<uint32_t> ends(1, 0);
+    size_t shortest = SIZE_MAX;
+    for (auto &rule : rules) {
+      if (rule.pattern.empty()) {
+        continue;
+      }
+      this->pattern_count++;
+      shortest = std::min(shortest, rule.pattern.size());
+      size_t state = 0;
+      for (unsigned char c : rule.pattern) {
+        size_t index = state * this->width + this->classes[c];
+        if (trie[index] < 0) {
+          if (ends.size() >= 1u << (32 - TARGET_SHIFT)) {
+            throw FilterError("patterns too large for one automaton");
+          }
+          trie[index] = ends.size();
+          ends.push_back(0);
+          trie.resize(trie.size() + this->width, -1);
+        }
+        state = trie[index];
+      }
+      if (rule.action == FILTER_REJECT) {
+        ends[state] |= REJECT_BIT;
+      } else {
+        uint32_t length = std::min<size_t>(rule.pattern.size(), ~REJECT_BIT);
+        ends[state] = (ends[state] & REJECT_BIT) |
+                      std::max(ends[state] & ~REJECT_BIT, length);
+      }
+    }
+
+    // Breadth first, so the fail target of a state, which is shallower, is
+    // done before it and its outputs can be inherited. order maps the new
+    // numbers to trie states.
+    size_t count = ends.size();
+    std::vector<uint32_t> order(1, 0);
+    std::vector<uint32_t> number(count, 0);
+    std::vector<uint32_t> depths(count, 0);
+    std::vector<uint32_t> fail(count, 0);
+    this->outputs.assign(count, 0);
+    for (size_t next = 0; next < order.size(); next++) {
+      uint32_t state = order[next];
+      this->outputs[next] = ends[state];
+      if (state != 0) {
+        uint32_t inherited = this->outputs[number[fail[state]]];
+        this->outputs[next] =
+            ((ends[state] | inherited) & REJECT_BIT) |
+            std::max(ends[state] & ~REJECT_BIT, inherited & ~REJECT_BIT);
+      }
+      for (uint32_t c = 0; c < this->width; c++) {
+        int32_t child = trie[state * this->width + c];
+        if (child < 0) {
+          continue;
+        }
+        number[child] = order.size();
+        order.push_back(child);
+        depths[child] = depths[state] + 1;
+        if (state != 0) {
+          int32_t target = -1;
+          for (uint32_t back = fail[state];; back = fail[back]) {
+            target = trie[back * this->width + c];
+            if (target >= 0 || back == 0) {
+              break;
+            }
+          }
+          fail[child] = std::max(target, 0);
+        }
+      }
+    }
+
+    this->dense = std::clamp<size_t>(
+        DENSE_BYTES / (this->width * sizeof(uint32_t)), 1, count);
+    this->rows.assign((size_t)this->dense * this->width, 0);
+    for (uint32_t next = 0; next < this->dense; next++) {
+      uint32_t state = order[next];
+      for (uint32_t c = 0; c < this->width; c++) {
+        int32_t child = trie[state * this->width + c];
+        uint32_t &entry = this->rows[next * this->width + c];
+        if (child >= 0) {
+          entry = transition(number[child], depths[child], false);
+        } else {
+          uint32_t target =
+              next == 0 ? 0
+                        : this->rows[number[fail[state]] * this->width + c] >>
+                              TARGET_SHIFT;
+          entry = transition(target, depths[order[target]], true);
+        }
+      }
+    }
+    for (uint32_t next = this->dense; next < count; next++) {
+      uint32_t state = order[next];
+      this->sparse.push_back(
+          SparseState{(uint32_t)this->edges.size(), number[fail[state]]});
+      for (uint32_t c = 0; c < this->width; c++) {
+        int32_t child = trie[state * this->width + c];
+        if (child >= 0) {
+          this->edge_classes.push_back(c);
+          this->edges.push_back(
+              transition(number[child], depths[child], false));
+        }
+      }
+    }
+    this->sparse.push_back(SparseState{(uint32_t)this->edges.size(), 0});
+
+    if (this->pattern_count > 0 && shortest >= 2) {
+      this->window = std::min(shortest, WINDOW_MAX);
+      size_t low_bytes = std::min<size_t>(this->window, 4);
+      // 64 bit shifts, so 4 bytes need no case of their own.
+      this->low_mask = (1ull << (8 * low_bytes)) - 1;
+      this->high_mask = (1ull << (8 * (this->window - low_bytes))) - 1;
+      this->prefixes.assign((1 << PREFIX_BITS) / 32, 0);
+      this->pairs.assign(1 << 16, 0);
+      for (auto &rule : rules) {
+        if (rule.pattern.empty()) {
+          continue;
+        }
+        uint32_t low, high;
+        this->foldWindow((const uint8_t *)rule.pattern.data(), low, high);
+        uint32_t hash = prefixHash(low, high);
+        this->prefixes[prefixWord(hash)] |= prefixBits(hash);
+        for (int upper = 0; upper < 4; upper++) {
+          uint8_t first = low, second = low >> 8;
+          first = upper & 1 && first >= 'a' && first <= 'z' ? first - 0x20
+                                                             : first;
+          second = upper & 2 && second >= 'a' && second <= 'z'
+                       ? second - 0x20
+                       : second;
+          this->pairs[first | second << 8] = 1;
+        }
+      }
+    }
+  }
+
+public:
+  // Empty patterns are ignored. Throws FilterError when the automaton would
+  // not fit its 23 bit state index, about a million patterns.
+  ContentFilter(const std::vector<FilterRule> &rules)
+      : width(1), dense(1), window(0), low_mask(0), high_mask(0),
+        pattern_count(0) {
+    this->build(rules);
+  };
+
+  // Throws FilterError when the file cannot be read or has a bad line.
+  static std::unique_ptr<ContentFilter> load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+      throw FilterError("cannot open " + path);
+    }
+    return std::make_unique<ContentFilter>(parseFilterRules(file));
+  }
+
+  // Masks matches of mask patterns in content. Returns FILTER_REJECT when a
+  // reject pattern matches, leaving content as it was, otherwise whether
+  // anything was masked. Any string type with data() and size() will do.
+  template <typename String> FilterAction apply(String &content) {
+    return apply(content.data(), content.size());
+  }
+
+  // The same for the size bytes at content.
+  FilterAction apply(char *content, size_t size) {
+    if (this->pattern_count == 0) {
+      return FILTER_PASS;
+    }
+    const uint8_t *text = (const uint8_t *)content;
+    // Masked after the scan, which may step back over bytes and must see
+    // them unmasked.
+    std::vector<std::pair<size_t, size_t>> masks;
+    uint32_t state = 0;
+    size_t pos = this->nextCandidate(text, 0, size);
+    while (pos < size) {
+      uint8_t c = this->classes[text[pos]];
+      uint32_t next = state < this->dense
+                          ? this->rows[state * this->width + c]
+                          : this->sparseNext(state, c);
+      state = next >> TARGET_SHIFT;
+      pos++;
+      if (next & OUTPUT_BIT) {
+        uint32_t output = this->outputs[state];
+        if (output & REJECT_BIT) {
+          return FILTER_REJECT;
+        }
+        masks.emplace_back(pos - output, pos);
+      }
+      if ((next & RESTART_BIT) == 0) {
+        continue;
+      }
+      // Any pattern still to match here starts at pos - depth or later.
+      size_t start = pos - ((next >> DEPTH_SHIFT) & DEPTH_MAX);
+      if (state != 0 && this->candidateAt(text, start, size)) {
+        continue;
+      }
+      state = 0;
+      pos = this->nextCandidate(text, start == pos ? pos : start + 1, size);
+    }
+
+    for (auto &mask : masks) {
+      std::memset(content + mask.first, '*', mask.second - mask.first);
+    }
+    return masks.empty() ? FILTER_PASS : FILTER_MASK;
+  }
+
+  size_t patterns() { return this->pattern_count; }
+
+  size_t states() { return this->outputs.size(); }
+
+  // Bytes of the compiled automaton.
+  size_t footprint() {
+    return sizeof(*this) + this->rows.size() * sizeof(uint32_t) +
+           this->sparse.size() * sizeof(SparseState) +
+           this->edges.size() * (sizeof(uint32_t) + sizeof(uint8_t)) +
+           this->outputs.size() * sizeof(uint32_t) +
+           this->prefixes.size() * sizeof(uint32_t) + this->pairs.size();
+  }
+};
+
+#endif
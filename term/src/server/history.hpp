@@ -0,0 +1,82 @@
+#ifndef __SERVER_HISTORY_H__
+#define __SERVER_HISTORY_H__
+
+#include "src/protocol/packet.hpp"
+#include "src/server/memory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct HistoryEntry {
+  uint64_t seq;
+  std::string sender;
+  Data frame;
+};
+
+// Recent RECV_MESSAGE frames by seq, replayed to resumed sessions.
+class MessageHistory {
+  std::deque<HistoryEntry, PoolAllocator<HistoryEntry>> entries;
+  size_t limit;
+  uint64_t last_seq;
+  MemoryGauge gauge;
+
+  static size_t footprint(const HistoryEntry &entry) {
+    return sizeof(HistoryEntry) + entry.sender.capacity() +
+           entry.frame.capacity();
+  }
+
+  void trim() {
+    while (this->entries.size() > this->limit) {
+      dropOldest();
+    }
+  }
+
+public:
+  MessageHistory(size_t limit = 1024)
+      : limit(limit), last_seq(0), gauge(MEMORY_HISTORY){};
+
+  uint64_t nextSeq() { return ++this->last_seq; }
+
+  uint64_t lastSeq() { return this->last_seq; }
+
+  void record(uint64_t seq, const std::string &sender, Data frame) {
+    this->entries.push_back(HistoryEntry{seq, sender, std::move(frame)});
+    this->gauge.add(footprint(this->entries.back()));
+    trim();
+  }
+
+  // Returns false when there was nothing to drop.
+  bool dropOldest() {
+    if (this->entries.empty()) {
+      return false;
+    }
+    this->gauge.add(-(int64_t)footprint(this->entries.front()));
+    this->entries.pop_front();
+    return true;
+  }
+
+  void setLimit(size_t limit) {
+    this->limit = limit;
+    trim();
+  }
+
+  size_t size() { return this->entries.size(); }
+
+  // Entries after seq still kept, oldest first. When the oldest of them is
+  // not seq + 1 the history did not reach back far enough.
+  std::vector<const HistoryEntry *> since(uint64_t seq) {
+    std::vector<const HistoryEntry *> found;
+    for (auto iter = this->entries.rbegin(); iter != this->entries.rend();
+         ++iter) {
+      if (iter->seq <= seq) {
+        break;
+      }
+      found.push_back(&*iter);
+    }
+    return std::vector<const HistoryEntry *>(found.rbegin(), found.rend());
+  }
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __SERVER_MEMORY_H__
+#define __SERVER_MEMORY_H__
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum MemorySubsystem {
+  MEMORY_RECV_BUFFERS,
+  MEMORY_SEND_QUEUES,
+  MEMORY_HISTORY,
+  MEMORY_CONNECTIONS,
+  MEMORY_SEARCH,
+  MEMORY_SUBSYSTEMS,
+};
+
+inline const char *memorySubsystemName(int subsystem) {
+  switch (subsystem) {
+  case MEMORY_RECV_BUFFERS:
+    return "recv_buffers";
+  case MEMORY_SEND_QUEUES:
+    return "send_queues";
+  case MEMORY_HISTORY:
+    return "history";
+  case MEMORY_CONNECTIONS:
+    return "connections";
+  case MEMORY_SEARCH:
+    return "search";
+  default:
+    return "unknown";
+  }
+}
+
+// Bytes held by each subsystem, process wide.
+class MemoryAccount {
+  std::array<std::atomic<int64_t>, MEMORY_SUBSYSTEMS> used;
+
+public:
+  MemoryAccount() {
+    for (auto &bytes : this->used) {
+      bytes = 0;
+    }
+  }
+
+  void add(MemorySubsystem subsystem, int64_t bytes) {
+    this->used[subsystem].fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  int64_t usage(MemorySubsystem subsystem) {
+    return this->used[subsystem].load(std::memory_order_relaxed);
+  }
+
+  int64_t total() {
+    int64_t sum = 0;
+    for (auto &bytes : this->used) {
+      sum += bytes.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  // "recv_buffers=1024 send_queues=0 ... total=1024"
+  std::string report() {
+    std::string line;
+    for (int i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+      line += std::string(memorySubsystemName(i)) + "=" +
+              std::to_string(usage((MemorySubsystem)i)) + " ";
+    }
+    return line + "total=" + std::to_string(total());
+  }
+};
+
+inline MemoryAccount &memoryAccount() {
+  static MemoryAccount account;
+  return account;
+}
+
+// Bytes one object charges to a subsystem. Copies charge again and
+// destruction gives the bytes back, so the account follows objects through
+// containers.
+class MemoryGauge {
+  MemorySubsystem subsystem;
+  size_t charged;
+
+public:
+  MemoryGauge(MemorySubsystem subsystem, size_t bytes = 0)
+      : subsystem(subsystem), charged(0) {
+    set(bytes);
+  }
+
+  MemoryGauge(const MemoryGauge &other)
+      : subsystem(other.subsystem), charged(0) {
+    set(other.charged);
+  }
+
+  MemoryGauge &operator=(const MemoryGauge &other) {
+    if (this != &other) {
+      set(0);
+      this->subsystem = other.subsystem;
+      set(other.charged);
+    }
+    return *this;
+  }
+
+  ~MemoryGauge() { set(0); }
+
+  void set(size_t bytes) {
+    memoryAccount().add(this->subsystem, (int64_t)bytes - this->charged);
+    this->charged = bytes;
+  }
+
+  void add(int64_t bytes) { set(this->charged + bytes); }
+
+  size_t bytes() { return this->charged; }
+};
+
+#endif
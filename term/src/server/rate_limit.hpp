@@ -0,0 +1,82 @@
+#ifndef __SERVER_RATE_LIMIT_H__
+#define __SERVER_RATE_LIMIT_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+// MESSAGE frames dropped in a row before a connection is cut off.
+#define RATE_LIMIT_MAX_THROTTLED 256
+
+using RateClock = std::chrono::steady_clock;
+
+// Per connection limits. A rate of 0 disables that bucket.
+struct RateLimit {
+  double message_rate = 0; // MESSAGE frames per second
+  double message_burst = 0;
+  double byte_rate = 0; // MESSAGE bytes per second
+  double byte_burst = 0;
+
+  // Credits handed out ahead of time with FLOW_CREDIT. 0 disables grants.
+  uint32_t flow_credits = 0;
+};
+
+// Classic token bucket: fills at rate up to burst, take() spends from it.
+class TokenBucket {
+  double rate;
+  double burst;
+  double tokens;
+  RateClock::time_point last;
+
+  void refill(RateClock::time_point now) {
+    if (now > this->last) {
+      double elapsed = std::chrono::duration<double>(now - this->last).count();
+      this->tokens = std::min(this->burst, this->tokens + elapsed * this->rate);
+    }
+    this->last = now;
+  }
+
+public:
+  TokenBucket() : rate(0), burst(0), tokens(0), last(RateClock::now()){};
+
+  // A burst below one second worth of rate is raised to it. A bucket that
+  // was disabled starts full.
+  void configure(double rate, double burst,
+                 RateClock::time_point now = RateClock::now()) {
+    bool was_enabled = enabled();
+    if (was_enabled) {
+      refill(now);
+    }
+    this->rate = rate;
+    this->burst = std::max(burst, rate);
+    this->tokens = was_enabled ? std::min(this->tokens, this->burst)
+                               : this->burst;
+    this->last = now;
+  }
+
+  bool enabled() { return this->rate > 0; }
+
+  bool take(double amount, RateClock::time_point now = RateClock::now()) {
+    if (!enabled()) {
+      return true;
+    }
+    refill(now);
+    if (this->tokens < amount) {
+      return false;
+    }
+    this->tokens -= amount;
+    return true;
+  }
+
+  // Infinite while disabled.
+  double available(RateClock::time_point now = RateClock::now()) {
+    if (!enabled()) {
+      return std::numeric_limits<double>::infinity();
+    }
+    refill(now);
+    return this->tokens;
+  }
+};
+
+#endif
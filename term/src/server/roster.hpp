@@ -0,0 +1,76 @@
+#ifndef __SERVER_ROSTER_H__
+#define __SERVER_ROSTER_H__
+
+#include "src/protocol/packet.hpp"
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Deltas kept for clients catching up after a gap.
+#define ROSTER_HISTORY 1024
+
+// Members of the room with a versioned change log.
+class Roster {
+  uint64_t version;
+  uint32_t next_id;
+  std::map<uint32_t, std::string> members;
+  std::deque<RosterDelta> history;
+
+  RosterDelta record(RosterOp op, uint32_t id, const std::string &name) {
+    RosterDelta delta(++this->version, op, id, name);
+    this->history.push_back(delta);
+    if (this->history.size() > ROSTER_HISTORY) {
+      this->history.pop_front();
+    }
+    return delta;
+  }
+
+public:
+  Roster() : version(0), next_id(1){};
+
+  // Ids are never reused while the server runs.
+  RosterDelta join(const std::string &name) {
+    uint32_t id = this->next_id++;
+    this->members[id] = name;
+    return record(ROSTER_JOIN, id, name);
+  }
+
+  RosterDelta leave(uint32_t id) {
+    auto iter = this->members.find(id);
+    std::string name = iter != this->members.end() ? iter->second : "";
+    this->members.erase(id);
+    return record(ROSTER_LEAVE, id, name);
+  }
+
+  RosterSnapshot snapshot() {
+    RosterSnapshot snapshot;
+    snapshot.version = this->version;
+    for (auto iter = this->members.begin(); iter != this->members.end();
+         ++iter) {
+      snapshot.members.push_back(RosterMember{iter->first, iter->second});
+    }
+    return snapshot;
+  }
+
+  // Deltas after version, or nullopt when they are no longer kept.
+  std::optional<std::vector<RosterDelta>> since(uint64_t version) {
+    if (version > this->version) {
+      return std::nullopt;
+    }
+    uint64_t missing = this->version - version;
+    if (missing > this->history.size()) {
+      return std::nullopt;
+    }
+    return std::vector<RosterDelta>(this->history.end() - missing,
+                                    this->history.end());
+  }
+
+  uint64_t getVersion() { return this->version; }
+
+  size_t count() { return this->members.size(); }
+};
+
+#endif
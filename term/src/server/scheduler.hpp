@@ -0,0 +1,49 @@
+#ifndef __SERVER_SCHEDULER_H__
+#define __SERVER_SCHEDULER_H__
+
+#include "src/protocol/pool.hpp"
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <unordered_set>
+
+// Round-robin queue of connections with pending input.
+//
+// Each round services every connection that was queued when the round
+// started, once, in arrival order. A connection with work left after its
+// turn goes to the back of the queue for the next round, so a busy client
+// can never hold up the others for more than one budget.
+class FairScheduler {
+  // Pooled, as every message schedules its connection.
+  std::deque<int, PoolAllocator<int>> queue;
+  std::unordered_set<int, std::hash<int>, std::equal_to<int>,
+                     PoolAllocator<int>>
+      queued;
+
+public:
+  // Queue fd unless it already waits for a turn.
+  void schedule(int fd) {
+    if (this->queued.insert(fd).second) {
+      this->queue.push_back(fd);
+    }
+  }
+
+  bool empty() { return this->queue.empty(); }
+
+  size_t size() { return this->queue.size(); }
+
+  // service returns whether fd has work left.
+  void runRound(std::function<bool(int)> service) {
+    size_t turns = this->queue.size();
+    for (size_t i = 0; i < turns && !this->queue.empty(); i++) {
+      int fd = this->queue.front();
+      this->queue.pop_front();
+      this->queued.erase(fd);
+      if (service(fd)) {
+        schedule(fd);
+      }
+    }
+  }
+};
+
+#endif
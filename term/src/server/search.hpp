@@ -0,0 +1,522 @@
+#ifndef __SERVER_SEARCH_H__
+#define __SERVER_SEARCH_H__
+
+#include "src/concurrency/cache_line.hpp"
+#include "src/concurrency/spsc_ring.hpp"
+#include "src/concurrency/wakeup.hpp"
+#include "src/protocol/packet.hpp"
+#include "src/server/memory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Seqs per posting block. A search decodes whole blocks.
+#define SEARCH_BLOCK_SIZE 128
+// Longer words are cut, in documents and queries alike.
+#define SEARCH_MAX_TERM 32
+#define SEARCH_DEFAULT_HITS 10
+#define SEARCH_MAX_HITS 100
+// Tasks waiting for the search thread. Messages arriving while it is full
+// are not indexed.
+#define SEARCH_QUEUE_SIZE (1 << 14)
+// Bytes of sender names and contents waiting for the search thread. Same
+// rule as above when they run out.
+#define SEARCH_TEXT_BYTES (4 << 20)
+#define SEARCH_ANSWER_QUEUE_SIZE 1024
+
+// Distinct lower-cased runs of letters and digits in text, sorted. Bytes
+// from 0x80 up count as letters so UTF-8 words stay whole.
+inline std::vector<std::string> searchTerms(std::string_view text) {
+  std::vector<std::string> terms;
+  std::string term;
+  for (unsigned char c : text) {
+    if (std::isalnum(c) || c >= 0x80) {
+      if (term.size() < SEARCH_MAX_TERM) {
+        term += (char)std::tolower(c);
+      }
+    } else if (!term.empty()) {
+      terms.push_back(term);
+      term.clear();
+    }
+  }
+  if (!term.empty()) {
+    terms.push_back(term);
+  }
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+  return terms;
+}
+
+// Ascending seqs of the messages containing one term.
+//
+// Seqs are stored as varint deltas in blocks of SEARCH_BLOCK_SIZE. Every
+// block keeps its first and last seq uncompressed, so a lookup finds the one
+// block that can hold a seq by binary search and decodes only that.
+class PostingList {
+  struct Block {
+    uint64_t first;
+    uint64_t last;
+    uint32_t offset; // of the delta following first
+    uint32_t count;
+  };
+  std::vector<Block> blocks;
+  std::vector<uint8_t> bytes;
+  size_t count;
+
+public:
+  PostingList() : count(0){};
+
+  // seq must be above every seq added before.
+  void add(uint64_t seq) {
+    this->count++;
+    if (this->blocks.empty() ||
+        this->blocks.back().count == SEARCH_BLOCK_SIZE) {
+      this->blocks.push_back(Block{seq, seq, (uint32_t)this->bytes.size(), 1});
+      return;
+    }
+    Block &block = this->blocks.back();
+    uint64_t delta = seq - block.last;
+    while (delta >= 0x80) {
+      this->bytes.push_back((uint8_t)(delta | 0x80));
+      delta >>= 7;
+    }
+    this->bytes.push_back((uint8_t)delta);
+    block.last = seq;
+    block.count++;
+  }
+
+  size_t size() { return this->count; }
+
+  size_t blockCount() { return this->blocks.size(); }
+
+  // Block that holds seq if any list entry does, blockCount() when seq is
+  // above all of them.
+  size_t findBlock(uint64_t seq) {
+    auto iter = std::lower_bound(
+        this->blocks.begin(), this->blocks.end(), seq,
+        [](const Block &block, uint64_t seq) { return block.last < seq; });
+    return iter - this->blocks.begin();
+  }
+
+  // Replaces out with the seqs of block index, ascending.
+  void decodeBlock(size_t index, std::vector<uint64_t> &out) {
+    const Block &block = this->blocks[index];
+    out.clear();
+    uint64_t seq = block.first;
+    out.push_back(seq);
+    size_t pos = block.offset;
+    for (uint32_t i = 1; i < block.count; i++) {
+      uint64_t delta = 0;
+      int shift = 0;
+      uint8_t byte;
+      do {
+        byte = this->bytes[pos++];
+        delta |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+      } while (byte & 0x80);
+      seq += delta;
+      out.push_back(seq);
+    }
+  }
+
+  // Re-encodes the list without the seqs below oldest.
+  void dropBefore(uint64_t oldest) {
+    PostingList kept;
+    std::vector<uint64_t> seqs;
+    for (size_t i = findBlock(oldest); i < this->blocks.size(); i++) {
+      decodeBlock(i, seqs);
+      for (uint64_t seq : seqs) {
+        if (seq >= oldest) {
+          kept.add(seq);
+        }
+      }
+    }
+    kept.blocks.shrink_to_fit();
+    kept.bytes.shrink_to_fit();
+    *this = std::move(kept);
+  }
+
+  size_t footprint() {
+    return sizeof(PostingList) + this->blocks.capacity() * sizeof(Block) +
+           this->bytes.capacity();
+  }
+};
+
+struct SearchDoc {
+  uint64_t seq;
+  std::string sender;
+  std::string content;
+};
+
+// Inverted index over the newest limit messages.
+//
+// Messages are added in seq order. Once more than limit are kept the oldest
+// are forgotten at once, but their postings stay until half a limit of them
+// piled up and every list is compacted in one pass; searches stop at the
+// oldest kept seq meanwhile.
+class SearchIndex {
+  std::unordered_map<std::string, PostingList> terms;
+  std::deque<SearchDoc> docs;
+  size_t limit;
+  size_t expired; // docs forgotten since the last compaction
+  uint64_t last_seq;
+  size_t doc_bytes;
+  size_t posting_bytes;
+  MemoryGauge gauge;
+
+  // Checks whether a list holds a seq, decoding one block at a time.
+  struct Cursor {
+    PostingList *list;
+    size_t block;
+    std::vector<uint64_t> seqs;
+
+    bool contains(uint64_t seq) {
+      size_t index = this->list->findBlock(seq);
+      if (index == this->list->blockCount()) {
+        return false;
+      }
+      if (index != this->block) {
+        this->list->decodeBlock(index, this->seqs);
+        this->block = index;
+      }
+      return std::binary_search(this->seqs.begin(), this->seqs.end(), seq);
+    }
+  };
+
+  static size_t termFootprint(const std::string &term) {
+    // Hash node and bucket, roughly.
+    return sizeof(std::string) + term.capacity() + 4 * sizeof(void *);
+  }
+
+  static size_t docFootprint(const SearchDoc &doc) {
+    return sizeof(SearchDoc) + doc.sender.capacity() + doc.content.capacity();
+  }
+
+  uint64_t oldestSeq() {
+    return this->docs.empty() ? this->last_seq + 1 : this->docs.front().seq;
+  }
+
+  const SearchDoc *findDoc(uint64_t seq) {
+    auto iter = std::lower_bound(
+        this->docs.begin(), this->docs.end(), seq,
+        [](const SearchDoc &doc, uint64_t seq) { return doc.seq < seq; });
+    return iter != this->docs.end() && iter->seq == seq ? &*iter : nullptr;
+  }
+
+  void forgetOldest(size_t count) {
+    for (size_t i = 0; i < count && !this->docs.empty(); i++) {
+      this->doc_bytes -= docFootprint(this->docs.front());
+      this->docs.pop_front();
+      this->expired++;
+    }
+    if (this->expired > this->limit / 2) {
+      compact();
+    }
+    account();
+  }
+
+  void account() { this->gauge.set(this->doc_bytes + this->posting_bytes); }
+
+public:
+  SearchIndex(size_t limit)
+      : limit(limit), expired(0), last_seq(0), doc_bytes(0),
+        posting_bytes(0), gauge(MEMORY_SEARCH){};
+
+  void add(uint64_t seq, std::string_view sender, std::string_view content) {
+    if (seq <= this->last_seq || this->limit == 0) {
+      return;
+    }
+    this->last_seq = seq;
+    for (auto &term : searchTerms(content)) {
+      auto inserted = this->terms.try_emplace(term);
+      PostingList &list = inserted.first->second;
+      size_t before = list.footprint();
+      if (inserted.second) {
+        before = 0;
+        this->posting_bytes += termFootprint(term);
+      }
+      list.add(seq);
+      this->posting_bytes += list.footprint() - before;
+    }
+    this->docs.push_back(
+        SearchDoc{seq, std::string(sender), std::string(content)});
+    this->doc_bytes += docFootprint(this->docs.back());
+    if (this->docs.size() > this->limit) {
+      forgetOldest(this->docs.size() - this->limit);
+    } else {
+      account();
+    }
+  }
+
+  // Newest messages containing every term of search.query.
+  SearchResult query(const SendSearch &search) {
+    SearchResult result(search.id, {});
+    size_t wanted = search.limit == 0 ? SEARCH_DEFAULT_HITS
+                                      : std::min<size_t>(search.limit,
+                                                         SEARCH_MAX_HITS);
+    std::vector<Cursor> cursors;
+    for (auto &term : searchTerms(search.query)) {
+      auto iter = this->terms.find(term);
+      if (iter == this->terms.end()) {
+        return result;
+      }
+      cursors.push_back(Cursor{&iter->second, SIZE_MAX, {}});
+    }
+    if (cursors.empty()) {
+      return result;
+    }
+    // Walk the rarest term newest first and probe the others.
+    std::sort(cursors.begin(), cursors.end(),
+              [](const Cursor &a, const Cursor &b) {
+                return a.list->size() < b.list->size();
+              });
+    PostingList *lead = cursors[0].list;
+    uint64_t oldest = oldestSeq();
+    std::vector<uint64_t> seqs;
+    for (size_t block = lead->blockCount(); block-- > 0;) {
+      lead->decodeBlock(block, seqs);
+      for (auto iter = seqs.rbegin(); iter != seqs.rend(); ++iter) {
+        if (*iter < oldest) {
+          return result;
+        }
+        bool all = true;
+        for (size_t i = 1; i < cursors.size() && all; i++) {
+          all = cursors[i].contains(*iter);
+        }
+        const SearchDoc *doc = all ? findDoc(*iter) : nullptr;
+        if (doc != nullptr) {
+          result.hits.push_back(SearchHit{doc->seq, doc->sender, doc->content});
+          if (result.hits.size() == wanted) {
+            return result;
+          }
+        }
+      }
+    }
+    return result;
+  }
+
+  // Drops the postings of forgotten messages.
+  void compact() {
+    uint64_t oldest = oldestSeq();
+    this->posting_bytes = 0;
+    for (auto iter = this->terms.begin(); iter != this->terms.end();) {
+      iter->second.dropBefore(oldest);
+      if (iter->second.size() == 0) {
+        iter = this->terms.erase(iter);
+        continue;
+      }
+      this->posting_bytes += termFootprint(iter->first) +
+                             iter->second.footprint();
+      ++iter;
+    }
+    this->expired = 0;
+    account();
+  }
+
+  void setLimit(size_t limit) {
+    this->limit = limit;
+    if (this->docs.size() > limit) {
+      forgetOldest(this->docs.size() - limit);
+    }
+  }
+
+  // Forgets the older half of the messages, e.g. to get under the memory
+  // limit.
+  void shed() {
+    forgetOldest(this->docs.size() / 2);
+    if (this->expired > 0) {
+      compact();
+    }
+  }
+
+  size_t size() { return this->docs.size(); }
+
+  size_t termCount() { return this->terms.size(); }
+};
+
+// Runs a SearchIndex on a thread of its own so neither indexing nor searching
+// holds up the event loop.
+//
+// The loop hands messages and queries over through a ring. Queries see every
+// message handed over before them. Answers come back through a second ring,
+// and fd() turns readable while any are waiting.
+//
+// Message texts are copied into one circular arena allocated up front,
+// which the search thread reads in place and gives back by moving a single
+// index, so indexing takes nothing from malloc on the loop however far
+// behind the search thread is.
+class SearchService {
+  enum TaskKind { TASK_INDEX, TASK_QUERY, TASK_LIMIT, TASK_SHED };
+
+  struct Task {
+    TaskKind kind;
+    uint64_t seq;   // TASK_INDEX
+    int fd;         // TASK_QUERY
+    uint64_t tag;   // TASK_QUERY
+    size_t limit;   // TASK_LIMIT
+    // TASK_INDEX: sender, then content, from offset in text. Both are done
+    // with once text_head reaches end.
+    size_t offset;
+    uint32_t sender_size;
+    uint32_t content_size;
+    uint64_t end;
+    SendSearch search;
+  };
+
+public:
+  struct Answer {
+    int fd;
+    uint64_t tag;
+    SearchResult result;
+  };
+
+private:
+  SearchIndex engine;
+  SpscRing<Task> tasks;
+  SpscRing<Answer> answers;
+  std::vector<char> text;
+  uint64_t text_tail; // bytes ever written, loop side
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> text_head; // ever released
+  Wakeup task_wakeup;
+  Wakeup answer_wakeup;
+  std::atomic<bool> stopping;
+  uint64_t dropped; // messages not indexed because the ring was full
+  std::thread worker;
+
+  bool post(Task task) {
+    if (!this->tasks.push(std::move(task))) {
+      return false;
+    }
+    this->task_wakeup.notify();
+    return true;
+  }
+
+  void run(Task &task) {
+    switch (task.kind) {
+    case TASK_INDEX:
+      this->engine.add(
+          task.seq,
+          std::string_view(&this->text[task.offset], task.sender_size),
+          std::string_view(&this->text[task.offset + task.sender_size],
+                           task.content_size));
+      this->text_head.store(task.end, std::memory_order_release);
+      break;
+    case TASK_QUERY: {
+      Answer answer{task.fd, task.tag, this->engine.query(task.search)};
+      while (!this->answers.push(std::move(answer))) {
+        if (this->stopping) {
+          return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      this->answer_wakeup.notify();
+      break;
+    }
+    case TASK_LIMIT:
+      this->engine.setLimit(task.limit);
+      break;
+    case TASK_SHED:
+      this->engine.shed();
+      break;
+    }
+  }
+
+  void loop() {
+    std::vector<Task> batch;
+    while (!this->stopping) {
+      this->task_wakeup.wait(-1);
+      while (this->tasks.popBatch(batch, SEARCH_QUEUE_SIZE) > 0) {
+        for (auto &task : batch) {
+          run(task);
+        }
+        batch.clear();
+      }
+    }
+  }
+
+public:
+  SearchService(size_t limit)
+      : engine(limit), tasks(SEARCH_QUEUE_SIZE),
+        answers(SEARCH_ANSWER_QUEUE_SIZE), text(SEARCH_TEXT_BYTES),
+        text_tail(0), text_head(0), stopping(false), dropped(0) {
+    this->worker = std::thread([this]() { loop(); });
+  };
+
+  ~SearchService() {
+    this->stopping = true;
+    this->task_wakeup.notify();
+    this->worker.join();
+  }
+
+  SearchService(const SearchService &) = delete;
+  SearchService &operator=(const SearchService &) = delete;
+
+  // Readable while answers are waiting.
+  int fd() { return this->answer_wakeup.fd(); }
+
+  // Returns false when the message could not be queued. Those are not
+  // searchable.
+  bool index(uint64_t seq, std::string_view sender, std::string_view content) {
+    size_t size = sender.size() + content.size();
+    // A text never wraps around: the rest of the arena is skipped instead.
+    uint64_t start = this->text_tail;
+    size_t offset = start % this->text.size();
+    if (offset + size > this->text.size()) {
+      start += this->text.size() - offset;
+      offset = 0;
+    }
+    uint64_t end = start + size;
+    if (size > this->text.size() ||
+        end - this->text_head.load(std::memory_order_acquire) >
+            this->text.size()) {
+      this->dropped++;
+      return false;
+    }
+    std::memcpy(&this->text[offset], sender.data(), sender.size());
+    std::memcpy(&this->text[offset + sender.size()], content.data(),
+                content.size());
+    if (!post(Task{TASK_INDEX, seq, -1, 0, 0, offset, (uint32_t)sender.size(),
+                   (uint32_t)content.size(), end, {}})) {
+      this->dropped++;
+      return false;
+    }
+    this->text_tail = end;
+    return true;
+  }
+
+  // Answered through answers() with fd and tag. Returns false when the
+  // query could not be queued.
+  bool search(int fd, uint64_t tag, const SendSearch &search) {
+    return post(Task{TASK_QUERY, 0, fd, tag, 0, 0, 0, 0, 0, search});
+  }
+
+  void setLimit(size_t limit) {
+    while (!post(Task{TASK_LIMIT, 0, -1, 0, limit, 0, 0, 0, 0, {}})) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Asks the search thread to forget the older half of the index.
+  void shed() { post(Task{TASK_SHED, 0, -1, 0, 0, 0, 0, 0, 0, {}}); }
+
+  std::vector<Answer> takeAnswers() {
+    std::vector<Answer> ready;
+    this->answer_wakeup.drain();
+    this->answers.popBatch(ready, SEARCH_ANSWER_QUEUE_SIZE);
+    return ready;
+  }
+
+  uint64_t droppedMessages() { return this->dropped; }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef __SERVER_SEND_QUEUE_H__
+#define __SERVER_SEND_QUEUE_H__
+
+#include "src/mychat/io.hpp"
+#include "src/protocol/packet.hpp"
+#include "src/server/memory.hpp"
+#include "src/server/trace.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <unistd.h>
+
+// A file descriptor closed when the last holder lets go of it.
+class OpenFile {
+  int file;
+
+public:
+  explicit OpenFile(int fd) : file(fd){};
+  OpenFile(const OpenFile &) = delete;
+  ~OpenFile() { close(this->file); }
+
+  int fd() { return this->file; }
+};
+
+// Outbound frames of one client that the kernel did not take yet.
+//
+// Besides frames it queues spans of files, which are handed to sendfile() so
+// their bytes go from the page cache to the socket without a copy through
+// user space. They count towards bytes() but not towards memory.
+class SendQueue {
+  struct Entry {
+    Data frame;
+    uint64_t trace_id; // recorded once written, 0 when not traced
+    std::shared_ptr<OpenFile> file; // frame is empty when set
+    uint64_t file_offset;
+    size_t file_length;
+
+    size_t size() {
+      return this->file ? this->file_length : this->frame.size();
+    }
+  };
+  std::deque<Entry, PoolAllocator<Entry>> frames;
+  size_t offset; // bytes of frames.front() already sent
+  size_t queued;
+  MemoryGauge gauge;
+
+public:
+  SendQueue() : offset(0), queued(0), gauge(MEMORY_SEND_QUEUES){};
+
+  void push(Data frame, uint64_t trace_id = 0) {
+    this->queued += frame.size();
+    this->gauge.add(sizeof(Entry) + frame.capacity());
+    this->frames.push_back(Entry{std::move(frame), trace_id, nullptr, 0, 0});
+  }
+
+  // Queue length bytes of file from offset on.
+  void pushFile(std::shared_ptr<OpenFile> file, uint64_t offset,
+                size_t length) {
+    this->queued += length;
+    this->gauge.add(sizeof(Entry));
+    this->frames.push_back(Entry{Data(), 0, std::move(file), offset, length});
+  }
+
+  // Write as much as the socket takes. Returns false on a socket error.
+  bool flush(int fd, MychatIo &io = mychat_system_io()) {
+    while (!this->frames.empty()) {
+      Entry &front = this->frames.front();
+      ssize_t sent;
+      if (front.file) {
+        off_t from = front.file_offset + this->offset;
+        sent = io.sendfile(fd, front.file->fd(), &from,
+                           front.file_length - this->offset);
+        if (sent == 0) {
+          errno = EIO; // the file is shorter than queued
+          return false;
+        }
+      } else {
+        sent = io.send(fd, front.frame.data() + this->offset,
+                       front.frame.size() - this->offset);
+      }
+      if (sent < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      this->offset += sent;
+      this->queued -= sent;
+      if (this->offset == front.size()) {
+        if (front.trace_id != 0) {
+          tracer().record(front.trace_id, TRACE_WRITE, fd, Tracer::now());
+        }
+        this->gauge.add(-(int64_t)(sizeof(Entry) + front.frame.capacity()));
+        this->frames.pop_front();
+        this->offset = 0;
+      }
+    }
+    return true;
+  }
+
+  size_t bytes() { return this->queued; }
+
+  bool empty() { return this->frames.empty(); }
+};
+
+#endif
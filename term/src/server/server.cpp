@@ -1,286 +1,69 @@
+#include "src/capture/capture.hpp"
 #include "src/cli/parser.h"
+#include "src/concurrency/affinity.hpp"
 #include "src/logging/logging.hpp"
 #include "src/mychat/mychat.hpp"
-#include "src/protocol/protocol.hpp"
-#include <arpa/inet.h>
-#include <asm-generic/socket.h>
-#include <csignal>
-#include <cstdint>
-#include <fcntl.h>
+#include "src/server/config.hpp"
+#include "src/server/federation.hpp"
+#include "src/server/server.hpp"
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <string>
-#include <sys/epoll.h>
-#include <sys/types.h>
-#include <tuple>
-#include <unordered_map>
-#include <variant>
 #include <vector>
 
-class Connection {
-  bool is_entered;
-  int sock;
-  std::function<void(int, std::vector<uint8_t>)> broadcast;
-  std::function<bool(std::string)> checkExists;
-  std::function<void(int)> disconnect;
-  Handle handle;
+ServerConfig buildConfig(Parser &p) {
+  ServerConfig config;
 
-public:
-  std::string name;
-
-  Connection(int sock, std::function<void(int, std::vector<uint8_t>)> broadcast,
-             std::function<bool(std::string)> checkExists,
-             std::function<void(int)> disconnect, Handle &handle)
-      : is_entered(false), sock(sock), broadcast(broadcast),
-        checkExists(checkExists), disconnect(disconnect), handle(handle),
-        name(""){};
-
-  void feed(std::vector<uint8_t> packet) {
-    try {
-      auto res = this->handle.feed(packet);
-      if (std::holds_alternative<SendEnter>(res)) {
-        //clang-format off
-        if (this->is_entered) {
-          this->disconnect(sock);
-        }
-        auto new_name = std::get<SendEnter>(res).name;
-        if (!this->checkExists(new_name)) {
-          std::string msg = "User " + std::get<SendEnter>(res).name +
-                            " entered. Please say hello.";
-          auto ntc = RecvNotice(msg);
-          this->broadcast(this->sock, this->handle.buildRecvNotice(ntc));
-          this->is_entered = true;
-          this->name = new_name;
-        } else {
-          this->disconnect(sock);
-        }
-        //clang-format on
-      } else if (std::holds_alternative<SendMessage>(res)) {
-        if (this->is_entered) {
-          std::string msg = std::get<SendMessage>(res).content;
-          auto recv = RecvMessage(this->name, msg);
-          this->broadcast(this->sock, this->handle.buildRecvMessage(recv));
-        } else {
-          this->disconnect(sock);
-        }
-      } else {
-        this->disconnect(sock);
-      }
-    } catch (HandleReturn e) {
-      this->disconnect(sock);
-    }
-  }
-};
-
-class Server {
-private:
-  // configuration
-  const int port;
-  const int max_connection;
-  const int max_events;
-
-  // managing
-  bool stopflag;
-  std::unordered_map<int, Connection> clients;
-  int server_socket;
-  int epoll_fd;
-  epoll_event _epoll_event;
-  Handle handle;
-
-  void registerEpoll() {
-
-    this->epoll_fd = epoll_create1(0);
-    if (epoll_fd < 0) {
-      EXIT_WITH_LOG_CRITICAL("Error in attaching io events.");
-      clear();
-      exit(-1);
-    }
-
-    _epoll_event.events = EPOLLIN;
-    _epoll_event.data.fd = this->server_socket;
-
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, this->server_socket, &_epoll_event) <
-        0) {
-      EXIT_WITH_LOG_CRITICAL("Error in handling io events.");
-      exit(-1);
-    }
-  }
-
-  void sendMessage(std::string msg, int client) {
-    if (mychat_send(client, msg.c_str(), msg.length()) < 0) {
-      EXIT_WITH_LOG_CRITICAL("Error in sending data to client");
-    }
-  };
-
-  void acceptNewClient(int epoll_fd) {
-    int client_socket;
-    struct sockaddr client_addr;
-    epoll_event event;
-    socklen_t client_sz = sizeof(client_addr);
-
-    client_socket = mychat_accept(server_socket,
-                                  (struct sockaddr *)&client_addr, &client_sz);
-    if (client_socket < 0) {
-      EXIT_WITH_LOG_CRITICAL("Error in accepting new connection.");
-    }
-    LOG_INFO("New client connected. Current connection " +
-             std::to_string(getConnectionCount() + 1));
-
-    // Set client socket nonblocking.
-    fcntl(client_socket, F_SETFL, O_NONBLOCK);
-
-    // Register epoll
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = client_socket;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) == -1) {
-      LOG_ERROR("Register client to epoll failed.");
-      disconnect(client_socket);
-    };
-
-    // Register Connection
-    Connection conn = Connection(
-        client_socket,
-        [&](int sender, std::vector<uint8_t> content) {
-          return broadcast(sender, content);
-        },
-        [&](std::string name) {
-          auto res = checkExists(name);
-          LOG_DEBUG("Username " + name + " already exists cheking is " +
-                    std::to_string(res));
-          return res;
-        },
-        [&](int sock) { return disconnect(sock); }, this->handle);
-    clients.insert(std::make_pair(client_socket, conn));
-    handleMessage(client_socket);
-  }
-
-  void handleInterrupt(int signal) {
-    if (signal == SIGINT) {
-      this->stopflag = true;
-    }
-  }
-
-  static void handleInterruptHelper(int signal) {
-    if (globalInteruptHandler != nullptr) {
-      globalInteruptHandler->handleInterrupt(signal);
-    }
-  }
-
-  void clear() {
-    LOG_ERROR("Clearing sockets...");
-    close(this->server_socket);
-    for (auto iter = this->clients.begin(); iter != clients.end(); ++iter) {
-      close(iter->first);
-    }
-    close(this->epoll_fd);
-    LOG_ERROR("Clear!");
-  }
-
-public:
-  static Server *globalInteruptHandler;
-
-  Server(int port, int max_connection, int max_events)
-      : port(port), max_connection(max_connection), max_events(max_events),
-        stopflag(false), handle(Handle()){};
-  Server &operator=(const Server &x) { return *this; };
-
-  void runServer() {
-    int sockopt = 1;
-    this->server_socket = mychat_serve(port, max_connection);
-    setsockopt(this->server_socket, SOL_SOCKET, SO_REUSEADDR, &sockopt,
-               sizeof(sockopt));
-    setsockopt(this->server_socket, SOL_SOCKET, SO_REUSEPORT, &sockopt,
-               sizeof(sockopt));
-    registerEpoll();
-
-    int event_count;
-    epoll_event events[this->max_events];
-
-    // Register Interrupt handler
-    globalInteruptHandler = this;
-    struct sigaction sa;
-    sa.sa_handler = handleInterruptHelper;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGINT, &sa, nullptr);
-
-    // Start Server
-    LOG_INFO("Server starts...");
-
-    while (true) {
-      event_count = epoll_wait(epoll_fd, events, this->max_events, 100);
-      if (this->stopflag == true) {
-        this->clear();
-        break;
-      }
-
-      if (event_count < 0) {
-        EXIT_WITH_LOG_CRITICAL("Error in waiting for io events");
-        this->clear();
-        exit(-1);
-      }
-
-      for (int i = 0; i < event_count; i++) {
-        if (events[i].data.fd == this->server_socket) {
-          acceptNewClient(epoll_fd);
-        } else {
-          handleMessage(events[i].data.fd);
-        }
-      }
-    };
-
-    mychat_close(server_socket);
+  int lv = p.get<int>("verbose");
+  if (lv == 2) {
+    config.log_level = TRACE;
+  } else if (lv == 1) {
+    config.log_level = DEBUG;
+  } else {
+    config.log_level = INFO;
   }
-
-  void handleMessage(int fd) {
-    int val_read;
-    uint8_t buffer[1024] = {0};
-    val_read = read(fd, buffer, 1024);
-    if (val_read == 0) {
-      auto ntc = RecvNotice("User " + this->clients.find(fd)->second.name +
-                            " get out.");
-      this->broadcast(fd, this->handle.buildRecvNotice(ntc));
-      this->disconnect(fd);
-      return;
-    } else if (val_read < 0) {
-      LOG_ERROR("Error in reading from client.");
-      return;
-    }
-    auto msg = std::vector<uint8_t>(buffer, buffer + val_read);
-    this->clients.find(fd)->second.feed(msg);
-  };
-
-  void broadcast(int fd_sender, std::vector<uint8_t> msg) {
-    LOG_INFO(std::string("Broadcast from ") + std::to_string(fd_sender));
-    for (auto iter = this->clients.begin(); iter != clients.end(); ++iter) {
-      if (iter->first != fd_sender) {
-        if (mychat_send(iter->first, msg.data(), msg.size()) == -1) {
-          LOG_ERROR("Send failed to" + std::to_string(fd_sender));
-        };
-      }
-    }
-  };
-
-  bool checkExists(std::string name) {
-    for (auto iter = this->clients.begin(); iter != this->clients.end();
-         ++iter) {
-      if (iter->second.name == name) {
-        return true;
-      }
+  auto level_name = p.get<std::string>("log-level");
+  if (!level_name.empty()) {
+    int level = levelFromName(level_name);
+    if (level < 0) {
+      throw InvalidOptionValueError();
     }
-    return false;
+    config.log_level = level;
   }
 
-  void disconnect(int fd) {
-    mychat_close(fd);
-    clients.erase(fd);
-    LOG_INFO("Client disconnected. Current connection is " +
-             std::to_string(getConnectionCount()));
+  config.send_queue_limit = p.get<size_t>("send-queue-limit");
+  config.frame_budget = p.get<int>("frame-budget");
+  config.byte_budget = p.get<size_t>("byte-budget");
+  config.history_size = p.get<int>("history-size");
+  config.session_linger = p.get<std::chrono::milliseconds>("session-linger");
+  config.memory_limit = p.get<size_t>("memory-limit");
+  config.trace_sample = p.get<int>("trace-sample");
+  config.trace_file = p.get<std::string>("trace-file");
+  config.search_limit = p.get<int>("search-limit");
+  config.workers = p.get<int>("workers");
+  config.filter_file = p.get<std::string>("filter-file");
+  config.attachment_dir = p.get<std::string>("attachment-dir");
+  config.attachment_limit = p.get<size_t>("attachment-limit");
+  config.attachment_store = p.get<size_t>("attachment-store");
+  config.low_latency = p.get<bool>("low-latency");
+  config.busy_poll = p.get<int>("busy-poll");
+  try {
+    config.cpus = parseCpuList(p.get<std::string>("cpus"));
+  } catch (std::exception &e) {
+    throw InvalidOptionValueError();
   }
-
-  int getConnectionCount() { return this->clients.size(); }
-};
-
-Server *Server::globalInteruptHandler = nullptr;
+  config.metrics_interval =
+      p.get<std::chrono::milliseconds>("metrics-interval");
+  config.rate_limit.message_rate = p.get<int>("message-rate");
+  config.rate_limit.message_burst = p.get<int>("message-burst");
+  config.rate_limit.byte_rate = p.get<size_t>("byte-rate");
+  config.rate_limit.byte_burst = p.get<size_t>("byte-burst");
+  config.rate_limit.flow_credits = p.get<int>("flow-credits");
+  config.peer_port = p.get<int>("peer-port");
+  config.peer_secret = p.get<std::string>("peer-secret");
+  return config;
+}
 
 int main(int argc, char **argv) {
   auto p = Parser("server");
@@ -288,30 +71,199 @@ int main(int argc, char **argv) {
   auto logopt = CounterOption("set log level maximum 3 times", "verbose", 'v',
                               "GROUP", 3);
   p.addOption(&logopt);
-  auto portopt = StringOption("port to serve. default to 9999", "port", 'p',
-                              "GROUP", std::string("9999"));
+  auto levelopt =
+      StringOption("log level name. overrides --verbose. reloadable",
+                   "log-level", 'l', "GROUP", std::string(""));
+  p.addOption(&levelopt);
+  auto portopt =
+      IntOption("port to serve. default to 9999", "port", 'p', "GROUP", 9999);
   p.addOption(&portopt);
-  auto connopt =
-      StringOption("maximum connection. defualts to 99", "max-connection", 'm',
-                   "GROUP", std::string("99"));
+  auto connopt = IntOption("maximum connection. defualts to 99",
+                           "max-connection", 'm', "GROUP", 99);
   p.addOption(&connopt);
+  auto captureopt =
+      StringOption("record inbound frames to the file for replay", "capture",
+                   'c', "GROUP", std::string(""));
+  p.addOption(&captureopt);
+  auto unixopt = StringOption("also serve on the unix domain socket path",
+                              "unix", 'u', "GROUP", std::string(""));
+  p.addOption(&unixopt);
+  auto configopt =
+      StringOption("config file of key = value lines. reloaded on SIGHUP",
+                   "config", 'f', "GROUP", std::string(""));
+  p.addOption(&configopt);
+  auto queueopt =
+      SizeOption("bytes queued per client before dropping it. reloadable",
+                 "send-queue-limit", std::nullopt, "GROUP", 1 << 20);
+  p.addOption(&queueopt);
+  auto framebudgetopt =
+      IntOption("frames handled per client per loop turn. reloadable",
+                "frame-budget", std::nullopt, "GROUP", 32);
+  p.addOption(&framebudgetopt);
+  auto bytebudgetopt =
+      SizeOption("bytes handled per client per loop turn. reloadable",
+                 "byte-budget", std::nullopt, "GROUP", 64 << 10);
+  p.addOption(&bytebudgetopt);
+  auto historyopt =
+      IntOption("messages kept for resumed sessions. reloadable",
+                "history-size", std::nullopt, "GROUP", 1024);
+  p.addOption(&historyopt);
+  auto lingeropt = DurationOption(
+      "how long a dropped user can resume. 0 disables resume. reloadable",
+      "session-linger", std::nullopt, "GROUP", std::chrono::seconds(30));
+  p.addOption(&lingeropt);
+  auto memoryopt = SizeOption(
+      "memory for buffers and connections before shedding load. 0 is "
+      "unlimited. reloadable",
+      "memory-limit", std::nullopt, "GROUP", 0);
+  p.addOption(&memoryopt);
+  auto metricsopt =
+      DurationOption("log memory usage this often. 0 only logs on SIGUSR1. "
+                     "reloadable",
+                     "metrics-interval", std::nullopt, "GROUP",
+                     std::chrono::milliseconds(0));
+  p.addOption(&metricsopt);
+  auto sampleopt =
+      IntOption("trace one inbound frame in every N. 0 disables. reloadable",
+                "trace-sample", std::nullopt, "GROUP", 0);
+  p.addOption(&sampleopt);
+  auto tracefileopt = StringOption(
+      "file the Chrome trace is written to on SIGUSR2. reloadable",
+      "trace-file", std::nullopt, "GROUP", std::string("mychat-trace.json"));
+  p.addOption(&tracefileopt);
+  auto searchopt =
+      IntOption("newest messages kept searchable. 0 disables. reloadable",
+                "search-limit", std::nullopt, "GROUP", 1000000);
+  p.addOption(&searchopt);
+  auto workersopt =
+      IntOption("threads for CPU-heavy work off the event loop", "workers",
+                std::nullopt, "GROUP", 2);
+  p.addOption(&workersopt);
+  auto filteropt = StringOption(
+      "block list of mask and reject lines checked on every message. "
+      "reloadable",
+      "filter-file", std::nullopt, "GROUP", std::string(""));
+  p.addOption(&filteropt);
+  auto attachdiropt =
+      StringOption("directory attachments are kept in. reloadable",
+                   "attachment-dir", std::nullopt, "GROUP",
+                   std::string("/tmp"));
+  p.addOption(&attachdiropt);
+  auto attachlimitopt =
+      SizeOption("largest attachment accepted. 0 disables. reloadable",
+                 "attachment-limit", std::nullopt, "GROUP", 16 << 20);
+  p.addOption(&attachlimitopt);
+  auto attachstoreopt =
+      SizeOption("attachment bytes kept before dropping the oldest. "
+                 "reloadable",
+                 "attachment-store", std::nullopt, "GROUP", 256 << 20);
+  p.addOption(&attachstoreopt);
+  auto lowlatencyopt = FlagOption(
+      "spin on the event loop and tune sockets and memory for latency. "
+      "burns a core",
+      "low-latency", std::nullopt, "GROUP");
+  p.addOption(&lowlatencyopt);
+  auto busypollopt =
+      IntOption("SO_BUSY_POLL microseconds on client sockets with "
+                "--low-latency. 0 disables",
+                "busy-poll", std::nullopt, "GROUP", 0);
+  p.addOption(&busypollopt);
+  auto cpusopt =
+      StringOption("cpus like 2,3 or 2-5. the event loop runs on the first, "
+                   "workers on the rest",
+                   "cpus", std::nullopt, "GROUP", std::string(""));
+  p.addOption(&cpusopt);
+  auto msgrateopt =
+      IntOption("messages per second per client. 0 is unlimited. reloadable",
+                "message-rate", std::nullopt, "GROUP", 0);
+  p.addOption(&msgrateopt);
+  auto msgburstopt =
+      IntOption("messages a client may burst. reloadable", "message-burst",
+                std::nullopt, "GROUP", 0);
+  p.addOption(&msgburstopt);
+  auto byterateopt =
+      SizeOption("message bytes per second per client. 0 is unlimited. "
+                 "reloadable",
+                 "byte-rate", std::nullopt, "GROUP", 0);
+  p.addOption(&byterateopt);
+  auto byteburstopt =
+      SizeOption("message bytes a client may burst. reloadable", "byte-burst",
+                 std::nullopt, "GROUP", 0);
+  p.addOption(&byteburstopt);
+  auto creditopt =
+      IntOption("send credits granted ahead to clients. 0 disables. "
+                "reloadable",
+                "flow-credits", std::nullopt, "GROUP", 0);
+  p.addOption(&creditopt);
+  auto nodeopt = IntOption("cluster node id. 0 runs standalone", "node-id",
+                           'n', "GROUP", 0);
+  p.addOption(&nodeopt);
+  auto peersopt = StringOption("comma separated host:port of peer nodes",
+                               "peers", std::nullopt, "GROUP", std::string(""));
+  p.addOption(&peersopt);
+  auto peerportopt =
+      IntOption("port other nodes link on. 0 takes no links", "peer-port",
+                std::nullopt, "GROUP", 0);
+  p.addOption(&peerportopt);
+  auto peersecretopt =
+      StringOption("secret shared by the nodes. better set in --config",
+                   "peer-secret", std::nullopt, "GROUP", std::string(""));
+  p.addOption(&peersecretopt);
 
   p.run(argc, argv);
 
-  int lv = std::any_cast<int>(p.getValue("verbose"));
-  if (lv == 2) {
-    _LOG_LEVEL = TRACE;
-  } else if (lv == 1) {
-    _LOG_LEVEL = DEBUG;
-  } else {
-    _LOG_LEVEL = INFO;
+  auto config_path = p.get<std::string>("config");
+  std::function<ServerConfig()> reloader = nullptr;
+  if (!config_path.empty()) {
+    reloader = [&]() {
+      p.loadConfig(config_path);
+      return buildConfig(p);
+    };
+  }
+
+  ServerConfig config;
+  try {
+    config = reloader ? reloader() : buildConfig(p);
+  } catch (CliError &e) {
+    LOG_CRITICAL(std::string("Invalid configuration: ") + e.what());
+    return -1;
+  }
+  _LOG_LEVEL = config.log_level;
+
+  std::vector<MychatAddress> peers;
+  try {
+    peers = parsePeers(p.get<std::string>("peers"));
+  } catch (std::exception &e) {
+    LOG_CRITICAL(std::string("Invalid peer address: ") + e.what());
+    return -1;
+  }
+  if (!peers.empty() && p.get<int>("node-id") == 0) {
+    LOG_CRITICAL("--peers needs a --node-id.");
+    return -1;
+  }
+  if (p.get<int>("node-id") != 0 && config.peer_secret.empty()) {
+    LOG_CRITICAL("--node-id needs a --peer-secret.");
+    return -1;
+  }
+
+  std::unique_ptr<CaptureWriter> capture;
+  auto capture_path = p.get<std::string>("capture");
+  if (!capture_path.empty()) {
+    capture = std::make_unique<CaptureWriter>(capture_path);
+    LOG_INFO("Capturing inbound traffic to " + capture_path);
   }
 
   // clang-format off
   Server(
-    std::stoi(std::any_cast<std::string>(p.getValue("port"))),
-    std::stoi(std::any_cast<std::string>(p.getValue("max-connection"))),
-    std::stoi(std::any_cast<std::string>(p.getValue("max-connection"))))
+    p.get<int>("port"),
+    p.get<int>("max-connection"),
+    p.get<int>("max-connection"),
+    p.get<std::string>("unix"),
+    capture.get(),
+    config,
+    reloader,
+    p.get<int>("node-id"),
+    peers)
   .runServer();
   // clang-format on
-}
\ No newline at end of file
+}
@@ -0,0 +1,1326 @@
+#ifndef __SERVER_SERVER_H__
+#define __SERVER_SERVER_H__
+
+#include "src/capture/capture.hpp"
+#include "src/concurrency/affinity.hpp"
+#include "src/concurrency/work_pool.hpp"
+#include "src/cli/parser.h"
+#include "src/logging/logging.hpp"
+#include "src/mychat/io.hpp"
+#include "src/mychat/mychat.hpp"
+#include "src/protocol/protocol.hpp"
+#include "src/server/attachment.hpp"
+#include "src/server/config.hpp"
+#include "src/server/connection.hpp"
+#include "src/server/federation.hpp"
+#include "src/server/filter.hpp"
+#include "src/server/history.hpp"
+#include "src/server/memory.hpp"
+#include "src/server/roster.hpp"
+#include "src/server/scheduler.hpp"
+#include "src/server/search.hpp"
+#include "src/server/session.hpp"
+#include "src/server/trace.hpp"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+class Server {
+private:
+  // configuration
+  const int port;
+  const int max_connection;
+  const int max_events;
+  const std::string unix_path;
+
+  ServerConfig config;
+  std::function<ServerConfig()> reloader;
+
+  // managing
+  bool stopflag;
+  bool reloadflag;
+  bool reportflag;
+  bool traceflag;
+  bool shedding; // over the memory limit
+  bool spinning; // low latency mode, the loop never sleeps
+  std::unordered_map<int, Connection> clients;
+  std::vector<int> server_sockets;
+  int peer_socket; // listening for other nodes, -1 when not
+  std::unique_ptr<MychatIo> own_io; // when none was handed in
+  MychatIo *io;
+  std::vector<epoll_event> events;
+  Handle handle;
+  Roster roster;
+  CaptureWriter *capture;
+  FairScheduler scheduler;
+  MessageHistory history;
+  SessionTable sessions;
+  std::unique_ptr<SearchService> search; // while search_limit > 0
+  std::unique_ptr<WorkPool> workers;
+  std::shared_ptr<ContentFilter> filter; // while filter_file is set
+  AttachmentStore attachments;
+  std::chrono::steady_clock::time_point last_expire;
+  std::chrono::steady_clock::time_point last_report;
+
+  // federation, only with a node id
+  std::unique_ptr<Federation> federation;
+  std::vector<MychatAddress> peer_addrs;
+  std::vector<int> peer_fds; // dialed link per address, -1 while down
+  std::unordered_set<int> dialing; // dialed links still connecting
+  std::unordered_map<int, uint32_t> peer_nodes; // link -> node after hello
+  std::unordered_map<std::string, uint32_t> remote_ids; // roster ids
+  std::chrono::steady_clock::time_point last_dial;
+  std::chrono::steady_clock::time_point last_refresh;
+
+  void registerEpoll() {
+    for (int server_socket : this->server_sockets) {
+      if (this->io->watch(server_socket, EPOLLIN) < 0) {
+        EXIT_WITH_LOG_CRITICAL("Error in handling io events.");
+        clear();
+        exit(-1);
+      }
+    }
+  }
+
+  bool isServerSocket(int fd) {
+    for (int server_socket : this->server_sockets) {
+      if (server_socket == fd) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void sendMessage(std::string msg, int client) {
+    if (this->io->send(client, msg.c_str(), msg.length()) < 0) {
+      EXIT_WITH_LOG_CRITICAL("Error in sending data to client");
+    }
+  };
+
+  void acceptNewClient(int server_socket) {
+    int client_socket = this->io->accept(server_socket);
+    if (client_socket < 0) {
+      EXIT_WITH_LOG_CRITICAL("Error in accepting new connection.");
+    }
+    if (this->shedding) {
+      LOG_WARN("Over the memory limit. Refusing new connection.");
+      this->io->close(client_socket);
+      return;
+    }
+    LOG_INFO("New client connected. Current connection " +
+             std::to_string(getConnectionCount() + 1));
+
+    registerConnection(client_socket, server_socket == this->peer_socket);
+    handleMessage(client_socket);
+  }
+
+  // client_socket is nonblocking already, as MychatIo hands them out. Links
+  // to other nodes, accepted on the peer port or dialed, take no ENTER or
+  // RESUME, and client connections take no PEER_HELLO.
+  void registerConnection(int client_socket, bool peer_link = false) {
+    // Register Connection
+    ConnectionHandlers handlers;
+    handlers.message = [&](int sender, RecvMessage &msg) {
+      if (!filterMessage(sender, msg)) {
+        return;
+      }
+      deliver(sender, msg);
+      if (this->federation != nullptr) {
+        publish(this->federation->originate(PEER_MESSAGE, msg.sender_name,
+                                            msg.content));
+      }
+    };
+    handlers.checkExists = [&](std::string name) {
+      auto res = checkExists(name);
+      LOG_DEBUG("Username " + name + " already exists cheking is " +
+                std::to_string(res));
+      return res;
+    };
+    handlers.disconnect = [&](int sock) { return disconnect(sock); };
+    if (!peer_link) {
+      handlers.entered = [&](int sock, std::string name) {
+        return enterRoster(sock, name);
+      };
+      handlers.resume = [&](int sock, SendResume &resume) {
+        return resumeSession(sock, resume);
+      };
+    }
+    handlers.sync = [&](int sock, uint64_t version) {
+      return syncRoster(sock, version);
+    };
+    handlers.search = [&](int sock, SendSearch &search) {
+      return searchHistory(sock, search);
+    };
+    handlers.offer = [&](int sock, AttachOffer &offer) {
+      return offerAttachment(sock, offer);
+    };
+    handlers.chunk = [&](int sock, AttachChunk &chunk) {
+      return receiveAttachment(sock, chunk);
+    };
+    handlers.fetch = [&](int sock, AttachFetch &fetch) {
+      return fetchAttachment(sock, fetch);
+    };
+    if (this->federation != nullptr && peer_link) {
+      handlers.peerHello = [&](int sock, PeerHello &hello) {
+        return peerHello(sock, hello);
+      };
+      handlers.peerEvent = [&](int sock, PeerEvent &event) {
+        return peerEvent(sock, event);
+      };
+    }
+    handlers.clock = [&]() { return this->io->now(); };
+    auto inserted =
+        clients.try_emplace(client_socket, client_socket, handlers,
+                            this->handle);
+    inserted.first->second.setRateLimit(this->config.rate_limit);
+    if (this->spinning) {
+      tuneSocket(client_socket);
+    }
+    if (this->capture != nullptr) {
+      this->capture->open(client_socket);
+    }
+
+    // Register epoll
+    if (this->io->watch(client_socket, EPOLLIN | EPOLLOUT | EPOLLET) == -1) {
+      LOG_ERROR("Register client to epoll failed.");
+      disconnect(client_socket);
+    };
+  }
+
+  // Low latency mode. Frames go out as soon as they are queued, and reads
+  // busy poll the device queue when busy_poll is set. Unix sockets have no
+  // Nagle to turn off, so failures only matter with TCP.
+  void tuneSocket(int fd) {
+    int on = 1;
+    this->io->setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    int busy_poll = this->config.busy_poll;
+    if (busy_poll > 0 && this->io->setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                                              &busy_poll,
+                                              sizeof(busy_poll)) < 0) {
+      LOG_DEBUG("SO_BUSY_POLL on " + std::to_string(fd) +
+                " failed: " + std::strerror(errno));
+    }
+  }
+
+  // Pin the loop and the workers, and in low latency mode fault in and lock
+  // the buffer pools so the first messages do not wait for page faults.
+  void tuneLatency() {
+    auto &cpus = this->config.cpus;
+    if (!cpus.empty()) {
+      if (!pinThread(pthread_self(), cpus[0])) {
+        LOG_WARN("Pinning the event loop to CPU " + std::to_string(cpus[0]) +
+                 " failed.");
+      }
+      std::vector<int> rest(cpus.begin() + 1, cpus.end());
+      if (!rest.empty()) {
+        this->workers->pin(rest);
+      }
+    }
+    this->spinning = this->config.low_latency;
+    if (!this->spinning) {
+      return;
+    }
+    size_t reserved = BufferPool::reserve(POOL_CLASS_BYTES);
+    if (mlockall(MCL_CURRENT) < 0) {
+      LOG_WARN(std::string("Locking memory failed: ") + std::strerror(errno) +
+               ". Pages may still be swapped out.");
+    }
+    LOG_INFO("Low latency mode. " + std::to_string(reserved >> 10) +
+             " KiB of buffers ready.");
+  }
+
+  // Dial configured peers whose link is down, at most once a second. The
+  // connects finish in the event loop, see finishDial, so a peer that does
+  // not answer holds nothing up.
+  void dialPeers() {
+    auto now = this->io->now();
+    if (now - this->last_dial < std::chrono::seconds(1)) {
+      return;
+    }
+    this->last_dial = now;
+
+    for (size_t i = 0; i < this->peer_addrs.size(); i++) {
+      if (this->peer_fds[i] >= 0) {
+        continue;
+      }
+      int sock = this->io->connect(this->peer_addrs[i]);
+      if (sock < 0) {
+        LOG_DEBUG("Peer " + this->peer_addrs[i].host + ":" +
+                  std::to_string(this->peer_addrs[i].port) + " unreachable.");
+        continue;
+      }
+      registerConnection(sock, true);
+      auto iter = this->clients.find(sock);
+      if (iter == this->clients.end()) {
+        continue;
+      }
+      iter->second.is_peer = true;
+      this->peer_fds[i] = sock;
+      this->dialing.insert(sock);
+    }
+  }
+
+  // The dialed link fd became writable or failed. Says hello once it is
+  // connected.
+  void finishDial(int fd) {
+    this->dialing.erase(fd);
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if (this->io->getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0) {
+      error = errno;
+    }
+    if (error != 0) {
+      LOG_DEBUG("Dialing peer on " + std::to_string(fd) +
+                " failed: " + std::strerror(error));
+      disconnect(fd);
+      return;
+    }
+    auto iter = this->clients.find(fd);
+    PeerHello hello = this->federation->hello(fd);
+    if (!sendTo(fd, iter->second, this->handle.build(hello))) {
+      disconnect(fd);
+    }
+  }
+
+  // A link to another node that is connected. Nothing may go out on a
+  // dialed one before its hello.
+  bool isLinked(int fd, Connection &conn) {
+    return conn.is_peer &&
+           (this->dialing.empty() || this->dialing.count(fd) == 0);
+  }
+
+  bool isDialed(int fd) {
+    for (int peer_fd : this->peer_fds) {
+      if (peer_fd == fd) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // A link says hello first, and again whenever more nodes became
+  // reachable through it.
+  void peerHello(int fd, PeerHello &hello) {
+    auto iter = this->clients.find(fd);
+    auto known = this->peer_nodes.find(fd);
+    if (!this->federation->admits(hello) ||
+        (known != this->peer_nodes.end() && known->second != hello.node_id)) {
+      LOG_WARN("Refused hello from node " + std::to_string(hello.node_id) +
+               ". Dropping link.");
+      disconnect(fd);
+      return;
+    }
+    bool first = known == this->peer_nodes.end();
+    this->peer_nodes[fd] = hello.node_id;
+    bool grew = this->federation->introduce(fd, hello);
+
+    bool ok = true;
+    if (first) {
+      LOG_INFO("Linked with node " + std::to_string(hello.node_id));
+      if (!isDialed(fd)) {
+        PeerHello reply = this->federation->hello(fd);
+        ok = sendTo(fd, iter->second, this->handle.build(reply));
+      }
+      // Claim the names of local users on the new link.
+      for (auto citer = this->clients.begin(); citer != this->clients.end();
+           ++citer) {
+        if (citer->second.isEntered()) {
+          auto event =
+              this->federation->originate(PEER_JOIN, citer->second.name);
+          ok = ok && sendTo(fd, iter->second, this->handle.build(event));
+        }
+      }
+    }
+    if (!ok) {
+      disconnect(fd);
+      return;
+    }
+    if (grew) {
+      introduceToPeers(fd);
+    }
+  }
+
+  // Say hello again on every link but fd_from, so they take events of the
+  // nodes fd_from introduced. Sent before any of those events is forwarded.
+  void introduceToPeers(int fd_from) {
+    std::vector<int> dropped;
+    for (auto iter = this->clients.begin(); iter != this->clients.end();
+         ++iter) {
+      if (isLinked(iter->first, iter->second) && iter->first != fd_from) {
+        PeerHello hello = this->federation->hello(iter->first);
+        if (!sendTo(iter->first, iter->second, this->handle.build(hello))) {
+          dropped.push_back(iter->first);
+        }
+      }
+    }
+    for (int fd : dropped) {
+      disconnect(fd);
+    }
+  }
+
+  void peerEvent(int fd, PeerEvent &event) {
+    // Own events come back around cycles of links.
+    if (event.origin == this->federation->nodeId()) {
+      return;
+    }
+    if (!this->federation->carries(fd, event.origin)) {
+      LOG_WARN("Event of node " + std::to_string(event.origin) +
+               " on a link that did not introduce it. Dropped.");
+      return;
+    }
+    if (!this->federation->accept(event)) {
+      return;
+    }
+    forwardToPeers(event, fd);
+
+    switch (event.kind) {
+    case PEER_MESSAGE: {
+      auto remote = this->remote_ids.find(event.name);
+      auto recv = RecvMessage(
+          event.name, Text(event.content), 0,
+          remote != this->remote_ids.end() ? remote->second : 0);
+      deliver(fd, recv);
+      break;
+    }
+    case PEER_JOIN: {
+      remoteJoin(event.name, event.origin);
+      break;
+    }
+    case PEER_LEAVE: {
+      remoteLeave(event.name, event.origin);
+      break;
+    }
+    }
+  }
+
+  void remoteJoin(const std::string &name, uint32_t node) {
+    for (auto iter = this->clients.begin(); iter != this->clients.end();
+         ++iter) {
+      if (iter->second.isEntered() && iter->second.name == name) {
+        if (this->federation->winsAgainst(node)) {
+          return;
+        }
+        LOG_WARN("Name " + name + " is taken on node " + std::to_string(node) +
+                 ". Dropping local user.");
+        this->sessions.close(iter->second.session);
+        iter->second.session = 0;
+        disconnect(iter->first);
+        break;
+      }
+    }
+    if (this->federation->hasRemoteName(name)) {
+      return;
+    }
+
+    this->federation->addRemoteName(name, node);
+    auto delta = this->roster.join(name);
+    this->remote_ids[name] = delta.id;
+    broadcast(-1, this->handle.build(delta));
+  }
+
+  void remoteLeave(const std::string &name, uint32_t node) {
+    if (!this->federation->removeRemoteName(name, node)) {
+      return;
+    }
+    auto delta = this->roster.leave(this->remote_ids[name]);
+    this->remote_ids.erase(name);
+    broadcast(-1, this->handle.build(delta));
+  }
+
+  void publish(PeerEvent event) { forwardToPeers(event, -1); }
+
+  void forwardToPeers(PeerEvent &event, int fd_from) {
+    auto frame = this->handle.build(event);
+    std::vector<int> dropped;
+    for (auto iter = this->clients.begin(); iter != this->clients.end();
+         ++iter) {
+      if (isLinked(iter->first, iter->second) && iter->first != fd_from) {
+        if (!sendTo(iter->first, iter->second, frame)) {
+          dropped.push_back(iter->first);
+        }
+      }
+    }
+    for (int fd : dropped) {
+      disconnect(fd);
+    }
+  }
+
+  // Forget users of a node once no link to it is left.
+  void unlinkPeer(int fd) {
+    for (size_t i = 0; i < this->peer_fds.size(); i++) {
+      if (this->peer_fds[i] == fd) {
+        this->peer_fds[i] = -1;
+      }
+    }
+    this->federation->unlink(fd);
+    auto iter = this->peer_nodes.find(fd);
+    if (iter == this->peer_nodes.end()) {
+      return;
+    }
+    uint32_t node = iter->second;
+    this->peer_nodes.erase(iter);
+    LOG_WARN("Link to node " + std::to_string(node) + " lost.");
+
+    for (auto niter = this->peer_nodes.begin(); niter != this->peer_nodes.end();
+         ++niter) {
+      if (niter->second == node) {
+        return;
+      }
+    }
+    for (auto &name : this->federation->namesOf(node)) {
+      remoteLeave(name, node);
+    }
+  }
+
+  void handleInterrupt(int signal) {
+    if (signal == SIGINT) {
+      this->stopflag = true;
+    } else if (signal == SIGHUP) {
+      this->reloadflag = true;
+    } else if (signal == SIGUSR1) {
+      this->reportflag = true;
+    } else if (signal == SIGUSR2) {
+      this->traceflag = true;
+    }
+  }
+
+  void dumpTrace() {
+    this->traceflag = false;
+    if (!tracer().enabled()) {
+      LOG_WARN("Tracing is off. Set --trace-sample to record traces.");
+      return;
+    }
+    // Rendering a full trace buffer takes long enough to stall delivery.
+    std::string path = this->config.trace_file;
+    auto written = std::make_shared<bool>(false);
+    this->workers->submit(
+        [path, written] { *written = tracer().dump(path); },
+        [path, written] {
+          if (*written) {
+            LOG_INFO("Trace written to " + path);
+          } else {
+            LOG_ERROR("Writing trace to " + path + " failed.");
+          }
+        });
+  }
+
+  void reportMemory() {
+    this->reportflag = false;
+    this->last_report = this->io->now();
+    LOG_INFO("Memory " + memoryAccount().report() + " limit=" +
+             std::to_string(this->config.memory_limit) +
+             " clients=" + std::to_string(getConnectionCount()) +
+             " history_entries=" + std::to_string(this->history.size()));
+  }
+
+  // Shed load until usage is back under the memory limit: refuse new
+  // connections, drop old history, halve the search index, give back idle
+  // receive buffers and finally drop the clients with the longest send
+  // queues.
+  void enforceMemoryLimit() {
+    int64_t limit = this->config.memory_limit;
+    MemoryAccount &account = memoryAccount();
+    if (limit == 0 || account.total() <= limit) {
+      if (this->shedding) {
+        LOG_INFO("Memory back under the limit.");
+        this->shedding = false;
+      }
+      return;
+    }
+    bool shed_search = !this->shedding;
+    if (!this->shedding) {
+      LOG_WARN("Memory limit exceeded. " + account.report());
+      this->shedding = true;
+    }
+
+    while (account.total() > limit && this->history.dropOldest()) {
+    }
+    // The search thread gives memory back on its own time. Ask it once per
+    // episode and do not drop clients for what it still holds.
+    if (this->search != nullptr && shed_search) {
+      this->search->shed();
+    }
+    int64_t searching = account.usage(MEMORY_SEARCH);
+    for (auto iter = this->clients.begin();
+         iter != this->clients.end() && account.total() > limit; ++iter) {
+      if (!iter->second.readable) {
+        iter->second.reader.shrink();
+        iter->second.accountMemory();
+      }
+    }
+    while (account.total() - searching > limit) {
+      int slowest = -1;
+      size_t longest = 0;
+      for (auto iter = this->clients.begin(); iter != this->clients.end();
+           ++iter) {
+        if (iter->second.send_queue.bytes() > longest) {
+          longest = iter->second.send_queue.bytes();
+          slowest = iter->first;
+        }
+      }
+      if (slowest < 0) {
+        break;
+      }
+      LOG_WARN("Dropping client " + std::to_string(slowest) +
+               " with " + std::to_string(longest) +
+               " queued bytes to free memory.");
+      disconnect(slowest);
+    }
+  }
+
+  void reloadConfig() {
+    this->reloadflag = false;
+    if (!this->reloader) {
+      LOG_WARN("No config file to reload.");
+      return;
+    }
+    try {
+      applyConfig(this->reloader());
+      LOG_INFO("Configuration reloaded.");
+    } catch (CliError &e) {
+      LOG_ERROR(std::string("Reloading configuration failed: ") + e.what() +
+                ". Keeping previous configuration.");
+    }
+  }
+
+  // Queue frame for the client and write what the socket takes. Returns false
+  // when the client has to be dropped.
+  bool sendTo(int fd, Connection &conn, const Data &frame) {
+    uint64_t trace_id = tracer().current();
+    if (trace_id != 0) {
+      tracer().record(trace_id, TRACE_ENQUEUE, fd, Tracer::now());
+    }
+    conn.send_queue.push(frame, trace_id);
+    if (!conn.send_queue.flush(fd, *this->io)) {
+      LOG_ERROR("Send failed to " + std::to_string(fd));
+      return false;
+    }
+    if (conn.send_queue.bytes() > this->config.send_queue_limit) {
+      LOG_WARN("Client " + std::to_string(fd) +
+               " is too slow. Dropping connection.");
+      return false;
+    }
+    return true;
+  }
+
+  void flushClient(int fd) {
+    auto iter = this->clients.find(fd);
+    if (iter == this->clients.end()) {
+      return;
+    }
+    if (!iter->second.send_queue.flush(fd, *this->io)) {
+      LOG_ERROR("Send failed to " + std::to_string(fd));
+      disconnect(fd);
+    }
+  }
+
+  static void handleInterruptHelper(int signal) {
+    if (globalInteruptHandler != nullptr) {
+      globalInteruptHandler->handleInterrupt(signal);
+    }
+  }
+
+  void clear() {
+    LOG_ERROR("Clearing sockets...");
+    for (int server_socket : this->server_sockets) {
+      this->io->close(server_socket);
+    }
+    if (!this->unix_path.empty()) {
+      unlink(this->unix_path.c_str());
+    }
+    for (auto iter = this->clients.begin(); iter != clients.end(); ++iter) {
+      this->io->close(iter->first);
+    }
+    this->search.reset();
+    this->workers.reset();
+    if (this->capture != nullptr) {
+      this->capture->flush();
+    }
+    LOG_ERROR("Clear!");
+  }
+
+public:
+  static inline Server *globalInteruptHandler = nullptr;
+
+  // unix_path additionally listens on an AF_UNIX socket when not empty.
+  // reloader is called on SIGHUP and may throw CliError to keep the current
+  // configuration.
+  // A node_id other than 0 joins the cluster formed with peers.
+  // io stands in for the operating system when given, e.g. a simulated
+  // network; it has to outlive the server.
+  Server(int port, int max_connection, int max_events,
+         std::string unix_path = "", CaptureWriter *capture = nullptr,
+         ServerConfig config = ServerConfig(),
+         std::function<ServerConfig()> reloader = nullptr,
+         uint32_t node_id = 0, std::vector<MychatAddress> peers = {},
+         MychatIo *io = nullptr)
+      : port(port), max_connection(max_connection), max_events(max_events),
+        unix_path(unix_path), config(config), reloader(reloader),
+        stopflag(false), reloadflag(false), reportflag(false),
+        traceflag(false), shedding(false), spinning(false), peer_socket(-1),
+        own_io(io == nullptr ? std::make_unique<MychatSystemIo>() : nullptr),
+        io(io == nullptr ? own_io.get() : io), events(max_events),
+        handle(Handle()), capture(capture), peer_addrs(peers),
+        peer_fds(peers.size(), -1) {
+    if (node_id != 0) {
+      this->federation =
+          std::make_unique<Federation>(node_id, config.peer_secret);
+    }
+  };
+  Server &operator=(const Server &x) { return *this; };
+
+  // Listen and get everything ready for step(). Exits when the port is
+  // taken.
+  void start() {
+    int server_socket =
+        this->io->listen(MychatAddress{MYCHAT_TCP, "", port}, max_connection);
+    if (server_socket < 0) {
+      EXIT_WITH_LOG_CRITICAL("Error in listening on port " +
+                             std::to_string(port));
+      exit(-1);
+    }
+    this->server_sockets.push_back(server_socket);
+
+    if (!this->unix_path.empty()) {
+      server_socket = this->io->listen(
+          MychatAddress{MYCHAT_UNIX, this->unix_path, 0}, max_connection);
+      if (server_socket < 0) {
+        EXIT_WITH_LOG_CRITICAL("Error in listening on " + this->unix_path);
+        exit(-1);
+      }
+      this->server_sockets.push_back(server_socket);
+      LOG_INFO("Listening on unix:" + this->unix_path);
+    }
+
+    if (this->federation != nullptr && this->config.peer_port != 0) {
+      this->peer_socket = this->io->listen(
+          MychatAddress{MYCHAT_TCP, "", this->config.peer_port},
+          max_connection);
+      if (this->peer_socket < 0) {
+        EXIT_WITH_LOG_CRITICAL("Error in listening for peers on port " +
+                               std::to_string(this->config.peer_port));
+        exit(-1);
+      }
+      this->server_sockets.push_back(this->peer_socket);
+      LOG_INFO("Listening for peers on port " +
+               std::to_string(this->config.peer_port));
+    }
+    registerEpoll();
+    startWorkers();
+    applyConfig(this->config);
+    tuneLatency();
+
+    // Start Server
+    LOG_INFO("Server starts...");
+  }
+
+  // One turn of the event loop: wait for events, sleeping at most 100 ms
+  // unless in low latency mode, and serve what came in. Returns false once
+  // the server stopped.
+  bool step() {
+    // Do not sleep while clients still have input waiting for a turn.
+    int timeout = this->spinning || !this->scheduler.empty() ? 0 : 100;
+    int event_count = this->io->wait(this->events.data(), this->max_events,
+                                     timeout);
+    if (this->stopflag == true) {
+      this->clear();
+      return false;
+    }
+    if (this->reloadflag == true) {
+      this->reloadConfig();
+    }
+    if (this->federation != nullptr) {
+      this->dialPeers();
+    }
+    this->refreshCredits();
+    this->expireSessions();
+    this->enforceMemoryLimit();
+    if (this->reportflag ||
+        (this->config.metrics_interval.count() > 0 &&
+         this->io->now() - this->last_report >=
+             this->config.metrics_interval)) {
+      this->reportMemory();
+    }
+    if (this->traceflag) {
+      this->dumpTrace();
+    }
+
+    if (event_count < 0 && errno == EINTR) {
+      return true;
+    }
+    if (event_count < 0) {
+      EXIT_WITH_LOG_CRITICAL("Error in waiting for io events");
+      this->clear();
+      exit(-1);
+    }
+
+    for (int i = 0; i < event_count; i++) {
+      epoll_event &event = this->events[i];
+      if (isServerSocket(event.data.fd)) {
+        acceptNewClient(event.data.fd);
+        continue;
+      }
+      if (this->search != nullptr && event.data.fd == this->search->fd()) {
+        answerSearches();
+        continue;
+      }
+      if (event.data.fd == this->workers->fd()) {
+        this->workers->runCompletions();
+        continue;
+      }
+      if (!this->dialing.empty() && this->dialing.count(event.data.fd) > 0) {
+        finishDial(event.data.fd);
+      } else if (event.events & EPOLLOUT) {
+        flushClient(event.data.fd);
+      }
+      if (event.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        handleMessage(event.data.fd);
+      }
+    }
+    this->scheduler.runRound([&](int fd) { return serviceClient(fd); });
+    if (this->spinning && event_count == 0) {
+      // Costs nothing on a core of its own, and lets clients sharing the
+      // core run instead of waiting out the time slice.
+      sched_yield();
+    }
+    return true;
+  }
+
+  // Close everything at the end of the next step().
+  void stop() { this->stopflag = true; }
+
+  void runServer() {
+    // Register Interrupt handler
+    globalInteruptHandler = this;
+    struct sigaction sa;
+    sa.sa_handler = handleInterruptHelper;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGHUP, &sa, nullptr);
+    sigaction(SIGUSR1, &sa, nullptr);
+    sigaction(SIGUSR2, &sa, nullptr);
+    // Writes to a client that just went away must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+    start();
+    while (step()) {
+    }
+  }
+
+  // Input became available on fd. Serviced in the next scheduler round.
+  void handleMessage(int fd) {
+    auto iter = this->clients.find(fd);
+    if (iter == this->clients.end()) {
+      return;
+    }
+    iter->second.readable = true;
+    this->scheduler.schedule(fd);
+  }
+
+  // One read into the frame reader. Clears readable once the socket is
+  // drained and sets eof when the client is gone.
+  void readClient(int fd, Connection &conn) {
+    uint8_t buffer[4096];
+    while (true) {
+      int val_read = this->io->recv(fd, buffer, sizeof(buffer));
+      if (val_read > 0) {
+        conn.reader.append(buffer, val_read);
+        if (tracer().enabled()) {
+          conn.last_read_ns = Tracer::now();
+        }
+        return;
+      }
+      if (val_read == 0) {
+        conn.eof = true;
+      } else if (errno == EINTR) {
+        continue;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_ERROR("Error in reading from client.");
+        conn.eof = true;
+      }
+      conn.readable = false;
+      return;
+    }
+  }
+
+  // Dispatch frames of fd up to the configured budget. Returns whether the
+  // client has input left for another turn.
+  bool serviceClient(int fd) {
+    size_t frames = 0;
+    size_t bytes = 0;
+    try {
+      while (frames < this->config.frame_budget &&
+             bytes < this->config.byte_budget) {
+        auto iter = this->clients.find(fd);
+        if (iter == this->clients.end()) {
+          return false;
+        }
+        auto frame = iter->second.reader.next();
+        if (!frame.has_value()) {
+          if (!iter->second.readable) {
+            break;
+          }
+          readClient(fd, iter->second);
+          continue;
+        }
+        if (this->capture != nullptr) {
+          this->capture->frame(fd, frame.value());
+        }
+        frames++;
+        bytes += frame->size();
+        uint64_t trace_id = tracer().sample();
+        if (trace_id != 0) {
+          tracer().record(trace_id, TRACE_RECV, fd, iter->second.last_read_ns);
+        }
+        iter->second.feed(frame.value());
+        tracer().finish();
+      }
+    } catch (HandleReturn e) {
+      tracer().finish();
+      this->disconnect(fd);
+      return false;
+    }
+
+    auto iter = this->clients.find(fd);
+    if (iter == this->clients.end()) {
+      return false;
+    }
+    iter->second.accountMemory();
+    bool more = iter->second.readable || iter->second.reader.ready();
+    if (!more && iter->second.eof) {
+      this->disconnect(fd);
+      return false;
+    }
+    grantCredits(fd);
+    return more;
+  }
+
+  void grantCredits(int fd) {
+    auto iter = this->clients.find(fd);
+    if (iter == this->clients.end()) {
+      return;
+    }
+    auto grant = iter->second.grantCredits();
+    if (grant.has_value() && !sendTo(fd, iter->second, grant.value())) {
+      disconnect(fd);
+    }
+  }
+
+  // Credits of idle clients grow back with their message bucket.
+  void refreshCredits() {
+    auto now = this->io->now();
+    if (this->config.rate_limit.flow_credits == 0 ||
+        now - this->last_refresh < std::chrono::milliseconds(50)) {
+      return;
+    }
+    this->last_refresh = now;
+
+    std::vector<int> fds;
+    for (auto iter = this->clients.begin(); iter != this->clients.end();
+         ++iter) {
+      fds.push_back(iter->first);
+    }
+    for (int fd : fds) {
+      grantCredits(fd);
+    }
+  }
+
+  void broadcast(int fd_sender, const Data &msg) {
+    LOG_DEBUG(std::string("Broadcast from ") + std::to_string(fd_sender));
+    std::vector<int> dropped;
+    for (auto iter = this->clients.begin(); iter != clients.end(); ++iter) {
+      if (iter->first != fd_sender && !iter->second.is_peer) {
+        if (!sendTo(iter->first, iter->second, msg)) {
+          dropped.push_back(iter->first);
+        }
+      }
+    }
+    for (int fd : dropped) {
+      disconnect(fd);
+    }
+  };
+
+  void startWorkers() {
+    this->workers = std::make_unique<WorkPool>(this->config.workers);
+    if (this->io->watch(this->workers->fd(), EPOLLIN) < 0) {
+      EXIT_WITH_LOG_CRITICAL("Register workers to epoll failed.");
+      this->clear();
+      exit(-1);
+    }
+    LOG_INFO("Started " + std::to_string(this->workers->size()) +
+             " workers");
+  }
+
+  // The first filter is compiled right away so no message gets past
+  // unchecked. Later ones are compiled on a worker, since a long block list
+  // takes a while, and the old filter stays until the new one is ready.
+  void loadFilter(const std::string &path) {
+    if (path.empty()) {
+      if (this->filter != nullptr) {
+        LOG_INFO("Content filter off");
+      }
+      this->filter.reset();
+      return;
+    }
+    if (this->filter == nullptr) {
+      try {
+        this->filter = ContentFilter::load(path);
+        LOG_INFO("Content filter loaded " +
+                 std::to_string(this->filter->patterns()) + " patterns");
+      } catch (FilterError &e) {
+        LOG_ERROR("Loading content filter " + path + " failed: " + e.what());
+      }
+      return;
+    }
+    auto loaded = std::make_shared<std::shared_ptr<ContentFilter>>();
+    auto error = std::make_shared<std::string>();
+    this->workers->submit(
+        [path, loaded, error] {
+          try {
+            *loaded = ContentFilter::load(path);
+          } catch (FilterError &e) {
+            *error = e.what();
+          }
+        },
+        [this, path, loaded, error] {
+          if (this->config.filter_file != path) {
+            return; // turned off or replaced meanwhile
+          }
+          if (*loaded == nullptr) {
+            LOG_ERROR("Reloading content filter " + path + " failed: " +
+                      *error + ". Keeping the old one.");
+            return;
+          }
+          this->filter = *loaded;
+          LOG_INFO("Content filter reloaded " +
+                   std::to_string(this->filter->patterns()) + " patterns");
+        });
+  }
+
+  // Mask or reject msg by the content filter. False when it was rejected
+  // and must not go anywhere.
+  bool filterMessage(int fd, RecvMessage &msg) {
+    if (this->filter == nullptr) {
+      return true;
+    }
+    if (this->filter->apply(msg.content) != FILTER_REJECT) {
+      return true;
+    }
+    LOG_DEBUG("Message from " + msg.sender_name + " rejected by filter.");
+    auto iter = this->clients.find(fd);
+    RecvNotice notice("Message blocked by the content filter.");
+    if (!sendTo(fd, iter->second, this->handle.build(notice))) {
+      disconnect(fd);
+    }
+    return false;
+  }
+
+  void applyConfig(const ServerConfig &config) {
+    this->config = config;
+    loadFilter(config.filter_file);
+    this->attachments.configure(config.attachment_dir,
+                                config.attachment_limit,
+                                config.attachment_store);
+    _LOG_LEVEL = config.log_level;
+    this->history.setLimit(config.history_size);
+    tracer().setSampling(config.trace_sample);
+    if (config.search_limit > 0 && this->search == nullptr) {
+      this->search = std::make_unique<SearchService>(config.search_limit);
+      if (this->io->watch(this->search->fd(), EPOLLIN) < 0) {
+        LOG_ERROR("Register search to epoll failed. Search disabled.");
+        this->search.reset();
+      }
+    } else if (this->search != nullptr) {
+      this->search->setLimit(config.search_limit);
+    }
+    for (auto iter = this->clients.begin(); iter != this->clients.end();
+         ++iter) {
+      iter->second.setRateLimit(config.rate_limit);
+    }
+  }
+
+  bool checkExists(std::string name) {
+    for (auto iter = this->clients.begin(); iter != this->clients.end();
+         ++iter) {
+      if (iter->second.name == name) {
+        return true;
+      }
+    }
+    if (this->sessions.holdsName(name)) {
+      return true;
+    }
+    return this->federation != nullptr &&
+           this->federation->hasRemoteName(name);
+  }
+
+  // Number msg, keep it for resumed sessions and send it to everyone but
+  // fd_from.
+  void deliver(int fd_from, RecvMessage &msg) {
+    msg.seq = this->history.nextSeq();
+    auto frame = this->handle.build(msg);
+    this->history.record(msg.seq, msg.sender_name, frame);
+    if (this->search != nullptr &&
+        !this->search->index(msg.seq, msg.sender_name, msg.content)) {
+      LOG_DEBUG("Search index lagging behind. Message not indexed.");
+    }
+    broadcast(fd_from, frame);
+  }
+
+  // Queue a SEARCH for the search thread. Answered right away with no hits
+  // when search is off or the thread is too far behind.
+  void searchHistory(int fd, SendSearch &search) {
+    auto iter = this->clients.find(fd);
+    if (this->search != nullptr &&
+        this->search->search(fd, iter->second.user_id, search)) {
+      return;
+    }
+    SearchResult empty(search.id, {});
+    if (!sendTo(fd, iter->second, this->handle.build(empty))) {
+      disconnect(fd);
+    }
+  }
+
+  // Send the answers the search thread has ready to clients still there.
+  void answerSearches() {
+    for (auto &answer : this->search->takeAnswers()) {
+      auto iter = this->clients.find(answer.fd);
+      if (iter == this->clients.end() ||
+          iter->second.user_id != answer.tag) {
+        continue;
+      }
+      if (!sendTo(answer.fd, iter->second,
+                  this->handle.build(answer.result))) {
+        disconnect(answer.fd);
+      }
+    }
+  }
+
+  void offerAttachment(int fd, AttachOffer &offer) {
+    auto iter = this->clients.find(fd);
+    AttachAck ack{offer.upload,
+                  this->attachments.begin(fd, offer, iter->second.name)};
+    if (ack.id == 0) {
+      LOG_DEBUG("Attachment " + offer.name + " from " + iter->second.name +
+                " refused.");
+    }
+    if (!sendTo(fd, iter->second, this->handle.build(ack))) {
+      disconnect(fd);
+    }
+  }
+
+  // Store the next chunk of an upload and announce the file to everyone
+  // else once it is complete.
+  void receiveAttachment(int fd, AttachChunk &chunk) {
+    uint64_t id;
+    auto result = this->attachments.append(fd, chunk, id);
+    if (result == APPEND_INVALID) {
+      LOG_WARN("Invalid attachment chunk from " + std::to_string(fd));
+      disconnect(fd);
+      return;
+    }
+    if (result == APPEND_MORE) {
+      return;
+    }
+    Attachment *file = this->attachments.find(id);
+    LOG_INFO("Attachment " + file->name + " from " + file->sender + " (" +
+             std::to_string(file->length) + " bytes) stored.");
+    RecvAttachment announce(file->id, file->length, file->sender, file->name);
+    broadcast(fd, this->handle.build(announce));
+  }
+
+  // Answer with one chunk of the file. Its bytes go from the file to the
+  // socket by sendfile as the send queue gets to them, so a big download
+  // neither copies through the server nor holds up the event loop.
+  void fetchAttachment(int fd, AttachFetch &fetch) {
+    auto iter = this->clients.find(fd);
+    Attachment *file = this->attachments.find(fetch.id);
+    uint32_t length = 0;
+    if (file != nullptr && fetch.offset < file->length) {
+      length = std::min<uint64_t>({fetch.length, ATTACHMENT_CHUNK,
+                                   file->length - fetch.offset});
+    }
+    auto head =
+        this->handle.buildAttachDataHead(fetch.id, fetch.offset, length);
+    iter->second.send_queue.push(std::move(head));
+    if (length > 0) {
+      iter->second.send_queue.pushFile(file->file, fetch.offset, length);
+    }
+    if (!iter->second.send_queue.flush(fd, *this->io)) {
+      LOG_ERROR("Send failed to " + std::to_string(fd));
+      disconnect(fd);
+    } else if (iter->second.send_queue.bytes() >
+               this->config.send_queue_limit) {
+      LOG_WARN("Client " + std::to_string(fd) +
+               " fetches faster than it reads. Dropping connection.");
+      disconnect(fd);
+    }
+  }
+
+  void resumeSession(int fd, SendResume &resume) {
+    auto iter = this->clients.find(fd);
+    Session *session = this->sessions.find(resume.token);
+    if (session == nullptr) {
+      LOG_DEBUG("Unknown session. Client has to enter again.");
+      SessionInfo rejected{0, this->history.lastSeq()};
+      if (!sendTo(fd, iter->second, this->handle.build(rejected))) {
+        disconnect(fd);
+      }
+      return;
+    }
+
+    // The old connection may not have noticed the drop yet.
+    if (session->fd >= 0) {
+      auto old = this->clients.find(session->fd);
+      if (old != this->clients.end()) {
+        old->second.release();
+        disconnect(session->fd);
+      }
+    }
+    this->sessions.attach(resume.token, fd);
+    iter->second.resumeAs(session->name, session->user_id, resume.token);
+    LOG_INFO("User " + session->name + " resumed.");
+
+    // The roster goes first, so the ids of new messages are known.
+    SessionInfo info{resume.token, this->history.lastSeq()};
+    bool ok = sendTo(fd, iter->second, this->handle.build(info));
+    auto snapshot = this->roster.snapshot();
+    ok = ok && sendTo(fd, iter->second, this->handle.build(snapshot));
+    for (auto entry : this->history.since(resume.last_seq)) {
+      if (entry->sender != session->name) {
+        ok = ok && sendTo(fd, iter->second, namedFrame(*entry));
+      }
+    }
+    if (!ok) {
+      disconnect(fd);
+      return;
+    }
+    grantCredits(fd);
+  }
+
+  // The frame of entry with the sender's name instead of the id, which a
+  // resumed client has not heard of when the sender left meanwhile.
+  Data namedFrame(const HistoryEntry &entry) {
+    Data frame = entry.frame;
+    auto msg = std::get<RecvMessage>(this->handle.parseRecv(frame));
+    msg.sender_id = 0;
+    msg.sender_name = entry.sender;
+    return this->handle.build(msg);
+  }
+
+  // Users whose session ran out without a resume leave for real.
+  void expireSessions() {
+    auto now = this->io->now();
+    if (now - this->last_expire < std::chrono::seconds(1)) {
+      return;
+    }
+    this->last_expire = now;
+
+    for (auto &session : this->sessions.expire(now)) {
+      leaveRoster(-1, session.user_id, session.name);
+    }
+  }
+
+  void leaveRoster(int fd, uint32_t user_id, const std::string &name) {
+    auto delta = this->roster.leave(user_id);
+    this->broadcast(fd, this->handle.build(delta));
+    if (this->federation != nullptr) {
+      publish(this->federation->originate(PEER_LEAVE, name));
+    }
+  }
+
+  void disconnect(int fd) {
+    auto iter = this->clients.find(fd);
+    if (iter == this->clients.end()) {
+      return;
+    }
+    bool was_entered = iter->second.isEntered();
+    bool was_peer = iter->second.is_peer;
+    uint32_t user_id = iter->second.user_id;
+    uint64_t session = iter->second.session;
+    std::string name = iter->second.name;
+
+    if (this->capture != nullptr) {
+      this->capture->close(fd);
+    }
+    this->attachments.abort(fd);
+    this->dialing.erase(fd);
+    this->io->close(fd);
+    clients.erase(iter);
+    LOG_INFO("Client disconnected. Current connection is " +
+             std::to_string(getConnectionCount()));
+
+    if (was_entered && session != 0 &&
+        this->config.session_linger.count() > 0) {
+      // Quietly keep the user around for a resume.
+      this->sessions.detach(session, this->io->now() +
+                                         this->config.session_linger);
+    } else if (was_entered) {
+      this->sessions.close(session);
+      leaveRoster(fd, user_id, name);
+    }
+    if (was_peer) {
+      unlinkPeer(fd);
+    }
+  }
+
+  // Give the new member the full roster and tell everyone else about it.
+  // The member is done with before the join goes out: dropping slow
+  // clients on the way may take fd along.
+  void enterRoster(int fd, std::string name) {
+    auto iter = this->clients.find(fd);
+    auto delta = this->roster.join(name);
+    iter->second.user_id = delta.id;
+    iter->second.session = this->sessions.open(name, delta.id, fd);
+
+    auto snapshot = this->roster.snapshot();
+    SessionInfo info{iter->second.session, this->history.lastSeq()};
+    if (!sendTo(fd, iter->second, this->handle.build(snapshot)) ||
+        !sendTo(fd, iter->second, this->handle.build(info))) {
+      disconnect(fd);
+      return;
+    }
+    this->broadcast(fd, this->handle.build(delta));
+    if (this->federation != nullptr) {
+      publish(this->federation->originate(PEER_JOIN, name));
+    }
+    grantCredits(fd);
+  }
+
+  void syncRoster(int fd, uint64_t version) {
+    auto iter = this->clients.find(fd);
+    auto deltas = this->roster.since(version);
+    bool ok = true;
+    if (deltas.has_value()) {
+      for (auto &delta : deltas.value()) {
+        auto frame = this->handle.build(delta);
+        ok = ok && sendTo(fd, iter->second, frame);
+      }
+    } else {
+      auto snapshot = this->roster.snapshot();
+      ok = sendTo(fd, iter->second, this->handle.build(snapshot));
+    }
+    if (!ok) {
+      disconnect(fd);
+    }
+  }
+
+  int getConnectionCount() { return this->clients.size(); }
+};
+
+#endif
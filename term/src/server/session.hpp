@@ -0,0 +1,100 @@
+#ifndef __SERVER_SESSION_H__
+#define __SERVER_SESSION_H__
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/random.h>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+using SessionClock = std::chrono::steady_clock;
+
+// A user that entered. It outlives its connection for a while so the
+// client can resume it after a reconnect.
+struct Session {
+  uint64_t token;
+  std::string name;
+  uint32_t user_id;
+  int fd; // -1 while detached
+  SessionClock::time_point expires;
+};
+
+class SessionTable {
+  std::unordered_map<uint64_t, Session> sessions;
+
+  // Tokens are all it takes to resume a session, so each one comes straight
+  // from the kernel's CSPRNG and tells nothing about the others.
+  static uint64_t randomToken() {
+    uint64_t token;
+    while (getrandom(&token, sizeof(token), 0) != sizeof(token)) {
+      if (errno != EINTR) {
+        throw std::system_error(errno, std::generic_category(),
+                                "getrandom");
+      }
+    }
+    return token;
+  }
+
+public:
+  uint64_t open(const std::string &name, uint32_t user_id, int fd) {
+    uint64_t token;
+    do {
+      token = randomToken();
+    } while (token == 0 || this->sessions.count(token) > 0);
+    this->sessions[token] = Session{token, name, user_id, fd, {}};
+    return token;
+  }
+
+  Session *find(uint64_t token) {
+    auto iter = this->sessions.find(token);
+    return iter == this->sessions.end() ? nullptr : &iter->second;
+  }
+
+  // Keep the session until expires unless it is resumed before.
+  void detach(uint64_t token, SessionClock::time_point expires) {
+    if (auto session = find(token)) {
+      session->fd = -1;
+      session->expires = expires;
+    }
+  }
+
+  void attach(uint64_t token, int fd) {
+    if (auto session = find(token)) {
+      session->fd = fd;
+    }
+  }
+
+  void close(uint64_t token) { this->sessions.erase(token); }
+
+  // Detached sessions still hold their name.
+  bool holdsName(const std::string &name) {
+    for (auto iter = this->sessions.begin(); iter != this->sessions.end();
+         ++iter) {
+      if (iter->second.fd < 0 && iter->second.name == name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Remove and return detached sessions expired by now.
+  std::vector<Session> expire(SessionClock::time_point now) {
+    std::vector<Session> expired;
+    for (auto iter = this->sessions.begin(); iter != this->sessions.end();) {
+      if (iter->second.fd < 0 && iter->second.expires <= now) {
+        expired.push_back(iter->second);
+        iter = this->sessions.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    return expired;
+  }
+
+  size_t size() { return this->sessions.size(); }
+};
+
+#endif
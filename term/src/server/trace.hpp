@@ -0,0 +1,226 @@
+#ifndef __SERVER_TRACE_H__
+#define __SERVER_TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Events kept for the dump. Older ones are overwritten.
+#define TRACE_BUFFER_SIZE (1 << 16)
+
+enum TraceStage : uint8_t {
+  TRACE_RECV,    // read() returned the bytes completing the frame
+  TRACE_PARSE,   // Handle::feed, with its duration
+  TRACE_ENQUEUE, // frame queued for one recipient
+  TRACE_WRITE,   // that copy fully written to the socket
+};
+
+struct TraceEvent {
+  uint64_t trace_id;
+  uint64_t ts_ns;
+  uint64_t dur_ns;
+  int fd;
+  TraceStage stage;
+};
+
+// Slot sequence number while a writer has the slot.
+#define TRACE_SLOT_BUSY UINT64_MAX
+
+// Fixed ring of trace events that any thread can append to without locks.
+//
+// Every slot is a seqlock: it carries the sequence number it was last
+// written with, TRACE_SLOT_BUSY while a writer holds it, so a reader can
+// skip slots that are overwritten while it copies them. The event is kept
+// in relaxed atomic words, with fences ordering them against the sequence
+// number on both sides. A writer lapped by a later one on the same slot
+// drops its event.
+class TraceBuffer {
+  static constexpr size_t WORDS =
+      (sizeof(TraceEvent) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  static_assert(std::is_trivially_copyable_v<TraceEvent>);
+
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> words[WORDS] = {};
+  };
+  std::vector<Slot> slots;
+  std::atomic<uint64_t> head{0};
+
+public:
+  TraceBuffer(size_t size = TRACE_BUFFER_SIZE) : slots(size){};
+
+  void push(const TraceEvent &event) {
+    uint64_t index = this->head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = this->slots[index % this->slots.size()];
+    uint64_t seen = slot.seq.load(std::memory_order_relaxed);
+    do {
+      while (seen == TRACE_SLOT_BUSY) {
+        seen = slot.seq.load(std::memory_order_relaxed);
+      }
+      if (seen > index + 1) {
+        return;
+      }
+    } while (!slot.seq.compare_exchange_weak(seen, TRACE_SLOT_BUSY,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed));
+    // The words must not be written before readers can see the slot busy.
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t words[WORDS] = {};
+    std::memcpy(words, &event, sizeof(event));
+    for (size_t i = 0; i < WORDS; i++) {
+      slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.seq.store(index + 1, std::memory_order_release);
+  }
+
+  // Copy of the kept events, oldest first.
+  std::vector<TraceEvent> snapshot() {
+    std::vector<TraceEvent> events;
+    uint64_t end = this->head.load(std::memory_order_acquire);
+    uint64_t begin = end > this->slots.size() ? end - this->slots.size() : 0;
+    for (uint64_t index = begin; index < end; index++) {
+      Slot &slot = this->slots[index % this->slots.size()];
+      if (slot.seq.load(std::memory_order_acquire) != index + 1) {
+        continue;
+      }
+      uint64_t words[WORDS];
+      for (size_t i = 0; i < WORDS; i++) {
+        words[i] = slot.words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != index + 1) {
+        continue;
+      }
+      TraceEvent event;
+      std::memcpy(&event, words, sizeof(event));
+      events.push_back(event);
+    }
+    return events;
+  }
+};
+
+// Sampled tracing of frames through the server.
+//
+// sample() picks one inbound frame in every N and makes its trace id
+// current; while it is current every stage the frame passes is recorded
+// under that id. Frames queued for recipients carry the id along so the
+// write completion can be recorded later.
+class Tracer {
+  TraceBuffer buffer;
+  std::atomic<uint32_t> every{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> next_id{1};
+  static inline thread_local uint64_t current_id = 0;
+
+  static std::string stageName(const TraceEvent &event) {
+    switch (event.stage) {
+    case TRACE_RECV:
+      return "recv";
+    case TRACE_PARSE:
+      return "parse";
+    case TRACE_ENQUEUE:
+      return "queued fd " + std::to_string(event.fd);
+    case TRACE_WRITE:
+      return "written fd " + std::to_string(event.fd);
+    }
+    return "unknown";
+  }
+
+public:
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Trace one frame in every frames. 0 turns tracing off.
+  void setSampling(uint32_t every) { this->every = every; }
+
+  bool enabled() { return this->every.load(std::memory_order_relaxed) > 0; }
+
+  // Start a trace for the next inbound frame if it is sampled. Returns the
+  // trace id, 0 when not sampled.
+  uint64_t sample() {
+    uint32_t every = this->every.load(std::memory_order_relaxed);
+    if (every == 0 ||
+        this->frames.fetch_add(1, std::memory_order_relaxed) % every != 0) {
+      current_id = 0;
+      return 0;
+    }
+    current_id = this->next_id.fetch_add(1, std::memory_order_relaxed);
+    return current_id;
+  }
+
+  uint64_t current() { return current_id; }
+
+  void finish() { current_id = 0; }
+
+  void record(uint64_t trace_id, TraceStage stage, int fd, uint64_t ts_ns,
+              uint64_t dur_ns = 0) {
+    if (trace_id != 0) {
+      this->buffer.push(TraceEvent{trace_id, ts_ns, dur_ns, fd, stage});
+    }
+  }
+
+  // Chrome trace-event JSON, one row per traced frame. Time spent queued
+  // for a recipient spans from the enqueue to the write completion.
+  std::string dumpJson() {
+    auto events = this->buffer.snapshot();
+    std::map<std::pair<uint64_t, int>, uint64_t> written;
+    for (auto &event : events) {
+      if (event.stage == TRACE_WRITE) {
+        written[{event.trace_id, event.fd}] = event.ts_ns;
+      }
+    }
+
+    std::string json = "{\"traceEvents\":[";
+    std::string pid = std::to_string(getpid());
+    bool first = true;
+    for (auto &event : events) {
+      if (event.stage == TRACE_WRITE) {
+        continue;
+      }
+      uint64_t dur = event.dur_ns;
+      if (event.stage == TRACE_ENQUEUE) {
+        auto iter = written.find({event.trace_id, event.fd});
+        if (iter != written.end() && iter->second >= event.ts_ns) {
+          dur = iter->second - event.ts_ns;
+        }
+      }
+      json += first ? "" : ",";
+      first = false;
+      json += "{\"name\":\"" + stageName(event) + "\",\"cat\":\"message\"," +
+              "\"pid\":" + pid + ",\"tid\":" +
+              std::to_string(event.trace_id) +
+              ",\"ts\":" + std::to_string(event.ts_ns / 1000.0);
+      if (event.stage == TRACE_RECV) {
+        json += ",\"ph\":\"i\",\"s\":\"t\"}";
+      } else {
+        json += ",\"ph\":\"X\",\"dur\":" + std::to_string(dur / 1000.0) + "}";
+      }
+    }
+    return json + "],\"displayTimeUnit\":\"ns\"}";
+  }
+
+  bool dump(const std::string &path) {
+    std::ofstream out(path);
+    out << dumpJson();
+    return out.good();
+  }
+};
+
+inline Tracer &tracer() {
+  static Tracer instance;
+  return instance;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __SIM_CLIENT_H__
+#define __SIM_CLIENT_H__
+
+#include "src/protocol/frame.hpp"
+#include "src/protocol/names.hpp"
+#include "src/protocol/protocol.hpp"
+#include "src/server/send_queue.hpp"
+#include "src/sim/network.hpp"
+#include <string>
+#include <variant>
+#include <vector>
+
+// A chat client on a SimNetwork, speaking the wire protocol without any of
+// the real client's smarts. What the server cannot take yet waits in a
+// send queue until the next send() or receive().
+class SimClient {
+  SimNetwork &net;
+  int sock;
+  Handle handle;
+  FrameReader reader;
+  SendQueue outbox;
+  SenderNames names;
+
+public:
+  SimClient(SimNetwork &net, const MychatAddress &addr)
+      : net(net), sock(net.connect(addr)){};
+  SimClient(const SimClient &) = delete;
+
+  int fd() { return this->sock; }
+
+  // Whether the connection is still up as far as the client knows.
+  bool connected() { return this->sock >= 0; }
+
+  // Queue raw bytes, which need not be a whole frame.
+  void send(Data bytes) {
+    if (!connected()) {
+      return;
+    }
+    this->outbox.push(std::move(bytes));
+    if (!this->outbox.flush(this->sock, this->net)) {
+      close();
+    }
+  }
+
+  void enter(const std::string &name) {
+    send(this->handle.buildRaw(ENTER, name));
+  }
+
+  void say(const std::string &content) {
+    send(this->handle.buildRaw(MESSAGE, content));
+  }
+
+  // Send what is still queued and parse everything the server sent so far,
+  // with the names of message senders filled in when the roster named them.
+  // A closed or broken connection ends with connected() false.
+  std::vector<RecvPacket> receive() {
+    std::vector<RecvPacket> packets;
+    if (!connected()) {
+      return packets;
+    }
+    if (!this->outbox.flush(this->sock, this->net)) {
+      close();
+      return packets;
+    }
+    uint8_t buffer[4096];
+    while (true) {
+      ssize_t got = this->net.recv(this->sock, buffer, sizeof(buffer));
+      if (got <= 0) {
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+          close();
+        }
+        break;
+      }
+      this->reader.append(buffer, got);
+    }
+    while (auto frame = this->reader.next()) {
+      auto packet = this->handle.parseRecv(frame.value());
+      if (auto *snapshot = std::get_if<RosterSnapshot>(&packet)) {
+        this->names.learn(*snapshot);
+      } else if (auto *delta = std::get_if<RosterDelta>(&packet)) {
+        this->names.learn(*delta);
+      } else if (auto *msg = std::get_if<RecvMessage>(&packet)) {
+        this->names.resolve(*msg);
+      }
+      packets.push_back(std::move(packet));
+    }
+    return packets;
+  }
+
+  // Throw away what arrived so far without parsing it, for load tests that
+  // only care about later frames. Returns how many bytes that was. Roster
+  // frames thrown away leave the names of senders unknown.
+  size_t drain() {
+    size_t dropped = this->reader.buffered();
+    this->reader = FrameReader();
+    if (!connected()) {
+      return dropped;
+    }
+    uint8_t buffer[4096];
+    ssize_t got;
+    while ((got = this->net.recv(this->sock, buffer, sizeof(buffer))) > 0) {
+      dropped += got;
+    }
+    if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      close();
+    }
+    return dropped;
+  }
+
+  // RECV_MESSAGE contents of receive(), the rest dropped.
+  std::vector<RecvMessage> messages() {
+    std::vector<RecvMessage> messages;
+    for (auto &packet : receive()) {
+      if (std::holds_alternative<RecvMessage>(packet)) {
+        messages.push_back(std::move(std::get<RecvMessage>(packet)));
+      }
+    }
+    return messages;
+  }
+
+  void close() {
+    if (connected()) {
+      this->net.close(this->sock);
+      this->sock = -1;
+    }
+  }
+
+  // Go away without closing properly.
+  void reset() {
+    if (connected()) {
+      this->net.reset(this->sock);
+      this->sock = -1;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef __SIM_NETWORK_H__
+#define __SIM_NETWORK_H__
+
+#include "src/mychat/io.hpp"
+#include "src/protocol/pool.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <vector>
+
+// Simulated descriptors start here so they never collide with real ones the
+// code under test still opens, like eventfds and attachment files.
+#define SIM_FD_BASE (1 << 24)
+// Bytes a socket holds for its reader before sends to it get EAGAIN.
+#define SIM_SOCKET_BUFFER (256 << 10)
+
+// Faults of one simulated socket.
+struct SimFaults {
+  size_t capacity = SIM_SOCKET_BUFFER; // unread bytes held, then EAGAIN
+  size_t max_send = std::numeric_limits<size_t>::max(); // partial writes
+  size_t max_recv = std::numeric_limits<size_t>::max(); // short reads
+};
+
+// In-process stand-in for the network and the clock, so a server and as
+// many clients as needed run in one thread without sockets.
+//
+// Every call completes at once and deterministically: descriptors are
+// handed out in order, wait() reports ready ones in descriptor order, and
+// time only moves when wait() has nothing to report and would sleep, or
+// when advance() says so. Streams connect right away as long as something
+// listens on the address. Real descriptors may still be watched; wait()
+// polls them without blocking.
+//
+// Descriptors are never reused, so sockets live in a vector indexed by
+// them, and wait() only looks at the ones something happened to.
+class SimNetwork : public MychatIo {
+  struct Socket {
+    bool open;
+    bool listening;
+    std::string address;     // listening sockets only
+    std::deque<int> backlog; // connected ends not accepted yet
+    int peer;                // other end, -1 once it closed
+    std::vector<uint8_t> inbox;
+    size_t inbox_pos; // bytes of inbox already read
+    bool eof;   // the peer closed, inbox is all that is left
+    bool reset; // the peer went away abruptly
+    SimFaults faults;
+    uint32_t watched; // events asked for, 0 when not watched
+    uint32_t pending; // edges not reported yet
+
+    size_t unread() { return this->inbox.size() - this->inbox_pos; }
+  };
+
+  std::vector<Socket> sockets; // by fd - SIM_FD_BASE
+  // Watched and maybe ready, in fd order. Pooled, so steady traffic does
+  // not allocate and tests can count what the server allocates.
+  std::set<int, std::less<int>, PoolAllocator<int>> dirty;
+  std::map<std::string, int> listeners;
+  std::vector<pollfd> external; // watched real descriptors
+  int next_fd;
+  MychatClock::duration elapsed;
+
+  static std::string key(const MychatAddress &addr) {
+    if (addr.transport == MYCHAT_UNIX) {
+      return "unix:" + addr.host;
+    }
+    return "tcp:" + std::to_string(addr.port);
+  }
+
+  Socket *find(int fd) {
+    size_t index = (size_t)fd - SIM_FD_BASE;
+    if (fd < SIM_FD_BASE || index >= this->sockets.size() ||
+        !this->sockets[index].open) {
+      return nullptr;
+    }
+    return &this->sockets[index];
+  }
+
+  Socket &open(bool listening) {
+    this->next_fd++;
+    Socket &socket = this->sockets.emplace_back();
+    socket.open = true;
+    socket.listening = listening;
+    socket.peer = -1;
+    socket.inbox_pos = 0;
+    socket.eof = false;
+    socket.reset = false;
+    socket.watched = 0;
+    socket.pending = 0;
+    return socket;
+  }
+
+  // Something happened to fd that wait() may have to report.
+  void notify(int fd, uint32_t events) {
+    Socket *socket = find(fd);
+    if (socket == nullptr) {
+      return;
+    }
+    socket->pending |= events;
+    if (socket->watched != 0) {
+      this->dirty.insert(fd);
+    }
+  }
+
+  static uint32_t pollToEpoll(short revents) {
+    uint32_t events = 0;
+    events |= (revents & POLLIN) ? (uint32_t)EPOLLIN : 0;
+    events |= (revents & POLLOUT) ? (uint32_t)EPOLLOUT : 0;
+    events |= (revents & POLLHUP) ? (uint32_t)EPOLLHUP : 0;
+    events |= (revents & (POLLERR | POLLNVAL)) ? (uint32_t)EPOLLERR : 0;
+    return events;
+  }
+
+  // Events fd has right now.
+  uint32_t readiness(int, Socket &socket) {
+    if (socket.listening) {
+      return socket.backlog.empty() ? 0 : (uint32_t)EPOLLIN;
+    }
+    uint32_t events = 0;
+    if (socket.unread() > 0 || socket.eof || socket.reset) {
+      events |= EPOLLIN;
+    }
+    Socket *peer = find(socket.peer);
+    if (peer != nullptr && peer->unread() < peer->faults.capacity) {
+      events |= EPOLLOUT;
+    }
+    if (socket.eof || socket.reset) {
+      events |= EPOLLHUP;
+    }
+    if (socket.reset) {
+      events |= EPOLLERR;
+    }
+    return events;
+  }
+
+  // The other end of fd is gone, gracefully or not.
+  void hangUp(int fd, bool reset) {
+    Socket *socket = find(fd);
+    if (socket == nullptr) {
+      return;
+    }
+    socket->peer = -1;
+    socket->eof = true;
+    socket->reset = reset;
+    notify(fd, EPOLLIN | EPOLLHUP | (reset ? (uint32_t)EPOLLERR : 0));
+  }
+
+  void drop(int fd, bool reset) {
+    Socket *found = find(fd);
+    if (found == nullptr) {
+      return;
+    }
+    Socket socket = std::move(*found);
+    *found = Socket();
+    this->dirty.erase(fd);
+    if (socket.listening) {
+      this->listeners.erase(socket.address);
+      for (int pending : socket.backlog) {
+        drop(pending, reset);
+      }
+      return;
+    }
+    hangUp(socket.peer, reset);
+  }
+
+  // Append up to size bytes to the inbox of fd's peer. Same results as
+  // send(2).
+  template <typename Read>
+  ssize_t deliver(int fd, size_t size, Read read) {
+    Socket *socket = find(fd);
+    if (socket == nullptr || socket->listening) {
+      errno = EBADF;
+      return -1;
+    }
+    if (socket->reset) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    Socket *peer = find(socket->peer);
+    if (peer == nullptr) {
+      errno = EPIPE;
+      return -1;
+    }
+    size_t room = peer->faults.capacity -
+                  std::min(peer->unread(), peer->faults.capacity);
+    size_t length = std::min({size, room, socket->faults.max_send});
+    if (length == 0 && size > 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+    ssize_t got = read(peer->inbox, length);
+    if (got > 0) {
+      notify(socket->peer, EPOLLIN);
+    }
+    return got;
+  }
+
+public:
+  SimNetwork() : next_fd(SIM_FD_BASE), elapsed(std::chrono::hours(1)){};
+  SimNetwork(const SimNetwork &) = delete;
+
+  int listen(const MychatAddress &addr, int) override {
+    std::string address = key(addr);
+    if (this->listeners.count(address) > 0) {
+      return MYCHAT_SERVE_ERR_SOCKET_BINDING_FAILED;
+    }
+    int fd = this->next_fd;
+    open(true).address = address;
+    this->listeners[address] = fd;
+    return fd;
+  }
+
+  int connect(const MychatAddress &addr) override {
+    auto listener = this->listeners.find(key(addr));
+    if (listener == this->listeners.end()) {
+      errno = ECONNREFUSED;
+      return MYCHAT_ENTER_SOCKET_CONNECTING_FAILED;
+    }
+    int client = this->next_fd;
+    open(false);
+    int server = this->next_fd;
+    open(false).peer = client;
+    find(client)->peer = server;
+    find(listener->second)->backlog.push_back(server);
+    notify(listener->second, EPOLLIN);
+    return client;
+  }
+
+  int accept(int fd) override {
+    Socket *socket = find(fd);
+    if (socket == nullptr || !socket->listening) {
+      errno = EBADF;
+      return -1;
+    }
+    if (socket->backlog.empty()) {
+      errno = EAGAIN;
+      return -1;
+    }
+    int accepted = socket->backlog.front();
+    socket->backlog.pop_front();
+    return accepted;
+  }
+
+  ssize_t recv(int fd, void *buffer, size_t size) override {
+    Socket *socket = find(fd);
+    if (socket == nullptr || socket->listening) {
+      errno = EBADF;
+      return -1;
+    }
+    if (socket->reset) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (socket->unread() == 0) {
+      if (socket->eof) {
+        return 0;
+      }
+      errno = EAGAIN;
+      return -1;
+    }
+    size_t length =
+        std::min({size, socket->unread(), socket->faults.max_recv});
+    std::copy_n(socket->inbox.begin() + socket->inbox_pos, length,
+                (uint8_t *)buffer);
+    socket->inbox_pos += length;
+    if (socket->inbox_pos == socket->inbox.size()) {
+      socket->inbox.clear();
+      socket->inbox_pos = 0;
+    } else if (socket->inbox_pos > socket->inbox.size() / 2) {
+      socket->inbox.erase(socket->inbox.begin(),
+                          socket->inbox.begin() + socket->inbox_pos);
+      socket->inbox_pos = 0;
+    }
+    notify(socket->peer, EPOLLOUT);
+    return length;
+  }
+
+  ssize_t send(int fd, const void *buffer, size_t size) override {
+    auto bytes = (const uint8_t *)buffer;
+    return deliver(fd, size, [bytes](std::vector<uint8_t> &inbox,
+                                     size_t length) -> ssize_t {
+      inbox.insert(inbox.end(), bytes, bytes + length);
+      return length;
+    });
+  }
+
+  // The file is real; its bytes are read with pread.
+  ssize_t sendfile(int fd, int file, off_t *offset, size_t size) override {
+    return deliver(fd, size, [file, offset](std::vector<uint8_t> &inbox,
+                                            size_t length) -> ssize_t {
+      std::vector<uint8_t> bytes(length);
+      ssize_t got = pread(file, bytes.data(), length, *offset);
+      if (got > 0) {
+        inbox.insert(inbox.end(), bytes.begin(), bytes.begin() + got);
+        *offset += got;
+      }
+      return got;
+    });
+  }
+
+  int close(int fd) override {
+    if (fd < SIM_FD_BASE) {
+      std::erase_if(this->external,
+                    [fd](const pollfd &watched) { return watched.fd == fd; });
+      return ::close(fd);
+    }
+    if (find(fd) == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    drop(fd, false);
+    return 0;
+  }
+
+  // Accepted and ignored on simulated sockets.
+  int setsockopt(int fd, int, int, const void *, socklen_t) override {
+    if (find(fd) == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    return 0;
+  }
+
+  // Only SO_ERROR, which is ECONNRESET once the peer reset the stream.
+  int getsockopt(int fd, int level, int name, void *value,
+                 socklen_t *size) override {
+    Socket *socket = find(fd);
+    if (socket == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    if (level != SOL_SOCKET || name != SO_ERROR || *size < sizeof(int)) {
+      errno = ENOPROTOOPT;
+      return -1;
+    }
+    *(int *)value = socket->reset ? ECONNRESET : 0;
+    *size = sizeof(int);
+    return 0;
+  }
+
+  // Close fd abruptly: its peer reads ECONNRESET instead of an end of file.
+  void reset(int fd) { drop(fd, true); }
+
+  int watch(int fd, uint32_t events) override {
+    if (fd < SIM_FD_BASE) {
+      pollfd watched{fd, 0, 0};
+      watched.events |= (events & EPOLLIN) ? POLLIN : 0;
+      watched.events |= (events & EPOLLOUT) ? POLLOUT : 0;
+      this->external.push_back(watched);
+      return 0;
+    }
+    Socket *socket = find(fd);
+    if (socket == nullptr) {
+      errno = EBADF;
+      return -1;
+    }
+    socket->watched = events;
+    socket->pending = readiness(fd, *socket);
+    this->dirty.insert(fd);
+    return 0;
+  }
+
+  int wait(epoll_event *events, int max, int timeout) override {
+    int count = 0;
+    auto iter = this->dirty.begin();
+    while (iter != this->dirty.end() && count < max) {
+      int fd = *iter;
+      Socket &socket = *find(fd);
+      uint32_t now_ready = readiness(fd, socket);
+      uint32_t ready =
+          (socket.watched & EPOLLET) ? socket.pending & now_ready : now_ready;
+      socket.pending = 0;
+      ready &= socket.watched | EPOLLHUP | EPOLLERR;
+      if (ready != 0) {
+        events[count].events = ready;
+        events[count].data.fd = fd;
+        count++;
+      }
+      // Level triggered ones stay until they are not ready any more.
+      if ((socket.watched & EPOLLET) || ready == 0) {
+        iter = this->dirty.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    if (count < max && !this->external.empty() &&
+        poll(this->external.data(), this->external.size(), 0) > 0) {
+      for (auto &watched : this->external) {
+        if (watched.revents != 0 && count < max) {
+          events[count].events = pollToEpoll(watched.revents);
+          events[count].data.fd = watched.fd;
+          count++;
+        }
+      }
+    }
+    if (count == 0 && timeout > 0) {
+      this->elapsed += std::chrono::milliseconds(timeout);
+    }
+    return count;
+  }
+
+  MychatClock::time_point now() override {
+    return MychatClock::time_point(this->elapsed);
+  }
+
+  void advance(MychatClock::duration duration) { this->elapsed += duration; }
+
+  // Faults of fd, to change before or while it is used.
+  SimFaults &faults(int fd) { return find(fd)->faults; }
+
+  // Other end of a stream, -1 once it closed. For a client that is the
+  // server's descriptor of the connection.
+  int peer(int fd) {
+    Socket *socket = find(fd);
+    return socket == nullptr ? -1 : socket->peer;
+  }
+
+  // Bytes fd has not read yet.
+  size_t unread(int fd) {
+    Socket *socket = find(fd);
+    return socket == nullptr ? 0 : socket->unread();
+  }
+};
+
+#endif
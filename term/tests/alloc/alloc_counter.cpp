@@ -0,0 +1,92 @@
+#include "tests/alloc/alloc_counter.h"
+#include <cstdlib>
+#include <new>
+
+std::atomic<uint64_t> g_alloc_count(0);
+thread_local uint64_t t_alloc_count = 0;
+
+// Every form of new below is counted and takes its memory from malloc or
+// aligned_alloc, and every form of delete gives it back with free, so any
+// new can be paired with the delete of the same form.
+
+static void *allocate(std::size_t size) noexcept {
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  t_alloc_count++;
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+static void *allocateAligned(std::size_t size,
+                             std::align_val_t align) noexcept {
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  t_alloc_count++;
+  std::size_t alignment = static_cast<std::size_t>(align);
+  // aligned_alloc wants a size that is a multiple of the alignment.
+  std::size_t rounded = (size + alignment - 1) / alignment * alignment;
+  return std::aligned_alloc(alignment, rounded == 0 ? alignment : rounded);
+}
+
+void *operator new(std::size_t size) {
+  if (void *ptr = allocate(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+  if (void *ptr = allocate(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  if (void *ptr = allocateAligned(size, align)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+  if (void *ptr = allocateAligned(size, align)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
@@ -0,0 +1,12 @@
+#ifndef __ALLOC_ALLOC_COUNTER_H__
+#define __ALLOC_ALLOC_COUNTER_H__
+#include <atomic>
+#include <cstdint>
+
+// Number of calls to global operator new since process start. Linking
+// alloc_counter replaces the global operators of the whole binary.
+extern std::atomic<uint64_t> g_alloc_count;
+// The calling thread's share of g_alloc_count.
+extern thread_local uint64_t t_alloc_count;
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __BENCH_BENCH_H__
+#define __BENCH_BENCH_H__
+#include "benchmark/benchmark.h"
+#include "src/protocol/packet.hpp"
+#include "tests/alloc/alloc_counter.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Counts allocations made while the benchmark loop runs and reports them as
+// "allocs/op".
+class AllocScope {
+  benchmark::State &state;
+  uint64_t start;
+
+public:
+  AllocScope(benchmark::State &state)
+      : state(state), start(g_alloc_count.load(std::memory_order_relaxed)){};
+
+  ~AllocScope() {
+    double allocs = g_alloc_count.load(std::memory_order_relaxed) - start;
+    state.counters["allocs/op"] =
+        benchmark::Counter(allocs, benchmark::Counter::kAvgIterations);
+  }
+};
+
+// Message sizes from 8 B to 64 KiB.
+#define BENCH_MESSAGE_SIZES RangeMultiplier(8)->Range(8, 64 << 10)
+#endif
@@ -0,0 +1,78 @@
+#include "src/server/attachment.hpp"
+#include "src/server/send_queue.hpp"
+#include "tests/bench/bench.h"
+#include <atomic>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#define BENCH_ATTACHMENT_SIZE (64 << 20)
+
+// A stored attachment, read once so it sits in the page cache like a file
+// just uploaded does.
+static std::shared_ptr<OpenFile> benchFile() {
+  int fd = open("/tmp", O_TMPFILE | O_RDWR, 0600);
+  std::string block(1 << 20, 'a');
+  for (int i = 0; i < BENCH_ATTACHMENT_SIZE / (1 << 20); i++) {
+    (void)!write(fd, block.data(), block.size());
+  }
+  return std::make_shared<OpenFile>(fd);
+}
+
+// Relay the whole file to one recipient through its SendQueue, one
+// ATTACHMENT_CHUNK at a time as fetches would ask for it. range(0) 1 queues
+// file spans sent with sendfile, 0 reads every chunk into a frame first as
+// a relay through user space would. A thread drains the other end.
+static void BM_AttachmentRelay(benchmark::State &state) {
+  bool zero_copy = state.range(0) == 1;
+  auto file = benchFile();
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  std::atomic<bool> stop{false};
+  std::thread reader([&] {
+    std::vector<char> buffer(1 << 20);
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (read(fds[1], buffer.data(), buffer.size()) <= 0) {
+        break;
+      }
+    }
+  });
+
+  SendQueue queue;
+  for (auto _ : state) {
+    for (uint64_t offset = 0; offset < BENCH_ATTACHMENT_SIZE;
+         offset += ATTACHMENT_CHUNK) {
+      if (zero_copy) {
+        queue.pushFile(file, offset, ATTACHMENT_CHUNK);
+      } else {
+        Data chunk(ATTACHMENT_CHUNK);
+        (void)!pread(file->fd(), chunk.data(), chunk.size(), offset);
+        queue.push(std::move(chunk));
+      }
+      while (!queue.empty()) {
+        queue.flush(fds[0]);
+        if (!queue.empty()) {
+          pollfd writable{fds[0], POLLOUT, 0};
+          poll(&writable, 1, -1);
+        }
+      }
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * BENCH_ATTACHMENT_SIZE);
+
+  stop = true;
+  shutdown(fds[0], SHUT_WR);
+  reader.join();
+  close(fds[0]);
+  close(fds[1]);
+}
+BENCHMARK(BM_AttachmentRelay)
+    ->ArgName("zero_copy")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
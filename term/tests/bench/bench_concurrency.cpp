@@ -0,0 +1,128 @@
+#include "src/concurrency/epoch.hpp"
+#include "src/concurrency/mpsc_queue.hpp"
+#include "src/concurrency/spsc_ring.hpp"
+#include "src/concurrency/wakeup.hpp"
+#include "tests/bench/bench.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#define BENCH_QUEUE_CAPACITY 1024
+#define BENCH_BATCH 64
+
+// Items per second from a producer thread to the benchmark thread, popped in
+// batches of up to range(0). Either side yields when it cannot make progress,
+// so the numbers stay meaningful on a single core.
+static void BM_SpscRingThroughput(benchmark::State &state) {
+  SpscRing<uint64_t> ring(BENCH_QUEUE_CAPACITY);
+  std::atomic<bool> stop{false};
+  std::thread producer([&] {
+    uint64_t value = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (ring.push(value)) {
+        value++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::vector<uint64_t> batch;
+  batch.reserve(state.range(0));
+  uint64_t received = 0;
+  for (auto _ : state) {
+    batch.clear();
+    while (ring.popBatch(batch, state.range(0)) == 0) {
+      std::this_thread::yield();
+    }
+    received += batch.size();
+  }
+  stop = true;
+  producer.join();
+  state.SetItemsProcessed(received);
+}
+BENCHMARK(BM_SpscRingThroughput)->Arg(1)->Arg(BENCH_BATCH)->UseRealTime();
+
+// Items per second from range(0) producer threads to the benchmark thread.
+static void BM_MpscQueueThroughput(benchmark::State &state) {
+  MpscQueue<uint64_t> queue(BENCH_QUEUE_CAPACITY);
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> producers;
+  for (int i = 0; i < state.range(0); i++) {
+    producers.emplace_back([&] {
+      uint64_t value = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (queue.push(value)) {
+          value++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<uint64_t> batch;
+  batch.reserve(BENCH_BATCH);
+  uint64_t received = 0;
+  for (auto _ : state) {
+    batch.clear();
+    while (queue.popBatch(batch, BENCH_BATCH) == 0) {
+      std::this_thread::yield();
+    }
+    received += batch.size();
+  }
+  stop = true;
+  for (auto &thread : producers) {
+    thread.join();
+  }
+  state.SetItemsProcessed(received);
+}
+BENCHMARK(BM_MpscQueueThroughput)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+
+// Cost of a notify when the owner has not drained yet, i.e. the common case
+// of a producer signalling every item it queues.
+static void BM_WakeupNotifyPending(benchmark::State &state) {
+  Wakeup wakeup;
+  wakeup.notify();
+  for (auto _ : state) {
+    wakeup.notify();
+  }
+  wakeup.drain();
+}
+BENCHMARK(BM_WakeupNotifyPending);
+
+// notify() followed by drain(): the two syscalls of one real wakeup.
+static void BM_WakeupRoundTrip(benchmark::State &state) {
+  Wakeup wakeup;
+  for (auto _ : state) {
+    wakeup.notify();
+    benchmark::DoNotOptimize(wakeup.drain());
+  }
+}
+BENCHMARK(BM_WakeupRoundTrip);
+
+// Read-side cost of epoch protection.
+static void BM_EpochPin(benchmark::State &state) {
+  EpochReclaimer reclaimer;
+  auto self = reclaimer.join();
+  for (auto _ : state) {
+    EpochReclaimer::Guard guard(self);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_EpochPin);
+
+// Swapping and retiring a shared message buffer, including the amortized
+// collection.
+static void BM_EpochRetire(benchmark::State &state) {
+  EpochReclaimer reclaimer;
+  auto self = reclaimer.join();
+  for (auto _ : state) {
+    self.retire(new Data(state.range(0)));
+  }
+  self.collect();
+  self.collect();
+  self.collect();
+}
+BENCHMARK(BM_EpochRetire)->Arg(64)->Arg(4096);
@@ -0,0 +1,35 @@
+#include "src/logging/logging.hpp"
+#include "src/protocol/packet.hpp"
+#include "src/protocol/protocol.hpp"
+#include "src/server/connection.hpp"
+#include "tests/bench/bench.h"
+#include <string>
+
+// Entered connection dispatching MESSAGE frames into a broadcast sink.
+static void BM_ConnectionFeed(benchmark::State &state) {
+  setLevel(INFO);
+  Handle handle;
+  size_t broadcasted = 0;
+  ConnectionHandlers handlers;
+  handlers.message = [&](int sender, RecvMessage &msg) {
+    broadcasted += handle.build(msg).size();
+  };
+  handlers.checkExists = [](std::string name) { return false; };
+  handlers.disconnect = [](int sock) {};
+  handlers.entered = [](int sock, std::string name) {};
+  handlers.sync = [](int sock, uint64_t version) {};
+  Connection conn(3, handlers, handle);
+  Data enter = Handle::buildRaw(ENTER, "bench");
+  conn.feed(enter);
+  Data frame = Handle::buildRaw(MESSAGE, std::string(state.range(0), 'a'));
+
+  {
+    AllocScope allocs(state);
+    for (auto _ : state) {
+      conn.feed(frame);
+    }
+  }
+  benchmark::DoNotOptimize(broadcasted);
+  state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_ConnectionFeed)->BENCH_MESSAGE_SIZES;
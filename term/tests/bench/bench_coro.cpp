@@ -0,0 +1,88 @@
+#include "src/coro/task.hpp"
+#include "tests/bench/bench.h"
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+// Hands one value at a time to a coroutine waiting for it, like
+// Connection::feed does with frames.
+struct Mailbox {
+  struct Awaiter {
+    Mailbox *box;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      this->box->waiting = handle;
+    }
+    uint64_t await_resume() { return this->box->value; }
+  };
+
+  std::coroutine_handle<> waiting;
+  uint64_t value = 0;
+
+  Awaiter next() { return Awaiter{this}; }
+  void push(uint64_t value) {
+    this->value = value;
+    std::exchange(this->waiting, nullptr).resume();
+  }
+};
+
+// Per frame dispatch the way Connection used to do it: a std::function
+// handler called for every frame.
+static void BM_CallbackDispatch(benchmark::State &state) {
+  uint64_t sum = 0;
+  std::function<void(uint64_t)> handler = [&sum](uint64_t value) {
+    sum += value;
+  };
+  uint64_t value = 0;
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    handler(value++);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_CallbackDispatch);
+
+// The same with the handler written as a coroutine resumed for every frame.
+static void BM_CoroutineDispatch(benchmark::State &state) {
+  uint64_t sum = 0;
+  Mailbox box;
+  auto body = [&box, &sum]() -> Task<> {
+    while (true) {
+      sum += co_await box.next();
+    }
+  };
+  Task<> task = body();
+  task.start();
+  uint64_t value = 0;
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    box.push(value++);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_CoroutineDispatch);
+
+static Task<uint64_t> addOne(uint64_t value) { co_return value + 1; }
+
+// Awaiting a nested task per frame, as a multi-step handler does. The frame
+// comes from BufferPool, so allocs/op stays 0.
+static void BM_NestedTask(benchmark::State &state) {
+  uint64_t sum = 0;
+  Mailbox box;
+  auto body = [&box, &sum]() -> Task<> {
+    while (true) {
+      sum += co_await addOne(co_await box.next());
+    }
+  };
+  Task<> task = body();
+  task.start();
+  uint64_t value = 0;
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    box.push(value++);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_NestedTask);
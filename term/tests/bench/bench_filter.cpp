@@ -0,0 +1,106 @@
+#include "src/server/filter.hpp"
+#include "tests/bench/bench.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define BENCH_FILTER_TEXT (1 << 20)
+
+static uint64_t nextRandom(uint64_t &state) {
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return state >> 33;
+}
+
+static std::string randomWord(uint64_t &state, size_t min, size_t max) {
+  std::string word(min + nextRandom(state) % (max - min + 1), ' ');
+  for (auto &c : word) {
+    c = 'a' + nextRandom(state) % 26;
+  }
+  return word;
+}
+
+// range(0) block list entries: random words of 5 to 12 letters and one link
+// in every ten, all masked.
+static std::vector<FilterRule> benchRules(size_t count) {
+  std::vector<FilterRule> rules;
+  uint64_t state = 42;
+  for (size_t i = 0; i < count; i++) {
+    std::string pattern = randomWord(state, 5, 12);
+    if (i % 10 == 0) {
+      pattern = "http://" + pattern + ".example";
+    }
+    rules.push_back(FilterRule{pattern, FILTER_MASK});
+  }
+  return rules;
+}
+
+// Chat-like text of short words and the odd capital and punctuation, none
+// of them on the list.
+static std::string benchText() {
+  std::string text;
+  uint64_t state = 7;
+  while (text.size() < BENCH_FILTER_TEXT) {
+    std::string word = randomWord(state, 1, 7);
+    if (nextRandom(state) % 8 == 0) {
+      word[0] -= 'a' - 'A';
+    }
+    text += word + (nextRandom(state) % 10 == 0 ? ". " : " ");
+  }
+  text.resize(BENCH_FILTER_TEXT);
+  return text;
+}
+
+// Clean messages of range(1) bytes against range(0) patterns. Bytes per
+// second is the number to watch.
+static void BM_FilterClean(benchmark::State &state) {
+  ContentFilter filter(benchRules(state.range(0)));
+  std::string text = benchText();
+  size_t size = state.range(1);
+  std::vector<std::string> messages;
+  for (size_t pos = 0; pos + size <= text.size(); pos += size) {
+    messages.push_back(text.substr(pos, size));
+  }
+  size_t index = 0;
+  size_t masked = 0;
+  for (auto _ : state) {
+    std::string &message = messages[index++ % messages.size()];
+    masked += filter.apply(message) == FILTER_MASK;
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+  state.counters["states"] = filter.states();
+  state.counters["KiB"] = filter.footprint() / 1024.0;
+  state.counters["masked"] = masked;
+}
+BENCHMARK(BM_FilterClean)
+    ->ArgNames({"patterns", "bytes"})
+    ->ArgsProduct({{100, 5000}, {64, 1024, 64 << 10}});
+
+// The same messages searched pattern by pattern, as a baseline.
+static void BM_FilterNaive(benchmark::State &state) {
+  auto rules = benchRules(state.range(0));
+  std::string text = benchText();
+  size_t size = state.range(1);
+  size_t found = 0;
+  size_t pos = 0;
+  for (auto _ : state) {
+    std::string_view message(text.data() + pos, size);
+    for (auto &rule : rules) {
+      found += message.find(rule.pattern) != std::string_view::npos;
+    }
+    pos = (pos + size) % (text.size() - size);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+  benchmark::DoNotOptimize(found);
+}
+BENCHMARK(BM_FilterNaive)
+    ->ArgNames({"patterns", "bytes"})
+    ->ArgsProduct({{100, 5000}, {1024}});
+
+static void BM_FilterCompile(benchmark::State &state) {
+  auto rules = benchRules(state.range(0));
+  for (auto _ : state) {
+    ContentFilter filter(rules);
+    benchmark::DoNotOptimize(filter.states());
+  }
+}
+BENCHMARK(BM_FilterCompile)->Arg(5000)->Unit(benchmark::kMillisecond);
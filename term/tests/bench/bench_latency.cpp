@@ -0,0 +1,124 @@
+#include "src/mychat/mychat.hpp"
+#include "src/server/server.hpp"
+#include "tests/bench/bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_LATENCY_PORT 19480
+
+static bool readFull(int fd, void *buffer, size_t size) {
+  size_t pos = 0;
+  while (pos < size) {
+    int n = mychat_recv(fd, (uint8_t *)buffer + pos, size - pos);
+    if (n <= 0) {
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+// Type of the next frame of fd, its payload skipped. -1 when fd closed.
+static int skipFrame(int fd) {
+  Header header;
+  if (!readFull(fd, &header, sizeof(header))) {
+    return -1;
+  }
+  std::vector<uint8_t> payload(header.size);
+  if (!readFull(fd, payload.data(), payload.size())) {
+    return -1;
+  }
+  return header.type;
+}
+
+// Enter as name and read up to the SESSION the server answers with.
+static int enter(int port, const std::string &name) {
+  int sock = mychat_connect(mychat_address("127.0.0.1", port));
+  int on = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  Data frame = Handle::buildRaw(ENTER, name);
+  mychat_send(sock, frame.data(), frame.size());
+  int type;
+  while ((type = skipFrame(sock)) != SESSION && type >= 0) {
+  }
+  return sock;
+}
+
+static double percentile(std::vector<double> &samples, double rank) {
+  size_t index = std::min(samples.size() - 1,
+                          (size_t)(rank * (samples.size() - 1) + 0.5));
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+// One message from alice to bob through a server on loopback TCP, timed
+// from alice's send to bob having the whole RECV_MESSAGE. range(0) 1 runs
+// the server in low latency mode, pinned to the last CPU when there is more
+// than one. Reports percentiles in microseconds.
+static void BM_EndToEndLatency(benchmark::State &state) {
+  bool low_latency = state.range(0) == 1;
+  int port = BENCH_LATENCY_PORT + state.range(0);
+  ServerConfig config;
+  config.log_level = ERROR;
+  config.search_limit = 0;
+  config.workers = 1;
+  config.low_latency = low_latency;
+  unsigned cpus = std::thread::hardware_concurrency();
+  if (low_latency && cpus > 1) {
+    config.cpus = {(int)cpus - 1};
+  }
+
+  Server server(port, 16, 16, "", nullptr, config);
+  std::atomic<bool> started{false};
+  std::atomic<bool> running{true};
+  std::thread loop([&] {
+    server.start();
+    started = true;
+    while (running.load(std::memory_order_relaxed)) {
+      server.step();
+    }
+    server.stop();
+    server.step();
+  });
+  while (!started) {
+    std::this_thread::yield();
+  }
+
+  int alice = enter(port, "alice");
+  int bob = enter(port, "bob");
+  Data ping = Handle::buildRaw(MESSAGE, "ping1234");
+  std::vector<double> samples;
+  for (auto _ : state) {
+    auto start = std::chrono::steady_clock::now();
+    mychat_send(alice, ping.data(), ping.size());
+    int type;
+    while ((type = skipFrame(bob)) != RECV_MESSAGE && type >= 0) {
+    }
+    samples.push_back(std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+  }
+  state.counters["p50_us"] = percentile(samples, 0.5);
+  state.counters["p99_us"] = percentile(samples, 0.99);
+  state.counters["p999_us"] = percentile(samples, 0.999);
+
+  close(alice);
+  close(bob);
+  running = false;
+  loop.join();
+}
+BENCHMARK(BM_EndToEndLatency)
+    ->ArgName("low_latency")
+    ->Arg(0)
+    ->Arg(1)
+    ->Iterations(20000)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
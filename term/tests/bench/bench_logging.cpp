@@ -0,0 +1,27 @@
+#include "src/logging/logging.hpp"
+#include "tests/bench/bench.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Level of the log call compared with the configured level. Output of enabled
+// calls goes to a discarded buffer so the terminal is not measured.
+static void BM_Log(benchmark::State &state, int level) {
+  std::ostringstream sink;
+  auto origin = std::cout.rdbuf(sink.rdbuf());
+  setLevel(INFO);
+  std::string msg(state.range(0), 'a');
+
+  {
+    AllocScope allocs(state);
+    for (auto _ : state) {
+      log(level, msg);
+      if (sink.tellp() > (1 << 20)) {
+        sink.str("");
+      }
+    }
+  }
+  std::cout.rdbuf(origin);
+}
+BENCHMARK_CAPTURE(BM_Log, enabled, WARN)->BENCH_MESSAGE_SIZES;
+BENCHMARK_CAPTURE(BM_Log, disabled, DEBUG)->BENCH_MESSAGE_SIZES;
@@ -0,0 +1,79 @@
+#include "src/logging/logging.hpp"
+#include "src/protocol/packet.hpp"
+#include "src/protocol/protocol.hpp"
+#include "tests/bench/bench.h"
+#include <string>
+
+static void BM_HandleFeed(benchmark::State &state) {
+  setLevel(INFO);
+  Handle handle;
+  Data frame = Handle::buildRaw(MESSAGE, std::string(state.range(0), 'a'));
+
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    auto packet = handle.feed(frame);
+    benchmark::DoNotOptimize(packet);
+  }
+  state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_HandleFeed)->BENCH_MESSAGE_SIZES;
+
+static void BM_HandleParseRecvMessage(benchmark::State &state) {
+  setLevel(INFO);
+  Handle handle;
+  RecvMessage msg("sender", Text(state.range(0), 'a'));
+  Data frame = handle.build(msg);
+
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    auto packet = handle.parseRecv(frame);
+    benchmark::DoNotOptimize(packet);
+  }
+  state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_HandleParseRecvMessage)->BENCH_MESSAGE_SIZES;
+
+static void BM_HandleParseRecvNotice(benchmark::State &state) {
+  setLevel(INFO);
+  Handle handle;
+  RecvNotice ntc(std::string(state.range(0), 'a'));
+  Data frame = handle.build(ntc);
+
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    auto packet = handle.parseRecv(frame);
+    benchmark::DoNotOptimize(packet);
+  }
+  state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_HandleParseRecvNotice)->BENCH_MESSAGE_SIZES;
+
+static void BM_BuildRecvMessage(benchmark::State &state) {
+  setLevel(INFO);
+  Handle handle;
+  RecvMessage msg("sender", Text(state.range(0), 'a'));
+
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    auto data = handle.build(msg);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          (sizeof(Header) + payloadSize(msg)));
+}
+BENCHMARK(BM_BuildRecvMessage)->BENCH_MESSAGE_SIZES;
+
+static void BM_BuildRecvNotice(benchmark::State &state) {
+  setLevel(INFO);
+  Handle handle;
+  RecvNotice ntc(std::string(state.range(0), 'a'));
+
+  AllocScope allocs(state);
+  for (auto _ : state) {
+    auto data = handle.build(ntc);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          (sizeof(Header) + payloadSize(ntc)));
+}
+BENCHMARK(BM_BuildRecvNotice)->BENCH_MESSAGE_SIZES;
@@ -0,0 +1,70 @@
+#include "src/server/search.hpp"
+#include "tests/bench/bench.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define BENCH_SEARCH_MESSAGES 1000000
+#define BENCH_SEARCH_VOCABULARY 50000
+
+// Words skewed towards the start of the vocabulary, so "w0" is in most
+// messages and words past a few thousand are rare.
+static std::string benchMessage(uint64_t &state) {
+  std::string content;
+  for (int i = 0; i < 8; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    double r = (state >> 11) * (1.0 / (1ULL << 53));
+    content += "w" + std::to_string((uint64_t)(r * r * r *
+                                               BENCH_SEARCH_VOCABULARY)) +
+               " ";
+  }
+  return content;
+}
+
+static SearchIndex &benchIndex() {
+  static std::unique_ptr<SearchIndex> index;
+  if (!index) {
+    index = std::make_unique<SearchIndex>(BENCH_SEARCH_MESSAGES);
+    uint64_t state = 1;
+    for (uint64_t seq = 1; seq <= BENCH_SEARCH_MESSAGES; seq++) {
+      index->add(seq, "bench", benchMessage(state));
+    }
+  }
+  return *index;
+}
+
+static void BM_SearchIndexAdd(benchmark::State &state) {
+  SearchIndex index(BENCH_SEARCH_MESSAGES);
+  std::vector<std::string> messages;
+  uint64_t rng = 1;
+  for (int i = 0; i < 4096; i++) {
+    messages.push_back(benchMessage(rng));
+  }
+  uint64_t seq = 0;
+  for (auto _ : state) {
+    index.add(seq + 1, "bench", messages[seq % messages.size()]);
+    seq++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SearchIndexAdd);
+
+// Top 10 over a million messages: a frequent word, two frequent words, a
+// frequent and a rare word, and two rare words that seldom meet.
+static void BM_SearchQuery(benchmark::State &state, const char *query) {
+  SearchIndex &index = benchIndex();
+  SendSearch search(1, 10, query);
+  size_t hits = 0;
+  for (auto _ : state) {
+    hits = index.query(search).hits.size();
+  }
+  state.counters["hits"] = hits;
+}
+BENCHMARK_CAPTURE(BM_SearchQuery, common, "w0")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SearchQuery, common_pair, "w0 w1")
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SearchQuery, common_rare, "w0 w20000")
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SearchQuery, rare_pair, "w9000 w20000")
+    ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,124 @@
+#include "src/mychat/mychat.hpp"
+#include "tests/bench/bench.h"
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_UNIX_PATH "/tmp/mychat_bench.sock"
+
+static bool readFull(int fd, uint8_t *buffer, size_t size) {
+  size_t pos = 0;
+  while (pos < size) {
+    int n = mychat_recv(fd, buffer + pos, size - pos);
+    if (n <= 0) {
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+static bool writeFull(int fd, const uint8_t *buffer, size_t size) {
+  size_t pos = 0;
+  while (pos < size) {
+    int n = mychat_send(fd, buffer + pos, size - pos);
+    if (n <= 0) {
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+// Connected client/peer pair over the given transport.
+class TransportPair {
+public:
+  int listener;
+  int client;
+  int peer;
+
+  TransportPair(MychatTransport transport)
+      : listener(-1), client(-1), peer(-1) {
+    MychatAddress addr;
+    if (transport == MYCHAT_UNIX) {
+      addr = mychat_address(MYCHAT_UNIX_PREFIX BENCH_UNIX_PATH, 0);
+      this->listener = mychat_listen(addr, 1);
+    } else {
+      this->listener = mychat_serve(0, 1);
+      sockaddr_in bound;
+      socklen_t size = sizeof(bound);
+      getsockname(this->listener, (sockaddr *)&bound, &size);
+      addr = mychat_address("127.0.0.1", ntohs(bound.sin_port));
+    }
+    this->client = mychat_connect(addr);
+    this->peer = mychat_accept(this->listener, nullptr, nullptr);
+  };
+
+  ~TransportPair() {
+    mychat_close(this->client);
+    mychat_close(this->peer);
+    mychat_close(this->listener);
+    unlink(BENCH_UNIX_PATH);
+  }
+};
+
+// Round trip of one message; the peer echoes everything back.
+static void BM_TransportPingPong(benchmark::State &state,
+                                 MychatTransport transport) {
+  TransportPair pair(transport);
+  size_t size = state.range(0);
+  std::thread echo([&]() {
+    std::vector<uint8_t> buffer(size);
+    while (readFull(pair.peer, buffer.data(), size) &&
+           writeFull(pair.peer, buffer.data(), size)) {
+    }
+  });
+
+  std::vector<uint8_t> buffer(size, 'a');
+  for (auto _ : state) {
+    writeFull(pair.client, buffer.data(), size);
+    readFull(pair.client, buffer.data(), size);
+  }
+  shutdown(pair.client, SHUT_WR);
+  echo.join();
+  state.SetBytesProcessed(state.iterations() * size * 2);
+}
+BENCHMARK_CAPTURE(BM_TransportPingPong, tcp, MYCHAT_TCP)
+    ->RangeMultiplier(16)
+    ->Range(64, 64 << 10)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_TransportPingPong, unix, MYCHAT_UNIX)
+    ->RangeMultiplier(16)
+    ->Range(64, 64 << 10)
+    ->UseRealTime();
+
+// One-way stream; the peer only drains.
+static void BM_TransportStream(benchmark::State &state,
+                               MychatTransport transport) {
+  TransportPair pair(transport);
+  size_t size = state.range(0);
+  std::thread sink([&]() {
+    std::vector<uint8_t> buffer(256 << 10);
+    while (mychat_recv(pair.peer, buffer.data(), buffer.size()) > 0) {
+    }
+  });
+
+  std::vector<uint8_t> buffer(size, 'a');
+  for (auto _ : state) {
+    writeFull(pair.client, buffer.data(), size);
+  }
+  shutdown(pair.client, SHUT_WR);
+  sink.join();
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK_CAPTURE(BM_TransportStream, tcp, MYCHAT_TCP)
+    ->RangeMultiplier(16)
+    ->Range(64, 64 << 10)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_TransportStream, unix, MYCHAT_UNIX)
+    ->RangeMultiplier(16)
+    ->Range(64, 64 << 10)
+    ->UseRealTime();
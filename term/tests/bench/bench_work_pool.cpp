@@ -0,0 +1,106 @@
+#include "src/concurrency/work_pool.hpp"
+#include "tests/bench/bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_MESSAGE_INTERVAL std::chrono::microseconds(200)
+#define BENCH_HEAVY_EVERY 10
+#define BENCH_HEAVY_WORK std::chrono::milliseconds(2)
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Stands in for compressing or filtering a message: pure CPU for a while.
+static void heavyWork() {
+  auto until = std::chrono::steady_clock::now() + BENCH_HEAVY_WORK;
+  uint64_t hash = 14695981039346656037ull;
+  while (std::chrono::steady_clock::now() < until) {
+    for (int i = 0; i < 256; i++) {
+      hash = (hash ^ i) * 1099511628211ull;
+    }
+    benchmark::DoNotOptimize(hash);
+  }
+}
+
+// Delivery latency of messages reaching an event loop, which also owes heavy
+// work for every BENCH_HEAVY_EVERY-th of them. range(0) 0 does that work
+// inline on the loop, 1 hands it to a WorkPool and only runs the completion
+// on the loop. One iteration is one delivered message; p50_us and p99_us are
+// from the message being sent to the loop reading it.
+static void BM_DeliveryWithHeavyWork(benchmark::State &state) {
+  bool offload = state.range(0) == 1;
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  std::atomic<bool> stop{false};
+  std::thread sender([&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      uint64_t sent = nowNs();
+      (void)!write(fds[1], &sent, sizeof(sent));
+      std::this_thread::sleep_for(BENCH_MESSAGE_INTERVAL);
+    }
+  });
+
+  WorkPool pool(2);
+  int epoll_fd = epoll_create1(0);
+  for (int fd : {fds[0], pool.fd()}) {
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+
+  std::vector<double> latencies;
+  uint64_t delivered = 0;
+  uint64_t completed = 0;
+  for (auto _ : state) {
+    bool got = false;
+    while (!got) {
+      epoll_event events[2];
+      int count = epoll_wait(epoll_fd, events, 2, -1);
+      for (int i = 0; i < count; i++) {
+        if (events[i].data.fd == pool.fd()) {
+          pool.runCompletions();
+        } else if (!got) {
+          uint64_t sent;
+          (void)!read(fds[0], &sent, sizeof(sent));
+          latencies.push_back((nowNs() - sent) / 1000.0);
+          got = true;
+        }
+      }
+    }
+    if (++delivered % BENCH_HEAVY_EVERY == 0) {
+      if (offload) {
+        pool.submit(heavyWork, [&completed] { completed++; });
+      } else {
+        heavyWork();
+      }
+    }
+  }
+
+  stop = true;
+  sender.join();
+  close(epoll_fd);
+  close(fds[0]);
+  close(fds[1]);
+
+  std::sort(latencies.begin(), latencies.end());
+  state.counters["p50_us"] = latencies[latencies.size() / 2];
+  state.counters["p99_us"] = latencies[latencies.size() * 99 / 100];
+  state.counters["completions"] = completed;
+}
+BENCHMARK(BM_DeliveryWithHeavyWork)
+    ->ArgName("offload")
+    ->Arg(0)
+    ->Arg(1)
+    ->Iterations(2000)
+    ->UseRealTime();
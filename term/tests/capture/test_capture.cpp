@@ -0,0 +1,47 @@
+#include "src/capture/capture.hpp"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <string>
+
+TEST(TEST_CAPTURE, ROUND_TRIP) {
+  std::string path = testing::TempDir() + "capture_round_trip.bin";
+  {
+    CaptureWriter writer(path);
+    writer.open(7);
+    writer.open(8);
+    writer.frame(7, Data{1, 2, 3});
+    writer.close(7);
+    writer.open(7);
+    writer.frame(8, Data{4});
+  }
+
+  CaptureReader reader(path);
+  uint32_t expected_ids[] = {0, 1, 0, 0, 2, 1};
+  CaptureKind expected_kinds[] = {CAPTURE_OPEN,  CAPTURE_OPEN,
+                                  CAPTURE_FRAME, CAPTURE_CLOSE,
+                                  CAPTURE_OPEN,  CAPTURE_FRAME};
+  uint64_t last_timestamp = 0;
+  for (int i = 0; i < 6; i++) {
+    auto record = reader.next();
+    ASSERT_TRUE(record.has_value());
+    EXPECT_EQ(record->conn_id, expected_ids[i]);
+    EXPECT_EQ(record->kind, expected_kinds[i]);
+    EXPECT_GE(record->timestamp, last_timestamp);
+    last_timestamp = record->timestamp;
+    if (i == 2) {
+      EXPECT_EQ(record->payload, (Data{1, 2, 3}));
+    }
+  }
+  EXPECT_FALSE(reader.next().has_value());
+  std::remove(path.c_str());
+}
+
+TEST(TEST_CAPTURE, REJECTS_FOREIGN_FILE) {
+  std::string path = testing::TempDir() + "capture_foreign.bin";
+  FILE *file = std::fopen(path.c_str(), "wb");
+  std::fputs("not a capture", file);
+  std::fclose(file);
+
+  EXPECT_THROW(CaptureReader reader(path), CaptureError);
+  std::remove(path.c_str());
+}
@@ -0,0 +1,105 @@
+#include "src/cli/parser.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+TEST(TEST_TYPED_OPTION, INT) {
+  IntOption opt("help text", "int", 'i', "GLOBAL", 3);
+
+  EXPECT_EQ(std::any_cast<int>(opt.getDefault()), 3);
+  EXPECT_EQ(std::any_cast<int>(opt.cast("int", "42")), 42);
+  EXPECT_THROW(opt.cast("int", "42x"), InvalidOptionValueError);
+  EXPECT_THROW(opt.cast("int", ""), InvalidOptionValueError);
+}
+
+TEST(TEST_TYPED_OPTION, DURATION) {
+  DurationOption opt("help text", "duration", 'd', "GLOBAL",
+                     std::chrono::milliseconds(5));
+  using ms = std::chrono::milliseconds;
+
+  EXPECT_EQ(std::any_cast<ms>(opt.cast("duration", "250")), ms(250));
+  EXPECT_EQ(std::any_cast<ms>(opt.cast("duration", "250ms")), ms(250));
+  EXPECT_EQ(std::any_cast<ms>(opt.cast("duration", "2s")), ms(2000));
+  EXPECT_EQ(std::any_cast<ms>(opt.cast("duration", "1m")), ms(60000));
+  EXPECT_THROW(opt.cast("duration", "2 days"), InvalidOptionValueError);
+}
+
+TEST(TEST_TYPED_OPTION, SIZE) {
+  SizeOption opt("help text", "size", 's', "GLOBAL", 0);
+
+  EXPECT_EQ(std::any_cast<size_t>(opt.cast("size", "512")), 512);
+  EXPECT_EQ(std::any_cast<size_t>(opt.cast("size", "64K")), 64 << 10);
+  EXPECT_EQ(std::any_cast<size_t>(opt.cast("size", "16MiB")), 16 << 20);
+  EXPECT_EQ(std::any_cast<size_t>(opt.cast("size", "1G")), 1 << 30);
+  EXPECT_THROW(opt.cast("size", "1T"), InvalidOptionValueError);
+  EXPECT_EQ(std::any_cast<size_t>(opt.cast("size", "17179869183G")),
+            size_t(17179869183) << 30);
+  EXPECT_THROW(opt.cast("size", "17179869184G"), InvalidOptionValueError);
+  EXPECT_THROW(opt.cast("size", "18446744073709551615K"),
+               InvalidOptionValueError);
+}
+
+TEST(TEST_CONFIG, COMMAND_LINE_OVERRIDES_FILE) {
+  std::string path = testing::TempDir() + "test_config.conf";
+  std::ofstream(path) << "# tuning\n"
+                         "port = 8080\n"
+                         "limit = 2M  # per client\n"
+                         "\n";
+
+  Parser p("cmd");
+  IntOption port("help text", "port", 'p', "GLOBAL", 9999);
+  SizeOption limit("help text", "limit", 'l', "GLOBAL", 1);
+  p.addOption(&port);
+  p.addOption(&limit);
+  const char *command[] = {"cmd", "-p", "7000"};
+  p.run(3, (char **)command);
+
+  p.loadConfig(path);
+  EXPECT_EQ(p.get<int>("port"), 7000);
+  EXPECT_EQ(p.get<size_t>("limit"), 2 << 20);
+  std::remove(path.c_str());
+}
+
+TEST(TEST_CONFIG, INVALID_FILE_APPLIES_NOTHING) {
+  std::string path = testing::TempDir() + "test_config_invalid.conf";
+  std::ofstream(path) << "limit = 2M\n"
+                         "port = eighty\n";
+
+  Parser p("cmd");
+  IntOption port("help text", "port", 'p', "GLOBAL", 9999);
+  SizeOption limit("help text", "limit", 'l', "GLOBAL", 1);
+  p.addOption(&port);
+  p.addOption(&limit);
+  const char *command[] = {"cmd"};
+  p.run(1, (char **)command);
+
+  EXPECT_THROW(p.loadConfig(path), InvalidOptionValueError);
+  EXPECT_EQ(p.get<size_t>("limit"), 1);
+  EXPECT_THROW(p.loadConfig(path + ".missing"), ConfigFileError);
+  std::remove(path.c_str());
+}
+
+TEST(TEST_CONFIG, RELOAD_RESETS_REMOVED_KEYS) {
+  std::string path = testing::TempDir() + "test_config_reload.conf";
+  std::ofstream(path) << "port = 8080\n"
+                         "limit = 2M\n";
+
+  Parser p("cmd");
+  IntOption port("help text", "port", 'p', "GLOBAL", 9999);
+  SizeOption limit("help text", "limit", 'l', "GLOBAL", 1);
+  p.addOption(&port);
+  p.addOption(&limit);
+  const char *command[] = {"cmd"};
+  p.run(1, (char **)command);
+
+  p.loadConfig(path);
+  EXPECT_EQ(p.get<int>("port"), 8080);
+  EXPECT_EQ(p.get<size_t>("limit"), 2 << 20);
+
+  std::ofstream(path) << "port = 8081\n";
+  p.loadConfig(path);
+  EXPECT_EQ(p.get<int>("port"), 8081);
+  EXPECT_EQ(p.get<size_t>("limit"), 1);
+  std::remove(path.c_str());
+}
@@ -0,0 +1,128 @@
+#include "src/client/core.hpp"
+#include "gtest/gtest.h"
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// The server's end of a socketpair whose other end a ClientCore owns.
+static int connectCore(int &server) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return -1;
+  }
+  server = fds[1];
+  return fds[0];
+}
+
+static Data messageFrame(const std::string &content, uint64_t seq) {
+  Handle handle;
+  RecvMessage msg("alice", Text(content), seq);
+  return handle.build(msg);
+}
+
+static size_t drain(int fd) {
+  uint8_t buffer[4096];
+  size_t total = 0;
+  ssize_t got;
+  while ((got = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    total += got;
+  }
+  return total;
+}
+
+TEST(TEST_CLIENT_CORE, JOINS_A_FRAME_SPLIT_ACROSS_READS) {
+  int server;
+  int sock = connectCore(server);
+  ASSERT_GE(sock, 0);
+  {
+    ClientCore core(sock);
+    std::vector<std::string> received;
+    core.on_message = [&](RecvMessage &msg) {
+      received.push_back(std::string(msg.content));
+    };
+
+    auto frame = messageFrame("hello", 1);
+    size_t half = sizeof(Header) / 2;
+    ASSERT_EQ(write(server, frame.data(), half), (ssize_t)half);
+    core.poll(0);
+    EXPECT_TRUE(received.empty());
+
+    ASSERT_EQ(write(server, frame.data() + half, sizeof(Header) + 2 - half),
+              (ssize_t)(sizeof(Header) + 2 - half));
+    core.poll(0);
+    EXPECT_TRUE(received.empty());
+
+    size_t rest = frame.size() - sizeof(Header) - 2;
+    ASSERT_EQ(write(server, frame.data() + sizeof(Header) + 2, rest),
+              (ssize_t)rest);
+    core.poll(0);
+    EXPECT_EQ(received, std::vector<std::string>{"hello"});
+    EXPECT_TRUE(core.isConnected());
+  }
+  close(server);
+}
+
+TEST(TEST_CLIENT_CORE, DISPATCHES_EVERY_FRAME_OF_ONE_READ) {
+  int server;
+  int sock = connectCore(server);
+  ASSERT_GE(sock, 0);
+  {
+    ClientCore core(sock);
+    std::vector<std::string> received;
+    core.on_message = [&](RecvMessage &msg) {
+      received.push_back(std::string(msg.content));
+    };
+
+    Data bytes;
+    for (auto [content, seq] : {std::pair<std::string, uint64_t>{"one", 1},
+                                {"two", 2},
+                                {"three", 3}}) {
+      auto frame = messageFrame(content, seq);
+      bytes.insert(bytes.end(), frame.begin(), frame.end());
+    }
+    ASSERT_EQ(write(server, bytes.data(), bytes.size()),
+              (ssize_t)bytes.size());
+    core.poll(0);
+    EXPECT_EQ(received,
+              (std::vector<std::string>{"one", "two", "three"}));
+  }
+  close(server);
+}
+
+TEST(TEST_CLIENT_CORE, QUEUES_ON_EAGAIN_UNTIL_WRITABLE) {
+  int server;
+  int sock = connectCore(server);
+  ASSERT_GE(sock, 0);
+  int size = 4096;
+  setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  setsockopt(server, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  {
+    ClientCore core(sock);
+
+    // Twice, so EPOLLOUT is dropped once the queue ran empty and armed
+    // again when the socket fills up the next time.
+    for (int round = 0; round < 2; round++) {
+      // More than the socket takes: the rest waits for EPOLLOUT.
+      std::string message(256 << 10, 'x');
+      core.sendMessage(message);
+      size_t queued = core.pendingBytes();
+      ASSERT_GT(queued, 0);
+
+      // Nothing goes out until the server reads.
+      core.poll(0);
+      EXPECT_EQ(core.pendingBytes(), queued);
+
+      size_t read = 0;
+      for (int i = 0; i < 1000 && core.pendingBytes() > 0; i++) {
+        read += drain(server);
+        core.poll(10);
+      }
+      EXPECT_EQ(core.pendingBytes(), 0);
+      read += drain(server);
+      EXPECT_EQ(read, sizeof(Header) + message.size());
+    }
+    EXPECT_TRUE(core.isConnected());
+  }
+  close(server);
+}
@@ -0,0 +1,65 @@
+#include "src/client/render.hpp"
+#include "gtest/gtest.h"
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+static std::string readPipe(int fd) {
+  char buffer[4096];
+  std::string out;
+  int n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    out.append(buffer, n);
+  }
+  return out;
+}
+
+TEST(TEST_RENDER, BATCHES_UNTIL_FLUSH) {
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  {
+    Renderer renderer(fds[1], 1000, 1024, 0);
+    renderer.push("one\n");
+    renderer.push("two\n");
+    EXPECT_EQ(readPipe(fds[0]), "");
+
+    renderer.flush();
+    EXPECT_EQ(readPipe(fds[0]), "one\ntwo\n");
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(TEST_RENDER, FLUSHES_AT_SIZE_LIMIT) {
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  {
+    Renderer renderer(fds[1], 1000, 8, 0);
+    renderer.push("1234\n");
+    EXPECT_EQ(readPipe(fds[0]), "");
+    renderer.push("5678\n");
+    EXPECT_EQ(readPipe(fds[0]), "1234\n5678\n");
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(TEST_RENDER, DROPS_OLD_LINES_OVER_SCROLLBACK) {
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+  {
+    Renderer renderer(fds[1], 1000, 1024, 2);
+    renderer.push("a\n");
+    renderer.push("b\n");
+    renderer.push("c\n");
+    renderer.push("d\n");
+    EXPECT_EQ(renderer.droppedLines(), 2);
+    renderer.flush();
+
+    auto out = readPipe(fds[0]);
+    EXPECT_NE(out.find("2 lines skipped"), std::string::npos);
+    EXPECT_EQ(out.substr(out.size() - 4), "c\nd\n");
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -0,0 +1,34 @@
+#include "src/concurrency/affinity.hpp"
+#include "gtest/gtest.h"
+#include <sched.h>
+#include <stdexcept>
+#include <vector>
+
+TEST(TEST_AFFINITY, PARSE_LISTS) {
+  EXPECT_EQ(parseCpuList(""), std::vector<int>{});
+  EXPECT_EQ(parseCpuList("3"), std::vector<int>{3});
+  EXPECT_EQ(parseCpuList("2,3,6-7"), (std::vector<int>{2, 3, 6, 7}));
+  EXPECT_EQ(parseCpuList("0-2,0"), (std::vector<int>{0, 1, 2, 0}));
+}
+
+TEST(TEST_AFFINITY, REJECTS_MALFORMED) {
+  EXPECT_THROW(parseCpuList("x"), std::invalid_argument);
+  EXPECT_THROW(parseCpuList("1,,2"), std::invalid_argument);
+  EXPECT_THROW(parseCpuList("3-1"), std::invalid_argument);
+  EXPECT_THROW(parseCpuList("1-2x"), std::invalid_argument);
+  EXPECT_THROW(parseCpuList("-1"), std::invalid_argument);
+}
+
+TEST(TEST_AFFINITY, PIN_CURRENT_THREAD) {
+  cpu_set_t before;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+  int allowed = 0;
+  while (!CPU_ISSET(allowed, &before)) {
+    allowed++;
+  }
+  EXPECT_FALSE(pinThread(pthread_self(), -1));
+  EXPECT_FALSE(pinThread(pthread_self(), CPU_SETSIZE));
+  ASSERT_TRUE(pinThread(pthread_self(), allowed));
+  EXPECT_EQ(sched_getcpu(), allowed);
+  sched_setaffinity(0, sizeof(before), &before);
+}
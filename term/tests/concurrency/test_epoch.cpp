@@ -0,0 +1,108 @@
+#include "src/concurrency/epoch.hpp"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct Counted {
+  static inline std::atomic<int> alive{0};
+  int value;
+  Counted(int value) : value(value) { alive++; }
+  ~Counted() {
+    alive--;
+    value = -1;
+  }
+};
+
+TEST(TEST_EPOCH, PINNED_READER_DELAYS_FREE) {
+  EpochReclaimer reclaimer;
+  auto writer = reclaimer.join();
+  auto reader = reclaimer.join();
+
+  reader.pin();
+  writer.retire(new Counted(1));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(writer.collect(), 0);
+  }
+  EXPECT_EQ(Counted::alive.load(), 1);
+
+  reader.unpin();
+  size_t freed = 0;
+  for (int i = 0; i < 4; i++) {
+    freed += writer.collect();
+  }
+  EXPECT_EQ(freed, 1);
+  EXPECT_EQ(Counted::alive.load(), 0);
+  EXPECT_EQ(writer.pending(), 0);
+}
+
+TEST(TEST_EPOCH, ORPHANS_FREED) {
+  {
+    EpochReclaimer reclaimer;
+    {
+      auto quitter = reclaimer.join();
+      quitter.retire(new Counted(1));
+    }
+    EXPECT_EQ(Counted::alive.load(), 1);
+    auto other = reclaimer.join();
+    size_t freed = 0;
+    for (int i = 0; i < 4; i++) {
+      freed += other.collect();
+    }
+    EXPECT_EQ(freed, 1);
+
+    auto last = reclaimer.join();
+    last.retire(new Counted(2));
+  }
+  EXPECT_EQ(Counted::alive.load(), 0);
+}
+
+TEST(TEST_EPOCH, PARTICIPANT_LIMIT) {
+  EpochReclaimer reclaimer;
+  std::vector<std::unique_ptr<EpochReclaimer::Participant>> participants;
+  for (int i = 0; i < EPOCH_MAX_PARTICIPANTS; i++) {
+    participants.emplace_back(
+        new EpochReclaimer::Participant(reclaimer.join()));
+  }
+  EXPECT_THROW(reclaimer.join(), std::length_error);
+  participants.pop_back();
+  EXPECT_NO_THROW(reclaimer.join());
+}
+
+// Readers keep dereferencing the current buffer while a writer swaps and
+// retires it. A freed buffer would show up as a torn value.
+TEST(TEST_EPOCH, SWAP_UNDER_READERS) {
+  EpochReclaimer reclaimer;
+  std::atomic<Counted *> current{new Counted(0)};
+  std::atomic<bool> stop{false};
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 3; r++) {
+    readers.emplace_back([&] {
+      auto self = reclaimer.join();
+      while (!stop.load()) {
+        EpochReclaimer::Guard guard(self);
+        Counted *buffer = current.load(std::memory_order_acquire);
+        ASSERT_GE(buffer->value, 0);
+      }
+    });
+  }
+
+  {
+    auto writer = reclaimer.join();
+    for (int i = 1; i <= 20000; i++) {
+      Counted *old = current.exchange(new Counted(i));
+      writer.retire(old);
+    }
+    stop = true;
+    for (auto &thread : readers) {
+      thread.join();
+    }
+    for (int i = 0; i < 4; i++) {
+      writer.collect();
+    }
+    EXPECT_EQ(writer.pending(), 0);
+  }
+  delete current.load();
+  EXPECT_EQ(Counted::alive.load(), 0);
+}
@@ -0,0 +1,59 @@
+#include "src/concurrency/mpsc_queue.hpp"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(TEST_MPSC_QUEUE, FULL_AND_EMPTY) {
+  MpscQueue<std::string> queue(2);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.push("a"));
+  EXPECT_TRUE(queue.push("b"));
+  EXPECT_FALSE(queue.push("c"));
+  EXPECT_EQ(queue.pop().value(), "a");
+  EXPECT_TRUE(queue.push("c"));
+
+  std::vector<std::string> out;
+  EXPECT_EQ(queue.popBatch(out, 8), 2);
+  EXPECT_EQ(out, (std::vector<std::string>{"b", "c"}));
+  EXPECT_FALSE(queue.pop().has_value());
+}
+
+// Every item from every producer arrives once, and each producer's items
+// arrive in the order it pushed them.
+TEST(TEST_MPSC_QUEUE, PRODUCERS_KEEP_ORDER) {
+  const int producers = 4;
+  const uint64_t per_producer = 50000;
+  MpscQueue<uint64_t> queue(256);
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      for (uint64_t i = 0; i < per_producer; i++) {
+        while (!queue.push(((uint64_t)p << 32) | i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<uint64_t> next(producers, 0);
+  std::vector<uint64_t> batch;
+  uint64_t received = 0;
+  while (received < producers * per_producer) {
+    batch.clear();
+    if (queue.popBatch(batch, 32) == 0) {
+      std::this_thread::yield();
+    }
+    for (auto value : batch) {
+      int p = value >> 32;
+      ASSERT_EQ(value & 0xffffffff, next[p]++);
+    }
+    received += batch.size();
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,57 @@
+#include "src/concurrency/spsc_ring.hpp"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+TEST(TEST_SPSC_RING, FULL_AND_EMPTY) {
+  SpscRing<int> ring(3);
+  EXPECT_EQ(ring.capacity(), 4);
+  EXPECT_FALSE(ring.pop().has_value());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(ring.push(i));
+  }
+  EXPECT_FALSE(ring.push(4));
+  EXPECT_EQ(ring.pop().value(), 0);
+  EXPECT_TRUE(ring.push(4));
+  EXPECT_EQ(ring.size(), 4);
+}
+
+TEST(TEST_SPSC_RING, POP_BATCH_WRAPS) {
+  SpscRing<int> ring(4);
+  std::vector<int> out;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 3; i++) {
+      ring.push(round * 3 + i);
+    }
+    EXPECT_EQ(ring.popBatch(out, 2), 2);
+    EXPECT_EQ(ring.popBatch(out, 8), 1);
+  }
+  EXPECT_EQ(out, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8}));
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(TEST_SPSC_RING, CROSS_THREAD_ORDER) {
+  const uint64_t count = 200000;
+  SpscRing<uint64_t> ring(64);
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < count; i++) {
+      while (!ring.push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::vector<uint64_t> batch;
+  uint64_t expected = 0;
+  while (expected < count) {
+    batch.clear();
+    if (ring.popBatch(batch, 16) == 0) {
+      std::this_thread::yield();
+    }
+    for (auto value : batch) {
+      ASSERT_EQ(value, expected++);
+    }
+  }
+  producer.join();
+}
@@ -0,0 +1,45 @@
+#include "src/concurrency/wakeup.hpp"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <sys/epoll.h>
+#include <thread>
+#include <unistd.h>
+
+TEST(TEST_WAKEUP, NOTIFIES_COALESCE) {
+  Wakeup wakeup;
+  ASSERT_GE(wakeup.fd(), 0);
+  EXPECT_FALSE(wakeup.wait(0));
+
+  wakeup.notify();
+  wakeup.notify();
+  EXPECT_TRUE(wakeup.wait(0));
+  // Both notifies were consumed by the one drain.
+  EXPECT_FALSE(wakeup.wait(0));
+}
+
+TEST(TEST_WAKEUP, WAKES_EPOLL) {
+  Wakeup wakeup;
+  int epoll_fd = epoll_create1(0);
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = wakeup.fd();
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup.fd(), &event);
+
+  std::atomic<int> value{0};
+  std::thread notifier([&] {
+    value = 42;
+    wakeup.notify();
+  });
+  epoll_event ready[1];
+  EXPECT_EQ(epoll_wait(epoll_fd, ready, 1, 5000), 1);
+  EXPECT_EQ(ready[0].data.fd, wakeup.fd());
+  EXPECT_TRUE(wakeup.drain());
+  EXPECT_EQ(value.load(), 42);
+  notifier.join();
+
+  // Drained, so the next wait blocks again until the next notify.
+  EXPECT_EQ(epoll_wait(epoll_fd, ready, 1, 0), 0);
+  wakeup.notify();
+  EXPECT_EQ(epoll_wait(epoll_fd, ready, 1, 0), 1);
+  ::close(epoll_fd);
+}
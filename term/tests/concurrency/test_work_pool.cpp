@@ -0,0 +1,103 @@
+#include "src/concurrency/work_pool.hpp"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+// Runs completions on this thread until the pool has none pending.
+static void drainPool(WorkPool &pool) {
+  while (pool.pending() > 0) {
+    pollfd pfd{pool.fd(), POLLIN, 0};
+    ::poll(&pfd, 1, 1000);
+    pool.runCompletions();
+  }
+}
+
+TEST(TEST_WORK_POOL, COMPLETIONS_RUN_ON_OWNER) {
+  WorkPool pool(2);
+  ASSERT_GE(pool.fd(), 0);
+  std::thread::id owner = std::this_thread::get_id();
+
+  std::vector<int> results;
+  std::atomic<int> off_owner{0};
+  for (int i = 0; i < 100; i++) {
+    auto value = std::make_shared<int>(0);
+    pool.submit(
+        [&off_owner, owner, value, i] {
+          if (std::this_thread::get_id() != owner) {
+            off_owner++;
+          }
+          *value = i * i;
+        },
+        [&results, owner, value] {
+          EXPECT_EQ(std::this_thread::get_id(), owner);
+          results.push_back(*value);
+        });
+  }
+  drainPool(pool);
+
+  EXPECT_EQ(off_owner, 100);
+  ASSERT_EQ(results.size(), 100);
+  long sum = 0;
+  for (int value : results) {
+    sum += value;
+  }
+  EXPECT_EQ(sum, 328350);
+}
+
+TEST(TEST_WORK_POOL, IDLE_WORKERS_STEAL) {
+  WorkPool pool(4);
+  std::atomic<int> ran{0};
+  // All the children land on the deque of the worker running the parent.
+  pool.submit([&pool, &ran] {
+    for (int i = 0; i < 64; i++) {
+      pool.submit([&ran] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ran++;
+      });
+    }
+  });
+  while (ran < 64) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_GT(pool.steals(), 0);
+  EXPECT_EQ(pool.pending(), 0);
+}
+
+TEST(TEST_WORK_POOL, BUSY_LOOP_RUNS_IN_BATCHES) {
+  WorkPool pool(1, 16);
+  std::atomic<int> done{0};
+  for (int i = 0; i < 200; i++) {
+    pool.submit([] {}, [&done] { done++; });
+  }
+
+  // A batch never runs more than asked for, and the fd stays readable for
+  // what is left.
+  size_t total = 0;
+  while (total < 200) {
+    pollfd pfd{pool.fd(), POLLIN, 0};
+    ASSERT_EQ(::poll(&pfd, 1, 1000), 1);
+    size_t ran = pool.runCompletions(8);
+    EXPECT_LE(ran, 8);
+    total += ran;
+  }
+  EXPECT_EQ(done, 200);
+  EXPECT_EQ(pool.pending(), 0);
+}
+
+TEST(TEST_WORK_POOL, STOPS_WITH_WORK_QUEUED) {
+  std::atomic<int> ran{0};
+  {
+    WorkPool pool(2);
+    for (int i = 0; i < 1000; i++) {
+      pool.submit([&ran] {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        ran++;
+      });
+    }
+  }
+  EXPECT_LE(ran, 1000);
+}
@@ -0,0 +1,118 @@
+#include "src/coro/task.hpp"
+#include "gtest/gtest.h"
+#include <coroutine>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Suspends until the test resumes it by hand.
+struct Gate {
+  struct Awaiter {
+    Gate *gate;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      this->gate->waiting = handle;
+    }
+    void await_resume() {}
+  };
+  std::coroutine_handle<> waiting;
+
+  Awaiter wait() { return Awaiter{this}; }
+  void open() { std::exchange(this->waiting, nullptr).resume(); }
+};
+
+static Task<int> add(int a, int b) { co_return a + b; }
+
+static Task<int> waitThenAdd(Gate &gate, int a, int b) {
+  co_await gate.wait();
+  co_return co_await add(a, b);
+}
+
+static Task<std::string> fails() {
+  throw std::runtime_error("broken");
+  co_return "";
+}
+
+TEST(TEST_TASK, LAZY_AND_NESTED) {
+  Gate gate;
+  int result = 0;
+  auto outer_body = [&]() -> Task<> {
+    result = co_await waitThenAdd(gate, 2, 3);
+  };
+  auto outer = outer_body();
+  EXPECT_FALSE(outer.done());
+
+  outer.start();
+  EXPECT_FALSE(outer.done());
+  EXPECT_EQ(result, 0);
+  gate.open();
+  EXPECT_TRUE(outer.done());
+  EXPECT_EQ(result, 5);
+}
+
+TEST(TEST_TASK, EXCEPTIONS_REACH_THE_AWAITER) {
+  std::string caught;
+  auto outer_body = [&]() -> Task<> {
+    try {
+      co_await fails();
+    } catch (std::runtime_error &e) {
+      caught = e.what();
+    }
+  };
+  auto outer = outer_body();
+  outer.start();
+  EXPECT_TRUE(outer.done());
+  EXPECT_EQ(caught, "broken");
+
+  auto top = fails();
+  top.start();
+  EXPECT_THROW(top.result(), std::runtime_error);
+}
+
+TEST(TEST_TASK, DESTROYED_WHILE_SUSPENDED) {
+  Gate gate;
+  struct Flag {
+    bool *destroyed;
+    ~Flag() { *this->destroyed = true; }
+  };
+  bool destroyed = false;
+  {
+    auto task_body = [&]() -> Task<> {
+      Flag flag{&destroyed};
+      co_await gate.wait();
+    };
+    auto task = task_body();
+    task.start();
+    EXPECT_FALSE(destroyed);
+  }
+  EXPECT_TRUE(destroyed);
+}
+
+TEST(TEST_TASK, DETACHED_FREES_ITSELF) {
+  Gate gate;
+  bool finished = false;
+  auto task_body = [&]() -> Task<> {
+    co_await gate.wait();
+    finished = true;
+  };
+  auto task = task_body();
+  task.start();
+  task.detach();
+  EXPECT_FALSE(task);
+  gate.open();
+  EXPECT_TRUE(finished);
+}
+
+TEST(TEST_TASK, FRAMES_ARE_POOLED) {
+  add(1, 2).start(); // warm the size class up
+  auto before = BufferPool::stats();
+  for (int i = 0; i < 100; i++) {
+    auto task = add(i, i);
+    task.start();
+    EXPECT_EQ(task.result(), 2 * i);
+  }
+  auto after = BufferPool::stats();
+  EXPECT_EQ(after.misses, before.misses);
+  EXPECT_EQ(after.hits - before.hits, 100);
+}
@@ -0,0 +1,53 @@
+#include "src/mychat/mychat.hpp"
+#include "gtest/gtest.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// A loopback port nothing listens on.
+static int closedPort() {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t size = sizeof(addr);
+  bind(sock, (struct sockaddr *)&addr, size);
+  getsockname(sock, (struct sockaddr *)&addr, &size);
+  close(sock);
+  return ntohs(addr.sin_port);
+}
+
+// Lowest free descriptor, which a leaked socket would hold on to.
+static int lowestFreeFd() {
+  int fd = open("/dev/null", O_RDONLY);
+  close(fd);
+  return fd;
+}
+
+TEST(TEST_MYCHAT, FAILED_CONNECT_CLOSES_ITS_SOCKET) {
+  MychatAddress addr{MYCHAT_TCP, "127.0.0.1", closedPort()};
+  int before = lowestFreeFd();
+  EXPECT_EQ(mychat_connect(addr), MYCHAT_ENTER_SOCKET_CONNECTING_FAILED);
+  EXPECT_EQ(lowestFreeFd(), before);
+}
+
+TEST(TEST_MYCHAT, NONBLOCKING_CONNECT_REPORTS_THROUGH_SO_ERROR) {
+  MychatAddress addr{MYCHAT_TCP, "127.0.0.1", closedPort()};
+  int before = lowestFreeFd();
+  int sock = mychat_connect(addr, true);
+  if (sock >= 0) {
+    EXPECT_NE(fcntl(sock, F_GETFL) & O_NONBLOCK, 0);
+    pollfd ready{sock, POLLOUT, 0};
+    ASSERT_EQ(poll(&ready, 1, 5000), 1);
+    int error = 0;
+    socklen_t size = sizeof(error);
+    ASSERT_EQ(getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &size), 0);
+    EXPECT_EQ(error, ECONNREFUSED);
+    close(sock);
+  } else {
+    // Refused before connect even returned.
+    EXPECT_EQ(sock, MYCHAT_ENTER_SOCKET_CONNECTING_FAILED);
+  }
+  EXPECT_EQ(lowestFreeFd(), before);
+}
@@ -0,0 +1,152 @@
+#include "src/protocol/names.hpp"
+#include "src/protocol/packet.hpp"
+#include "src/protocol/protocol.hpp"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <string>
+#include <variant>
+
+// Packets of fixed fields only have a size known at compile time.
+static_assert(SendResume::schema::fixed);
+static_assert(SendResume::schema::min_size == 16);
+static_assert(AttachFetch::schema::min_size == 20);
+static_assert(!RecvMessage::schema::fixed);
+static_assert(RecvMessage::schema::min_size == 12);
+
+// What parsing a frame of type around payload throws, -1 for nothing.
+static int parseError(MessageType type, const std::string &payload,
+                      bool recv = false) {
+  Data data = Handle::buildRaw(type, payload);
+  Handle handle;
+  try {
+    if (recv) {
+      handle.parseRecv(data);
+    } else {
+      handle.feed(data);
+    }
+  } catch (HandleReturn e) {
+    return e;
+  }
+  return -1;
+}
+
+TEST(TEST_SCHEMA, ROUND_TRIPS) {
+  Handle handle;
+
+  SendEnter enter{"alice"};
+  Data data = handle.build(enter);
+  EXPECT_EQ(data.size(), sizeof(Header) + 5);
+  EXPECT_EQ(std::get<SendEnter>(handle.feed(data)).name, "alice");
+
+  PeerEvent event(7, 3, 42, PEER_JOIN, "bob", "hi there");
+  data = handle.build(event);
+  EXPECT_EQ(data.size(), sizeof(Header) + payloadSize(event));
+  auto parsed = std::get<PeerEvent>(handle.feed(data));
+  EXPECT_EQ(parsed.origin, 7);
+  EXPECT_EQ(parsed.epoch, 3);
+  EXPECT_EQ(parsed.seq, 42);
+  EXPECT_EQ(parsed.kind, PEER_JOIN);
+  EXPECT_EQ(parsed.name, "bob");
+  EXPECT_EQ(parsed.content, "hi there");
+
+  RecvMessage msg("carol", "hello", 9);
+  data = handle.build(msg);
+  auto recv = std::get<RecvMessage>(handle.parseRecv(data));
+  EXPECT_EQ(recv.seq, 9);
+  EXPECT_EQ(recv.sender_name, "carol");
+  EXPECT_EQ(recv.content, "hello");
+
+  SearchResult result(3, {{1, "a", "first"}, {2, "bb", ""}});
+  data = handle.build(result);
+  auto hits = std::get<SearchResult>(handle.parseRecv(data));
+  EXPECT_EQ(hits.id, 3);
+  ASSERT_EQ(hits.hits.size(), 2);
+  EXPECT_EQ(hits.hits[1].seq, 2);
+  EXPECT_EQ(hits.hits[1].sender, "bb");
+  EXPECT_EQ(hits.hits[0].content, "first");
+
+  uint8_t bytes[] = {1, 2, 3};
+  AttachChunk chunk{5, bytes, sizeof(bytes)};
+  data = handle.build(chunk);
+  auto view = std::get<AttachChunk>(handle.feed(data));
+  EXPECT_EQ(view.upload, 5);
+  ASSERT_EQ(view.length, 3);
+  EXPECT_EQ(view.bytes, data.data() + sizeof(Header) + 4);
+}
+
+TEST(TEST_SCHEMA, OPTIONAL_FIELDS) {
+  Handle handle;
+  RosterDelta leave(4, ROSTER_LEAVE, 2, "ignored");
+  EXPECT_EQ(payloadSize(leave), 13);
+  Data data = handle.build(leave);
+  auto parsed = std::get<RosterDelta>(handle.parseRecv(data));
+  EXPECT_EQ(parsed.op, ROSTER_LEAVE);
+  EXPECT_EQ(parsed.name, "");
+
+  RosterDelta join(5, ROSTER_JOIN, 3, "dave");
+  data = handle.build(join);
+  EXPECT_EQ(std::get<RosterDelta>(handle.parseRecv(data)).name, "dave");
+}
+
+TEST(TEST_SCHEMA, REJECTS_MALFORMED) {
+  // Short, and with bytes left over.
+  EXPECT_EQ(parseError(RESUME, std::string(15, '\0')), INVALID_SIZE);
+  EXPECT_EQ(parseError(RESUME, std::string(17, '\0')), INVALID_SIZE);
+  EXPECT_EQ(parseError(RESUME, std::string(16, '\0')), -1);
+
+  // A name running past the payload.
+  std::string payload(25, '\0');
+  uint32_t name_size = 100;
+  std::memcpy(payload.data() + 21, &name_size, sizeof(name_size));
+  EXPECT_EQ(parseError(PEER_EVENT, payload), INVALID_SIZE);
+
+  // A kind past PEER_LEAVE.
+  name_size = 0;
+  std::memcpy(payload.data() + 21, &name_size, sizeof(name_size));
+  EXPECT_EQ(parseError(PEER_EVENT, payload), -1);
+  payload[20] = 9;
+  EXPECT_EQ(parseError(PEER_EVENT, payload), INVALID_TYPE);
+
+  // A message with neither a sender id nor a name.
+  payload = std::string(16, '\0') + "text";
+  EXPECT_EQ(parseError(RECV_MESSAGE, payload, true), INVALID_SIZE);
+
+  // A count of more members than the payload can hold.
+  payload = std::string(12, '\0');
+  uint32_t count = 1 << 30;
+  std::memcpy(payload.data() + 8, &count, sizeof(count));
+  EXPECT_EQ(parseError(ROSTER_SNAPSHOT, payload, true), INVALID_SIZE);
+
+  // A packet the other side does not take.
+  EXPECT_EQ(parseError(RECV_NOTICE, "x"), INVALID_TYPE);
+}
+
+TEST(TEST_SCHEMA, SENDER_IDS) {
+  Handle handle;
+  RecvMessage named("carol", "hi", 9);
+  RecvMessage interned("carol", "hi", 9, 4);
+  EXPECT_EQ(payloadSize(named), 8 + 4 + 4 + 5 + 2);
+  EXPECT_EQ(payloadSize(interned), 8 + 4 + 2);
+
+  Data data = handle.build(interned);
+  auto msg = std::get<RecvMessage>(handle.parseRecv(data));
+  EXPECT_EQ(msg.sender_id, 4);
+  EXPECT_EQ(msg.sender_name, "");
+  EXPECT_EQ(msg.content, "hi");
+
+  SenderNames names;
+  EXPECT_FALSE(names.resolve(msg));
+  names.learn(RosterSnapshot(1, {{4, "carol"}, {5, "dave"}}));
+  names.learn(RosterDelta(2, ROSTER_LEAVE, 4, ""));
+  names.learn(RosterDelta(3, ROSTER_JOIN, 6, "erin"));
+  // Left, but messages sent before that may still arrive.
+  ASSERT_TRUE(names.resolve(msg));
+  EXPECT_EQ(msg.sender_name, "carol");
+  EXPECT_EQ(names.size(), 3);
+
+  // Named messages need no roster.
+  data = handle.build(named);
+  msg = std::get<RecvMessage>(handle.parseRecv(data));
+  EXPECT_TRUE(SenderNames().resolve(msg));
+  EXPECT_EQ(msg.sender_name, "carol");
+}
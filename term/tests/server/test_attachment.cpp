@@ -0,0 +1,132 @@
+#include "src/protocol/protocol.hpp"
+#include "src/server/attachment.hpp"
+#include "src/server/send_queue.hpp"
+#include "gtest/gtest.h"
+#include <fcntl.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static AttachChunk chunkOf(uint32_t upload, const std::string &bytes) {
+  return AttachChunk{upload, (const uint8_t *)bytes.data(), bytes.size()};
+}
+
+static std::string readAll(Attachment *file) {
+  std::string bytes(file->length, '\0');
+  EXPECT_EQ(pread(file->file->fd(), bytes.data(), bytes.size(), 0),
+            (ssize_t)bytes.size());
+  return bytes;
+}
+
+TEST(TEST_ATTACHMENT, UPLOAD_IN_CHUNKS) {
+  AttachmentStore store;
+  store.configure("/tmp", 1024, 4096);
+  uint64_t id = store.begin(3, AttachOffer(7, 11, "hello.txt"), "alice");
+  ASSERT_NE(id, 0);
+  EXPECT_EQ(store.find(id), nullptr); // not complete yet
+
+  uint64_t got;
+  EXPECT_EQ(store.append(3, chunkOf(7, "hello "), got), APPEND_MORE);
+  EXPECT_EQ(got, id);
+  EXPECT_EQ(store.append(3, chunkOf(7, "world"), got), APPEND_DONE);
+  Attachment *file = store.find(id);
+  ASSERT_NE(file, nullptr);
+  EXPECT_EQ(file->name, "hello.txt");
+  EXPECT_EQ(file->sender, "alice");
+  EXPECT_EQ(readAll(file), "hello world");
+
+  // The upload number is free again once the file is complete.
+  EXPECT_NE(store.begin(3, AttachOffer(7, 1, "again"), "alice"), 0);
+}
+
+TEST(TEST_ATTACHMENT, INVALID_UPLOADS) {
+  AttachmentStore store;
+  store.configure("/tmp", 16, 64);
+  EXPECT_EQ(store.begin(3, AttachOffer(1, 17, "big"), "alice"), 0);
+  EXPECT_EQ(store.begin(3, AttachOffer(1, 0, "empty"), "alice"), 0);
+
+  uint64_t id = store.begin(3, AttachOffer(1, 4, "four"), "alice");
+  ASSERT_NE(id, 0);
+  EXPECT_EQ(store.begin(3, AttachOffer(1, 4, "twice"), "alice"), 0);
+  uint64_t got;
+  // Someone else's upload number, then more than announced.
+  EXPECT_EQ(store.append(4, chunkOf(1, "ab"), got), APPEND_INVALID);
+  EXPECT_EQ(store.append(3, chunkOf(1, "abcde"), got), APPEND_INVALID);
+  EXPECT_EQ(store.size(), 0);
+  EXPECT_EQ(store.bytes(), 0);
+
+  // Attachments off.
+  store.configure("/tmp", 0, 64);
+  EXPECT_EQ(store.begin(3, AttachOffer(2, 1, "one"), "alice"), 0);
+}
+
+TEST(TEST_ATTACHMENT, ABORT_AND_EVICT) {
+  AttachmentStore store;
+  store.configure("/tmp", 100, 250);
+  uint64_t got;
+  uint64_t first = store.begin(3, AttachOffer(1, 100, "first"), "alice");
+  store.append(3, chunkOf(1, std::string(100, 'a')), got);
+  uint64_t pending = store.begin(4, AttachOffer(1, 100, "pending"), "bob");
+  EXPECT_EQ(store.bytes(), 200);
+
+  // Only complete files make room, oldest first.
+  uint64_t third = store.begin(5, AttachOffer(1, 100, "third"), "carol");
+  ASSERT_NE(third, 0);
+  EXPECT_EQ(store.find(first), nullptr);
+  EXPECT_EQ(store.bytes(), 200);
+  EXPECT_EQ(store.begin(6, AttachOffer(1, 100, "fourth"), "dave"), 0);
+
+  store.abort(4);
+  EXPECT_EQ(store.append(4, chunkOf(1, "x"), got), APPEND_INVALID);
+  EXPECT_EQ(store.bytes(), 100);
+  EXPECT_NE(pending, 0);
+}
+
+TEST(TEST_ATTACHMENT, SEND_QUEUE_RELAYS_FILE_SPANS) {
+  AttachmentStore store;
+  store.configure("/tmp", 1 << 20, 1 << 20);
+  std::string bytes(300000, '\0');
+  for (size_t i = 0; i < bytes.size(); i++) {
+    bytes[i] = i * 7;
+  }
+  uint64_t got;
+  uint64_t id = store.begin(3, AttachOffer(1, bytes.size(), "blob"), "a");
+  ASSERT_EQ(store.append(3, chunkOf(1, bytes), got), APPEND_DONE);
+
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  Handle handle;
+  SendQueue queue;
+  queue.push(handle.buildAttachDataHead(id, 1000, 200000));
+  queue.pushFile(store.find(id)->file, 1000, 200000);
+  // The file outlives the store's copy of it while queued.
+  store.configure("/tmp", 1 << 20, 0);
+  EXPECT_EQ(store.find(id), nullptr);
+
+  std::string received;
+  char buffer[65536];
+  while (!queue.empty()) {
+    ASSERT_TRUE(queue.flush(fds[0]));
+    ssize_t got;
+    while (received.size() < 228 + 200000 &&
+           (got = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+      received.append(buffer, got);
+    }
+  }
+  ssize_t rest;
+  while ((rest = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    received.append(buffer, rest);
+  }
+  EXPECT_EQ(queue.bytes(), 0);
+
+  Data frame(received.begin(), received.end());
+  auto parsed = handle.parseRecv(frame);
+  ASSERT_TRUE(std::holds_alternative<AttachData>(parsed));
+  auto &data = std::get<AttachData>(parsed);
+  EXPECT_EQ(data.id, id);
+  EXPECT_EQ(data.offset, 1000);
+  EXPECT_EQ(data.bytes, bytes.substr(1000, 200000));
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -0,0 +1,100 @@
+#include "src/logging/logging.hpp"
+#include "src/server/connection.hpp"
+#include "gtest/gtest.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Connections kept the way the server keeps them: disconnecting erases the
+// Connection, from inside its own handler too.
+class ConnectionTest : public ::testing::Test {
+protected:
+  Handle handle;
+  std::unordered_map<int, Connection> clients;
+  std::vector<std::string> messages;
+  std::vector<int> disconnected;
+
+  Connection &connect(int fd) {
+    ConnectionHandlers handlers;
+    handlers.message = [this](int sender, RecvMessage &msg) {
+      this->messages.push_back(msg.sender_name + ": " +
+                               std::string(msg.content));
+      if (msg.content == "bye") {
+        this->disconnect(sender);
+      }
+    };
+    handlers.checkExists = [this](std::string name) {
+      for (auto &client : this->clients) {
+        if (client.second.name == name) {
+          return true;
+        }
+      }
+      return false;
+    };
+    handlers.disconnect = [this](int fd) { this->disconnect(fd); };
+    handlers.entered = [](int fd, std::string name) {};
+    handlers.sync = [](int fd, uint64_t version) {};
+    return this->clients.try_emplace(fd, fd, handlers, this->handle)
+        .first->second;
+  }
+
+  void disconnect(int fd) {
+    this->disconnected.push_back(fd);
+    this->clients.erase(fd);
+  }
+
+  void feed(int fd, MessageType type, const std::string &payload) {
+    Data frame = Handle::buildRaw(type, payload);
+    this->clients.at(fd).feed(frame);
+  }
+};
+
+TEST_F(ConnectionTest, ENTER_THEN_MESSAGES) {
+  setLevel(INFO);
+  connect(3);
+  feed(3, ENTER, "alice");
+  EXPECT_TRUE(this->clients.at(3).isEntered());
+  feed(3, MESSAGE, "hi");
+  feed(3, MESSAGE, "there");
+  EXPECT_EQ(this->messages,
+            (std::vector<std::string>{"alice: hi", "alice: there"}));
+}
+
+TEST_F(ConnectionTest, MESSAGE_BEFORE_ENTER_DISCONNECTS) {
+  connect(3);
+  feed(3, MESSAGE, "hi");
+  EXPECT_EQ(this->clients.count(3), 0);
+  EXPECT_TRUE(this->messages.empty());
+}
+
+TEST_F(ConnectionTest, TAKEN_NAME_AND_SECOND_ENTER_DISCONNECT) {
+  connect(3);
+  connect(4);
+  feed(3, ENTER, "alice");
+  feed(4, ENTER, "alice");
+  EXPECT_EQ(this->disconnected, std::vector<int>{4});
+
+  feed(3, ENTER, "again");
+  EXPECT_EQ(this->disconnected, (std::vector<int>{4, 3}));
+}
+
+TEST_F(ConnectionTest, HANDLER_DROPS_ITS_OWN_CONNECTION) {
+  connect(3);
+  connect(4);
+  feed(3, ENTER, "alice");
+  feed(4, ENTER, "bob");
+  // The Connection is erased while its coroutine runs the handler.
+  feed(3, MESSAGE, "bye");
+  EXPECT_EQ(this->clients.count(3), 0);
+  feed(4, MESSAGE, "still here");
+  EXPECT_EQ(this->messages.back(), "bob: still here");
+}
+
+TEST_F(ConnectionTest, BROKEN_FRAME_DISCONNECTS) {
+  connect(3);
+  feed(3, ENTER, "alice");
+  Data frame = Handle::buildRaw(MESSAGE, "hi");
+  frame.resize(frame.size() - 1); // shorter than its header says
+  this->clients.at(3).feed(frame);
+  EXPECT_EQ(this->disconnected, std::vector<int>{3});
+}
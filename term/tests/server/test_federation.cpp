@@ -0,0 +1,134 @@
+#include "src/protocol/protocol.hpp"
+#include "src/server/federation.hpp"
+#include "gtest/gtest.h"
+
+TEST(TEST_FEDERATION, ACCEPT_ONCE) {
+  Federation a(1), b(2);
+  auto event = a.originate(PEER_MESSAGE, "alice", "hi");
+
+  EXPECT_FALSE(a.accept(event));
+  EXPECT_TRUE(b.accept(event));
+  EXPECT_FALSE(b.accept(event));
+  EXPECT_TRUE(b.accept(a.originate(PEER_MESSAGE, "alice", "again")));
+}
+
+TEST(TEST_FEDERATION, OUT_OF_ORDER_AND_WINDOW) {
+  Federation b(2);
+  EXPECT_TRUE(b.accept(PeerEvent(1, 1, 5, PEER_MESSAGE, "a", "")));
+  EXPECT_TRUE(b.accept(PeerEvent(1, 1, 3, PEER_MESSAGE, "a", "")));
+  EXPECT_FALSE(b.accept(PeerEvent(1, 1, 3, PEER_MESSAGE, "a", "")));
+
+  EXPECT_TRUE(
+      b.accept(PeerEvent(1, 1, 5 + FEDERATION_SEEN_WINDOW, PEER_MESSAGE, "a",
+                         "")));
+  EXPECT_FALSE(b.accept(PeerEvent(1, 1, 4, PEER_MESSAGE, "a", "")));
+}
+
+TEST(TEST_FEDERATION, RESTARTED_NODE_STARTS_OVER) {
+  Federation b(2, "secret");
+  Federation before(1, "secret", 100);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(b.accept(before.originate(PEER_MESSAGE, "alice", "hi")));
+  }
+
+  // Numbered from 1 again, but under a newer epoch.
+  Federation after(1, "secret", 200);
+  EXPECT_TRUE(b.accept(after.originate(PEER_JOIN, "alice")));
+  EXPECT_TRUE(b.accept(after.originate(PEER_MESSAGE, "alice", "back")));
+  // Late events of the earlier run are dropped.
+  EXPECT_FALSE(b.accept(PeerEvent(1, 100, 9, PEER_MESSAGE, "alice", "")));
+
+  // A hello starts over as well, even with an older epoch.
+  Federation rewound(1, "secret", 50);
+  b.introduce(10, rewound.hello(10));
+  EXPECT_TRUE(b.accept(rewound.originate(PEER_JOIN, "alice")));
+}
+
+TEST(TEST_FEDERATION, REMOTE_NAMES) {
+  Federation a(1);
+  a.addRemoteName("bob", 2);
+  a.addRemoteName("carol", 3);
+
+  EXPECT_TRUE(a.hasRemoteName("bob"));
+  EXPECT_FALSE(a.removeRemoteName("bob", 3));
+  EXPECT_EQ(a.namesOf(3), std::vector<std::string>{"carol"});
+  EXPECT_TRUE(a.removeRemoteName("bob", 2));
+  EXPECT_FALSE(a.hasRemoteName("bob"));
+
+  EXPECT_TRUE(a.winsAgainst(2));
+  EXPECT_FALSE(Federation(3).winsAgainst(2));
+}
+
+TEST(TEST_FEDERATION, PARSE_PEERS) {
+  auto peers = parsePeers("127.0.0.1:9001,unix:/tmp/node.sock,");
+  ASSERT_EQ(peers.size(), 2);
+  EXPECT_EQ(peers[0].transport, MYCHAT_TCP);
+  EXPECT_EQ(peers[0].port, 9001);
+  EXPECT_EQ(peers[1].transport, MYCHAT_UNIX);
+  EXPECT_EQ(peers[1].host, "/tmp/node.sock");
+
+  EXPECT_THROW(parsePeers("localhost"), std::invalid_argument);
+}
+
+TEST(TEST_FEDERATION, PEER_EVENT_ROUND_TRIP) {
+  Handle handle;
+  PeerEvent event(7, 9, 42, PEER_JOIN, "alice", "");
+  auto frame = handle.build(event);
+  auto packet = handle.feed(frame);
+  ASSERT_TRUE(std::holds_alternative<PeerEvent>(packet));
+
+  auto &res = std::get<PeerEvent>(packet);
+  EXPECT_EQ(res.origin, 7);
+  EXPECT_EQ(res.epoch, 9);
+  EXPECT_EQ(res.seq, 42);
+  EXPECT_EQ(res.kind, PEER_JOIN);
+  EXPECT_EQ(res.name, "alice");
+
+  PeerHello hello{3, "secret", {PeerNode{4}, PeerNode{5}}, 11};
+  frame = handle.build(hello);
+  packet = handle.feed(frame);
+  auto &back = std::get<PeerHello>(packet);
+  EXPECT_EQ(back.node_id, 3);
+  EXPECT_EQ(back.secret, "secret");
+  ASSERT_EQ(back.relays.size(), 2);
+  EXPECT_EQ(back.relays[1].id, 5);
+  EXPECT_EQ(back.epoch, 11);
+}
+
+TEST(TEST_FEDERATION, ADMITS_ONLY_WITH_THE_SECRET) {
+  Federation a(1, "secret");
+  EXPECT_TRUE(a.admits(PeerHello{2, "secret", {}}));
+  EXPECT_FALSE(a.admits(PeerHello{2, "secreT", {}}));
+  EXPECT_FALSE(a.admits(PeerHello{2, "secret!", {}}));
+  EXPECT_FALSE(a.admits(PeerHello{2, "", {}}));
+  // Nobody links as the node itself, and without a secret nobody links.
+  EXPECT_FALSE(a.admits(PeerHello{1, "secret", {}}));
+  EXPECT_FALSE(Federation(1).admits(PeerHello{2, "", {}}));
+}
+
+TEST(TEST_FEDERATION, LINKS_CARRY_WHAT_THEY_INTRODUCED) {
+  Federation a(1, "secret");
+  // The node itself is never taken from a link.
+  EXPECT_TRUE(a.introduce(10, PeerHello{2, "secret", {{3}, {1}}}));
+  EXPECT_TRUE(a.carries(10, 2));
+  EXPECT_TRUE(a.carries(10, 3));
+  EXPECT_FALSE(a.carries(10, 1));
+  EXPECT_FALSE(a.carries(11, 2));
+
+  // Node 3 over a second link is nothing new; node 4 is.
+  EXPECT_FALSE(a.introduce(11, PeerHello{3, "secret", {}}));
+  EXPECT_TRUE(a.introduce(11, PeerHello{3, "secret", {{4}}}));
+
+  // Each link hears of the nodes behind the others.
+  auto hello = a.hello(11);
+  EXPECT_EQ(hello.node_id, 1);
+  EXPECT_EQ(hello.secret, "secret");
+  ASSERT_EQ(hello.relays.size(), 2);
+  EXPECT_EQ(hello.relays[0].id, 2);
+  EXPECT_EQ(hello.relays[1].id, 3);
+
+  a.unlink(10);
+  EXPECT_FALSE(a.carries(10, 2));
+  EXPECT_FALSE(a.reaches(2));
+  EXPECT_TRUE(a.reaches(4));
+}
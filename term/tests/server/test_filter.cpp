@@ -0,0 +1,175 @@
+#include "src/server/filter.hpp"
+#include "gtest/gtest.h"
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::string lower(std::string text) {
+  for (auto &c : text) {
+    c = foldCase(c);
+  }
+  return text;
+}
+
+// The same filter the slow way: every pattern at every position.
+static FilterAction naiveApply(const std::vector<FilterRule> &rules,
+                               std::string &content) {
+  std::string folded = lower(content);
+  std::string masked = content;
+  FilterAction result = FILTER_PASS;
+  for (auto &rule : rules) {
+    std::string pattern = lower(rule.pattern);
+    for (size_t pos = folded.find(pattern); pos != std::string::npos;
+         pos = folded.find(pattern, pos + 1)) {
+      if (rule.action == FILTER_REJECT) {
+        return FILTER_REJECT;
+      }
+      masked.replace(pos, pattern.size(), pattern.size(), '*');
+      result = FILTER_MASK;
+    }
+  }
+  content = masked;
+  return result;
+}
+
+TEST(TEST_FILTER, PARSE_RULES) {
+  std::istringstream in("# block list\n"
+                        "mask darn\n"
+                        "\n"
+                        "  reject   http://spam.example  \r\n"
+                        "mask two words\n");
+  auto rules = parseFilterRules(in);
+  ASSERT_EQ(rules.size(), 3);
+  EXPECT_EQ(rules[0].pattern, "darn");
+  EXPECT_EQ(rules[0].action, FILTER_MASK);
+  EXPECT_EQ(rules[1].pattern, "http://spam.example");
+  EXPECT_EQ(rules[1].action, FILTER_REJECT);
+  EXPECT_EQ(rules[2].pattern, "two words");
+
+  std::istringstream bad("mask ok\nblock this\n");
+  try {
+    parseFilterRules(bad);
+    FAIL();
+  } catch (FilterError &e) {
+    EXPECT_EQ(std::string(e.what()).find("line 2"), 0);
+  }
+  std::istringstream empty("reject\n");
+  EXPECT_THROW(parseFilterRules(empty), FilterError);
+}
+
+TEST(TEST_FILTER, MASKS_IGNORING_CASE) {
+  ContentFilter filter({{"darn", FILTER_MASK}, {"heck", FILTER_MASK}});
+  std::string content = "Darn it, what the HECK. darnation!";
+  EXPECT_EQ(filter.apply(content), FILTER_MASK);
+  EXPECT_EQ(content, "**** it, what the ****. ****ation!");
+
+  std::string clean = "nothing to see here";
+  EXPECT_EQ(filter.apply(clean), FILTER_PASS);
+  EXPECT_EQ(clean, "nothing to see here");
+}
+
+TEST(TEST_FILTER, OVERLAPPING_AND_NESTED) {
+  // "she" ends inside "ushers", "he" is a suffix of "she" and "hers" starts
+  // in the middle of it.
+  ContentFilter filter({{"he", FILTER_MASK},
+                        {"she", FILTER_MASK},
+                        {"his", FILTER_MASK},
+                        {"hers", FILTER_MASK}});
+  std::string content = "ushers";
+  EXPECT_EQ(filter.apply(content), FILTER_MASK);
+  EXPECT_EQ(content, "u*****");
+}
+
+TEST(TEST_FILTER, REJECT_WINS) {
+  ContentFilter filter(
+      {{"spam", FILTER_MASK}, {"buy.example/spam", FILTER_REJECT}});
+  std::string masked = "no spam here";
+  EXPECT_EQ(filter.apply(masked), FILTER_MASK);
+
+  std::string rejected = "see BUY.example/spam now";
+  EXPECT_EQ(filter.apply(rejected), FILTER_REJECT);
+}
+
+TEST(TEST_FILTER, SHORT_PATTERNS_AND_EDGES) {
+  // A one byte pattern turns the prefilter off, a two byte one narrows the
+  // window. Matches at the very start and end must be found either way.
+  for (auto rules : std::vector<std::vector<FilterRule>>{
+           {{"x", FILTER_MASK}, {"abcdef", FILTER_MASK}},
+           {{"xy", FILTER_MASK}, {"abcdef", FILTER_MASK}}}) {
+    ContentFilter filter(rules);
+    std::string content = rules[0].pattern + " ... abcdef";
+    EXPECT_EQ(filter.apply(content), FILTER_MASK);
+    EXPECT_EQ(content, std::string(rules[0].pattern.size(), '*') +
+                           " ... ******");
+  }
+  ContentFilter none({});
+  std::string content = "anything";
+  EXPECT_EQ(none.apply(content), FILTER_PASS);
+}
+
+TEST(TEST_FILTER, MATCHES_NAIVE_SEARCH) {
+  std::mt19937 random(7);
+  auto word = [&](size_t min, size_t max) {
+    std::string text(min + random() % (max - min + 1), ' ');
+    for (auto &c : text) {
+      // Few letters, both cases, so patterns overlap a lot.
+      c = "abcdABCD.-"[random() % 10];
+    }
+    return text;
+  };
+
+  for (int round = 0; round < 50; round++) {
+    std::vector<FilterRule> rules;
+    for (int i = 0; i < 20; i++) {
+      rules.push_back(FilterRule{word(2, 6), random() % 8 == 0
+                                                 ? FILTER_REJECT
+                                                 : FILTER_MASK});
+    }
+    ContentFilter filter(rules);
+    for (int i = 0; i < 20; i++) {
+      std::string content = word(0, 120);
+      std::string expected = content;
+      FilterAction want = naiveApply(rules, expected);
+      FilterAction got = filter.apply(content);
+      ASSERT_EQ(got, want) << content;
+      if (want != FILTER_REJECT) {
+        ASSERT_EQ(content, expected);
+      }
+    }
+  }
+}
+
+// Enough patterns that most states go without a row of their own, long
+// enough that the prefilter hashes windows of 5 and 8 bytes.
+TEST(TEST_FILTER, MATCHES_NAIVE_SEARCH_WITH_MANY_PATTERNS) {
+  std::mt19937 random(11);
+  auto word = [&](size_t min, size_t max) {
+    std::string text(min + random() % (max - min + 1), ' ');
+    for (auto &c : text) {
+      c = "abcdABCD.-"[random() % 10];
+    }
+    return text;
+  };
+
+  for (size_t shortest : {5, 8}) {
+    std::vector<FilterRule> rules;
+    for (int i = 0; i < 3000; i++) {
+      rules.push_back(FilterRule{word(shortest, 14), random() % 8 == 0
+                                                         ? FILTER_REJECT
+                                                         : FILTER_MASK});
+    }
+    ContentFilter filter(rules);
+    EXPECT_GT(filter.states(), 10000);
+    for (int i = 0; i < 100; i++) {
+      std::string content = word(0, 300);
+      std::string expected = content;
+      FilterAction want = naiveApply(rules, expected);
+      FilterAction got = filter.apply(content);
+      ASSERT_EQ(got, want) << content;
+      if (want != FILTER_REJECT) {
+        ASSERT_EQ(content, expected);
+      }
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#include "src/server/history.hpp"
+#include "src/server/memory.hpp"
+#include "src/server/send_queue.hpp"
+#include "gtest/gtest.h"
+#include <vector>
+
+TEST(TEST_MEMORY, GAUGE_FOLLOWS_COPIES) {
+  auto &account = memoryAccount();
+  int64_t before = account.usage(MEMORY_CONNECTIONS);
+  {
+    MemoryGauge gauge(MEMORY_CONNECTIONS, 100);
+    EXPECT_EQ(account.usage(MEMORY_CONNECTIONS), before + 100);
+
+    std::vector<MemoryGauge> copies(2, gauge);
+    EXPECT_EQ(account.usage(MEMORY_CONNECTIONS), before + 300);
+
+    gauge.set(10);
+    EXPECT_EQ(account.usage(MEMORY_CONNECTIONS), before + 210);
+  }
+  EXPECT_EQ(account.usage(MEMORY_CONNECTIONS), before);
+}
+
+TEST(TEST_MEMORY, HISTORY_ACCOUNTED) {
+  auto &account = memoryAccount();
+  int64_t before = account.usage(MEMORY_HISTORY);
+  {
+    MessageHistory history(2);
+    for (int i = 0; i < 3; i++) {
+      history.record(history.nextSeq(), "alice", Data(1000));
+    }
+    int64_t two = account.usage(MEMORY_HISTORY) - before;
+    EXPECT_GE(two, 2000);
+    EXPECT_LT(two, 3000);
+
+    EXPECT_TRUE(history.dropOldest());
+    EXPECT_TRUE(history.dropOldest());
+    EXPECT_FALSE(history.dropOldest());
+    EXPECT_EQ(account.usage(MEMORY_HISTORY), before);
+  }
+}
+
+TEST(TEST_MEMORY, SEND_QUEUE_ACCOUNTED) {
+  auto &account = memoryAccount();
+  int64_t before = account.usage(MEMORY_SEND_QUEUES);
+  {
+    SendQueue queue;
+    queue.push(Data(4096));
+    EXPECT_GE(account.usage(MEMORY_SEND_QUEUES), before + 4096);
+  }
+  EXPECT_EQ(account.usage(MEMORY_SEND_QUEUES), before);
+}
+
+TEST(TEST_MEMORY, REPORT) {
+  auto report = memoryAccount().report();
+  EXPECT_NE(report.find("recv_buffers="), std::string::npos);
+  EXPECT_NE(report.find("total="), std::string::npos);
+}
@@ -0,0 +1,137 @@
+#include "src/protocol/frame.hpp"
+#include "src/protocol/pool.hpp"
+#include "src/protocol/protocol.hpp"
+#include "src/server/server.hpp"
+#include "src/sim/network.hpp"
+#include "tests/alloc/alloc_counter.h"
+#include "gtest/gtest.h"
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+TEST(TEST_POOL, SIZE_CLASSES) {
+  EXPECT_EQ(BufferPool::classOf(1), 0);
+  EXPECT_EQ(BufferPool::classOf(POOL_MIN_BLOCK), 0);
+  EXPECT_EQ(BufferPool::classOf(POOL_MIN_BLOCK + 1), 1);
+  EXPECT_EQ(BufferPool::classOf(128 << 10), POOL_CLASSES - 1);
+  EXPECT_EQ(BufferPool::classOf((128 << 10) + 1), -1);
+}
+
+TEST(TEST_POOL, REUSES_FREED_BLOCKS) {
+  const uint8_t *first;
+  {
+    Data data(100);
+    first = data.data();
+  }
+  PoolStats before = BufferPool::stats();
+  Data data(120);
+  PoolStats after = BufferPool::stats();
+  EXPECT_EQ(data.data(), first);
+  EXPECT_EQ(after.hits, before.hits + 1);
+  EXPECT_EQ(after.misses, before.misses);
+}
+
+TEST(TEST_POOL, FREED_ON_OTHER_THREAD) {
+  Data data(1000);
+  std::thread([moved = std::move(data)]() mutable {
+    moved.clear();
+    moved.shrink_to_fit();
+    EXPECT_EQ(BufferPool::stats().cached, BufferPool::blockSize(4));
+  }).join();
+}
+
+TEST(TEST_POOL, RESERVE_PREFAULTS_EVERY_CLASS) {
+  std::thread([] {
+    size_t added = BufferPool::reserve(128 << 10);
+    EXPECT_EQ(added, (size_t)(128 << 10) * POOL_CLASSES);
+    EXPECT_EQ(BufferPool::stats().cached, added);
+    // Already full: nothing more to add.
+    EXPECT_EQ(BufferPool::reserve(128 << 10), 0);
+
+    Data small(10);
+    Data large(60 << 10);
+    EXPECT_EQ(BufferPool::stats().hits, 2);
+    EXPECT_EQ(BufferPool::stats().misses, 0);
+  }).join();
+}
+
+// Sizes of BENCH_MESSAGE_SIZES, 8 B to 64 KiB.
+static const size_t STEADY_SIZES[] = {8, 64, 512, 4096, 32 << 10, 64 << 10};
+
+// Messages through Server on a SimNetwork: read, parsed, numbered into the
+// history, indexed and broadcast to three clients, which read and parse them
+// back. After warming up, that allocates nothing on the loop thread, at any
+// message size. The search thread's index grows as it likes.
+TEST(TEST_POOL, STEADY_STATE_WITHOUT_MALLOC) {
+  SimNetwork net;
+  ServerConfig config;
+  config.log_level = INFO;
+  // Wraps around within the warmup.
+  config.history_size = 64;
+  config.workers = 1;
+  Server server(7100, 16, 16, "", nullptr, config, nullptr, 0,
+                std::vector<MychatAddress>{}, &net);
+  server.start();
+
+  const MychatAddress addr{MYCHAT_TCP, "127.0.0.1", 7100};
+  const char *names[] = {"alice", "bob", "carol", "dave"};
+  int socks[4];
+  FrameReader readers[4];
+  for (int i = 0; i < 4; i++) {
+    socks[i] = net.connect(addr);
+    Data enter = Handle::buildRaw(ENTER, names[i]);
+    ASSERT_EQ(net.send(socks[i], enter.data(), enter.size()),
+              (ssize_t)enter.size());
+  }
+
+  Handle handle;
+  uint8_t buffer[16 << 10];
+  // Everything that arrived for client i, with the RECV_MESSAGEs checked
+  // to carry size bytes.
+  auto drain = [&](int i, size_t size) {
+    ssize_t got;
+    while ((got = net.recv(socks[i], buffer, sizeof(buffer))) > 0) {
+      readers[i].append(buffer, got);
+    }
+    while (auto frame = readers[i].next()) {
+      auto packet = handle.parseRecv(frame.value());
+      if (auto *msg = std::get_if<RecvMessage>(&packet)) {
+        ASSERT_EQ(msg->content.size(), size);
+      }
+    }
+  };
+  for (int step = 0; step < 16; step++) {
+    server.step();
+  }
+  for (int i = 0; i < 4; i++) {
+    drain(i, 0);
+  }
+
+  for (size_t size : STEADY_SIZES) {
+    std::string content(size, 'x');
+    Data message = Handle::buildRaw(MESSAGE, content);
+    auto roundTrip = [&]() {
+      ASSERT_EQ(net.send(socks[0], message.data(), message.size()),
+                (ssize_t)message.size());
+      for (int step = 0; step < 4; step++) {
+        server.step();
+      }
+      for (int i = 1; i < 4; i++) {
+        drain(i, size);
+      }
+    };
+
+    for (int i = 0; i < 100; i++) {
+      roundTrip();
+    }
+    uint64_t before = t_alloc_count;
+    for (int i = 0; i < 100; i++) {
+      roundTrip();
+    }
+    EXPECT_EQ(t_alloc_count - before, 0) << size << " bytes";
+  }
+
+  server.stop();
+  server.step();
+}
@@ -0,0 +1,94 @@
+#include "src/protocol/protocol.hpp"
+#include "src/server/connection.hpp"
+#include "src/server/rate_limit.hpp"
+#include "gtest/gtest.h"
+#include <chrono>
+
+using namespace std::chrono_literals;
+
+TEST(TEST_RATE_LIMIT, BUCKET_REFILL) {
+  auto now = RateClock::now();
+  TokenBucket bucket;
+  EXPECT_TRUE(bucket.take(1000, now));
+
+  bucket.configure(10, 20, now);
+  EXPECT_TRUE(bucket.take(20, now));
+  EXPECT_FALSE(bucket.take(1, now));
+
+  EXPECT_TRUE(bucket.take(5, now + 500ms));
+  EXPECT_FALSE(bucket.take(1, now + 500ms));
+  EXPECT_DOUBLE_EQ(bucket.available(now + 10s), 20);
+}
+
+TEST(TEST_RATE_LIMIT, BURST_AT_LEAST_RATE) {
+  auto now = RateClock::now();
+  TokenBucket bucket;
+  bucket.configure(100, 0, now);
+  EXPECT_DOUBLE_EQ(bucket.available(now), 100);
+}
+
+class RateLimitedConnection : public ::testing::Test {
+protected:
+  Handle handle;
+  int broadcasts = 0;
+  bool disconnected = false;
+  // Stands still, so no bucket refills while a test runs.
+  RateClock::time_point now = RateClock::now();
+  ConnectionHandlers handlers;
+
+  void SetUp() override {
+    handlers.clock = [&]() { return now; };
+    handlers.message = [&](int sock, RecvMessage &msg) {
+      broadcasts++;
+    };
+    handlers.checkExists = [](std::string name) { return false; };
+    handlers.disconnect = [&](int sock) { disconnected = true; };
+    handlers.entered = [](int sock, std::string name) {};
+    handlers.sync = [](int sock, uint64_t version) {};
+  }
+};
+
+TEST_F(RateLimitedConnection, DROPS_OVER_LIMIT) {
+  Connection conn(3, handlers, handle);
+  RateLimit limit;
+  limit.message_rate = 5;
+  conn.setRateLimit(limit);
+
+  auto enter = Handle::buildRaw(ENTER, "alice");
+  conn.feed(enter);
+  auto msg = Handle::buildRaw(MESSAGE, "hi");
+  for (int i = 0; i < 10; i++) {
+    conn.feed(msg);
+  }
+  EXPECT_EQ(broadcasts, 5);
+  EXPECT_FALSE(disconnected);
+
+  for (int i = 0; i < RATE_LIMIT_MAX_THROTTLED; i++) {
+    conn.feed(msg);
+  }
+  EXPECT_TRUE(disconnected);
+}
+
+TEST_F(RateLimitedConnection, GRANTS_CREDITS) {
+  Connection conn(3, handlers, handle);
+  RateLimit limit;
+  limit.message_rate = 100;
+  limit.flow_credits = 16;
+  conn.setRateLimit(limit);
+  EXPECT_FALSE(conn.grantCredits().has_value());
+
+  auto enter = Handle::buildRaw(ENTER, "alice");
+  conn.feed(enter);
+  auto grant = conn.grantCredits();
+  ASSERT_TRUE(grant.has_value());
+  EXPECT_EQ(std::get<FlowCredit>(handle.parseRecv(grant.value())).credits, 16);
+  EXPECT_FALSE(conn.grantCredits().has_value());
+
+  auto msg = Handle::buildRaw(MESSAGE, "hi");
+  for (int i = 0; i < 8; i++) {
+    conn.feed(msg);
+  }
+  grant = conn.grantCredits();
+  ASSERT_TRUE(grant.has_value());
+  EXPECT_EQ(std::get<FlowCredit>(handle.parseRecv(grant.value())).credits, 8);
+}
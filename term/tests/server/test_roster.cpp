@@ -0,0 +1,82 @@
+#include "src/protocol/protocol.hpp"
+#include "src/server/roster.hpp"
+#include "gtest/gtest.h"
+
+TEST(TEST_ROSTER, JOIN_AND_LEAVE) {
+  Roster roster;
+  auto alice = roster.join("alice");
+  auto bob = roster.join("bob");
+  auto left = roster.leave(alice.id);
+
+  EXPECT_NE(alice.id, bob.id);
+  EXPECT_EQ(left.op, ROSTER_LEAVE);
+  EXPECT_EQ(left.version, 3);
+
+  auto snapshot = roster.snapshot();
+  EXPECT_EQ(snapshot.version, 3);
+  ASSERT_EQ(snapshot.members.size(), 1);
+  EXPECT_EQ(snapshot.members[0].name, "bob");
+}
+
+TEST(TEST_ROSTER, SINCE) {
+  Roster roster;
+  roster.join("alice");
+  roster.join("bob");
+  roster.join("carol");
+
+  auto deltas = roster.since(1);
+  ASSERT_TRUE(deltas.has_value());
+  ASSERT_EQ(deltas->size(), 2);
+  EXPECT_EQ(deltas->at(0).name, "bob");
+  EXPECT_EQ(deltas->at(1).version, 3);
+
+  EXPECT_TRUE(roster.since(3)->empty());
+  EXPECT_FALSE(roster.since(4).has_value());
+}
+
+TEST(TEST_ROSTER, SINCE_FORGOTTEN_HISTORY) {
+  Roster roster;
+  for (int i = 0; i < ROSTER_HISTORY + 10; i++) {
+    roster.join("user" + std::to_string(i));
+  }
+  EXPECT_FALSE(roster.since(5).has_value());
+  EXPECT_TRUE(roster.since(20).has_value());
+}
+
+TEST(TEST_ROSTER, WIRE_ROUND_TRIP) {
+  Handle handle;
+  Roster roster;
+  roster.join("alice");
+  auto delta = roster.join("bob");
+  roster.leave(delta.id);
+
+  auto snapshot = roster.snapshot();
+  auto data = handle.build(snapshot);
+  auto parsed = std::get<RosterSnapshot>(handle.parseRecv(data));
+  EXPECT_EQ(parsed.version, 3);
+  ASSERT_EQ(parsed.members.size(), 1);
+  EXPECT_EQ(parsed.members[0].name, "alice");
+
+  data = handle.build(delta);
+  auto join = std::get<RosterDelta>(handle.parseRecv(data));
+  EXPECT_EQ(join.op, ROSTER_JOIN);
+  EXPECT_EQ(join.id, delta.id);
+  EXPECT_EQ(join.name, "bob");
+
+  auto leave = roster.since(2)->at(0);
+  data = handle.build(leave);
+  EXPECT_EQ(data.size(), sizeof(Header) + 13);
+  EXPECT_EQ(std::get<RosterDelta>(handle.parseRecv(data)).op, ROSTER_LEAVE);
+}
+
+TEST(TEST_ROSTER, TRUNCATED_SNAPSHOT) {
+  Handle handle;
+  RosterSnapshot snapshot(1, {RosterMember{1, "alice"}});
+  auto data = handle.build(snapshot);
+  Header header;
+  std::memcpy(&header, data.data(), sizeof(Header));
+  header.size -= 3;
+  std::memcpy(data.data(), &header, sizeof(Header));
+
+  EXPECT_THROW(handle.parseRecv(data), HandleReturn);
+}
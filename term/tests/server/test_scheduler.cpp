@@ -0,0 +1,43 @@
+#include "src/server/scheduler.hpp"
+#include "gtest/gtest.h"
+#include <map>
+#include <vector>
+
+TEST(TEST_SCHEDULER, ROUND_ROBIN) {
+  FairScheduler scheduler;
+  scheduler.schedule(5);
+  scheduler.schedule(7);
+  scheduler.schedule(5);
+  EXPECT_EQ(scheduler.size(), 2);
+
+  // 5 needs three turns, 7 only one.
+  std::map<int, int> work{{5, 3}, {7, 1}};
+  std::vector<int> order;
+  while (!scheduler.empty()) {
+    scheduler.runRound([&](int fd) {
+      order.push_back(fd);
+      return --work[fd] > 0;
+    });
+  }
+  EXPECT_EQ(order, (std::vector<int>{5, 7, 5, 5}));
+}
+
+TEST(TEST_SCHEDULER, NEW_WORK_WAITS_FOR_NEXT_ROUND) {
+  FairScheduler scheduler;
+  scheduler.schedule(1);
+
+  std::vector<int> order;
+  scheduler.runRound([&](int fd) {
+    order.push_back(fd);
+    scheduler.schedule(2);
+    return true;
+  });
+  EXPECT_EQ(order, std::vector<int>{1});
+
+  scheduler.runRound([&](int fd) {
+    order.push_back(fd);
+    return false;
+  });
+  EXPECT_EQ(order, (std::vector<int>{1, 2, 1}));
+  EXPECT_TRUE(scheduler.empty());
+}
@@ -0,0 +1,154 @@
+#include "src/protocol/protocol.hpp"
+#include "src/server/search.hpp"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::vector<uint64_t> seqsOf(const SearchResult &result) {
+  std::vector<uint64_t> seqs;
+  for (auto &hit : result.hits) {
+    seqs.push_back(hit.seq);
+  }
+  return seqs;
+}
+
+TEST(TEST_SEARCH, TERMS) {
+  EXPECT_EQ(searchTerms("Hello, hello WORLD! 42x"),
+            (std::vector<std::string>{"42x", "hello", "world"}));
+  EXPECT_EQ(searchTerms("  ...  "), (std::vector<std::string>{}));
+  EXPECT_EQ(searchTerms("caf\xc3\xa9 au lait"),
+            (std::vector<std::string>{"au", "caf\xc3\xa9", "lait"}));
+}
+
+TEST(TEST_SEARCH, POSTING_BLOCKS) {
+  PostingList list;
+  std::vector<uint64_t> added;
+  for (uint64_t seq = 5; added.size() < 3 * SEARCH_BLOCK_SIZE + 7;
+       seq += 1 + seq % 300) {
+    list.add(seq);
+    added.push_back(seq);
+  }
+  EXPECT_EQ(list.blockCount(), 4);
+
+  std::vector<uint64_t> decoded, block;
+  for (size_t i = 0; i < list.blockCount(); i++) {
+    list.decodeBlock(i, block);
+    decoded.insert(decoded.end(), block.begin(), block.end());
+  }
+  EXPECT_EQ(decoded, added);
+  EXPECT_EQ(list.findBlock(added[SEARCH_BLOCK_SIZE]), 1);
+  EXPECT_EQ(list.findBlock(added.back() + 1), list.blockCount());
+
+  list.dropBefore(added[200]);
+  EXPECT_EQ(list.size(), added.size() - 200);
+  list.decodeBlock(0, block);
+  EXPECT_EQ(block[0], added[200]);
+}
+
+TEST(TEST_SEARCH, ALL_TERMS_NEWEST_FIRST) {
+  SearchIndex index(100);
+  index.add(1, "alice", "the quick brown fox");
+  index.add(2, "bob", "a slow brown dog");
+  index.add(3, "alice", "Quick, the DOG!");
+  index.add(4, "bob", "quick brown dog");
+
+  EXPECT_EQ(seqsOf(index.query(SendSearch(7, 0, "brown"))),
+            (std::vector<uint64_t>{4, 2, 1}));
+  EXPECT_EQ(seqsOf(index.query(SendSearch(7, 0, "dog quick"))),
+            (std::vector<uint64_t>{4, 3}));
+  EXPECT_EQ(seqsOf(index.query(SendSearch(7, 2, "brown"))),
+            (std::vector<uint64_t>{4, 2}));
+  EXPECT_TRUE(index.query(SendSearch(7, 0, "cat")).hits.empty());
+  EXPECT_TRUE(index.query(SendSearch(7, 0, "  ")).hits.empty());
+
+  auto result = index.query(SendSearch(9, 1, "fox"));
+  EXPECT_EQ(result.id, 9);
+  ASSERT_EQ(result.hits.size(), 1);
+  EXPECT_EQ(result.hits[0].sender, "alice");
+  EXPECT_EQ(result.hits[0].content, "the quick brown fox");
+}
+
+TEST(TEST_SEARCH, FORGETS_OLDEST) {
+  SearchIndex index(10);
+  for (uint64_t seq = 1; seq <= 30; seq++) {
+    index.add(seq, "alice", seq % 2 ? "odd" : "even");
+  }
+  EXPECT_EQ(index.size(), 10);
+  auto hits = seqsOf(index.query(SendSearch(1, 100, "odd")));
+  EXPECT_EQ(hits, (std::vector<uint64_t>{29, 27, 25, 23, 21}));
+
+  index.setLimit(4);
+  hits = seqsOf(index.query(SendSearch(1, 100, "even")));
+  EXPECT_EQ(hits, (std::vector<uint64_t>{30, 28}));
+
+  index.setLimit(0);
+  EXPECT_TRUE(index.query(SendSearch(1, 100, "even")).hits.empty());
+  EXPECT_EQ(index.termCount(), 0);
+}
+
+TEST(TEST_SEARCH, SERVICE_ANSWERS_OFF_THREAD) {
+  SearchService service(100);
+  service.index(1, "alice", "hello there");
+  service.index(2, "bob", "hello again");
+  ASSERT_TRUE(service.search(5, 77, SendSearch(3, 0, "hello")));
+
+  pollfd pfd{service.fd(), POLLIN, 0};
+  ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+  auto answers = service.takeAnswers();
+  ASSERT_EQ(answers.size(), 1);
+  EXPECT_EQ(answers[0].fd, 5);
+  EXPECT_EQ(answers[0].tag, 77);
+  EXPECT_EQ(answers[0].result.id, 3);
+  EXPECT_EQ(seqsOf(answers[0].result), (std::vector<uint64_t>{2, 1}));
+  EXPECT_EQ(poll(&pfd, 1, 0), 0);
+}
+
+// Contents larger than a tenth of the text arena, so it wraps around and
+// skips its tail a few times.
+TEST(TEST_SEARCH, SERVICE_TEXT_WRAPS_AROUND) {
+  SearchService service(100);
+  std::string padding(SEARCH_TEXT_BYTES / 7, '.');
+  for (uint64_t seq = 1; seq <= 30; seq++) {
+    std::string content = "word" + std::to_string(seq) + padding;
+    // Refused only while the search thread holds the whole arena.
+    while (!service.index(seq, "alice", content)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  ASSERT_TRUE(service.search(5, 77, SendSearch(3, 0, "word29")));
+
+  pollfd pfd{service.fd(), POLLIN, 0};
+  ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+  auto answers = service.takeAnswers();
+  ASSERT_EQ(answers.size(), 1);
+  ASSERT_EQ(seqsOf(answers[0].result), (std::vector<uint64_t>{29}));
+  EXPECT_EQ(answers[0].result.hits[0].sender, "alice");
+  EXPECT_EQ(answers[0].result.hits[0].content, "word29" + padding);
+}
+
+TEST(TEST_SEARCH, PACKETS) {
+  Handle handle;
+  SendSearch search(4, 20, "brown dog");
+  Data frame = handle.build(search);
+  auto parsed = std::get<SendSearch>(handle.feed(frame));
+  EXPECT_EQ(parsed.id, 4);
+  EXPECT_EQ(parsed.limit, 20);
+  EXPECT_EQ(parsed.query, "brown dog");
+
+  SearchResult result(4, {{9, "alice", "brown dog"}, {3, "bob", ""}});
+  frame = handle.build(result);
+  auto back = std::get<SearchResult>(handle.parseRecv(frame));
+  EXPECT_EQ(back.id, 4);
+  ASSERT_EQ(back.hits.size(), 2);
+  EXPECT_EQ(back.hits[0].seq, 9);
+  EXPECT_EQ(back.hits[0].content, "brown dog");
+  EXPECT_EQ(back.hits[1].sender, "bob");
+
+  frame.resize(frame.size() - 2);
+  Header header(SEARCH_RESULT, frame.size() - sizeof(Header));
+  std::memcpy(frame.data(), &header, sizeof(Header));
+  EXPECT_THROW(handle.parseRecv(frame), HandleReturn);
+}
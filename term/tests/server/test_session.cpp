@@ -0,0 +1,73 @@
+#include "src/protocol/protocol.hpp"
+#include "src/server/history.hpp"
+#include "src/server/session.hpp"
+#include "gtest/gtest.h"
+#include <chrono>
+
+using namespace std::chrono_literals;
+
+TEST(TEST_SESSION, HISTORY_SINCE) {
+  MessageHistory history(3);
+  for (int i = 0; i < 5; i++) {
+    uint64_t seq = history.nextSeq();
+    history.record(seq, "alice", Data{(uint8_t)seq});
+  }
+  EXPECT_EQ(history.lastSeq(), 5);
+  EXPECT_EQ(history.size(), 3);
+
+  auto entries = history.since(3);
+  ASSERT_EQ(entries.size(), 2);
+  EXPECT_EQ(entries[0]->seq, 4);
+  EXPECT_EQ(entries[1]->frame, Data{5});
+
+  // Asked for more than is kept.
+  EXPECT_EQ(history.since(0).front()->seq, 3);
+  EXPECT_TRUE(history.since(5).empty());
+
+  history.setLimit(1);
+  EXPECT_EQ(history.size(), 1);
+}
+
+TEST(TEST_SESSION, DETACH_AND_EXPIRE) {
+  SessionTable sessions;
+  auto now = SessionClock::now();
+  uint64_t alice = sessions.open("alice", 1, 4);
+  uint64_t bob = sessions.open("bob", 2, 5);
+  EXPECT_NE(alice, 0);
+  EXPECT_NE(alice, bob);
+
+  // Attached sessions leave name checks to their connection.
+  EXPECT_FALSE(sessions.holdsName("alice"));
+  sessions.detach(alice, now + 10s);
+  EXPECT_TRUE(sessions.holdsName("alice"));
+  EXPECT_EQ(sessions.find(alice)->fd, -1);
+
+  EXPECT_TRUE(sessions.expire(now).empty());
+  auto expired = sessions.expire(now + 11s);
+  ASSERT_EQ(expired.size(), 1);
+  EXPECT_EQ(expired[0].name, "alice");
+  EXPECT_EQ(sessions.find(alice), nullptr);
+  EXPECT_NE(sessions.find(bob), nullptr);
+}
+
+TEST(TEST_SESSION, RESUME_FRAMES) {
+  Handle handle;
+  SendResume resume{42, 7};
+  auto frame = handle.build(resume);
+  auto packet = handle.feed(frame);
+  ASSERT_TRUE(std::holds_alternative<SendResume>(packet));
+  EXPECT_EQ(std::get<SendResume>(packet).token, 42);
+  EXPECT_EQ(std::get<SendResume>(packet).last_seq, 7);
+
+  SessionInfo info{42, 9};
+  frame = handle.build(info);
+  auto recv = handle.parseRecv(frame);
+  EXPECT_EQ(std::get<SessionInfo>(recv).seq, 9);
+
+  RecvMessage msg("alice", "hi", 10);
+  frame = handle.build(msg);
+  recv = handle.parseRecv(frame);
+  EXPECT_EQ(std::get<RecvMessage>(recv).seq, 10);
+  EXPECT_EQ(std::get<RecvMessage>(recv).sender_name, "alice");
+  EXPECT_EQ(std::get<RecvMessage>(recv).content, "hi");
+}
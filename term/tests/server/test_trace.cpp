@@ -0,0 +1,105 @@
+#include "src/server/trace.hpp"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(TEST_TRACE, SAMPLING) {
+  Tracer tracer;
+  EXPECT_EQ(tracer.sample(), 0);
+
+  tracer.setSampling(3);
+  std::vector<uint64_t> ids;
+  for (int i = 0; i < 9; i++) {
+    ids.push_back(tracer.sample());
+  }
+  EXPECT_NE(ids[0], 0);
+  EXPECT_EQ(ids[1], 0);
+  EXPECT_EQ(ids[2], 0);
+  EXPECT_NE(ids[3], ids[0]);
+  EXPECT_EQ(tracer.current(), 0);
+
+  tracer.sample();
+  tracer.finish();
+  EXPECT_EQ(tracer.current(), 0);
+}
+
+TEST(TEST_TRACE, BUFFER_KEEPS_NEWEST) {
+  TraceBuffer buffer(4);
+  for (uint64_t i = 1; i <= 6; i++) {
+    buffer.push(TraceEvent{i, i, 0, 3, TRACE_RECV});
+  }
+  auto events = buffer.snapshot();
+  ASSERT_EQ(events.size(), 4);
+  EXPECT_EQ(events.front().trace_id, 3);
+  EXPECT_EQ(events.back().trace_id, 6);
+}
+
+TEST(TEST_TRACE, CONCURRENT_PUSH) {
+  TraceBuffer buffer(1 << 12);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&buffer, t]() {
+      for (int i = 0; i < 1000; i++) {
+        buffer.push(TraceEvent{(uint64_t)t + 1, (uint64_t)i, 0, t, TRACE_RECV});
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(buffer.snapshot().size(), 4000);
+}
+
+// Snapshots taken while two writers keep lapping a small ring only ever
+// hold whole events.
+TEST(TEST_TRACE, SNAPSHOT_WHILE_PUSHING) {
+  TraceBuffer buffer(16);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 2; t++) {
+    writers.emplace_back([&buffer, t]() {
+      for (uint64_t i = 1; i <= 20000; i++) {
+        uint64_t id = i * 2 + t;
+        buffer.push(
+            TraceEvent{id, id * 3, id * 5, (int)(id % 1000), TRACE_PARSE});
+      }
+    });
+  }
+  std::thread reader([&]() {
+    while (!done) {
+      for (auto &event : buffer.snapshot()) {
+        ASSERT_EQ(event.ts_ns, event.trace_id * 3);
+        ASSERT_EQ(event.dur_ns, event.trace_id * 5);
+        ASSERT_EQ(event.fd, (int)(event.trace_id % 1000));
+        ASSERT_EQ(event.stage, TRACE_PARSE);
+      }
+    }
+  });
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+  EXPECT_EQ(buffer.snapshot().size(), 16);
+}
+
+TEST(TEST_TRACE, CHROME_JSON) {
+  Tracer tracer;
+  tracer.setSampling(1);
+  uint64_t id = tracer.sample();
+  tracer.record(id, TRACE_RECV, 4, 1000);
+  tracer.record(id, TRACE_PARSE, 4, 2000, 500);
+  tracer.record(id, TRACE_ENQUEUE, 5, 3000);
+  tracer.record(id, TRACE_WRITE, 5, 7000);
+
+  auto json = tracer.dumpJson();
+  EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0);
+  EXPECT_NE(json.find("\"name\":\"recv\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"parse\""), std::string::npos);
+  EXPECT_NE(json.find("\"dur\":0.500000"), std::string::npos);
+  // Queued from 3us until written at 7us.
+  EXPECT_NE(json.find("\"name\":\"queued fd 5\""), std::string::npos);
+  EXPECT_NE(json.find("\"dur\":4.000000"), std::string::npos);
+  EXPECT_EQ(json.find("written"), std::string::npos);
+}
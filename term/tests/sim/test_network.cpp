@@ -0,0 +1,127 @@
+#include "src/sim/network.hpp"
+#include "gtest/gtest.h"
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static const MychatAddress SIM_ADDR{MYCHAT_TCP, "127.0.0.1", 7000};
+
+TEST(TEST_SIM_NETWORK, CONNECT_AND_ACCEPT) {
+  SimNetwork net;
+  EXPECT_LT(net.connect(SIM_ADDR), 0);
+  int listener = net.listen(SIM_ADDR, 10);
+  ASSERT_GE(listener, SIM_FD_BASE);
+  EXPECT_LT(net.listen(SIM_ADDR, 10), 0);
+  ASSERT_EQ(net.watch(listener, EPOLLIN), 0);
+
+  epoll_event events[4];
+  EXPECT_EQ(net.wait(events, 4, 0), 0);
+  int client = net.connect(SIM_ADDR);
+  ASSERT_GE(client, 0);
+  // Listening sockets are level triggered.
+  EXPECT_EQ(net.wait(events, 4, 0), 1);
+  EXPECT_EQ(net.wait(events, 4, 0), 1);
+  EXPECT_EQ(events[0].data.fd, listener);
+  int server = net.accept(listener);
+  EXPECT_EQ(net.peer(client), server);
+  EXPECT_EQ(net.accept(listener), -1);
+  EXPECT_EQ(errno, EAGAIN);
+
+  EXPECT_EQ(net.send(client, "hello", 5), 5);
+  char buffer[16];
+  EXPECT_EQ(net.recv(server, buffer, sizeof(buffer)), 5);
+  EXPECT_EQ(std::string(buffer, 5), "hello");
+  EXPECT_EQ(net.recv(server, buffer, sizeof(buffer)), -1);
+  EXPECT_EQ(errno, EAGAIN);
+
+  net.close(client);
+  EXPECT_EQ(net.recv(server, buffer, sizeof(buffer)), 0);
+  EXPECT_EQ(net.send(server, "x", 1), -1);
+  EXPECT_EQ(errno, EPIPE);
+}
+
+TEST(TEST_SIM_NETWORK, EDGE_TRIGGERED_EVENTS) {
+  SimNetwork net;
+  int listener = net.listen(SIM_ADDR, 10);
+  int client = net.connect(SIM_ADDR);
+  int server = net.accept(listener);
+  ASSERT_EQ(net.watch(server, EPOLLIN | EPOLLOUT | EPOLLET), 0);
+
+  epoll_event events[4];
+  ASSERT_EQ(net.wait(events, 4, 0), 1);
+  EXPECT_EQ(events[0].events, (uint32_t)EPOLLOUT);
+  EXPECT_EQ(net.wait(events, 4, 0), 0);
+
+  net.send(client, "ab", 2);
+  ASSERT_EQ(net.wait(events, 4, 0), 1);
+  EXPECT_EQ(events[0].events, (uint32_t)EPOLLIN);
+  // Not drained, but no new edge either.
+  EXPECT_EQ(net.wait(events, 4, 0), 0);
+
+  net.reset(client);
+  ASSERT_EQ(net.wait(events, 4, 0), 1);
+  EXPECT_TRUE(events[0].events & EPOLLERR);
+  char buffer[4];
+  EXPECT_EQ(net.recv(server, buffer, sizeof(buffer)), -1);
+  EXPECT_EQ(errno, ECONNRESET);
+}
+
+TEST(TEST_SIM_NETWORK, FAULTS) {
+  SimNetwork net;
+  int listener = net.listen(SIM_ADDR, 10);
+  int client = net.connect(SIM_ADDR);
+  int server = net.accept(listener);
+  net.watch(server, EPOLLIN | EPOLLOUT | EPOLLET);
+
+  net.faults(server).max_send = 3;
+  net.faults(client).capacity = 5;
+  EXPECT_EQ(net.send(server, "abcdefgh", 8), 3);
+  EXPECT_EQ(net.send(server, "defgh", 5), 2);
+  EXPECT_EQ(net.send(server, "fgh", 3), -1);
+  EXPECT_EQ(errno, EAGAIN);
+  EXPECT_EQ(net.unread(client), 5);
+
+  epoll_event events[4];
+  net.wait(events, 4, 0);
+  net.faults(client).max_recv = 2;
+  char buffer[8];
+  EXPECT_EQ(net.recv(client, buffer, sizeof(buffer)), 2);
+  // Reading made room: the writer gets a new EPOLLOUT edge.
+  ASSERT_EQ(net.wait(events, 4, 0), 1);
+  EXPECT_EQ(events[0].data.fd, server);
+  EXPECT_TRUE(events[0].events & EPOLLOUT);
+}
+
+TEST(TEST_SIM_NETWORK, VIRTUAL_CLOCK) {
+  SimNetwork net;
+  auto start = net.now();
+  epoll_event events[1];
+  // Nothing to wait for: the clock jumps ahead instead of sleeping.
+  EXPECT_EQ(net.wait(events, 1, 100), 0);
+  EXPECT_EQ(net.now() - start, std::chrono::milliseconds(100));
+  net.advance(std::chrono::seconds(5));
+  EXPECT_EQ(net.now() - start, std::chrono::milliseconds(5100));
+}
+
+TEST(TEST_SIM_NETWORK, REAL_DESCRIPTORS) {
+  SimNetwork net;
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  ASSERT_EQ(net.watch(pipe_fds[1], EPOLLOUT), 0);
+  ASSERT_EQ(net.watch(pipe_fds[0], EPOLLIN), 0);
+
+  // Only the write end is ready, and only for writing.
+  epoll_event events[2];
+  ASSERT_EQ(net.wait(events, 2, 0), 1);
+  EXPECT_EQ(events[0].data.fd, pipe_fds[1]);
+  EXPECT_EQ(events[0].events, (uint32_t)EPOLLOUT);
+
+  ASSERT_EQ(write(pipe_fds[1], "x", 1), 1);
+  ASSERT_EQ(net.wait(events, 2, 0), 2);
+  EXPECT_EQ(events[1].data.fd, pipe_fds[0]);
+  EXPECT_EQ(events[1].events, (uint32_t)EPOLLIN);
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+}
@@ -0,0 +1,498 @@
+#include "src/server/server.hpp"
+#include "src/sim/client.hpp"
+#include "src/sim/network.hpp"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+#define SIM_PORT 7000
+#define SIM_PEER_PORT 7001
+#define SIM_SECRET "cluster secret"
+
+static const MychatAddress SIM_SERVER{MYCHAT_TCP, "127.0.0.1", SIM_PORT};
+static const MychatAddress SIM_PEERS{MYCHAT_TCP, "127.0.0.1", SIM_PEER_PORT};
+
+// Another node's end of a link to the server, speaking the peer protocol
+// by hand.
+class SimPeer {
+  SimNetwork &net;
+  int sock;
+  Handle handle;
+  FrameReader reader;
+
+public:
+  SimPeer(SimNetwork &net, const MychatAddress &addr)
+      : net(net), sock(net.connect(addr)){};
+  // A link the server dialed, accepted on sock.
+  SimPeer(SimNetwork &net, int sock) : net(net), sock(sock){};
+
+  template <typename P> void send(const P &packet) {
+    Data frame = this->handle.build(packet);
+    ASSERT_EQ(this->net.send(this->sock, frame.data(), frame.size()),
+              (ssize_t)frame.size());
+  }
+
+  // Packets the server sent so far. An empty list and connected() false
+  // once the server closed the link.
+  std::vector<SendPacket> receive() {
+    std::vector<SendPacket> packets;
+    uint8_t buffer[4096];
+    ssize_t got;
+    while ((got = this->net.recv(this->sock, buffer, sizeof(buffer))) > 0) {
+      this->reader.append(buffer, got);
+    }
+    if (got == 0) {
+      this->net.close(this->sock);
+      this->sock = -1;
+    }
+    while (auto frame = this->reader.next()) {
+      packets.push_back(this->handle.feed(frame.value()));
+    }
+    return packets;
+  }
+
+  bool connected() { return this->sock >= 0; }
+
+  void close() {
+    if (connected()) {
+      this->net.close(this->sock);
+      this->sock = -1;
+    }
+  }
+};
+
+// A server on a simulated network, with whatever clients the test makes.
+class SimServerTest : public ::testing::Test {
+protected:
+  SimNetwork net;
+  ServerConfig config;
+  std::unique_ptr<Server> server;
+  std::deque<SimClient> clients;
+
+  void SetUp() override {
+    this->config.log_level = ERROR;
+    this->config.search_limit = 0; // no search thread
+    this->config.workers = 1;
+  }
+
+  void TearDown() override {
+    if (this->server != nullptr) {
+      this->server->stop();
+      this->server->step();
+    }
+  }
+
+  void start(int max_connection = 64, uint32_t node_id = 0,
+             std::vector<MychatAddress> peers = {}) {
+    this->server = std::make_unique<Server>(
+        SIM_PORT, max_connection, max_connection, "", nullptr, this->config,
+        nullptr, node_id, peers, &this->net);
+    this->server->start();
+  }
+
+  // Node 1 of a cluster, taking links on SIM_PEER_PORT and dialing peers.
+  void startNode(std::vector<MychatAddress> peers = {}) {
+    this->config.peer_port = SIM_PEER_PORT;
+    this->config.peer_secret = SIM_SECRET;
+    start(64, 1, peers);
+  }
+
+  // Loop turns until the server has nothing left to do right now.
+  void run(int steps = 8) {
+    for (int i = 0; i < steps; i++) {
+      this->server->step();
+    }
+  }
+
+  SimClient &join(const std::string &name) {
+    SimClient &client = this->clients.emplace_back(this->net, SIM_SERVER);
+    client.enter(name);
+    return client;
+  }
+};
+
+TEST_F(SimServerTest, A_THOUSAND_CLIENTS) {
+  start(2048);
+  for (int i = 0; i < 1000; i++) {
+    join("user" + std::to_string(i));
+  }
+  // One accept per turn, as with a real listening socket.
+  run(1100);
+  EXPECT_EQ(this->server->getConnectionCount(), 1000);
+  for (auto &client : this->clients) {
+    EXPECT_GT(client.drain(), 0); // rosters and sessions
+  }
+
+  this->clients[0].say("hello everyone");
+  this->clients[999].say("bye");
+  run(64);
+  // The rosters naming the senders were drained: only their ids are known.
+  uint32_t sender = this->clients[1].messages()[0].sender_id;
+  EXPECT_NE(sender, 0);
+  for (size_t i = 2; i < this->clients.size(); i++) {
+    auto messages = this->clients[i].messages();
+    ASSERT_EQ(messages.size(), i == 999 ? 1 : 2) << i;
+    EXPECT_EQ(messages[0].sender_id, sender);
+    EXPECT_EQ(messages[0].content, "hello everyone");
+  }
+}
+
+TEST_F(SimServerTest, PARTIAL_WRITES_AND_READS) {
+  start();
+  SimClient &alice = join("alice");
+  SimClient &bob = join("bob");
+  run();
+  alice.receive();
+  bob.receive();
+
+  // The server writes 3 bytes and reads 5 at a time for bob, and bob's
+  // own frames arrive a byte at a time.
+  int bob_server = this->net.peer(bob.fd());
+  this->net.faults(bob_server).max_send = 3;
+  this->net.faults(bob_server).max_recv = 5;
+  this->net.faults(bob.fd()).max_send = 1;
+  std::string long_text(3000, 'x');
+  alice.say(long_text);
+  bob.say("short");
+  run();
+
+  auto to_alice = alice.messages();
+  ASSERT_EQ(to_alice.size(), 1);
+  EXPECT_EQ(to_alice[0].content, "short");
+  auto to_bob = bob.messages();
+  ASSERT_EQ(to_bob.size(), 1);
+  EXPECT_EQ(to_bob[0].content, Text(long_text));
+}
+
+TEST_F(SimServerTest, SLOW_READER_IS_DROPPED) {
+  this->config.send_queue_limit = 4096;
+  start();
+  SimClient &alice = join("alice");
+  SimClient &slow = join("slow");
+  run();
+  alice.receive();
+  slow.receive();
+
+  // slow never reads and holds 100 bytes: the server's sends to it get
+  // EAGAIN and pile up in its send queue until it is cut off.
+  this->net.faults(slow.fd()).capacity = 100;
+  for (int i = 0; i < 200 && this->server->getConnectionCount() == 2; i++) {
+    alice.say("message " + std::to_string(i));
+    run(1);
+  }
+  EXPECT_EQ(this->server->getConnectionCount(), 1);
+  EXPECT_EQ(this->net.peer(slow.fd()), -1);
+  // alice is still served.
+  alice.receive();
+  EXPECT_TRUE(alice.connected());
+}
+
+TEST_F(SimServerTest, ENTERING_CLIENT_DROPPED_BY_ITS_OWN_JOIN) {
+  // Any frame that has to wait gets a client dropped.
+  this->config.send_queue_limit = 8;
+  this->config.session_linger = std::chrono::milliseconds(0);
+  start();
+  SimClient &slow = join("slow");
+  run();
+  slow.receive();
+  this->net.faults(slow.fd()).capacity = 0;
+
+  // carol takes her roster and nothing more. Had her join gone out before
+  // she was done with, it would have dropped slow, and slow's leave then
+  // carol, under the feet of her entering.
+  SimClient &carol = this->clients.emplace_back(this->net, SIM_SERVER);
+  RosterSnapshot roster(0, {RosterMember{1, "slow"}, RosterMember{2, "carol"}});
+  this->net.faults(carol.fd()).capacity = Handle().build(roster).size();
+  carol.enter("carol");
+  run();
+  // carol's leave then had to wait for slow.
+  EXPECT_EQ(this->net.peer(carol.fd()), -1);
+  EXPECT_EQ(this->server->getConnectionCount(), 0);
+}
+
+TEST_F(SimServerTest, DISCONNECT_MID_FRAME) {
+  this->config.session_linger = std::chrono::milliseconds(0);
+  start();
+  SimClient &alice = join("alice");
+  SimClient &bob = join("bob");
+  run();
+  alice.receive();
+
+  // Half of a MESSAGE frame, then bob's connection breaks.
+  Header header(MESSAGE, 10);
+  Data half(sizeof(Header) + 4);
+  std::memcpy(half.data(), &header, sizeof(Header));
+  bob.send(half);
+  run();
+  EXPECT_EQ(this->server->getConnectionCount(), 2);
+  bob.reset();
+  run();
+  EXPECT_EQ(this->server->getConnectionCount(), 1);
+
+  bool left = false;
+  for (auto &packet : alice.receive()) {
+    if (std::holds_alternative<RosterDelta>(packet)) {
+      left = std::get<RosterDelta>(packet).op == ROSTER_LEAVE;
+    }
+    EXPECT_FALSE(std::holds_alternative<RecvMessage>(packet));
+  }
+  EXPECT_TRUE(left);
+}
+
+TEST_F(SimServerTest, SESSION_EXPIRES_ON_THE_VIRTUAL_CLOCK) {
+  this->config.session_linger = std::chrono::seconds(30);
+  start();
+  SimClient &alice = join("alice");
+  SimClient &bob = join("bob");
+  run();
+  alice.receive();
+  bob.close();
+
+  // Ten virtual seconds pass within no real time at all.
+  for (int i = 0; i < 100; i++) {
+    this->server->step();
+  }
+  for (auto &packet : alice.receive()) {
+    EXPECT_FALSE(std::holds_alternative<RosterDelta>(packet));
+  }
+
+  this->net.advance(std::chrono::seconds(30));
+  run(20);
+  auto packets = alice.receive();
+  ASSERT_EQ(packets.size(), 1);
+  ASSERT_TRUE(std::holds_alternative<RosterDelta>(packets[0]));
+  EXPECT_EQ(std::get<RosterDelta>(packets[0]).op, ROSTER_LEAVE);
+}
+
+TEST_F(SimServerTest, SENDERS_BY_ID) {
+  this->config.session_linger = std::chrono::seconds(30);
+  start();
+  SimClient &alice = join("alice");
+  SimClient &bob = join("bob");
+  run();
+  alice.receive();
+  uint64_t token = 0;
+  for (auto &packet : bob.receive()) {
+    if (std::holds_alternative<SessionInfo>(packet)) {
+      token = std::get<SessionInfo>(packet).token;
+    }
+  }
+  ASSERT_NE(token, 0);
+
+  // The frame carries alice's id, and bob knows her from the roster.
+  alice.say("hi");
+  run();
+  EXPECT_EQ(this->net.unread(bob.fd()), sizeof(Header) + 8 + 4 + 2);
+  auto to_bob = bob.messages();
+  ASSERT_EQ(to_bob.size(), 1);
+  EXPECT_NE(to_bob[0].sender_id, 0);
+  EXPECT_EQ(to_bob[0].sender_name, "alice");
+  uint64_t last_seq = to_bob[0].seq;
+
+  // carol comes and talks while bob is away. The replay names her, and
+  // the roster sent on resume covers what she says after.
+  bob.close();
+  SimClient &carol = join("carol");
+  run();
+  carol.say("missed me?");
+  run();
+  SimClient &back = this->clients.emplace_back(this->net, SIM_SERVER);
+  SendResume resume{token, last_seq};
+  back.send(Handle().build(resume));
+  run();
+  carol.say("welcome back");
+  run();
+  auto replayed = back.messages();
+  ASSERT_EQ(replayed.size(), 2);
+  EXPECT_EQ(replayed[0].sender_id, 0);
+  EXPECT_EQ(replayed[0].sender_name, "carol");
+  EXPECT_EQ(replayed[0].content, "missed me?");
+  EXPECT_NE(replayed[1].sender_id, 0);
+  EXPECT_EQ(replayed[1].sender_name, "carol");
+  EXPECT_EQ(replayed[1].content, "welcome back");
+}
+
+TEST_F(SimServerTest, PEER_HELLO_FROM_A_CLIENT_IS_REFUSED) {
+  startNode();
+  // Even with the secret, the client port takes no links.
+  SimClient &mallory = this->clients.emplace_back(this->net, SIM_SERVER);
+  mallory.send(Handle().build(PeerHello{2, SIM_SECRET, {}}));
+  run();
+  mallory.receive();
+  EXPECT_FALSE(mallory.connected());
+  EXPECT_EQ(this->server->getConnectionCount(), 0);
+
+  // Nor does the peer port without it.
+  SimPeer guess(this->net, SIM_PEERS);
+  guess.send(PeerHello{2, "guessed", {}});
+  run();
+  EXPECT_TRUE(guess.receive().empty());
+  EXPECT_FALSE(guess.connected());
+
+  // And no node may link as the server itself.
+  SimPeer twin(this->net, SIM_PEERS);
+  twin.send(PeerHello{1, SIM_SECRET, {}});
+  run();
+  twin.receive();
+  EXPECT_FALSE(twin.connected());
+  EXPECT_EQ(this->server->getConnectionCount(), 0);
+}
+
+TEST_F(SimServerTest, PEER_PORT_TAKES_NO_CLIENTS) {
+  startNode();
+  SimClient &alice = this->clients.emplace_back(this->net, SIM_PEERS);
+  alice.enter("alice");
+  run();
+  alice.receive();
+  EXPECT_FALSE(alice.connected());
+}
+
+TEST_F(SimServerTest, LINKS_CARRY_ONLY_NODES_THEY_INTRODUCED) {
+  startNode();
+  SimClient &alice = join("alice");
+  run();
+  alice.receive();
+
+  // Node 2 relays for node 3. The server answers with its own hello and
+  // claims alice.
+  SimPeer link(this->net, SIM_PEERS);
+  link.send(PeerHello{2, SIM_SECRET, {PeerNode{3}}});
+  run();
+  auto packets = link.receive();
+  ASSERT_EQ(packets.size(), 2);
+  EXPECT_EQ(std::get<PeerHello>(packets[0]).node_id, 1);
+  EXPECT_EQ(std::get<PeerHello>(packets[0]).secret, SIM_SECRET);
+  EXPECT_EQ(std::get<PeerEvent>(packets[1]).name, "alice");
+
+  link.send(PeerEvent(2, 1, 1, PEER_JOIN, "bob", ""));
+  link.send(PeerEvent(3, 1, 1, PEER_JOIN, "carol", ""));
+  link.send(PeerEvent(4, 1, 1, PEER_JOIN, "dave", ""));
+  link.send(PeerEvent(1, 1, 99, PEER_JOIN, "eve", ""));
+  run();
+  std::vector<std::string> joined;
+  for (auto &packet : alice.receive()) {
+    if (auto *delta = std::get_if<RosterDelta>(&packet)) {
+      joined.push_back(delta->name);
+    }
+  }
+  EXPECT_EQ(joined, (std::vector<std::string>{"bob", "carol"}));
+  EXPECT_TRUE(link.connected());
+
+  // Once node 2 also relays for node 4, its events get through, and the
+  // other links hear that the server now reaches node 4 over node 2.
+  SimPeer other(this->net, SIM_PEERS);
+  other.send(PeerHello{5, SIM_SECRET, {}});
+  run();
+  other.receive();
+  link.send(PeerHello{2, SIM_SECRET, {PeerNode{3}, PeerNode{4}}});
+  link.send(PeerEvent(4, 1, 2, PEER_JOIN, "dave", ""));
+  run();
+  packets = other.receive();
+  ASSERT_GE(packets.size(), 2);
+  auto &hello = std::get<PeerHello>(packets[0]);
+  ASSERT_EQ(hello.relays.size(), 3);
+  EXPECT_EQ(hello.relays[2].id, 4);
+  EXPECT_EQ(std::get<PeerEvent>(packets[1]).name, "dave");
+  auto last = alice.receive();
+  ASSERT_EQ(last.size(), 1);
+  EXPECT_EQ(std::get<RosterDelta>(last[0]).name, "dave");
+}
+
+TEST_F(SimServerTest, DIALED_LINK_SAYS_HELLO_FIRST) {
+  MychatAddress remote{MYCHAT_TCP, "127.0.0.1", SIM_PEER_PORT + 1};
+  int listener = this->net.listen(remote, 4);
+  startNode({remote});
+
+  // alice enters while the dial is still connecting. Her join must not go
+  // out on the link before the hello.
+  SimClient &alice = join("alice");
+  run();
+  alice.receive();
+  int sock = this->net.accept(listener);
+  ASSERT_GE(sock, 0);
+  SimPeer link(this->net, sock);
+  auto packets = link.receive();
+  ASSERT_EQ(packets.size(), 1);
+  EXPECT_EQ(std::get<PeerHello>(packets[0]).node_id, 1);
+
+  link.send(PeerHello{2, SIM_SECRET, {}});
+  run();
+  packets = link.receive();
+  ASSERT_EQ(packets.size(), 1);
+  EXPECT_EQ(std::get<PeerEvent>(packets[0]).name, "alice");
+  EXPECT_TRUE(link.connected());
+}
+
+TEST_F(SimServerTest, RESTARTED_NODE_IS_HEARD_AGAIN) {
+  startNode();
+  SimClient &alice = join("alice");
+  run();
+  alice.receive();
+
+  SimPeer before(this->net, SIM_PEERS);
+  before.send(PeerHello{2, SIM_SECRET, {}, 100});
+  before.send(PeerEvent(2, 100, 1, PEER_JOIN, "bob", ""));
+  before.send(PeerEvent(2, 100, 2, PEER_MESSAGE, "bob", "hi"));
+  run();
+  before.close();
+  run();
+
+  // Node 2 came back and numbers its events from 1 again.
+  SimPeer after(this->net, SIM_PEERS);
+  after.send(PeerHello{2, SIM_SECRET, {}, 200});
+  after.send(PeerEvent(2, 200, 1, PEER_JOIN, "bob", ""));
+  after.send(PeerEvent(2, 200, 2, PEER_MESSAGE, "bob", "back"));
+  run();
+  std::vector<std::string> heard;
+  for (auto &packet : alice.receive()) {
+    if (auto *delta = std::get_if<RosterDelta>(&packet)) {
+      // Leaves carry only the id.
+      heard.push_back(delta->op == ROSTER_JOIN ? "+" + delta->name : "-");
+    } else if (auto *msg = std::get_if<RecvMessage>(&packet)) {
+      heard.push_back(std::string(msg->content));
+    }
+  }
+  EXPECT_EQ(heard,
+            (std::vector<std::string>{"+bob", "hi", "-", "+bob", "back"}));
+}
+
+// Two runs of the same chatter with faults produce the same transcript.
+static std::vector<std::string> transcript(int seed) {
+  SimNetwork net;
+  ServerConfig config;
+  config.log_level = ERROR;
+  config.search_limit = 0;
+  config.workers = 1;
+  Server server(SIM_PORT, 64, 64, "", nullptr, config, nullptr, 0, {}, &net);
+  server.start();
+  std::deque<SimClient> clients;
+  for (int i = 0; i < 20; i++) {
+    clients.emplace_back(net, SIM_SERVER).enter("user" + std::to_string(i));
+    net.faults(clients.back().fd()).max_send = 1 + (seed * i) % 7;
+  }
+  std::vector<std::string> lines;
+  for (int round = 0; round < 50; round++) {
+    clients[(round * seed) % clients.size()].say(std::to_string(round));
+    server.step();
+    for (size_t i = 0; i < clients.size(); i++) {
+      for (auto &msg : clients[i].messages()) {
+        lines.push_back(std::to_string(i) + " " + std::to_string(msg.seq) +
+                        " " + msg.sender_name + ": " +
+                        std::string(msg.content));
+      }
+    }
+  }
+  server.stop();
+  server.step();
+  return lines;
+}
+
+TEST(TEST_SIM_SERVER, DETERMINISTIC) {
+  auto first = transcript(3);
+  EXPECT_GT(first.size(), 100);
+  EXPECT_EQ(first, transcript(3));
+}